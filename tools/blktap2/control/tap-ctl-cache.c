@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2008, XenSource Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of XenSource Inc. nor the names of its contributors
+ *       may be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+ * OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tap-ctl.h"
+#include "block-cache-shm.h"
+
+/*
+ * map the cache the tapdisks share, read-only: the statistics are read
+ * without taking its lock, which is good enough for reporting them.
+ */
+int
+tap_ctl_cache_map(block_cache_shm_t **_shm)
+{
+	int fd, err;
+	struct stat st;
+	block_cache_shm_t *shm;
+
+	*_shm = NULL;
+
+	fd = shm_open(BLOCK_CACHE_SHM_NAME, O_RDONLY, 0);
+	if (fd == -1)
+		return errno;
+
+	err = 0;
+	shm = MAP_FAILED;
+
+	if (fstat(fd, &st)) {
+		err = errno;
+		goto out;
+	}
+
+	if (st.st_size < sizeof(*shm)) {
+		err = EINVAL;
+		goto out;
+	}
+
+	shm = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (shm == MAP_FAILED) {
+		err = errno;
+		goto out;
+	}
+
+	if (shm->magic != BLOCK_CACHE_SHM_MAGIC ||
+	    shm->version != BLOCK_CACHE_SHM_VERSION ||
+	    shm->size != st.st_size) {
+		EPRINTF("unknown block cache %s\n", BLOCK_CACHE_SHM_NAME);
+		munmap(shm, st.st_size);
+		err = EINVAL;
+		goto out;
+	}
+
+	*_shm = shm;
+
+out:
+	close(fd);
+	return err;
+}
+
+void
+tap_ctl_cache_unmap(block_cache_shm_t *shm)
+{
+	if (shm)
+		munmap(shm, shm->size);
+}
@@ -53,7 +53,7 @@ tap_ctl_create(const char *params, char **devname)
 	if (err)
 		goto destroy;
 
-	err = tap_ctl_open(id, minor, params);
+	err = tap_ctl_open(id, minor, params, 0);
 	if (err)
 		goto detach;
 
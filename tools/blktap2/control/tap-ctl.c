@@ -31,6 +31,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <inttypes.h>
 
 #include "tap-ctl.h"
 
@@ -633,21 +634,23 @@ usage:
 static void
 tap_cli_open_usage(FILE *stream)
 {
-	fprintf(stream, "usage: open <-p pid> <-m minor> <-a args>\n");
+	fprintf(stream, "usage: open <-p pid> <-m minor> <-a args> [-c]\n"
+		"(-c caches read-only parents in the shared block cache)\n");
 }
 
 static int
 tap_cli_open(int argc, char **argv)
 {
 	const char *args;
-	int c, pid, minor;
+	int c, pid, minor, flags;
 
 	pid   = -1;
 	minor = -1;
+	flags = 0;
 	args  = NULL;
 
 	optind = 0;
-	while ((c = getopt(argc, argv, "a:m:p:h")) != -1) {
+	while ((c = getopt(argc, argv, "a:m:p:ch")) != -1) {
 		switch (c) {
 		case 'p':
 			pid = atoi(optarg);
@@ -658,6 +661,9 @@ tap_cli_open(int argc, char **argv)
 		case 'a':
 			args = optarg;
 			break;
+		case 'c':
+			flags |= TAPDISK_MESSAGE_FLAG_ADD_CACHE;
+			break;
 		case '?':
 			goto usage;
 		case 'h':
@@ -669,7 +675,7 @@ tap_cli_open(int argc, char **argv)
 	if (pid == -1 || minor == -1 || !args)
 		goto usage;
 
-	return tap_ctl_open(pid, minor, args);
+	return tap_ctl_open(pid, minor, args, flags);
 
 usage:
 	tap_cli_open_usage(stderr);
@@ -702,6 +708,74 @@ usage:
 	return EINVAL;
 }
 
+static void
+tap_cli_cache_usage(FILE *stream)
+{
+	fprintf(stream, "usage: cache [-h]\n"
+		"(shows the statistics of the shared block cache)\n");
+}
+
+static double
+tap_cli_cache_ratio(uint64_t hits, uint64_t reads)
+{
+	return reads ? 100.0 * hits / reads : 0;
+}
+
+static int
+tap_cli_cache(int argc, char **argv)
+{
+	int c, i, err;
+	block_cache_shm_t *shm;
+	const block_cache_shm_image_t *image;
+
+	optind = 0;
+	while ((c = getopt(argc, argv, "h")) != -1) {
+		switch (c) {
+		case '?':
+			goto usage;
+		case 'h':
+			tap_cli_cache_usage(stdout);
+			return 0;
+		}
+	}
+
+	err = tap_ctl_cache_map(&shm);
+	if (err) {
+		if (err == ENOENT)
+			printf("no shared block cache\n");
+		return err;
+	}
+
+	printf("size: %"PRIu64"KB, pages: %u/%u, hit rate: %.1f%%\n",
+	       ((uint64_t)shm->nr_pages << BLOCK_CACHE_SHM_PAGE_SHIFT) >> 10,
+	       shm->used, shm->nr_pages,
+	       tap_cli_cache_ratio(shm->hits, shm->reads));
+	printf("reads: %"PRIu64", hits: %"PRIu64", misses: %"PRIu64", "
+	       "inserts: %"PRIu64", evictions: %"PRIu64", resets: %"PRIu64"\n",
+	       shm->reads, shm->hits, shm->misses,
+	       shm->inserts, shm->evictions, shm->resets);
+
+	printf("%12s %12s %12s %6s %10s %s\n",
+	       "reads", "hits", "misses", "hit%", "inserts", "image");
+	for (i = 0; i < BLOCK_CACHE_SHM_IMAGES; i++) {
+		image = shm->images + i;
+		if (!image->key)
+			continue;
+
+		printf("%12"PRIu64" %12"PRIu64" %12"PRIu64" %6.1f %10"PRIu64
+		       " %.*s\n", image->reads, image->hits, image->misses,
+		       tap_cli_cache_ratio(image->hits, image->reads),
+		       image->inserts, (int)sizeof(image->name), image->name);
+	}
+
+	tap_ctl_cache_unmap(shm);
+	return 0;
+
+usage:
+	tap_cli_cache_usage(stderr);
+	return EINVAL;
+}
+
 struct command commands[] = {
 	{ .name = "list",         .func = tap_cli_list          },
 	{ .name = "allocate",     .func = tap_cli_allocate      },
@@ -717,6 +791,7 @@ struct command commands[] = {
 	{ .name = "unpause",      .func = tap_cli_unpause       },
 	{ .name = "major",        .func = tap_cli_major         },
 	{ .name = "check",        .func = tap_cli_check         },
+	{ .name = "cache",        .func = tap_cli_cache         },
 };
 
 #define print_commands()					\
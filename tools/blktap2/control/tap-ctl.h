@@ -31,6 +31,7 @@
 #include <syslog.h>
 #include <errno.h>
 #include <tapdisk-message.h>
+#include <block-cache-shm.h>
 
 extern int tap_ctl_debug;
 
@@ -90,7 +91,8 @@ pid_t tap_ctl_get_pid(const int id);
 int tap_ctl_attach(const int id, const int minor);
 int tap_ctl_detach(const int id, const int minor);
 
-int tap_ctl_open(const int id, const int minor, const char *params);
+int tap_ctl_open(const int id, const int minor,
+		 const char *params, int flags);
 int tap_ctl_close(const int id, const int minor, const int force);
 
 int tap_ctl_pause(const int id, const int minor);
@@ -98,4 +100,7 @@ int tap_ctl_unpause(const int id, const int minor, const char *params);
 
 int tap_ctl_blk_major(void);
 
+int tap_ctl_cache_map(block_cache_shm_t **shm);
+void tap_ctl_cache_unmap(block_cache_shm_t *shm);
+
 #endif
@@ -30,7 +30,9 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 
+#include "block-cache-shm.h"
 #include "tapdisk.h"
 #include "tapdisk-utils.h"
 #include "tapdisk-driver.h"
@@ -58,6 +60,9 @@
 #define BLOCK_CACHE_REQUESTS            (TAPDISK_DATA_REQUESTS << 3)
 #define BLOCK_CACHE_PAGE_IDLETIME       60
 
+#define BLOCK_CACHE_SHM_PAGE_SECS       (BLOCK_CACHE_SHM_PAGE_SIZE >> RADIX_TREE_NODE_SHIFT)
+#define BLOCK_CACHE_SHM_REQUEST_PAGES   32 /* larger reads bypass the cache */
+
 typedef struct radix_tree               radix_tree_t;
 typedef struct radix_tree_node          radix_tree_node_t;
 typedef struct radix_tree_link          radix_tree_link_t;
@@ -108,6 +113,9 @@ struct block_cache_request {
 	uint64_t                        secs;
 	td_request_t                    treq;
 	block_cache_t                  *cache;
+
+	uint64_t                        buf_sec;   /* shared cache misses */
+	uint64_t                        buf_secs;  /* read whole pages */
 };
 
 struct block_cache_stats {
@@ -131,6 +139,10 @@ struct block_cache {
 
 	radix_tree_t                    tree;
 
+	block_cache_shm_t              *shm;       /* NULL if private */
+	uint64_t                        key;
+	int                             image;     /* in shm, -1 if none */
+
 	block_cache_stats_t             stats;
 };
 
@@ -516,6 +528,576 @@ block_cache_put_request(block_cache_t *cache, block_cache_request_t *breq)
 	cache->request_free_list[cache->requests_free++] = breq;
 }
 
+/*
+ * host-wide cache, shared with the other tapdisks through a shared
+ * memory segment; see block-cache-shm.h.  all caches in a tapdisk use
+ * the same mapping.
+ */
+static block_cache_shm_t               *block_cache_shm;
+static int                              block_cache_shm_users;
+
+static inline uint64_t
+block_cache_shm_fnv(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *p = data;
+
+	while (size--) {
+		hash ^= *p++;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+/*
+ * images are identified by their file rather than by their path, and
+ * their key changes if they are modified.
+ */
+static uint64_t
+block_cache_shm_key(const char *name)
+{
+	struct stat st;
+	uint64_t key;
+
+	key = 0xcbf29ce484222325ULL;
+
+	if (stat(name, &st))
+		key = block_cache_shm_fnv(key, name, strlen(name));
+	else {
+		key = block_cache_shm_fnv(key, &st.st_dev, sizeof(st.st_dev));
+		key = block_cache_shm_fnv(key, &st.st_ino, sizeof(st.st_ino));
+		key = block_cache_shm_fnv(key, &st.st_size, sizeof(st.st_size));
+		key = block_cache_shm_fnv(key, &st.st_mtime, sizeof(st.st_mtime));
+	}
+
+	return key ? : 1;
+}
+
+static inline int32_t *
+block_cache_shm_bucket(block_cache_shm_t *shm, uint64_t key, uint64_t index)
+{
+	uint64_t hash;
+
+	hash = (key ^ (index * 0x9e3779b97f4a7c15ULL)) >> 17;
+	return block_cache_shm_buckets(shm) + hash % shm->nr_buckets;
+}
+
+static void
+block_cache_shm_reset(block_cache_shm_t *shm)
+{
+	int i;
+	int32_t *buckets;
+
+	buckets = block_cache_shm_buckets(shm);
+	for (i = 0; i < shm->nr_buckets; i++)
+		buckets[i] = BLOCK_CACHE_SHM_NO_PAGE;
+
+	memset(block_cache_shm_pages(shm), 0,
+	       shm->nr_pages * sizeof(block_cache_shm_page_t));
+
+	shm->hand = 0;
+	shm->used = 0;
+	shm->resets++;
+}
+
+static int
+block_cache_shm_lock(block_cache_shm_t *shm)
+{
+	int err;
+
+	err = pthread_mutex_lock(&shm->lock);
+	if (err == EOWNERDEAD) {
+		/* a tapdisk died holding the lock, maybe half way through
+		 * an update: start afresh */
+		WARN("block cache lock owner died, resetting cache\n");
+		block_cache_shm_reset(shm);
+		pthread_mutex_consistent(&shm->lock);
+		err = 0;
+	}
+
+	return -err;
+}
+
+static inline void
+block_cache_shm_unlock(block_cache_shm_t *shm)
+{
+	pthread_mutex_unlock(&shm->lock);
+}
+
+static int32_t
+block_cache_shm_find(block_cache_shm_t *shm, uint64_t key, uint64_t index)
+{
+	int32_t i;
+	block_cache_shm_page_t *page, *pages;
+
+	pages = block_cache_shm_pages(shm);
+
+	for (i = *block_cache_shm_bucket(shm, key, index);
+	     i != BLOCK_CACHE_SHM_NO_PAGE; i = page->next) {
+		page = pages + i;
+		if (page->key == key && page->index == index)
+			return i;
+	}
+
+	return BLOCK_CACHE_SHM_NO_PAGE;
+}
+
+static void
+block_cache_shm_unlink(block_cache_shm_t *shm, int32_t i)
+{
+	int32_t *link;
+	block_cache_shm_page_t *page, *pages;
+
+	pages = block_cache_shm_pages(shm);
+	page  = pages + i;
+	link  = block_cache_shm_bucket(shm, page->key, page->index);
+
+	while (*link != i)
+		link = &pages[*link].next;
+
+	*link       = page->next;
+	page->valid = 0;
+	shm->used--;
+}
+
+/*
+ * clock: pages read since the hand last went past them get another
+ * round, the first one which was not is replaced.
+ */
+static int32_t
+block_cache_shm_alloc(block_cache_shm_t *shm)
+{
+	int32_t i;
+	uint64_t n;
+	block_cache_shm_page_t *page;
+
+	for (n = 0; n < 2 * (uint64_t)shm->nr_pages; n++) {
+		i         = shm->hand;
+		page      = block_cache_shm_pages(shm) + i;
+		shm->hand = (shm->hand + 1) % shm->nr_pages;
+
+		if (!page->valid)
+			return i;
+
+		if (page->ref) {
+			page->ref = 0;
+			continue;
+		}
+
+		block_cache_shm_unlink(shm, i);
+		shm->evictions++;
+		return i;
+	}
+
+	return BLOCK_CACHE_SHM_NO_PAGE;
+}
+
+static int
+block_cache_shm_insert(block_cache_shm_t *shm,
+		       uint64_t key, uint64_t index, const char *buf)
+{
+	int32_t i, *bucket;
+	block_cache_shm_page_t *page;
+
+	if (block_cache_shm_find(shm, key, index) != BLOCK_CACHE_SHM_NO_PAGE)
+		return 0;
+
+	i = block_cache_shm_alloc(shm);
+	if (i == BLOCK_CACHE_SHM_NO_PAGE)
+		return 0;
+
+	memcpy(block_cache_shm_data(shm, i), buf, BLOCK_CACHE_SHM_PAGE_SIZE);
+
+	bucket      = block_cache_shm_bucket(shm, key, index);
+	page        = block_cache_shm_pages(shm) + i;
+	page->key   = key;
+	page->index = index;
+	page->ref   = 1;
+	page->valid = 1;
+	page->next  = *bucket;
+	*bucket     = i;
+
+	shm->used++;
+	shm->inserts++;
+
+	return 1;
+}
+
+static int
+block_cache_shm_init(block_cache_shm_t *shm, size_t size)
+{
+	int err;
+	pthread_mutexattr_t attr;
+
+	shm->version        = BLOCK_CACHE_SHM_VERSION;
+	shm->size           = size;
+	shm->nr_pages       = BLOCK_CACHE_SHM_PAGES;
+	shm->nr_buckets     = BLOCK_CACHE_SHM_PAGES;
+	shm->buckets_offset = (sizeof(*shm) + 7) & ~7ULL;
+	shm->pages_offset   = shm->buckets_offset +
+		((shm->nr_buckets * sizeof(int32_t) + 7) & ~7ULL);
+	shm->data_offset    = (shm->pages_offset +
+			       shm->nr_pages * sizeof(block_cache_shm_page_t) +
+			       BLOCK_CACHE_SHM_PAGE_SIZE - 1) &
+		~(uint64_t)(BLOCK_CACHE_SHM_PAGE_SIZE - 1);
+
+	if (shm->data_offset +
+	    ((uint64_t)shm->nr_pages << BLOCK_CACHE_SHM_PAGE_SHIFT) > size)
+		return -EINVAL;
+
+	err = pthread_mutexattr_init(&attr);
+	if (err)
+		return -err;
+
+	err = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	if (!err)
+		err = pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	if (!err)
+		err = pthread_mutex_init(&shm->lock, &attr);
+
+	pthread_mutexattr_destroy(&attr);
+	if (err)
+		return -err;
+
+	block_cache_shm_reset(shm);
+	shm->resets = 0;
+
+	/* publish only once initialized */
+	__sync_synchronize();
+	shm->magic = BLOCK_CACHE_SHM_MAGIC;
+
+	return 0;
+}
+
+static inline size_t
+block_cache_shm_size(void)
+{
+	size_t size;
+
+	size  = sizeof(block_cache_shm_t) + 8;
+	size += BLOCK_CACHE_SHM_PAGES * sizeof(int32_t) + 8;
+	size += BLOCK_CACHE_SHM_PAGES * sizeof(block_cache_shm_page_t);
+	size  = (size + BLOCK_CACHE_SHM_PAGE_SIZE - 1) &
+		~(size_t)(BLOCK_CACHE_SHM_PAGE_SIZE - 1);
+	size += (size_t)BLOCK_CACHE_SHM_PAGES << BLOCK_CACHE_SHM_PAGE_SHIFT;
+
+	return size;
+}
+
+static block_cache_shm_t *
+block_cache_shm_attach(void)
+{
+	int i, fd, err, creator;
+	size_t size;
+	struct stat st;
+	block_cache_shm_t *shm;
+
+	if (block_cache_shm) {
+		block_cache_shm_users++;
+		return block_cache_shm;
+	}
+
+	shm     = NULL;
+	creator = 1;
+	size    = block_cache_shm_size();
+
+	fd = shm_open(BLOCK_CACHE_SHM_NAME, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd == -1) {
+		if (errno != EEXIST)
+			goto fail;
+
+		creator = 0;
+		fd = shm_open(BLOCK_CACHE_SHM_NAME, O_RDWR, 0);
+		if (fd == -1)
+			goto fail;
+
+		if (fstat(fd, &st))
+			goto fail;
+
+		size = st.st_size;
+		if (size < sizeof(*shm)) {
+			errno = EINVAL;
+			goto fail;
+		}
+	} else if (ftruncate(fd, size))
+		goto fail;
+
+	shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (shm == MAP_FAILED) {
+		shm = NULL;
+		goto fail;
+	}
+
+	close(fd);
+	fd = -1;
+
+	if (creator) {
+		err = block_cache_shm_init(shm, size);
+		if (err) {
+			errno = -err;
+			goto fail;
+		}
+	} else {
+		/* give the creator some time to set it up */
+		for (i = 0; shm->magic != BLOCK_CACHE_SHM_MAGIC && i < 100; i++)
+			usleep(10000);
+
+		__sync_synchronize();
+		if (shm->magic != BLOCK_CACHE_SHM_MAGIC ||
+		    shm->version != BLOCK_CACHE_SHM_VERSION ||
+		    shm->size != size) {
+			errno = EINVAL;
+			goto fail;
+		}
+	}
+
+	DPRINTF("%s shared block cache %s, %"PRIu64" pages\n",
+		creator ? "created" : "attached to",
+		BLOCK_CACHE_SHM_NAME, (uint64_t)shm->nr_pages);
+
+	block_cache_shm       = shm;
+	block_cache_shm_users = 1;
+	return shm;
+
+fail:
+	err = errno;
+	DPRINTF("no shared block cache, using a private one: %d\n", -err);
+	if (shm)
+		munmap(shm, size);
+	if (fd != -1)
+		close(fd);
+	if (creator && fd != -1)
+		shm_unlink(BLOCK_CACHE_SHM_NAME);
+	return NULL;
+}
+
+static void
+block_cache_shm_detach(void)
+{
+	if (!block_cache_shm || --block_cache_shm_users)
+		return;
+
+	munmap(block_cache_shm, block_cache_shm->size);
+	block_cache_shm = NULL;
+}
+
+/*
+ * returns the slot in which the statistics of the image are kept, or -1
+ * if the table is full, in which case only the totals are kept.
+ */
+static int
+block_cache_shm_add_image(block_cache_shm_t *shm,
+			  uint64_t key, const char *name)
+{
+	int i, slot;
+	block_cache_shm_image_t *image;
+
+	if (block_cache_shm_lock(shm))
+		return -1;
+
+	slot = -1;
+	for (i = 0; i < BLOCK_CACHE_SHM_IMAGES; i++) {
+		image = shm->images + i;
+		if (image->key == key) {
+			slot = i;
+			break;
+		}
+		if (!image->key && slot == -1)
+			slot = i;
+	}
+
+	if (slot != -1 && shm->images[slot].key != key) {
+		image = shm->images + slot;
+		memset(image, 0, sizeof(*image));
+		image->key = key;
+		snprintf(image->name, sizeof(image->name), "%s", name);
+	}
+
+	block_cache_shm_unlock(shm);
+	return slot;
+}
+
+static inline block_cache_shm_image_t *
+block_cache_shm_image(block_cache_t *cache)
+{
+	static block_cache_shm_image_t dummy;
+
+	if (cache->image == -1)
+		return &dummy;
+
+	return cache->shm->images + cache->image;
+}
+
+/*
+ * copy the sectors common to a buffer holding @ssecs sectors from @ssec
+ * and one holding @dsecs sectors from @dsec.
+ */
+static inline void
+block_cache_copy_overlap(char *dst, uint64_t dsec, uint64_t dsecs,
+			 const char *src, uint64_t ssec, uint64_t ssecs)
+{
+	uint64_t start, end;
+
+	start = (dsec > ssec ? dsec : ssec);
+	end   = (dsec + dsecs < ssec + ssecs ? dsec + dsecs : ssec + ssecs);
+	if (start >= end)
+		return;
+
+	memcpy(dst + ((start - dsec) << RADIX_TREE_NODE_SHIFT),
+	       src + ((start - ssec) << RADIX_TREE_NODE_SHIFT),
+	       (end - start) << RADIX_TREE_NODE_SHIFT);
+}
+
+static void
+block_cache_shm_populate(td_request_t clone, int err)
+{
+	uint64_t sec, end;
+	block_cache_t *cache;
+	block_cache_shm_t *shm;
+	block_cache_request_t *breq;
+
+	breq        = (block_cache_request_t *)clone.cb_data;
+	cache       = breq->cache;
+	shm         = cache->shm;
+	breq->secs -= clone.secs;
+	breq->err   = (breq->err ? breq->err : err);
+
+	if (breq->secs)
+		return;
+
+	if (breq->err)
+		goto out;
+
+	block_cache_copy_overlap(breq->treq.buf,
+				 breq->treq.sec, breq->treq.secs,
+				 breq->buf, breq->buf_sec, breq->buf_secs);
+
+	if (block_cache_shm_lock(shm))
+		goto out;
+
+	/* a partial page at the end of the image is not cached */
+	end = breq->buf_sec + breq->buf_secs;
+	for (sec = breq->buf_sec;
+	     sec + BLOCK_CACHE_SHM_PAGE_SECS <= end;
+	     sec += BLOCK_CACHE_SHM_PAGE_SECS)
+		block_cache_shm_image(cache)->inserts +=
+			block_cache_shm_insert(shm, cache->key,
+					       sec / BLOCK_CACHE_SHM_PAGE_SECS,
+					       breq->buf +
+					       ((sec - breq->buf_sec) <<
+						RADIX_TREE_NODE_SHIFT));
+
+	block_cache_shm_unlock(shm);
+
+out:
+	free(breq->buf);
+	td_complete_request(breq->treq, breq->err);
+	block_cache_put_request(cache, breq);
+}
+
+/*
+ * read the whole pages the request touches from the image below, so that
+ * they can be added to the cache.
+ */
+static void
+block_cache_shm_miss(block_cache_t *cache, td_request_t treq,
+		     uint64_t first, uint64_t last)
+{
+	char *buf;
+	td_request_t clone;
+	block_cache_request_t *breq;
+
+	DBG("%s: shared block cache miss: sec 0x%08llx\n",
+	    cache->name, treq.sec);
+
+	breq = block_cache_get_request(cache);
+	if (!breq)
+		return td_forward_request(treq);
+
+	breq->buf_sec  = first * BLOCK_CACHE_SHM_PAGE_SECS;
+	breq->buf_secs = (last - first + 1) * BLOCK_CACHE_SHM_PAGE_SECS;
+	if (breq->buf_sec + breq->buf_secs > cache->sectors)
+		breq->buf_secs = cache->sectors - breq->buf_sec;
+
+	if (posix_memalign((void **)&buf, BLOCK_CACHE_SHM_PAGE_SIZE,
+			   breq->buf_secs << RADIX_TREE_NODE_SHIFT)) {
+		block_cache_put_request(cache, breq);
+		return td_forward_request(treq);
+	}
+
+	breq->treq     = treq;
+	breq->secs     = breq->buf_secs;
+	breq->err      = 0;
+	breq->buf      = buf;
+	breq->cache    = cache;
+
+	clone          = treq;
+	clone.sec      = breq->buf_sec;
+	clone.secs     = breq->buf_secs;
+	clone.buf      = buf;
+	clone.cb       = block_cache_shm_populate;
+	clone.cb_data  = breq;
+
+	td_forward_request(clone);
+}
+
+static void
+block_cache_shm_queue_read(block_cache_t *cache, td_request_t treq)
+{
+	int32_t i, pages[BLOCK_CACHE_SHM_REQUEST_PAGES];
+	uint64_t n, first, last;
+	block_cache_shm_t *shm;
+	block_cache_shm_image_t *image;
+	block_cache_shm_page_t *page;
+
+	shm   = cache->shm;
+	first = treq.sec / BLOCK_CACHE_SHM_PAGE_SECS;
+	last  = (treq.sec + treq.secs - 1) / BLOCK_CACHE_SHM_PAGE_SECS;
+
+	if (last - first >= BLOCK_CACHE_SHM_REQUEST_PAGES)
+		return td_forward_request(treq);
+
+	if (block_cache_shm_lock(shm))
+		return td_forward_request(treq);
+
+	image = block_cache_shm_image(cache);
+	shm->reads   += treq.secs;
+	image->reads += treq.secs;
+
+	for (n = 0; n <= last - first; n++) {
+		pages[n] = block_cache_shm_find(shm, cache->key, first + n);
+		if (pages[n] == BLOCK_CACHE_SHM_NO_PAGE)
+			break;
+	}
+
+	if (n <= last - first) {
+		shm->misses   += treq.secs;
+		image->misses += treq.secs;
+		block_cache_shm_unlock(shm);
+
+		cache->stats.misses += treq.secs;
+		return block_cache_shm_miss(cache, treq, first, last);
+	}
+
+	/* copy out before the pages can be replaced */
+	for (n = 0; n <= last - first; n++) {
+		i         = pages[n];
+		page      = block_cache_shm_pages(shm) + i;
+		page->ref = 1;
+		block_cache_copy_overlap(treq.buf, treq.sec, treq.secs,
+					 block_cache_shm_data(shm, i),
+					 (first + n) * BLOCK_CACHE_SHM_PAGE_SECS,
+					 BLOCK_CACHE_SHM_PAGE_SECS);
+	}
+
+	shm->hits   += treq.secs;
+	image->hits += treq.secs;
+	block_cache_shm_unlock(shm);
+
+	cache->stats.hits += treq.secs;
+	td_complete_request(treq, 0);
+}
+
 static int
 block_cache_open(td_driver_t *driver, const char *name, td_flag_t flags)
 {
@@ -554,9 +1136,17 @@ block_cache_open(td_driver_t *driver, const char *name, td_flag_t flags)
 	if (cache->timeout_id < 0)
 		goto fail;
 
+	cache->image = -1;
+	cache->shm   = block_cache_shm_attach();
+	if (cache->shm) {
+		cache->key   = block_cache_shm_key(name);
+		cache->image = block_cache_shm_add_image(cache->shm,
+							 cache->key, name);
+	}
+
 	DPRINTF("opening cache for %s, sectors: %"PRIu64", "
-		"tree: %p, height: %d\n",
-		cache->name, cache->sectors, tree, tree->height);
+		"tree: %p, height: %d, shared: %d\n",
+		cache->name, cache->sectors, tree, tree->height, !!cache->shm);
 
 	if (mlockall(MCL_CURRENT | MCL_FUTURE))
 		DPRINTF("mlockall failed: %d\n", -errno);
@@ -584,6 +1174,9 @@ block_cache_close(td_driver_t *driver)
 	radix_tree_free(tree);
 	free(cache->name);
 
+	if (cache->shm)
+		block_cache_shm_detach();
+
 	return 0;
 }
 
@@ -719,6 +1312,9 @@ block_cache_queue_read(td_driver_t *driver, td_request_t treq)
 
 	cache->stats.reads += treq.secs;
 
+	if (cache->shm)
+		return block_cache_shm_queue_read(cache, treq);
+
 	if (treq.secs > BLOCK_CACHE_NODES_PER_PAGE)
 		return td_forward_request(treq);
 
@@ -771,6 +1367,12 @@ block_cache_debug(td_driver_t *driver)
 	WARN("BLOCK CACHE %s\n", cache->name);
 	WARN("reads: %"PRIu64", hits: %"PRIu64", misses: %"PRIu64", prunes: %"PRIu64"\n",
 	     stats->reads, stats->hits, stats->misses, stats->prunes);
+
+	if (cache->shm)
+		WARN("shared: key: 0x%016"PRIx64", image: %d, pages: %u/%u, "
+		     "evictions: %"PRIu64"\n", cache->key, cache->image,
+		     cache->shm->used, cache->shm->nr_pages,
+		     cache->shm->evictions);
 }
 
 struct tap_disk tapdisk_block_cache = {
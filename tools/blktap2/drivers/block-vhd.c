@@ -72,10 +72,10 @@ unsigned int SPB;
 	do {								\
 		DBG(TLOG_DBG, "%s: QUEUED: %" PRIu64 ", COMPLETED: %"	\
 		    PRIu64", RETURNED: %" PRIu64 ", DATA_ALLOCATED: "	\
-		    "%lu, BBLK: 0x%04x\n",				\
+		    "%lu, PBW: %d\n",					\
 		    s->vhd.file, s->queued, s->completed, s->returned,	\
 		    VHD_REQS_DATA - s->vreq_free_count,			\
-		    s->bat.pbw_blk);					\
+		    s->bat.pending);					\
 	} while(0)
 
 #define __ASSERT(_p)							\
@@ -111,6 +111,15 @@ unsigned int SPB;
 /******VHD DEFINES******/
 #define VHD_CACHE_SIZE               32
 
+/*
+ * blocks may be allocated concurrently, each holding its bitmap locked in
+ * the cache until its bat entry is on disk; leave room for the rest.
+ */
+#define VHD_BAT_MAX_PENDING          (VHD_CACHE_SIZE / 2)
+
+/* most blocks zeroed ahead of next_db at once when preallocating */
+#define VHD_PREALLOC_MAX_BLOCKS      16
+
 #define VHD_REQS_DATA                TAPDISK_DATA_REQUESTS
 #define VHD_REQS_META                (VHD_CACHE_SIZE + 2)
 #define VHD_REQS_TOTAL               (VHD_REQS_DATA + VHD_REQS_META)
@@ -136,13 +145,13 @@ unsigned int SPB;
 #define VHD_FLAG_OPEN_QUERY          16
 #define VHD_FLAG_OPEN_PREALLOCATE    32
 
-#define VHD_FLAG_BAT_LOCKED          1
 #define VHD_FLAG_BAT_WRITE_STARTED   2
 
-#define VHD_FLAG_BM_UPDATE_BAT       1
 #define VHD_FLAG_BM_WRITE_PENDING    2
 #define VHD_FLAG_BM_READ_PENDING     4
 #define VHD_FLAG_BM_LOCKED           8
+#define VHD_FLAG_BM_BAT_READY        16
+#define VHD_FLAG_BM_BAT_WRITE        32
 
 #define VHD_FLAG_REQ_UPDATE_BAT      1
 #define VHD_FLAG_REQ_UPDATE_BITMAP   2
@@ -151,6 +160,7 @@ unsigned int SPB;
 
 #define VHD_FLAG_TX_LIVE             1
 #define VHD_FLAG_TX_UPDATE_BAT       2
+#define VHD_FLAG_TX_WAIT_BAT         4
 
 typedef uint8_t vhd_flag_t;
 
@@ -186,17 +196,22 @@ struct vhd_bat_state {
 	vhd_bat_t                 bat;
 	vhd_batmap_t              batmap;
 	vhd_flag_t                status;
-	uint32_t                  pbw_blk;     /* blk num of pending write */
-	uint64_t                  pbw_offset;  /* file offset of same */
+	int                       pending;     /* blocks allocated, entries
+						* not yet written */
 	struct vhd_request        req;         /* for writing bat table */
-	struct vhd_request        zero_req;    /* for initializing bitmaps */
-	char                     *bat_buf;
+	char                     *bat_buf;     /* image of the table, from
+						* which runs of sectors are
+						* written */
+	uint64_t                  flushes;     /* bat writes, and entries */
+	uint64_t                  flushed;     /* they carried */
 };
 
 struct vhd_bitmap {
 	u32                       blk;
 	u64                       seqno;       /* lru sequence number */
 	vhd_flag_t                status;
+	u64                       pbw_offset;  /* file offset of block while
+						* its bat entry is pending */
 
 	char                     *map;         /* map should only be modified
 					        * in finish_bitmap_write */
@@ -224,6 +239,9 @@ struct vhd_state {
         u32                       spb;         /* sectors per block */
         u64                       next_db;     /* pointer to the next 
 						* (unallocated) datablock */
+	u64                       prealloc_end; /* end of zeroes written
+						 * ahead of next_db */
+	u32                       prealloc_blks; /* blocks to zero ahead */
 
 	struct vhd_bat_state      bat;
 
@@ -436,8 +454,9 @@ vhd_initialize_bat(struct vhd_state *s)
 					s->vhd.file);
 	}
 
-	err = posix_memalign((void **)&s->bat.bat_buf,
-			     VHD_SECTOR_SIZE, VHD_SECTOR_SIZE);
+	err = posix_memalign((void **)&s->bat.bat_buf, VHD_SECTOR_SIZE,
+			     vhd_bytes_padded(s->bat.bat.entries *
+					      sizeof(uint32_t)));
 	if (err) {
 		s->bat.bat_buf = NULL;
 		goto fail;
@@ -606,8 +625,9 @@ __vhd_open(td_driver_t *driver, const char *name, vhd_flag_t flags)
 	s = (struct vhd_state *)driver->data;
 	memset(s, 0, sizeof(struct vhd_state));
 
-	s->flags  = flags;
-	s->driver = driver;
+	s->flags         = flags;
+	s->driver        = driver;
+	s->prealloc_blks = 1;
 
 	err = vhd_initialize(s);
 	if (err)
@@ -721,6 +741,25 @@ vhd_log_close(struct vhd_state *s)
 		s->vhd.file, s->bat.bat.entries, allocated, full, s->next_db);
 }
 
+/*
+ * the footer goes right after the last block, so drop any zeroes
+ * preallocated beyond it.
+ */
+static void
+vhd_trim_preallocation(struct vhd_state *s)
+{
+	off_t end;
+
+	if (s->vhd.is_block || s->prealloc_end <= s->next_db)
+		return;
+
+	if (vhd_end_of_data(&s->vhd, &end))
+		return;
+
+	if (ftruncate(s->vhd.fd, end + sizeof(vhd_footer_t)))
+		EPRINTF("truncating %s: %d\n", s->vhd.file, -errno);
+}
+
 static int
 _vhd_close(td_driver_t *driver)
 {
@@ -743,6 +782,8 @@ _vhd_close(td_driver_t *driver)
 	if (test_vhd_flag(s->flags, VHD_FLAG_OPEN_STRICT) || s->writes) {
 		memcpy(&s->vhd.bat, &s->bat.bat, sizeof(vhd_bat_t));
 		err = vhd_write_footer(&s->vhd, &s->vhd.footer);
+		if (!err)
+			vhd_trim_preallocation(s);
 		memset(&s->vhd.bat, 0, sizeof(vhd_bat_t));
 
 		if (err)
@@ -925,41 +966,13 @@ transaction_completed(struct vhd_transaction *tx)
 	return (tx->started == tx->finished);
 }
 
-static inline void
-init_bat(struct vhd_state *s)
-{
-	s->bat.req.tx     = NULL;
-	s->bat.req.next   = NULL;
-	s->bat.req.error  = 0;
-	s->bat.pbw_blk    = 0;
-	s->bat.pbw_offset = 0;
-	s->bat.status     = 0;
-}
-
-static inline void
-lock_bat(struct vhd_state *s)
-{
-	set_vhd_flag(s->bat.status, VHD_FLAG_BAT_LOCKED);
-}
-
-static inline void
-unlock_bat(struct vhd_state *s)
-{
-	clear_vhd_flag(s->bat.status, VHD_FLAG_BAT_LOCKED);
-}
-
-static inline int
-bat_locked(struct vhd_state *s)
-{
-	return test_vhd_flag(s->bat.status, VHD_FLAG_BAT_LOCKED);
-}
-
 static inline void
 init_vhd_bitmap(struct vhd_state *s, struct vhd_bitmap *bm)
 {
-	bm->blk    = 0;
-	bm->seqno  = 0;
-	bm->status = 0;
+	bm->blk        = 0;
+	bm->seqno      = 0;
+	bm->status     = 0;
+	bm->pbw_offset = 0;
 	init_tx(&bm->tx);
 	clear_req_list(&bm->queue);
 	clear_req_list(&bm->waiting);
@@ -1016,6 +1029,12 @@ bitmap_in_use(struct vhd_bitmap *bm)
 		bm->waiting.head || bm->tx.requests.head || bm->queue.head);
 }
 
+static inline int
+bitmap_allocating(struct vhd_bitmap *bm)
+{
+	return test_vhd_flag(bm->tx.status, VHD_FLAG_TX_UPDATE_BAT);
+}
+
 static inline int
 bitmap_full(struct vhd_state *s, struct vhd_bitmap *bm)
 {
@@ -1156,8 +1175,11 @@ read_bitmap_cache(struct vhd_state *s, uint64_t sector, uint8_t op)
 
 	if (bat_entry(s, blk) == DD_BLK_UNUSED) {
 		if (op == VHD_OP_DATA_WRITE &&
-		    s->bat.pbw_blk != blk && bat_locked(s))
-			return VHD_BM_BAT_LOCKED;
+		    s->bat.pending >= VHD_BAT_MAX_PENDING) {
+			bm = get_bitmap(s, blk);
+			if (!bm || !bitmap_allocating(bm))
+				return VHD_BM_BAT_LOCKED;
+		}
 
 		return VHD_BM_BAT_CLEAR;
 	}
@@ -1265,58 +1287,114 @@ aio_write(struct vhd_state *s, struct vhd_request *req, uint64_t offset)
 }
 
 static inline uint64_t
-reserve_new_block(struct vhd_state *s, uint32_t blk)
+reserve_new_block(struct vhd_state *s, struct vhd_bitmap *bm)
 {
 	int gap = 0;
+	uint64_t lb_end = s->next_db;
 
-	ASSERT(!test_vhd_flag(s->bat.status, VHD_FLAG_BAT_WRITE_STARTED));
+	ASSERT(!bitmap_allocating(bm));
 
 	/* data region of segment should begin on page boundary */
 	if ((s->next_db + s->bm_secs) % s->spp)
 		gap = (s->spp - ((s->next_db + s->bm_secs) % s->spp));
 
-	s->bat.pbw_blk    = blk;
-	s->bat.pbw_offset = s->next_db + gap;
+	bm->pbw_offset = s->next_db + gap;
+	s->next_db     = bm->pbw_offset + s->spb + s->bm_secs;
+	s->bat.pending++;
+
+	lock_bitmap(bm);
+	set_vhd_flag(bm->tx.status, VHD_FLAG_TX_UPDATE_BAT);
 
-	return s->next_db;
+	return lb_end;
 }
 
-static int
+/*
+ * the space reserved for a block whose bat write failed is not reused
+ * until the next open, as later blocks may already have been placed
+ * after it.
+ */
+static inline void
+release_new_block(struct vhd_state *s, struct vhd_bitmap *bm)
+{
+	ASSERT(bitmap_allocating(bm) && s->bat.pending > 0);
+
+	s->bat.pending--;
+	bm->pbw_offset = 0;
+	clear_vhd_flag(bm->status, (VHD_FLAG_BM_BAT_READY |
+				    VHD_FLAG_BM_BAT_WRITE));
+	clear_vhd_flag(bm->tx.status, VHD_FLAG_TX_UPDATE_BAT);
+}
+
+/*
+ * write the entries of all blocks whose bitmaps are known to be zeroed
+ * on disk.  only one bat write is in flight at a time: entries becoming
+ * ready meanwhile are coalesced into the next one, which covers the run
+ * of table sectors between the lowest and highest entry it carries.
+ * sectors in between are rewritten with the entries already on disk.
+ */
+static void
 schedule_bat_write(struct vhd_state *s)
 {
 	int i;
-	u32 blk;
-	char *buf;
+	u32 *buf, lo, hi, nr;
 	u64 offset;
+	struct vhd_bitmap  *bm;
 	struct vhd_request *req;
 
-	ASSERT(bat_locked(s));
+	if (test_vhd_flag(s->bat.status, VHD_FLAG_BAT_WRITE_STARTED))
+		return;
 
-	req = &s->bat.req;
-	buf = s->bat.bat_buf;
-	blk = s->bat.pbw_blk;
+	lo  = ~0U;
+	hi  = 0;
+	nr  = 0;
+	buf = (u32 *)s->bat.bat_buf;
 
-	init_vhd_request(s, req);
-	memcpy(buf, &bat_entry(s, blk - (blk % 128)), 512);
+	for (i = 0; i < VHD_CACHE_SIZE; i++) {
+		bm = s->bitmap[i];
+		if (!bm || !test_vhd_flag(bm->status, VHD_FLAG_BM_BAT_READY))
+			continue;
+
+		lo = MIN(lo, bm->blk / 128);
+		hi = MAX(hi, bm->blk / 128);
+		nr++;
+	}
+
+	if (!nr)
+		return;
 
-	((u32 *)buf)[blk % 128] = s->bat.pbw_offset;
+	memcpy(buf + lo * 128, &bat_entry(s, lo * 128),
+	       vhd_sectors_to_bytes(hi - lo + 1));
 
-	for (i = 0; i < 128; i++)
-		BE32_OUT(&((u32 *)buf)[i]);
+	for (i = 0; i < VHD_CACHE_SIZE; i++) {
+		bm = s->bitmap[i];
+		if (!bm || !test_vhd_flag(bm->status, VHD_FLAG_BM_BAT_READY))
+			continue;
+
+		buf[bm->blk] = bm->pbw_offset;
+		clear_vhd_flag(bm->status, VHD_FLAG_BM_BAT_READY);
+		set_vhd_flag(bm->status, VHD_FLAG_BM_BAT_WRITE);
+	}
 
-	offset         = s->vhd.header.table_offset + (blk - (blk % 128)) * 4;
-	req->treq.secs = 1;
-	req->treq.buf  = buf;
+	for (i = lo * 128; i < (hi + 1) * 128 && i < s->bat.bat.entries; i++)
+		BE32_OUT(&buf[i]);
+
+	req = &s->bat.req;
+	init_vhd_request(s, req);
+
+	offset         = s->vhd.header.table_offset + vhd_sectors_to_bytes(lo);
+	req->treq.secs = hi - lo + 1;
+	req->treq.buf  = (char *)(buf + lo * 128);
 	req->op        = VHD_OP_BAT_WRITE;
 	req->next      = NULL;
 
 	aio_write(s, req, offset);
 	set_vhd_flag(s->bat.status, VHD_FLAG_BAT_WRITE_STARTED);
 
-	DBG(TLOG_DBG, "blk: 0x%04x, pbwo: 0x%08"PRIx64", "
-	    "table_offset: 0x%08"PRIx64"\n", blk, s->bat.pbw_offset, offset);
+	s->bat.flushes++;
+	s->bat.flushed += nr;
 
-	return 0;
+	DBG(TLOG_DBG, "entries: %u, secs: %u, table_offset: 0x%08"PRIx64"\n",
+	    nr, req->treq.secs, offset);
 }
 
 static void
@@ -1324,39 +1402,30 @@ schedule_zero_bm_write(struct vhd_state *s,
 		       struct vhd_bitmap *bm, uint64_t lb_end)
 {
 	uint64_t offset;
-	struct vhd_request *req = &s->bat.zero_req;
+	struct vhd_request *req = &bm->req;
 
 	init_vhd_request(s, req);
 
 	offset         = vhd_sectors_to_bytes(lb_end);
 	req->op        = VHD_OP_ZERO_BM_WRITE;
-	req->treq.sec  = s->bat.pbw_blk * s->spb;
-	req->treq.secs = (s->bat.pbw_offset - lb_end) + s->bm_secs;
+	req->treq.sec  = bm->blk * s->spb;
+	req->treq.secs = (bm->pbw_offset - lb_end) + s->bm_secs;
 	req->treq.buf  = vhd_zeros(vhd_sectors_to_bytes(req->treq.secs));
 	req->next      = NULL;
 
 	DBG(TLOG_DBG, "blk: 0x%04x, writing zero bitmap at 0x%08"PRIx64"\n",
-	    s->bat.pbw_blk, offset);
+	    bm->blk, offset);
 
-	lock_bitmap(bm);
 	add_to_transaction(&bm->tx, req);
 	aio_write(s, req, offset);
 }
 
 static int
-update_bat(struct vhd_state *s, uint32_t blk)
+get_new_bitmap(struct vhd_state *s, uint32_t blk, struct vhd_bitmap **bitmap)
 {
 	int err;
-	uint64_t lb_end;
 	struct vhd_bitmap *bm;
 
-	ASSERT(bat_entry(s, blk) == DD_BLK_UNUSED);
-	
-	if (bat_locked(s)) {
-		ASSERT(s->bat.pbw_blk == blk);
-		return 0;
-	}
-
 	/* empty bitmap could already be in
 	 * cache if earlier bat update failed */
 	bm = get_bitmap(s, blk);
@@ -1369,75 +1438,110 @@ update_bat(struct vhd_state *s, uint32_t blk)
 		install_bitmap(s, bm);
 	}
 
-	lock_bat(s);
-	lb_end = reserve_new_block(s, blk);
-	schedule_zero_bm_write(s, bm, lb_end);
-	set_vhd_flag(bm->tx.status, VHD_FLAG_TX_UPDATE_BAT);
-
+	*bitmap = bm;
 	return 0;
 }
 
 static int
-allocate_block(struct vhd_state *s, uint32_t blk)
+update_bat(struct vhd_state *s, uint32_t blk)
 {
-	char *zeros;
-	int err, gap;
-	uint64_t offset, size;
+	int err;
+	uint64_t lb_end;
 	struct vhd_bitmap *bm;
 
 	ASSERT(bat_entry(s, blk) == DD_BLK_UNUSED);
 
-	if (bat_locked(s)) {
-		ASSERT(s->bat.pbw_blk == blk);
-		if (s->bat.req.error)
-			return -EBUSY;
+	err = get_new_bitmap(s, blk, &bm);
+	if (err)
+		return err;
+
+	if (bitmap_allocating(bm))
 		return 0;
-	}
 
-	gap            = 0;
-	s->bat.pbw_blk = blk;
-	offset         = vhd_sectors_to_bytes(s->next_db);
+	lb_end = reserve_new_block(s, bm);
+	schedule_zero_bm_write(s, bm, lb_end);
 
-	/* data region of segment should begin on page boundary */
-	if ((s->next_db + s->bm_secs) % s->spp) {
-		gap = (s->spp - ((s->next_db + s->bm_secs) % s->spp));
-		s->next_db += gap;
-	}
+	return 0;
+}
 
-	s->bat.pbw_offset = s->next_db;
+/*
+ * zero the bitmap and data region of a new block synchronously, so that
+ * its bat entry can be written straight away.  the zeroes are written
+ * for more blocks at a time while the disk keeps growing, so that a
+ * sequential writer filling a sparse disk pays for one large write every
+ * VHD_PREALLOC_MAX_BLOCKS blocks rather than for a small one per block.
+ */
+static int
+preallocate_block(struct vhd_state *s, struct vhd_bitmap *bm, uint64_t lb_end)
+{
+	off_t off;
+	ssize_t ret;
+	uint64_t end, size, len;
 
-	DBG(TLOG_DBG, "blk: 0x%04x, pbwo: 0x%08"PRIx64"\n",
-	    blk, s->bat.pbw_offset);
+	end = bm->pbw_offset + s->spb;
+	if (end <= s->prealloc_end)
+		return 0;
 
-	if (lseek(s->vhd.fd, offset, SEEK_SET) == (off_t)-1) {
-		ERR(errno, "lseek failed\n");
-		return -errno;
+	lb_end = MAX(lb_end, s->prealloc_end);
+	end   += (uint64_t)(s->prealloc_blks - 1) *
+		(s->spb + s->bm_secs + s->spp);
+
+	off  = vhd_sectors_to_bytes(lb_end);
+	size = vhd_sectors_to_bytes(end - lb_end);
+
+	DBG(TLOG_DBG, "blk: 0x%04x, pbwo: 0x%08"PRIx64", zeroing %"PRIu64
+	    " bytes at 0x%08"PRIx64"\n", bm->blk, bm->pbw_offset, size,
+	    (uint64_t)off);
+
+	while (size) {
+		len = MIN(size, _vhd_zsize);
+		ret = pwrite(s->vhd.fd, vhd_zeros(len), len, off);
+		if (ret != len) {
+			ret = (ret == -1 ? -errno : -EIO);
+			ERR((int)ret, "write failed");
+			return ret;
+		}
+
+		off  += len;
+		size -= len;
 	}
 
-	size = vhd_sectors_to_bytes(s->spb + s->bm_secs + gap);
-	err  = write(s->vhd.fd, vhd_zeros(size), size);
-	if (err != size) {
-		err = (err == -1 ? -errno : -EIO);
-		ERR(err, "write failed");
+	s->prealloc_end = end;
+	if (s->prealloc_blks < VHD_PREALLOC_MAX_BLOCKS)
+		s->prealloc_blks <<= 1;
+
+	return 0;
+}
+
+static int
+allocate_block(struct vhd_state *s, uint32_t blk)
+{
+	int err;
+	uint64_t lb_end;
+	struct vhd_bitmap *bm;
+
+	ASSERT(bat_entry(s, blk) == DD_BLK_UNUSED);
+
+	err = get_new_bitmap(s, blk, &bm);
+	if (err)
 		return err;
-	}
 
-	/* empty bitmap could already be in
-	 * cache if earlier bat update failed */
-	bm = get_bitmap(s, blk);
-	if (!bm) {
-		/* install empty bitmap in cache */
-		err = alloc_vhd_bitmap(s, &bm, blk);
-		if (err) 
-			return err;
+	if (bitmap_allocating(bm))
+		return 0;
 
-		install_bitmap(s, bm);
+	lb_end = reserve_new_block(s, bm);
+
+	err = preallocate_block(s, bm, lb_end);
+	if (err) {
+		release_new_block(s, bm);
+		s->next_db = lb_end;
+		if (!bitmap_in_use(bm))
+			unlock_bitmap(bm);
+		return err;
 	}
 
-	lock_bat(s);
-	lock_bitmap(bm);
+	set_vhd_flag(bm->status, VHD_FLAG_BM_BAT_READY);
 	schedule_bat_write(s);
-	add_to_transaction(&bm->tx, &s->bat.req);
 
 	return 0;
 }
@@ -1513,7 +1617,8 @@ schedule_data_write(struct vhd_state *s, td_request_t treq, vhd_flag_t flags)
 		if (err)
 			return err;
 
-		offset = s->bat.pbw_offset;
+		bm     = get_bitmap(s, blk);
+		offset = bm->pbw_offset;
 	}
 
 	offset += s->bm_secs + sec;
@@ -1608,8 +1713,8 @@ schedule_bitmap_write(struct vhd_state *s, uint32_t blk)
 	       !test_vhd_flag(bm->status, VHD_FLAG_BM_WRITE_PENDING));
 
 	if (offset == DD_BLK_UNUSED) {
-		ASSERT(bat_locked(s) && s->bat.pbw_blk == blk);
-		offset = s->bat.pbw_offset;
+		ASSERT(bitmap_allocating(bm));
+		offset = bm->pbw_offset;
 	}
 	
 	offset = vhd_sectors_to_bytes(offset);
@@ -1899,32 +2004,6 @@ start_new_bitmap_transaction(struct vhd_state *s, struct vhd_bitmap *bm)
 		finish_data_transaction(s, bm);
 }
 
-static void
-finish_bat_transaction(struct vhd_state *s, struct vhd_bitmap *bm)
-{
-	struct vhd_transaction *tx = &bm->tx;
-
-	if (!bat_locked(s))
-		return;
-
-	if (s->bat.pbw_blk != bm->blk)
-		return;
-
-	if (!s->bat.req.error)
-		goto release;
-
-	if (!test_vhd_flag(tx->status, VHD_FLAG_TX_LIVE))
-		goto release;
-
-	tx->closed = 1;
-	return;
-
- release:
-	DBG(TLOG_DBG, "blk: 0x%04x\n", bm->blk);
-	unlock_bat(s);
-	init_bat(s);
-}
-
 static void
 finish_bitmap_transaction(struct vhd_state *s,
 			  struct vhd_bitmap *bm, int error)
@@ -1936,15 +2015,10 @@ finish_bitmap_transaction(struct vhd_state *s,
 	tx->error = (tx->error ? tx->error : error);
 	map_size  = vhd_sectors_to_bytes(s->bm_secs);
 
-	if (!test_vhd_flag(s->flags, VHD_FLAG_OPEN_PREALLOCATE)) {
-		if (test_vhd_flag(tx->status, VHD_FLAG_TX_UPDATE_BAT)) {
-			/* still waiting for bat write */
-			ASSERT(bm->blk == s->bat.pbw_blk);
-			ASSERT(test_vhd_flag(s->bat.status, 
-					     VHD_FLAG_BAT_WRITE_STARTED));
-			s->bat.req.tx = tx;
-			return;
-		}
+	if (test_vhd_flag(tx->status, VHD_FLAG_TX_UPDATE_BAT)) {
+		/* still waiting for bat write */
+		set_vhd_flag(tx->status, VHD_FLAG_TX_WAIT_BAT);
+		return;
 	}
 
 	if (tx->error) {
@@ -1964,8 +2038,6 @@ finish_bitmap_transaction(struct vhd_state *s,
 
 	if (!bitmap_in_use(bm))
 		unlock_bitmap(bm);
-
-	finish_bat_transaction(s, bm);
 }
 
 static void
@@ -1986,6 +2058,7 @@ finish_data_transaction(struct vhd_state *s, struct vhd_bitmap *bm)
 static void
 finish_bat_write(struct vhd_request *req)
 {
+	int i;
 	struct vhd_bitmap *bm;
 	struct vhd_transaction *tx;
 	struct vhd_state *s = req->state;
@@ -1993,35 +2066,36 @@ finish_bat_write(struct vhd_request *req)
 	s->returned++;
 	TRACE(s);
 
-	bm = get_bitmap(s, s->bat.pbw_blk);
+	ASSERT(test_vhd_flag(s->bat.status, VHD_FLAG_BAT_WRITE_STARTED));
 
-	DBG(TLOG_DBG, "blk 0x%04x, pbwo: 0x%08"PRIx64", err %d\n",
-	    s->bat.pbw_blk, s->bat.pbw_offset, req->error);
-	ASSERT(bm && bitmap_valid(bm));
-	ASSERT(bat_locked(s) &&
-	       test_vhd_flag(s->bat.status, VHD_FLAG_BAT_WRITE_STARTED));
+	for (i = 0; i < VHD_CACHE_SIZE; i++) {
+		bm = s->bitmap[i];
+		if (!bm || !test_vhd_flag(bm->status, VHD_FLAG_BM_BAT_WRITE))
+			continue;
 
-	tx = &bm->tx;
-	ASSERT(test_vhd_flag(tx->status, VHD_FLAG_TX_LIVE));
+		tx = &bm->tx;
 
-	if (!req->error) {
-		bat_entry(s, s->bat.pbw_blk) = s->bat.pbw_offset;
-		s->next_db = s->bat.pbw_offset + s->spb + s->bm_secs;
-	} else
-		tx->error = req->error;
+		DBG(TLOG_DBG, "blk 0x%04x, pbwo: 0x%08"PRIx64", err %d\n",
+		    bm->blk, bm->pbw_offset, req->error);
+		ASSERT(bitmap_valid(bm) && bitmap_allocating(bm));
 
-	if (test_vhd_flag(s->flags, VHD_FLAG_OPEN_PREALLOCATE)) {
-		tx->finished++;
-		remove_from_req_list(&tx->requests, req);
-		if (transaction_completed(tx))
-			finish_data_transaction(s, bm);
-	} else {
-		clear_vhd_flag(tx->status, VHD_FLAG_TX_UPDATE_BAT);
-		if (s->bat.req.tx)
+		if (!req->error)
+			bat_entry(s, bm->blk) = bm->pbw_offset;
+		else if (test_vhd_flag(tx->status, VHD_FLAG_TX_LIVE))
+			tx->error = req->error;
+
+		release_new_block(s, bm);
+
+		if (test_vhd_flag(tx->status, VHD_FLAG_TX_WAIT_BAT)) {
+			clear_vhd_flag(tx->status, VHD_FLAG_TX_WAIT_BAT);
 			finish_bitmap_transaction(s, bm, req->error);
+		} else if (!bitmap_in_use(bm))
+			unlock_bitmap(bm);
 	}
 
-	finish_bat_transaction(s, bm);
+	/* flush entries which became ready meanwhile */
+	clear_vhd_flag(s->bat.status, VHD_FLAG_BAT_WRITE_STARTED);
+	schedule_bat_write(s);
 }
 
 static void
@@ -2039,20 +2113,20 @@ finish_zero_bm_write(struct vhd_request *req)
 	bm  = get_bitmap(s, blk);
 
 	DBG(TLOG_DBG, "blk: 0x%04x\n", blk);
-	ASSERT(bat_locked(s));
-	ASSERT(s->bat.pbw_blk == blk);
 	ASSERT(bm && bitmap_valid(bm) && bitmap_locked(bm));
+	ASSERT(bitmap_allocating(bm));
 
 	tx->finished++;
 	remove_from_req_list(&tx->requests, req);
 
 	if (req->error) {
-		unlock_bat(s);
-		init_bat(s);
 		tx->error = req->error;
-		clear_vhd_flag(tx->status, VHD_FLAG_TX_UPDATE_BAT);
-	} else
+		release_new_block(s, bm);
+	} else {
+		/* the bitmap is zeroed: the entry may now go to disk */
+		set_vhd_flag(bm->status, VHD_FLAG_BM_BAT_READY);
 		schedule_bat_write(s);
+	}
 
 	if (transaction_completed(tx))
 		finish_data_transaction(s, bm);
@@ -2298,9 +2372,10 @@ vhd_debug(td_driver_t *driver)
 		    tx->started, tx->finished, tx->status, tx->requests.head, rnum);
 	}
 
-	DBG(TLOG_WARN, "BAT: status: 0x%08x, pbw_blk: 0x%04x, "
-	    "pbw_off: 0x%08"PRIx64", tx: %p\n", s->bat.status, s->bat.pbw_blk,
-	    s->bat.pbw_offset, s->bat.req.tx);
+	DBG(TLOG_WARN, "BAT: status: 0x%08x, pending: %d, writes: %"PRIu64
+	    ", entries written: %"PRIu64", next_db: 0x%08"PRIx64", "
+	    "prealloc_end: 0x%08"PRIx64"\n", s->bat.status, s->bat.pending,
+	    s->bat.flushes, s->bat.flushed, s->next_db, s->prealloc_end);
 
 /*
 	for (i = 0; i < s->hdr.max_bat_size; i++)
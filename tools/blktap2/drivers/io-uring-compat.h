@@ -0,0 +1,68 @@
+/*
+ * This  library is  free  software; you  can  redistribute it  and/or
+ * modify it under the terms  of the GNU Lesser General Public License
+ * as published by  the Free Software Foundation; either  version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT  ANY  WARRANTY;  without   even  the  implied  warranty  of
+ * MERCHANTABILITY or  FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should  have received a copy  of the GNU  Lesser General Public
+ * License along with this library; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * kernel 5.1 added io_uring(7). liburing is rarely installed on dom0s
+ * yet, and all tapdisk needs are the three system calls, so call them
+ * directly, using the kernel's uapi header for the ring layout. C
+ * libraries which predate the calls don't have their numbers, which are
+ * the same on all architectures but alpha.
+ */
+
+#ifndef __IO_URING_COMPAT
+#define __IO_URING_COMPAT
+
+#include "../../config.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#include <linux/io_uring.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifndef __NR_io_uring_setup
+# if defined(__alpha__)
+#  define __NR_io_uring_setup		535
+#  define __NR_io_uring_enter		536
+#  define __NR_io_uring_register	537
+# else
+#  define __NR_io_uring_setup		425
+#  define __NR_io_uring_enter		426
+#  define __NR_io_uring_register	427
+# endif
+#endif
+
+static inline int tapdisk_io_uring_setup(unsigned entries,
+					 struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int tapdisk_io_uring_enter(int fd, unsigned to_submit,
+					 unsigned min_complete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+static inline int tapdisk_io_uring_register(int fd, unsigned opcode,
+					    const void *arg, unsigned nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+#endif /* HAVE_LINUX_IO_URING_H */
+
+#endif /* __IO_URING_COMPAT */
@@ -589,6 +589,8 @@ tapdisk_stream_close_image(struct tapdisk_stream *s)
 	if (vbd) {
 		tapdisk_vbd_close_vdi(vbd);
 		tapdisk_server_remove_vbd(vbd);
+		if (vbd->ring.vstart)
+			tapdisk_server_unregister_buffer((void *)vbd->ring.vstart);
 		free((void *)vbd->ring.vstart);
 		free(vbd->name);
 		free(vbd);
@@ -615,6 +617,9 @@ tapdisk_stream_initialize_requests(struct tapdisk_stream *s)
 		return err;
 	}
 
+	/* unlike blktap's, these pages never change: let the queue pin them */
+	tapdisk_server_register_buffer((void *)ring->vstart, size);
+
 	for (i = 0; i < MAX_REQUESTS; i++) {
 		struct tapdisk_stream_request *req = s->requests + i;
 		tapdisk_stream_initialize_request(req);
@@ -28,8 +28,11 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <libaio.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #ifdef __linux__
 #include <linux/version.h>
 #endif
@@ -42,6 +45,7 @@
 #include "tapdisk-utils.h"
 
 #include "libaio-compat.h"
+#include "io-uring-compat.h"
 #include "atomicio.h"
 
 #define WARN(_f, _a...) tlog_write(TLOG_WARN, _f, ##_a)
@@ -547,6 +551,549 @@ static const struct tio td_tio_lio = {
 	.tio_submit  = tapdisk_lio_submit,
 };
 
+#ifdef HAVE_LINUX_IO_URING_H
+
+/*
+ * io_uring
+ *
+ * Like lio, but requests are written straight into a submission ring
+ * shared with the kernel and submitted with one io_uring_enter per
+ * batch, and completions are read from a shared completion ring without
+ * any system call. Under load the completion eventfd is switched off
+ * and the server reaps the ring once per iteration instead (see
+ * tapdisk_queue_poll). Buffers registered with the queue are pinned
+ * once, and requests wholly within one use the fixed-buffer opcodes,
+ * which saves the kernel mapping them on every request.
+ */
+
+#define URING_MAX_BUFS          64
+
+struct uring_slot {
+	struct iocb            *iocb;
+	struct iovec            iov;
+};
+
+struct uring {
+	int                     fd;
+	int                     event_fd;
+	int                     event_id;
+
+	void                   *sq_ring;
+	size_t                  sq_ring_size;
+	unsigned               *sq_head;
+	unsigned               *sq_tail;
+	unsigned               *sq_mask;
+	unsigned               *sq_array;
+	struct io_uring_sqe    *sqes;
+	size_t                  sqes_size;
+
+	void                   *cq_ring;
+	size_t                  cq_ring_size;
+	unsigned               *cq_head;
+	unsigned               *cq_tail;
+	unsigned               *cq_mask;
+	unsigned               *cq_flags;
+	struct io_uring_cqe    *cqes;
+
+	/* one slot per iocb in flight, indexed by sqe->user_data */
+	struct uring_slot      *slots;
+	int                    *free_slots;
+	int                     nr_free;
+
+	struct io_event        *aio_events;
+
+	struct iovec            bufs[URING_MAX_BUFS];
+	int                     nr_bufs;
+	int                     bufs_dirty;
+	int                     bufs_registered;
+
+	int                     polling;
+};
+
+static inline void *
+uring_ptr(void *ring, unsigned offset)
+{
+	return (char *)ring + offset;
+}
+
+static inline unsigned
+uring_load_acquire(const unsigned *p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+uring_store_release(unsigned *p, unsigned v)
+{
+	__atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static void
+tapdisk_uring_destroy(struct tqueue *queue)
+{
+	struct uring *ring = queue->tio_data;
+
+	if (!ring)
+		return;
+
+	if (ring->event_id >= 0) {
+		tapdisk_server_unregister_event(ring->event_id);
+		ring->event_id = -1;
+	}
+
+	if (ring->sqes) {
+		munmap(ring->sqes, ring->sqes_size);
+		ring->sqes = NULL;
+	}
+
+	if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	ring->cq_ring = NULL;
+
+	if (ring->sq_ring) {
+		munmap(ring->sq_ring, ring->sq_ring_size);
+		ring->sq_ring = NULL;
+	}
+
+	if (ring->fd >= 0) {
+		close(ring->fd);
+		ring->fd = -1;
+	}
+
+	if (ring->event_fd >= 0) {
+		close(ring->event_fd);
+		ring->event_fd = -1;
+	}
+
+	free(ring->slots);
+	ring->slots = NULL;
+	free(ring->free_slots);
+	ring->free_slots = NULL;
+	free(ring->aio_events);
+	ring->aio_events = NULL;
+}
+
+static int
+tapdisk_uring_map(struct uring *ring, struct io_uring_params *p)
+{
+	ring->sq_ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = p->cq_off.cqes +
+		p->cq_entries * sizeof(struct io_uring_cqe);
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+#endif
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size,
+			     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			     ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) {
+		ring->sq_ring = NULL;
+		return -errno;
+	}
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+	if (p->features & IORING_FEAT_SINGLE_MMAP)
+		ring->cq_ring = ring->sq_ring;
+	else
+#endif
+	{
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size,
+				     PROT_READ | PROT_WRITE,
+				     MAP_SHARED | MAP_POPULATE,
+				     ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED) {
+			ring->cq_ring = NULL;
+			return -errno;
+		}
+	}
+
+	ring->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size,
+			  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			  ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		return -errno;
+	}
+
+	ring->sq_head  = uring_ptr(ring->sq_ring, p->sq_off.head);
+	ring->sq_tail  = uring_ptr(ring->sq_ring, p->sq_off.tail);
+	ring->sq_mask  = uring_ptr(ring->sq_ring, p->sq_off.ring_mask);
+	ring->sq_array = uring_ptr(ring->sq_ring, p->sq_off.array);
+
+	ring->cq_head  = uring_ptr(ring->cq_ring, p->cq_off.head);
+	ring->cq_tail  = uring_ptr(ring->cq_ring, p->cq_off.tail);
+	ring->cq_mask  = uring_ptr(ring->cq_ring, p->cq_off.ring_mask);
+	ring->cqes     = uring_ptr(ring->cq_ring, p->cq_off.cqes);
+	ring->cq_flags = NULL;
+#ifdef IORING_CQ_EVENTFD_DISABLED
+	/* older kernels leave the offset zero */
+	if (p->cq_off.flags)
+		ring->cq_flags = uring_ptr(ring->cq_ring, p->cq_off.flags);
+#endif
+
+	return 0;
+}
+
+/*
+ * (Re-)register the buffers, which the kernel only allows as a whole.
+ * Only done with nothing in flight, so that no request can be using a
+ * buffer which is going away. Until then, requests don't use them.
+ */
+static void
+tapdisk_uring_sync_buffers(struct tqueue *queue)
+{
+	struct uring *ring = queue->tio_data;
+	int err;
+
+	if (!ring->bufs_dirty || queue->iocbs_pending)
+		return;
+
+	ring->bufs_dirty = 0;
+
+	if (ring->bufs_registered) {
+		tapdisk_io_uring_register(ring->fd, IORING_UNREGISTER_BUFFERS,
+					  NULL, 0);
+		ring->bufs_registered = 0;
+	}
+
+	if (!ring->nr_bufs)
+		return;
+
+	err = tapdisk_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS,
+					ring->bufs, ring->nr_bufs);
+	if (err) {
+		/* not fatal: requests just go through the normal opcodes */
+		DPRINTF("Couldn't register %d I/O buffers: %d. You may need to "
+			"raise the locked memory limit (ulimit -l).\n",
+			ring->nr_bufs, -errno);
+		return;
+	}
+
+	ring->bufs_registered = 1;
+}
+
+static int
+tapdisk_uring_find_buffer(struct uring *ring, const char *buf, size_t size)
+{
+	int i;
+
+	if (!ring->bufs_registered || ring->bufs_dirty)
+		return -1;
+
+	for (i = 0; i < ring->nr_bufs; i++) {
+		const char *base = ring->bufs[i].iov_base;
+
+		if (buf >= base && buf + size <= base + ring->bufs[i].iov_len)
+			return i;
+	}
+
+	return -1;
+}
+
+static int
+tapdisk_uring_register(struct tqueue *queue, void *buf, size_t size)
+{
+	struct uring *ring = queue->tio_data;
+
+	if (ring->nr_bufs == URING_MAX_BUFS)
+		return -ENOSPC;
+
+	ring->bufs[ring->nr_bufs].iov_base = buf;
+	ring->bufs[ring->nr_bufs].iov_len  = size;
+	ring->nr_bufs++;
+	ring->bufs_dirty = 1;
+
+	return 0;
+}
+
+static void
+tapdisk_uring_unregister(struct tqueue *queue, void *buf)
+{
+	struct uring *ring = queue->tio_data;
+	int i;
+
+	for (i = 0; i < ring->nr_bufs; i++)
+		if (ring->bufs[i].iov_base == buf) {
+			ring->bufs[i] = ring->bufs[--ring->nr_bufs];
+			ring->bufs_dirty = 1;
+			return;
+		}
+}
+
+/*
+ * Switch the completion eventfd on or off, where the kernel supports
+ * it. Returns whether it is off.
+ */
+static int
+tapdisk_uring_set_polling(struct uring *ring, int polling)
+{
+#ifdef IORING_CQ_EVENTFD_DISABLED
+	if (ring->cq_flags) {
+		unsigned flags = uring_load_acquire(ring->cq_flags);
+
+		if (polling)
+			flags |= IORING_CQ_EVENTFD_DISABLED;
+		else
+			flags &= ~IORING_CQ_EVENTFD_DISABLED;
+		uring_store_release(ring->cq_flags, flags);
+	}
+#endif
+	ring->polling = polling;
+	return polling;
+}
+
+/*
+ * td_complete may queue more tiocbs
+ */
+static int
+tapdisk_uring_reap(struct tqueue *queue)
+{
+	struct uring *ring = queue->tio_data;
+	unsigned head, tail;
+	int i, n = 0, split;
+	struct iocb *iocb;
+	struct tiocb *tiocb;
+	struct io_event *ep;
+
+	head = *ring->cq_head;
+	tail = uring_load_acquire(ring->cq_tail);
+
+	for (; head != tail; head++) {
+		struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+		struct uring_slot *slot = &ring->slots[cqe->user_data];
+
+		ep       = ring->aio_events + n++;
+		ep->obj  = slot->iocb;
+		ep->res  = (long)cqe->res;
+		ep->res2 = 0;
+
+		ring->free_slots[ring->nr_free++] = cqe->user_data;
+	}
+
+	uring_store_release(ring->cq_head, head);
+
+	if (!n)
+		return 0;
+
+	split = io_split(&queue->opioctx, ring->aio_events, n);
+	tapdisk_filter_events(queue->filter, ring->aio_events, split);
+
+	DBG("events: %d, tiocbs: %d\n", n, split);
+
+	queue->iocbs_pending  -= n;
+	queue->tiocbs_pending -= split;
+
+	for (i = split, ep = ring->aio_events; i-- > 0; ep++) {
+		iocb  = ep->obj;
+		tiocb = iocb->data;
+		complete_tiocb(queue, tiocb, ep->res);
+	}
+
+	queue_deferred_tiocbs(queue);
+
+	return split;
+}
+
+static void
+tapdisk_uring_event(event_id_t id, char mode, void *private)
+{
+	struct tqueue *queue = private;
+	struct uring *ring = queue->tio_data;
+	uint64_t val;
+
+	read_exact(ring->event_fd, &val, sizeof(val));
+
+	tapdisk_uring_reap(queue);
+}
+
+static int
+tapdisk_uring_poll(struct tqueue *queue)
+{
+	struct uring *ring = queue->tio_data;
+	int n;
+
+	n = tapdisk_uring_reap(queue);
+
+	if (tapdisk_queue_polling(queue) != ring->polling &&
+	    !tapdisk_uring_set_polling(ring, tapdisk_queue_polling(queue)))
+		/* catch completions posted while the eventfd was off */
+		n += tapdisk_uring_reap(queue);
+
+	return n;
+}
+
+static int
+tapdisk_uring_setup(struct tqueue *queue, int qlen)
+{
+	struct uring *ring = queue->tio_data;
+	struct io_uring_params p;
+	int i, err;
+
+	ring->fd       = -1;
+	ring->event_fd = -1;
+	ring->event_id = -1;
+
+	memset(&p, 0, sizeof(p));
+
+	ring->fd = tapdisk_io_uring_setup(qlen, &p);
+	if (ring->fd < 0) {
+		err = -errno;
+		goto fail;
+	}
+
+	err = tapdisk_uring_map(ring, &p);
+	if (err)
+		goto fail;
+
+	ring->event_fd = tapdisk_sys_eventfd(0);
+	if (ring->event_fd < 0) {
+		err = -errno;
+		goto fail;
+	}
+
+	err = tapdisk_io_uring_register(ring->fd, IORING_REGISTER_EVENTFD,
+					&ring->event_fd, 1);
+	if (err) {
+		err = -errno;
+		goto fail;
+	}
+
+	ring->slots      = calloc(qlen, sizeof(struct uring_slot));
+	ring->free_slots = calloc(qlen, sizeof(int));
+	ring->aio_events = calloc(qlen, sizeof(struct io_event));
+	if (!ring->slots || !ring->free_slots || !ring->aio_events) {
+		err = -ENOMEM;
+		goto fail;
+	}
+
+	for (i = qlen; i-- > 0; )
+		ring->free_slots[ring->nr_free++] = i;
+
+	ring->event_id =
+		tapdisk_server_register_event(SCHEDULER_POLL_READ_FD,
+					      ring->event_fd, 0,
+					      tapdisk_uring_event,
+					      queue);
+	err = ring->event_id;
+	if (err < 0)
+		goto fail;
+
+	return 0;
+
+fail:
+	tapdisk_uring_destroy(queue);
+	return err;
+}
+
+static void
+tapdisk_uring_prep_sqe(struct tqueue *queue, unsigned idx, struct iocb *iocb)
+{
+	struct uring *ring = queue->tio_data;
+	unsigned i = idx & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[i];
+	int write = (iocb->aio_lio_opcode == IO_CMD_PWRITE);
+	int slot, buf;
+
+	slot = ring->free_slots[--ring->nr_free];
+	ring->slots[slot].iocb = iocb;
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->fd        = iocb->aio_fildes;
+	sqe->off       = iocb->u.c.offset;
+	sqe->user_data = slot;
+
+	buf = tapdisk_uring_find_buffer(ring, iocb->u.c.buf, iocb->u.c.nbytes);
+	if (buf >= 0) {
+		sqe->opcode    = write ? IORING_OP_WRITE_FIXED :
+					 IORING_OP_READ_FIXED;
+		sqe->addr      = (unsigned long)iocb->u.c.buf;
+		sqe->len       = iocb->u.c.nbytes;
+		sqe->buf_index = buf;
+	} else {
+		struct iovec *iov = &ring->slots[slot].iov;
+
+		iov->iov_base  = iocb->u.c.buf;
+		iov->iov_len   = iocb->u.c.nbytes;
+		sqe->opcode    = write ? IORING_OP_WRITEV : IORING_OP_READV;
+		sqe->addr      = (unsigned long)iov;
+		sqe->len       = 1;
+	}
+
+	ring->sq_array[i] = i;
+}
+
+static int
+tapdisk_uring_submit(struct tqueue *queue)
+{
+	struct uring *ring = queue->tio_data;
+	int i, merged, submitted, err = 0;
+	unsigned tail;
+
+	if (!queue->queued)
+		return 0;
+
+	tapdisk_uring_sync_buffers(queue);
+
+	tapdisk_filter_iocbs(queue->filter, queue->iocbs, queue->queued);
+	merged = io_merge(&queue->opioctx, queue->iocbs, queue->queued);
+
+	tail = *ring->sq_tail;
+	for (i = 0; i < merged; i++)
+		tapdisk_uring_prep_sqe(queue, tail + i, queue->iocbs[i]);
+	uring_store_release(ring->sq_tail, tail + merged);
+
+	submitted = tapdisk_io_uring_enter(ring->fd, merged, 0, 0);
+
+	DBG("queued: %d, merged: %d, submitted: %d\n",
+	    queue->queued, merged, submitted);
+
+	if (submitted < 0) {
+		err = -errno;
+		submitted = 0;
+	} else if (submitted < merged)
+		err = -EIO;
+
+	if (submitted < merged) {
+		/* take back the sqes the kernel didn't consume */
+		for (i = submitted; i < merged; i++) {
+			unsigned idx = (tail + i) & *ring->sq_mask;
+			ring->free_slots[ring->nr_free++] =
+				ring->sqes[idx].user_data;
+		}
+		uring_store_release(ring->sq_tail,
+				    uring_load_acquire(ring->sq_head));
+	}
+
+	queue->iocbs_pending  += submitted;
+	queue->tiocbs_pending += queue->queued;
+	queue->queued          = 0;
+
+	if (err)
+		queue->tiocbs_pending -=
+			fail_tiocbs(queue, submitted, merged, err);
+
+	return submitted;
+}
+
+static const struct tio td_tio_uring = {
+	.name           = "uring",
+	.data_size      = sizeof(struct uring),
+	.tio_setup      = tapdisk_uring_setup,
+	.tio_destroy    = tapdisk_uring_destroy,
+	.tio_submit     = tapdisk_uring_submit,
+	.tio_poll       = tapdisk_uring_poll,
+	.tio_register   = tapdisk_uring_register,
+	.tio_unregister = tapdisk_uring_unregister,
+};
+
+#endif /* HAVE_LINUX_IO_URING_H */
+
 static void
 tapdisk_queue_free_io(struct tqueue *queue)
 {
@@ -575,6 +1122,11 @@ tapdisk_queue_init_io(struct tqueue *queue, int drv)
 	case TIO_DRV_RWIO:
 		tio = &td_tio_rwio;
 		break;
+#ifdef HAVE_LINUX_IO_URING_H
+	case TIO_DRV_URING:
+		tio = &td_tio_uring;
+		break;
+#endif
 	default:
 		err = -EINVAL;
 		goto fail;
@@ -657,9 +1209,11 @@ tapdisk_debug_queue(struct tqueue *queue)
 
 	WARN("TAPDISK QUEUE:\n");
 	WARN("size: %d, tio: %s, queued: %d, iocbs_pending: %d, "
-	     "tiocbs_pending: %d, tiocbs_deferred: %d, deferrals: %"PRIx64"\n",
+	     "tiocbs_pending: %d, tiocbs_deferred: %d, deferrals: %"PRIx64", "
+	     "polled: %"PRIx64"\n",
 	     queue->size, queue->tio->name, queue->queued, queue->iocbs_pending,
-	     queue->tiocbs_pending, queue->tiocbs_deferred, queue->deferrals);
+	     queue->tiocbs_pending, queue->tiocbs_deferred, queue->deferrals,
+	     queue->polled);
 
 	if (tiocb) {
 		WARN("deferred:\n");
@@ -741,3 +1295,41 @@ tapdisk_cancel_all_tiocbs(struct tqueue *queue)
 
 	return cancelled;
 }
+
+/*
+ * reaps completions without waiting for their notification, if the
+ * driver can. td_complete may queue more tiocbs.
+ */
+int
+tapdisk_queue_poll(struct tqueue *queue)
+{
+	int n;
+
+	if (!queue->tio || !queue->tio->tio_poll)
+		return 0;
+
+	n = queue->tio->tio_poll(queue);
+	queue->polled += n;
+
+	return n;
+}
+
+/*
+ * buf must stay mapped, and backed by the same pages, until it is
+ * unregistered.
+ */
+int
+tapdisk_queue_register_buffer(struct tqueue *queue, void *buf, size_t size)
+{
+	if (!queue->tio || !queue->tio->tio_register)
+		return 0;
+
+	return queue->tio->tio_register(queue, buf, size);
+}
+
+void
+tapdisk_queue_unregister_buffer(struct tqueue *queue, void *buf)
+{
+	if (queue->tio && queue->tio->tio_unregister)
+		queue->tio->tio_unregister(queue, buf);
+}
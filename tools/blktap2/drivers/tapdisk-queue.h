@@ -82,6 +82,8 @@ struct tqueue {
 	struct tfilter       *filter;
 
 	uint64_t              deferrals;
+	/* completions reaped by polling rather than on notification */
+	uint64_t              polled;
 };
 
 struct tio {
@@ -91,13 +93,27 @@ struct tio {
 	int  (*tio_setup)    (struct tqueue *queue, int qlen);
 	void (*tio_destroy)  (struct tqueue *queue);
 	int  (*tio_submit)   (struct tqueue *queue);
+
+	/* optional: reap completions without waiting for a notification */
+	int  (*tio_poll)     (struct tqueue *queue);
+	/* optional: pin buffers which most requests will be to or from */
+	int  (*tio_register) (struct tqueue *queue, void *buf, size_t size);
+	void (*tio_unregister)(struct tqueue *queue, void *buf);
 };
 
 enum {
 	TIO_DRV_LIO     = 1,
 	TIO_DRV_RWIO    = 2,
+	TIO_DRV_URING   = 3,
 };
 
+/*
+ * With at least this many iocbs in flight, a driver with tio_poll
+ * reaps completions once per server iteration, and the server doesn't
+ * sleep waiting for them.
+ */
+#define TAPDISK_QUEUE_POLL_THRESHOLD 16
+
 /*
  * Interface for request producer (i.e., tapdisk)
  * NB: the following functions may cause additional tiocbs to be queued:
@@ -111,6 +127,9 @@ enum {
 #define tapdisk_queue_empty(q) ((q)->queued == 0)
 #define tapdisk_queue_full(q)  \
 	(((q)->tiocbs_pending + (q)->queued) >= (q)->size)
+#define tapdisk_queue_polling(q) \
+	((q)->tio && (q)->tio->tio_poll && \
+	 (q)->iocbs_pending >= TAPDISK_QUEUE_POLL_THRESHOLD)
 int tapdisk_init_queue(struct tqueue *, int size, int drv, struct tfilter *);
 void tapdisk_free_queue(struct tqueue *);
 void tapdisk_debug_queue(struct tqueue *);
@@ -119,6 +138,9 @@ int tapdisk_submit_tiocbs(struct tqueue *);
 int tapdisk_submit_all_tiocbs(struct tqueue *);
 int tapdisk_cancel_tiocbs(struct tqueue *);
 int tapdisk_cancel_all_tiocbs(struct tqueue *);
+int tapdisk_queue_poll(struct tqueue *);
+int tapdisk_queue_register_buffer(struct tqueue *, void *, size_t);
+void tapdisk_queue_unregister_buffer(struct tqueue *, void *);
 void tapdisk_prep_tiocb(struct tiocb *, int, int, char *, size_t,
 			long long, td_queue_callback_t, void *);
 
@@ -101,6 +101,18 @@ tapdisk_server_queue_tiocb(struct tiocb *tiocb)
 	tapdisk_queue_tiocb(&server.aio_queue, tiocb);
 }
 
+int
+tapdisk_server_register_buffer(void *buf, size_t size)
+{
+	return tapdisk_queue_register_buffer(&server.aio_queue, buf, size);
+}
+
+void
+tapdisk_server_unregister_buffer(void *buf)
+{
+	tapdisk_queue_unregister_buffer(&server.aio_queue, buf);
+}
+
 void
 tapdisk_server_debug(void)
 {
@@ -177,6 +189,23 @@ tapdisk_server_submit_tiocbs(void)
 	tapdisk_submit_all_tiocbs(&server.aio_queue);
 }
 
+/*
+ * under load, don't sleep waiting for completions, but pick them up on
+ * every iteration
+ */
+static void
+tapdisk_server_set_poll_timeout(void)
+{
+	if (tapdisk_queue_polling(&server.aio_queue))
+		tapdisk_server_set_max_timeout(0);
+}
+
+static void
+tapdisk_server_poll_tiocbs(void)
+{
+	tapdisk_queue_poll(&server.aio_queue);
+}
+
 static void
 tapdisk_server_kick_responses(void)
 {
@@ -208,6 +237,15 @@ tapdisk_server_stop_vbds(void)
 static int
 tapdisk_server_init_aio(void)
 {
+	int err;
+
+	err = tapdisk_init_queue(&server.aio_queue, TAPDISK_TIOCBS,
+				 TIO_DRV_URING, NULL);
+	if (!err)
+		return 0;
+
+	DPRINTF("io_uring unavailable (%d), falling back to libaio\n", err);
+
 	return tapdisk_init_queue(&server.aio_queue, TAPDISK_TIOCBS,
 				  TIO_DRV_LIO, NULL);
 }
@@ -231,12 +269,14 @@ tapdisk_server_iterate(void)
 
 	tapdisk_server_assert_locks();
 	tapdisk_server_set_retry_timeout();
+	tapdisk_server_set_poll_timeout();
 	tapdisk_server_check_progress();
 
 	ret = scheduler_wait_for_events(&server.scheduler);
 	if (ret < 0)
 		DBG(TLOG_WARN, "server wait returned %d\n", ret);
 
+	tapdisk_server_poll_tiocbs();
 	tapdisk_server_check_vbds();
 	tapdisk_server_submit_tiocbs();
 	tapdisk_server_kick_responses();
@@ -0,0 +1,115 @@
+/*
+ * This  library is  free  software; you  can  redistribute it  and/or
+ * modify it under the terms  of the GNU Lesser General Public License
+ * as published by  the Free Software Foundation; either  version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT  ANY  WARRANTY;  without   even  the  implied  warranty  of
+ * MERCHANTABILITY or  FITNESS FOR A PARTICULAR PURPOSE.   See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should  have received a copy  of the GNU  Lesser General Public
+ * License along with this library; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Layout of the read cache which all tapdisks on a host share for their
+ * read-only parent images, in a POSIX shared memory segment.  The first
+ * tapdisk to open a block cache creates and sizes the segment; tap-ctl
+ * maps it read-only to report its statistics.
+ *
+ * The segment holds this header, a table of the images cached, the hash
+ * buckets, one descriptor per page and finally the pages themselves.
+ * Pages are keyed by (image key, page index), where the image key is a
+ * hash of the identity of the image file, so that every tapdisk with the
+ * same golden image open finds the pages the first one read.  Pages are
+ * reclaimed by a clock sweep.  Everything but the statistics is only
+ * accessed with the lock held.
+ */
+
+#ifndef _BLOCK_CACHE_SHM_H_
+#define _BLOCK_CACHE_SHM_H_
+
+#include <inttypes.h>
+#include <pthread.h>
+
+#define BLOCK_CACHE_SHM_NAME             "/tapdisk-block-cache"
+#define BLOCK_CACHE_SHM_MAGIC            0x54444243 /* "TDBC" */
+#define BLOCK_CACHE_SHM_VERSION          1
+
+#define BLOCK_CACHE_SHM_PAGE_SHIFT       12
+#define BLOCK_CACHE_SHM_PAGE_SIZE        (1 << BLOCK_CACHE_SHM_PAGE_SHIFT)
+#define BLOCK_CACHE_SHM_PAGES            (32 << 10) /* 128MB */
+#define BLOCK_CACHE_SHM_IMAGES           64
+#define BLOCK_CACHE_SHM_NAME_LENGTH      128
+
+#define BLOCK_CACHE_SHM_NO_PAGE          ((int32_t)-1)
+
+typedef struct block_cache_shm           block_cache_shm_t;
+typedef struct block_cache_shm_image     block_cache_shm_image_t;
+typedef struct block_cache_shm_page      block_cache_shm_page_t;
+
+struct block_cache_shm_image {
+	uint64_t                         key;       /* 0 if slot unused */
+	char                             name[BLOCK_CACHE_SHM_NAME_LENGTH];
+	uint64_t                         reads;     /* sectors */
+	uint64_t                         hits;      /* sectors */
+	uint64_t                         misses;    /* sectors */
+	uint64_t                         inserts;   /* pages */
+};
+
+struct block_cache_shm_page {
+	uint64_t                         key;
+	uint64_t                         index;
+	int32_t                          next;      /* in hash chain */
+	uint8_t                          valid;
+	uint8_t                          ref;       /* clock reference bit */
+	uint16_t                         pad;
+};
+
+struct block_cache_shm {
+	uint32_t                         magic;
+	uint32_t                         version;
+	uint64_t                         size;
+
+	uint32_t                         nr_pages;
+	uint32_t                         nr_buckets;
+	uint64_t                         buckets_offset;
+	uint64_t                         pages_offset;
+	uint64_t                         data_offset;
+
+	pthread_mutex_t                  lock;
+	uint32_t                         hand;
+	uint32_t                         used;
+
+	uint64_t                         reads;     /* sectors */
+	uint64_t                         hits;      /* sectors */
+	uint64_t                         misses;    /* sectors */
+	uint64_t                         inserts;   /* pages */
+	uint64_t                         evictions; /* pages */
+	uint64_t                         resets;
+
+	block_cache_shm_image_t          images[BLOCK_CACHE_SHM_IMAGES];
+};
+
+static inline int32_t *
+block_cache_shm_buckets(block_cache_shm_t *shm)
+{
+	return (int32_t *)((char *)shm + shm->buckets_offset);
+}
+
+static inline block_cache_shm_page_t *
+block_cache_shm_pages(block_cache_shm_t *shm)
+{
+	return (block_cache_shm_page_t *)((char *)shm + shm->pages_offset);
+}
+
+static inline char *
+block_cache_shm_data(block_cache_shm_t *shm, int32_t page)
+{
+	return (char *)shm + shm->data_offset +
+		((uint64_t)page << BLOCK_CACHE_SHM_PAGE_SHIFT);
+}
+
+#endif
@@ -1433,6 +1433,16 @@ int xc_perfc_query_number(xc_interface *xch,
 int xc_perfc_query(xc_interface *xch,
                    xc_hypercall_buffer_t *desc,
                    xc_hypercall_buffer_t *val);
+/*
+ * As above, but with arrays reported per CPU (pcd[i].nr_elems values for
+ * each online CPU) rather than summed over all CPUs.
+ */
+int xc_perfc_query_number_percpu(xc_interface *xch,
+                                 int *nbr_desc,
+                                 int *nbr_val);
+int xc_perfc_query_percpu(xc_interface *xch,
+                          xc_hypercall_buffer_t *desc,
+                          xc_hypercall_buffer_t *val);
 
 typedef xen_sysctl_lockprof_data_t xc_lockprof_data_t;
 int xc_lockprof_reset(xc_interface *xch);
@@ -1442,6 +1452,57 @@ int xc_lockprof_query(xc_interface *xch,
                       uint32_t *n_elems,
                       uint64_t *time,
                       xc_hypercall_buffer_t *data);
+typedef xen_sysctl_lockprof_wait_t xc_lockprof_wait_t;
+/* The longest lock waits since the last reset, longest first. */
+int xc_lockprof_query_waits(xc_interface *xch,
+                            uint32_t *n_elems,
+                            uint64_t *time,
+                            xc_hypercall_buffer_t *waits);
+
+typedef xen_sysctl_stats_op_t xc_stats_info_t;
+/*
+ * Shared statistics region (see XEN_SYSCTL_stats_op).  Enabling allocates
+ * the region on first use, sized for @max_domains and @max_vcpus (0 for
+ * the defaults), and sets the update period; @info returns its location.
+ */
+int xc_stats_enable(xc_interface *xch, uint32_t period_ms,
+                    uint32_t max_domains, uint32_t max_vcpus,
+                    xc_stats_info_t *info);
+int xc_stats_disable(xc_interface *xch);
+int xc_stats_get_info(xc_interface *xch, xc_stats_info_t *info);
+/* Map the region read-only; returns NULL if it hasn't been allocated. */
+struct xen_stats_header *xc_stats_map(xc_interface *xch,
+                                      xc_stats_info_t *info);
+
+typedef xen_sysctl_exitlat_t xc_exitlat_t;
+typedef xen_sysctl_exitlat_op_t xc_exitlat_info_t;
+/* HVM exit latency histograms (see XEN_SYSCTL_exitlat_op). */
+int xc_exitlat_enable(xc_interface *xch);
+int xc_exitlat_disable(xc_interface *xch);
+int xc_exitlat_reset(xc_interface *xch);
+/*
+ * Get the histograms of @cpu.  On entry *@nr_entries is the size of
+ * @entries (which may be NULL), and on return the number of exit reasons
+ * seen.  @info (if not NULL) gets the vendor, TSC frequency and state.
+ */
+int xc_exitlat_query(xc_interface *xch, uint32_t cpu,
+                     uint32_t *nr_entries, xc_exitlat_t *entries,
+                     xc_exitlat_info_t *info);
+
+typedef xen_sysctl_hcall_prof_t xc_hcall_prof_t;
+/* Hypercall cost accounting (see XEN_SYSCTL_hcall_prof_op). */
+int xc_hcall_prof_enable(xc_interface *xch);
+int xc_hcall_prof_disable(xc_interface *xch);
+int xc_hcall_prof_reset(xc_interface *xch);
+/*
+ * Get the counts of @domid, or of all domains for DOMID_INVALID.  On entry
+ * *@nr_entries is the size of @entries (which may be NULL), and on return
+ * the number of entries available.  @enabled (if not NULL) gets whether
+ * hypercalls are being accounted.
+ */
+int xc_hcall_prof_query(xc_interface *xch, domid_t domid,
+                        uint32_t *nr_entries, xc_hcall_prof_t *entries,
+                        int *enabled);
 
 void *xc_memalign(xc_interface *xch, size_t alignment, size_t size);
 
@@ -1710,7 +1771,9 @@ int xc_get_hvm_param(xc_interface *handle, domid_t dom, int param, unsigned long
  * @parm xch a handle to an open hypervisor interface.
  * @parm domid the domain id to be serviced
  * @parm handle_bufioreq how should the IOREQ Server handle buffered requests
- *                       (HVM_IOREQSRV_BUFIOREQ_*)?
+ *                       (HVM_IOREQSRV_BUFIOREQ_*)? Or in
+ *                       HVM_IOREQSRV_BUFIOREQ_EVTIDX and an order for a
+ *                       multi-page ring with notification suppression.
  * @parm id pointer to an ioservid_t to receive the IOREQ Server id.
  * @return 0 on success, -1 on failure.
  */
@@ -1727,7 +1790,7 @@ int xc_hvm_create_ioreq_server(xc_interface *xch,
  * @parm domid the domain id to be serviced
  * @parm id the IOREQ Server id.
  * @parm ioreq_pfn pointer to a xen_pfn_t to receive the synchronous ioreq gmfn
- * @parm bufioreq_pfn pointer to a xen_pfn_t to receive the buffered ioreq gmfn
+ * @parm bufioreq_pfn pointer to a xen_pfn_t to receive the (first) buffered ioreq gmfn
  * @parm bufioreq_port pointer to a evtchn_port_t to receive the buffered ioreq event channel
  * @return 0 on success, -1 on failure.
  */
@@ -2169,6 +2232,13 @@ int xc_get_mem_access(xc_interface *xch, domid_t domain_id,
  * Caller has to unmap this page when done.
  */
 void *xc_monitor_enable(xc_interface *xch, domid_t domain_id, uint32_t *port);
+/*
+ * As xc_monitor_enable(), but with a ring of nr_frames pages (at most
+ * XEN_VM_EVENT_MAX_RING_FRAMES), so that guests with many vCPUs don't stall
+ * on a full ring.  The caller has to unmap nr_frames pages when done.
+ */
+void *xc_monitor_enable_frames(xc_interface *xch, domid_t domain_id,
+                               unsigned int nr_frames, uint32_t *port);
 int xc_monitor_disable(xc_interface *xch, domid_t domain_id);
 int xc_monitor_resume(xc_interface *xch, domid_t domain_id);
 /*
@@ -2378,6 +2448,47 @@ int xc_memshr_range_share(xc_interface *xch,
                           uint64_t first_gfn,
                           uint64_t last_gfn);
 
+/* Allows to deduplicate many arbitrary gfn pairs in a single hypercall. This
+ * is equivalent of calling xc_memshr_nominate_gfn on source_gfns[i] and
+ * client_gfns[i], followed by xc_memshr_share_gfns, for each i < nr.
+ *
+ * Pairs which cannot be shared are skipped; on success the number of pairs
+ * actually deduplicated is returned in nr_shared (if non-NULL).
+ *
+ * May fail with -EINVAL if memory sharing is not enabled on either of the
+ * domains, or -ENOMEM if there isn't enough memory available to store the
+ * sharing metadata.
+ */
+int xc_memshr_bulk_share(xc_interface *xch,
+                         domid_t source_domain,
+                         domid_t client_domain,
+                         uint64_t *source_gfns,
+                         uint64_t *client_gfns,
+                         uint32_t nr,
+                         uint32_t *nr_shared);
+
+/* Turns domid into a copy-on-write fork of parent_domain.
+ *
+ * domid must be an empty HAP domain with the same number of vcpus as the
+ * parent, which must be paused and stays paused for as long as the fork
+ * exists. vcpu and HVM context are copied from the parent; memory is
+ * populated lazily as the fork touches it.
+ *
+ * May fail with EINVAL if the domains are not suitable, EBUSY if the parent
+ * is running, or EXDEV if either domain has a passthrough device.
+ */
+int xc_memshr_fork(xc_interface *xch,
+                   domid_t parent_domain,
+                   domid_t domid);
+
+/* Resets a fork to the state of its parent: memory privately populated by
+ * the fork is dropped and vcpu and HVM context reloaded from the parent.
+ *
+ * May fail with EINVAL if domid is not a fork.
+ */
+int xc_memshr_fork_reset(xc_interface *xch,
+                         domid_t domid);
+
 /* Debug calls: return the number of pages referencing the shared frame backing
  * the input argument. Should be one or greater. 
  *
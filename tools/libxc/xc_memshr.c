@@ -41,6 +41,38 @@ int xc_memshr_control(xc_interface *xch,
     return do_domctl(xch, &domctl);
 }
 
+int xc_memshr_fork(xc_interface *xch,
+                   domid_t parent_domain,
+                   domid_t domid)
+{
+    DECLARE_DOMCTL;
+    struct xen_domctl_mem_sharing_op *op;
+
+    domctl.cmd = XEN_DOMCTL_mem_sharing_op;
+    domctl.interface_version = XEN_DOMCTL_INTERFACE_VERSION;
+    domctl.domain = domid;
+    op = &(domctl.u.mem_sharing_op);
+    op->op = XEN_DOMCTL_MEM_SHARING_FORK;
+    op->u.fork.parent_domain = parent_domain;
+
+    return do_domctl(xch, &domctl);
+}
+
+int xc_memshr_fork_reset(xc_interface *xch,
+                         domid_t domid)
+{
+    DECLARE_DOMCTL;
+    struct xen_domctl_mem_sharing_op *op;
+
+    domctl.cmd = XEN_DOMCTL_mem_sharing_op;
+    domctl.interface_version = XEN_DOMCTL_INTERFACE_VERSION;
+    domctl.domain = domid;
+    op = &(domctl.u.mem_sharing_op);
+    op->op = XEN_DOMCTL_MEM_SHARING_FORK_RESET;
+
+    return do_domctl(xch, &domctl);
+}
+
 int xc_memshr_ring_enable(xc_interface *xch, 
                           domid_t domid, 
                           uint32_t *port)
@@ -200,6 +232,49 @@ int xc_memshr_range_share(xc_interface *xch,
     return xc_memshr_memop(xch, source_domain, &mso);
 }
 
+int xc_memshr_bulk_share(xc_interface *xch,
+                         domid_t source_domain,
+                         domid_t client_domain,
+                         uint64_t *source_gfns,
+                         uint64_t *client_gfns,
+                         uint32_t nr,
+                         uint32_t *nr_shared)
+{
+    DECLARE_HYPERCALL_BOUNCE(source_gfns, nr * sizeof(uint64_t),
+                             XC_HYPERCALL_BUFFER_BOUNCE_IN);
+    DECLARE_HYPERCALL_BOUNCE(client_gfns, nr * sizeof(uint64_t),
+                             XC_HYPERCALL_BUFFER_BOUNCE_IN);
+    xen_mem_sharing_op_t mso;
+    int rc;
+
+    if ( xc_hypercall_bounce_pre(xch, source_gfns) ||
+         xc_hypercall_bounce_pre(xch, client_gfns) )
+    {
+        PERROR("Could not bounce memory for XENMEM_sharing_op_bulk_share");
+        xc_hypercall_bounce_post(xch, source_gfns);
+        return -1;
+    }
+
+    memset(&mso, 0, sizeof(mso));
+
+    mso.op = XENMEM_sharing_op_bulk_share;
+
+    mso.u.bulk.client_domain = client_domain;
+    mso.u.bulk.nr = nr;
+    set_xen_guest_handle(mso.u.bulk.source_gfns, source_gfns);
+    set_xen_guest_handle(mso.u.bulk.client_gfns, client_gfns);
+
+    rc = xc_memshr_memop(xch, source_domain, &mso);
+
+    xc_hypercall_bounce_post(xch, client_gfns);
+    xc_hypercall_bounce_post(xch, source_gfns);
+
+    if ( !rc && nr_shared )
+        *nr_shared = mso.u.bulk.nr_shared;
+
+    return rc;
+}
+
 int xc_memshr_domain_resume(xc_interface *xch,
                             domid_t domid)
 {
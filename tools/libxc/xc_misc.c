@@ -349,21 +349,22 @@ int xc_perfc_reset(xc_interface *xch)
 
     sysctl.cmd = XEN_SYSCTL_perfc_op;
     sysctl.u.perfc_op.cmd = XEN_SYSCTL_PERFCOP_reset;
+    sysctl.u.perfc_op.flags = 0;
     set_xen_guest_handle(sysctl.u.perfc_op.desc, HYPERCALL_BUFFER_NULL);
     set_xen_guest_handle(sysctl.u.perfc_op.val, HYPERCALL_BUFFER_NULL);
 
     return do_sysctl(xch, &sysctl);
 }
 
-int xc_perfc_query_number(xc_interface *xch,
-                          int *nbr_desc,
-                          int *nbr_val)
+static int perfc_query_number(xc_interface *xch, uint32_t flags,
+                              int *nbr_desc, int *nbr_val)
 {
     int rc;
     DECLARE_SYSCTL;
 
     sysctl.cmd = XEN_SYSCTL_perfc_op;
     sysctl.u.perfc_op.cmd = XEN_SYSCTL_PERFCOP_query;
+    sysctl.u.perfc_op.flags = flags;
     set_xen_guest_handle(sysctl.u.perfc_op.desc, HYPERCALL_BUFFER_NULL);
     set_xen_guest_handle(sysctl.u.perfc_op.val, HYPERCALL_BUFFER_NULL);
 
@@ -377,9 +378,24 @@ int xc_perfc_query_number(xc_interface *xch,
     return rc;
 }
 
-int xc_perfc_query(xc_interface *xch,
-                   struct xc_hypercall_buffer *desc,
-                   struct xc_hypercall_buffer *val)
+int xc_perfc_query_number(xc_interface *xch,
+                          int *nbr_desc,
+                          int *nbr_val)
+{
+    return perfc_query_number(xch, 0, nbr_desc, nbr_val);
+}
+
+int xc_perfc_query_number_percpu(xc_interface *xch,
+                                 int *nbr_desc,
+                                 int *nbr_val)
+{
+    return perfc_query_number(xch, XEN_SYSCTL_PERFC_F_percpu,
+                              nbr_desc, nbr_val);
+}
+
+static int perfc_query(xc_interface *xch, uint32_t flags,
+                       struct xc_hypercall_buffer *desc,
+                       struct xc_hypercall_buffer *val)
 {
     DECLARE_SYSCTL;
     DECLARE_HYPERCALL_BUFFER_ARGUMENT(desc);
@@ -387,12 +403,27 @@ int xc_perfc_query(xc_interface *xch,
 
     sysctl.cmd = XEN_SYSCTL_perfc_op;
     sysctl.u.perfc_op.cmd = XEN_SYSCTL_PERFCOP_query;
+    sysctl.u.perfc_op.flags = flags;
     set_xen_guest_handle(sysctl.u.perfc_op.desc, desc);
     set_xen_guest_handle(sysctl.u.perfc_op.val, val);
 
     return do_sysctl(xch, &sysctl);
 }
 
+int xc_perfc_query(xc_interface *xch,
+                   struct xc_hypercall_buffer *desc,
+                   struct xc_hypercall_buffer *val)
+{
+    return perfc_query(xch, 0, desc, val);
+}
+
+int xc_perfc_query_percpu(xc_interface *xch,
+                          struct xc_hypercall_buffer *desc,
+                          struct xc_hypercall_buffer *val)
+{
+    return perfc_query(xch, XEN_SYSCTL_PERFC_F_percpu, desc, val);
+}
+
 int xc_lockprof_reset(xc_interface *xch)
 {
     DECLARE_SYSCTL;
@@ -400,6 +431,7 @@ int xc_lockprof_reset(xc_interface *xch)
     sysctl.cmd = XEN_SYSCTL_lockprof_op;
     sysctl.u.lockprof_op.cmd = XEN_SYSCTL_LOCKPROF_reset;
     set_xen_guest_handle(sysctl.u.lockprof_op.data, HYPERCALL_BUFFER_NULL);
+    set_xen_guest_handle(sysctl.u.lockprof_op.waits, HYPERCALL_BUFFER_NULL);
 
     return do_sysctl(xch, &sysctl);
 }
@@ -414,6 +446,7 @@ int xc_lockprof_query_number(xc_interface *xch,
     sysctl.u.lockprof_op.max_elem = 0;
     sysctl.u.lockprof_op.cmd = XEN_SYSCTL_LOCKPROF_query;
     set_xen_guest_handle(sysctl.u.lockprof_op.data, HYPERCALL_BUFFER_NULL);
+    set_xen_guest_handle(sysctl.u.lockprof_op.waits, HYPERCALL_BUFFER_NULL);
 
     rc = do_sysctl(xch, &sysctl);
 
@@ -435,10 +468,210 @@ int xc_lockprof_query(xc_interface *xch,
     sysctl.u.lockprof_op.cmd = XEN_SYSCTL_LOCKPROF_query;
     sysctl.u.lockprof_op.max_elem = *n_elems;
     set_xen_guest_handle(sysctl.u.lockprof_op.data, data);
+    set_xen_guest_handle(sysctl.u.lockprof_op.waits, HYPERCALL_BUFFER_NULL);
 
     rc = do_sysctl(xch, &sysctl);
 
     *n_elems = sysctl.u.lockprof_op.nr_elem;
+    *time = sysctl.u.lockprof_op.time;
+
+    return rc;
+}
+
+int xc_lockprof_query_waits(xc_interface *xch,
+                            uint32_t *n_elems,
+                            uint64_t *time,
+                            struct xc_hypercall_buffer *waits)
+{
+    int rc;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BUFFER_ARGUMENT(waits);
+
+    sysctl.cmd = XEN_SYSCTL_lockprof_op;
+    sysctl.u.lockprof_op.cmd = XEN_SYSCTL_LOCKPROF_query_waits;
+    sysctl.u.lockprof_op.max_elem = *n_elems;
+    set_xen_guest_handle(sysctl.u.lockprof_op.data, HYPERCALL_BUFFER_NULL);
+    set_xen_guest_handle(sysctl.u.lockprof_op.waits, waits);
+
+    rc = do_sysctl(xch, &sysctl);
+
+    *n_elems = sysctl.u.lockprof_op.nr_elem;
+    *time = sysctl.u.lockprof_op.time;
+
+    return rc;
+}
+
+static int xc_stats_op(xc_interface *xch, uint32_t cmd, uint32_t period_ms,
+                       uint32_t max_domains, uint32_t max_vcpus,
+                       xc_stats_info_t *info)
+{
+    int rc;
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_stats_op;
+    memset(&sysctl.u.stats_op, 0, sizeof(sysctl.u.stats_op));
+    sysctl.u.stats_op.cmd = cmd;
+    sysctl.u.stats_op.period_ms = period_ms;
+    sysctl.u.stats_op.max_domains = max_domains;
+    sysctl.u.stats_op.max_vcpus = max_vcpus;
+
+    rc = do_sysctl(xch, &sysctl);
+
+    if ( !rc && info )
+        *info = sysctl.u.stats_op;
+
+    return rc;
+}
+
+int xc_stats_enable(xc_interface *xch, uint32_t period_ms,
+                    uint32_t max_domains, uint32_t max_vcpus,
+                    xc_stats_info_t *info)
+{
+    return xc_stats_op(xch, XEN_SYSCTL_STATS_OP_enable, period_ms,
+                       max_domains, max_vcpus, info);
+}
+
+int xc_stats_disable(xc_interface *xch)
+{
+    return xc_stats_op(xch, XEN_SYSCTL_STATS_OP_disable, 0, 0, 0, NULL);
+}
+
+int xc_stats_get_info(xc_interface *xch, xc_stats_info_t *info)
+{
+    return xc_stats_op(xch, XEN_SYSCTL_STATS_OP_get_info, 0, 0, 0, info);
+}
+
+struct xen_stats_header *xc_stats_map(xc_interface *xch,
+                                      xc_stats_info_t *info)
+{
+    if ( !info->nr_frames )
+    {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    return xc_map_foreign_range(xch, DOMID_XEN,
+                                (size_t)info->nr_frames << XC_PAGE_SHIFT,
+                                PROT_READ, info->mfn);
+}
+
+static int xc_exitlat_op(xc_interface *xch, uint32_t cmd)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_exitlat_op;
+    memset(&sysctl.u.exitlat_op, 0, sizeof(sysctl.u.exitlat_op));
+    sysctl.u.exitlat_op.cmd = cmd;
+    set_xen_guest_handle(sysctl.u.exitlat_op.entries, HYPERCALL_BUFFER_NULL);
+
+    return do_sysctl(xch, &sysctl);
+}
+
+int xc_exitlat_enable(xc_interface *xch)
+{
+    return xc_exitlat_op(xch, XEN_SYSCTL_EXITLAT_enable);
+}
+
+int xc_exitlat_disable(xc_interface *xch)
+{
+    return xc_exitlat_op(xch, XEN_SYSCTL_EXITLAT_disable);
+}
+
+int xc_exitlat_reset(xc_interface *xch)
+{
+    return xc_exitlat_op(xch, XEN_SYSCTL_EXITLAT_reset);
+}
+
+int xc_exitlat_query(xc_interface *xch, uint32_t cpu,
+                     uint32_t *nr_entries, xc_exitlat_t *entries,
+                     xc_exitlat_info_t *info)
+{
+    int rc;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(entries, *nr_entries * sizeof(*entries),
+                             XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( (rc = xc_hypercall_bounce_pre(xch, entries)) )
+        return rc;
+
+    sysctl.cmd = XEN_SYSCTL_exitlat_op;
+    memset(&sysctl.u.exitlat_op, 0, sizeof(sysctl.u.exitlat_op));
+    sysctl.u.exitlat_op.cmd = XEN_SYSCTL_EXITLAT_query;
+    sysctl.u.exitlat_op.cpu = cpu;
+    sysctl.u.exitlat_op.nr_entries = *nr_entries;
+    set_xen_guest_handle(sysctl.u.exitlat_op.entries, entries);
+
+    rc = do_sysctl(xch, &sysctl);
+
+    xc_hypercall_bounce_post(xch, entries);
+
+    if ( !rc )
+    {
+        *nr_entries = sysctl.u.exitlat_op.nr_entries;
+        if ( info )
+            *info = sysctl.u.exitlat_op;
+    }
+
+    return rc;
+}
+
+static int xc_hcall_prof_op(xc_interface *xch, uint32_t cmd)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_hcall_prof_op;
+    memset(&sysctl.u.hcall_prof_op, 0, sizeof(sysctl.u.hcall_prof_op));
+    sysctl.u.hcall_prof_op.cmd = cmd;
+    set_xen_guest_handle(sysctl.u.hcall_prof_op.entries,
+                         HYPERCALL_BUFFER_NULL);
+
+    return do_sysctl(xch, &sysctl);
+}
+
+int xc_hcall_prof_enable(xc_interface *xch)
+{
+    return xc_hcall_prof_op(xch, XEN_SYSCTL_HCALL_PROF_enable);
+}
+
+int xc_hcall_prof_disable(xc_interface *xch)
+{
+    return xc_hcall_prof_op(xch, XEN_SYSCTL_HCALL_PROF_disable);
+}
+
+int xc_hcall_prof_reset(xc_interface *xch)
+{
+    return xc_hcall_prof_op(xch, XEN_SYSCTL_HCALL_PROF_reset);
+}
+
+int xc_hcall_prof_query(xc_interface *xch, domid_t domid,
+                        uint32_t *nr_entries, xc_hcall_prof_t *entries,
+                        int *enabled)
+{
+    int rc;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(entries, *nr_entries * sizeof(*entries),
+                             XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( (rc = xc_hypercall_bounce_pre(xch, entries)) )
+        return rc;
+
+    sysctl.cmd = XEN_SYSCTL_hcall_prof_op;
+    memset(&sysctl.u.hcall_prof_op, 0, sizeof(sysctl.u.hcall_prof_op));
+    sysctl.u.hcall_prof_op.cmd = XEN_SYSCTL_HCALL_PROF_query;
+    sysctl.u.hcall_prof_op.domid = domid;
+    sysctl.u.hcall_prof_op.nr_entries = *nr_entries;
+    set_xen_guest_handle(sysctl.u.hcall_prof_op.entries, entries);
+
+    rc = do_sysctl(xch, &sysctl);
+
+    xc_hypercall_bounce_post(xch, entries);
+
+    if ( !rc )
+    {
+        *nr_entries = sysctl.u.hcall_prof_op.nr_entries;
+        if ( enabled )
+            *enabled = sysctl.u.hcall_prof_op.enabled;
+    }
 
     return rc;
 }
@@ -25,7 +25,14 @@
 void *xc_monitor_enable(xc_interface *xch, domid_t domain_id, uint32_t *port)
 {
     return xc_vm_event_enable(xch, domain_id, HVM_PARAM_MONITOR_RING_PFN,
-                              port);
+                              1, port);
+}
+
+void *xc_monitor_enable_frames(xc_interface *xch, domid_t domain_id,
+                               unsigned int nr_frames, uint32_t *port)
+{
+    return xc_vm_event_enable(xch, domain_id, HVM_PARAM_MONITOR_RING_PFN,
+                              nr_frames, port);
 }
 
 int xc_monitor_disable(xc_interface *xch, domid_t domain_id)
@@ -415,9 +415,11 @@ int xc_vm_event_control(xc_interface *xch, domid_t domain_id, unsigned int op,
 /*
  * Enables vm_event and returns the mapped ring page indicated by param.
  * param can be HVM_PARAM_PAGING/ACCESS/SHARING_RING_PFN
+ * With nr_frames > 1 a multi-page ring is set up on pages allocated above
+ * the guest's memory instead, and the nr_frames pages are mapped.
  */
 void *xc_vm_event_enable(xc_interface *xch, domid_t domain_id, int param,
-                         uint32_t *port);
+                         unsigned int nr_frames, uint32_t *port);
 
 #endif /* __XC_PRIVATE_H__ */
 
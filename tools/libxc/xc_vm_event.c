@@ -22,8 +22,10 @@
 
 #include "xc_private.h"
 
-int xc_vm_event_control(xc_interface *xch, domid_t domain_id, unsigned int op,
-                        unsigned int mode, uint32_t *port)
+static int vm_event_control(xc_interface *xch, domid_t domain_id,
+                            unsigned int op, unsigned int mode,
+                            unsigned int nr_frames, xen_pfn_t ring_pfn,
+                            uint32_t *port)
 {
     DECLARE_DOMCTL;
     int rc;
@@ -32,6 +34,8 @@ int xc_vm_event_control(xc_interface *xch, domid_t domain_id, unsigned int op,
     domctl.domain = domain_id;
     domctl.u.vm_event_op.op = op;
     domctl.u.vm_event_op.mode = mode;
+    domctl.u.vm_event_op.nr_frames = nr_frames;
+    domctl.u.vm_event_op.ring_gfn = ring_pfn;
 
     rc = do_domctl(xch, &domctl);
     if ( !rc && port )
@@ -39,21 +43,31 @@ int xc_vm_event_control(xc_interface *xch, domid_t domain_id, unsigned int op,
     return rc;
 }
 
+int xc_vm_event_control(xc_interface *xch, domid_t domain_id, unsigned int op,
+                        unsigned int mode, uint32_t *port)
+{
+    return vm_event_control(xch, domain_id, op, mode, 0, 0, port);
+}
+
 void *xc_vm_event_enable(xc_interface *xch, domid_t domain_id, int param,
-                         uint32_t *port)
+                         unsigned int nr_frames, uint32_t *port)
 {
     void *ring_page = NULL;
     uint64_t pfn;
-    xen_pfn_t ring_pfn, mmap_pfn;
-    unsigned int op, mode;
+    xen_pfn_t ring_pfn[XEN_VM_EVENT_MAX_RING_FRAMES];
+    xen_pfn_t mmap_pfn[XEN_VM_EVENT_MAX_RING_FRAMES];
+    unsigned int op, mode, i;
     int rc1, rc2, saved_errno;
 
-    if ( !port )
+    if ( !port || nr_frames > XEN_VM_EVENT_MAX_RING_FRAMES )
     {
         errno = EINVAL;
         return NULL;
     }
 
+    if ( nr_frames == 0 )
+        nr_frames = 1;
+
     /* Pause the domain for ring page setup */
     rc1 = xc_domain_pause(xch, domain_id);
     if ( rc1 != 0 )
@@ -62,32 +76,62 @@ void *xc_vm_event_enable(xc_interface *xch, domid_t domain_id, int param,
         return NULL;
     }
 
-    /* Get the pfn of the ring page */
-    rc1 = xc_hvm_param_get(xch, domain_id, param, &pfn);
-    if ( rc1 != 0 )
+    if ( nr_frames == 1 )
     {
-        PERROR("Failed to get pfn of ring page\n");
-        goto out;
-    }
+        /* Get the pfn of the ring page */
+        rc1 = xc_hvm_param_get(xch, domain_id, param, &pfn);
+        if ( rc1 != 0 )
+        {
+            PERROR("Failed to get pfn of ring page\n");
+            goto out;
+        }
 
-    ring_pfn = pfn;
-    mmap_pfn = pfn;
-    rc1 = xc_get_pfn_type_batch(xch, domain_id, 1, &mmap_pfn);
-    if ( rc1 || mmap_pfn & XEN_DOMCTL_PFINFO_XTAB )
+        ring_pfn[0] = pfn;
+        mmap_pfn[0] = pfn;
+        rc1 = xc_get_pfn_type_batch(xch, domain_id, 1, mmap_pfn);
+        if ( rc1 || mmap_pfn[0] & XEN_DOMCTL_PFINFO_XTAB )
+        {
+            /* Page not in the physmap, try to populate it */
+            rc1 = xc_domain_populate_physmap_exact(xch, domain_id, 1, 0, 0,
+                                                  ring_pfn);
+            if ( rc1 != 0 )
+            {
+                PERROR("Failed to populate ring pfn\n");
+                goto out;
+            }
+        }
+    }
+    else
     {
-        /* Page not in the physmap, try to populate it */
-        rc1 = xc_domain_populate_physmap_exact(xch, domain_id, 1, 0, 0,
-                                              &ring_pfn);
+        xen_pfn_t max_gpfn;
+
+        /*
+         * The special pages next to the HVM param are in use by the other
+         * rings, so put larger rings just above the guest's memory.  They
+         * are only in the physmap until Xen has taken its references.
+         */
+        rc1 = xc_domain_maximum_gpfn(xch, domain_id, &max_gpfn);
+        if ( rc1 != 0 )
+        {
+            PERROR("Failed to get max gpfn\n");
+            goto out;
+        }
+
+        for ( i = 0; i < nr_frames; i++ )
+            ring_pfn[i] = max_gpfn + 1 + i;
+
+        rc1 = xc_domain_populate_physmap_exact(xch, domain_id, nr_frames,
+                                              0, 0, ring_pfn);
         if ( rc1 != 0 )
         {
-            PERROR("Failed to populate ring pfn\n");
+            PERROR("Failed to populate ring pfns\n");
             goto out;
         }
     }
 
-    mmap_pfn = ring_pfn;
+    memcpy(mmap_pfn, ring_pfn, nr_frames * sizeof(*ring_pfn));
     ring_page = xc_map_foreign_pages(xch, domain_id, PROT_READ | PROT_WRITE,
-                                         &mmap_pfn, 1);
+                                     mmap_pfn, nr_frames);
     if ( !ring_page )
     {
         PERROR("Could not map the ring page\n");
@@ -121,7 +165,8 @@ void *xc_vm_event_enable(xc_interface *xch, domid_t domain_id, int param,
         goto out;
     }
 
-    rc1 = xc_vm_event_control(xch, domain_id, op, mode, port);
+    rc1 = vm_event_control(xch, domain_id, op, mode,
+                           nr_frames, ring_pfn[0], port);
     if ( rc1 != 0 )
     {
         PERROR("Failed to enable vm_event\n");
@@ -129,7 +174,8 @@ void *xc_vm_event_enable(xc_interface *xch, domid_t domain_id, int param,
     }
 
     /* Remove the ring_pfn from the guest's physmap */
-    rc1 = xc_domain_decrease_reservation_exact(xch, domain_id, 1, 0, &ring_pfn);
+    rc1 = xc_domain_decrease_reservation_exact(xch, domain_id, nr_frames, 0,
+                                               ring_pfn);
     if ( rc1 != 0 )
         PERROR("Failed to remove ring page from guest physmap");
 
@@ -147,7 +193,7 @@ void *xc_vm_event_enable(xc_interface *xch, domid_t domain_id, int param,
         }
 
         if ( ring_page )
-            xenforeignmemory_unmap(xch->fmem, ring_page, 1);
+            xenforeignmemory_unmap(xch->fmem, ring_page, nr_frames);
         ring_page = NULL;
 
         errno = saved_errno;
@@ -0,0 +1,377 @@
+/*
+ * xen-exitlat: HVM exit latency histograms
+ *
+ * Controls and prints the per-pCPU histograms which Xen keeps of the time
+ * taken by each HVM exit, by exit reason (see XEN_SYSCTL_exitlat_op).
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <xenctrl.h>
+
+#define NR_BUCKETS XEN_SYSCTL_EXITLAT_BUCKETS
+
+static const char *const vmx_reasons[] = {
+    [0]  = "EXCEPTION_NMI",      [1]  = "EXTERNAL_INTERRUPT",
+    [2]  = "TRIPLE_FAULT",       [3]  = "INIT",
+    [4]  = "SIPI",               [5]  = "IO_SMI",
+    [6]  = "OTHER_SMI",          [7]  = "PENDING_VIRT_INTR",
+    [8]  = "PENDING_VIRT_NMI",   [9]  = "TASK_SWITCH",
+    [10] = "CPUID",              [11] = "GETSEC",
+    [12] = "HLT",                [13] = "INVD",
+    [14] = "INVLPG",             [15] = "RDPMC",
+    [16] = "RDTSC",              [17] = "RSM",
+    [18] = "VMCALL",             [19] = "VMCLEAR",
+    [20] = "VMLAUNCH",           [21] = "VMPTRLD",
+    [22] = "VMPTRST",            [23] = "VMREAD",
+    [24] = "VMRESUME",           [25] = "VMWRITE",
+    [26] = "VMXOFF",             [27] = "VMXON",
+    [28] = "CR_ACCESS",          [29] = "DR_ACCESS",
+    [30] = "IO_INSTRUCTION",     [31] = "MSR_READ",
+    [32] = "MSR_WRITE",          [33] = "INVALID_GUEST_STATE",
+    [34] = "MSR_LOADING",        [36] = "MWAIT",
+    [37] = "MONITOR_TRAP_FLAG",  [39] = "MONITOR",
+    [40] = "PAUSE",              [41] = "MCE_DURING_VMENTRY",
+    [43] = "TPR_BELOW_THRESHOLD", [44] = "APIC_ACCESS",
+    [45] = "EOI_INDUCED",        [46] = "ACCESS_GDTR_OR_IDTR",
+    [47] = "ACCESS_LDTR_OR_TR",  [48] = "EPT_VIOLATION",
+    [49] = "EPT_MISCONFIG",      [50] = "INVEPT",
+    [51] = "RDTSCP",             [52] = "PREEMPTION_TIMER",
+    [53] = "INVVPID",            [54] = "WBINVD",
+    [55] = "XSETBV",             [56] = "APIC_WRITE",
+    [58] = "INVPCID",            [59] = "VMFUNC",
+    [62] = "PML_FULL",           [63] = "XSAVES",
+    [64] = "XRSTORS",
+};
+
+/* SVM exit codes from 0x60; the lower ones are CR, DR and exceptions. */
+static const char *const svm_reasons[] = {
+    "INTR", "NMI", "SMI", "INIT", "VINTR", "CR0_SEL_WRITE",
+    "IDTR_READ", "GDTR_READ", "LDTR_READ", "TR_READ",
+    "IDTR_WRITE", "GDTR_WRITE", "LDTR_WRITE", "TR_WRITE",
+    "RDTSC", "RDPMC", "PUSHF", "POPF", "CPUID", "RSM", "IRET", "SWINT",
+    "INVD", "PAUSE", "HLT", "INVLPG", "INVLPGA", "IOIO", "MSR",
+    "TASK_SWITCH", "FERR_FREEZE", "SHUTDOWN", "VMRUN", "VMMCALL",
+    "VMLOAD", "VMSAVE", "STGI", "CLGI", "SKINIT", "RDTSCP", "ICEBP",
+    "WBINVD", "MONITOR", "MWAIT", "MWAIT_CONDITIONAL", "XSETBV",
+};
+
+static const char *reason_str(uint32_t vendor, uint32_t reason,
+                              char *buf, size_t len)
+{
+    const char *name = NULL;
+
+    if ( vendor == XEN_SYSCTL_EXITLAT_vmx )
+    {
+        if ( reason < sizeof(vmx_reasons) / sizeof(vmx_reasons[0]) )
+            name = vmx_reasons[reason];
+    }
+    else if ( vendor == XEN_SYSCTL_EXITLAT_svm )
+    {
+        if ( reason < 0x60 )
+        {
+            static const char *const kind[] = {
+                "CR%u_READ", "CR%u_WRITE", "DR%u_READ", "DR%u_WRITE",
+                "EXCP%u", "EXCP%u",
+            };
+
+            snprintf(buf, len, kind[reason >> 4],
+                     reason >= 0x40 ? reason - 0x40 : reason & 0xf);
+            return buf;
+        }
+        if ( reason == 0x400 )
+            name = "NPF";
+        else if ( reason - 0x60 < sizeof(svm_reasons) / sizeof(svm_reasons[0]) )
+            name = svm_reasons[reason - 0x60];
+    }
+
+    if ( name )
+        snprintf(buf, len, "%s", name);
+    else
+        snprintf(buf, len, "%#x", reason);
+    return buf;
+}
+
+/* One exit reason, summed over one or more pCPUs. */
+struct reason {
+    uint32_t reason;
+    uint64_t count, cycles, max;
+    uint64_t hist[NR_BUCKETS];
+};
+
+struct table {
+    unsigned int nr;
+    struct reason r[256];
+};
+
+static void table_add(struct table *t, const xc_exitlat_t *e)
+{
+    struct reason *r;
+    unsigned int i;
+
+    for ( i = 0; i < t->nr; i++ )
+        if ( t->r[i].reason == e->reason )
+            break;
+    if ( i == t->nr )
+    {
+        if ( t->nr == sizeof(t->r) / sizeof(t->r[0]) )
+            return;
+        memset(&t->r[t->nr], 0, sizeof(t->r[0]));
+        t->r[t->nr++].reason = e->reason;
+    }
+
+    r = &t->r[i];
+    r->count += e->count;
+    r->cycles += e->cycles;
+    if ( e->max > r->max )
+        r->max = e->max;
+    for ( i = 0; i < NR_BUCKETS; i++ )
+        r->hist[i] += e->hist[i];
+}
+
+static int compare_reason(const void *a, const void *b)
+{
+    const struct reason *ra = a, *rb = b;
+
+    if ( ra->cycles != rb->cycles )
+        return ra->cycles < rb->cycles ? 1 : -1;
+    return ra->reason < rb->reason ? -1 : ra->reason > rb->reason;
+}
+
+/*
+ * Upper bound, in cycles, of the bucket holding the pct'th percentile, or
+ * the maximum if that is lower.
+ */
+static uint64_t hist_pct(const struct reason *r, double pct)
+{
+    uint64_t sum = 0;
+    unsigned int b;
+
+    for ( b = 0; b < NR_BUCKETS - 1; b++ )
+    {
+        sum += r->hist[b];
+        if ( sum >= r->count * pct / 100 )
+            break;
+    }
+    return (2ULL << b) < r->max ? (2ULL << b) : r->max;
+}
+
+static double to_us(uint64_t cycles, uint32_t khz)
+{
+    return khz ? (double)cycles * 1000 / khz : 0;
+}
+
+static void print_table(struct table *t, uint32_t vendor, uint32_t khz,
+                        int hist)
+{
+    unsigned int i, b;
+    char name[32];
+
+    qsort(t->r, t->nr, sizeof(t->r[0]), compare_reason);
+
+    printf("%-22s %12s %10s %10s %10s %10s %10s\n", "reason", "count",
+           "mean(us)", "p50(us)", "p99(us)", "p99.9(us)", "max(us)");
+    for ( i = 0; i < t->nr; i++ )
+    {
+        const struct reason *r = &t->r[i];
+
+        printf("%-22s %12"PRIu64" %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+               reason_str(vendor, r->reason, name, sizeof(name)), r->count,
+               to_us(r->cycles / r->count, khz),
+               to_us(hist_pct(r, 50), khz),
+               to_us(hist_pct(r, 99), khz),
+               to_us(hist_pct(r, 99.9), khz),
+               to_us(r->max, khz));
+
+        if ( !hist )
+            continue;
+        printf("   ");
+        for ( b = 0; b < NR_BUCKETS; b++ )
+            if ( r->hist[b] )
+                printf(" <%.2fus:%"PRIu64, to_us(2ULL << b, khz),
+                       r->hist[b]);
+        printf("\n");
+    }
+}
+
+static int show(xc_interface *xch, int only_cpu, int per_cpu, int hist)
+{
+    xc_physinfo_t physinfo = { 0 };
+    xc_exitlat_info_t info = { 0 };
+    xc_exitlat_t *entries;
+    struct table *total, *t;
+    uint32_t nr, max = 256;
+    unsigned int cpu, first, last, i;
+    int rc = 1;
+
+    if ( xc_physinfo(xch, &physinfo) )
+    {
+        fprintf(stderr, "Failed to get physinfo: %d (%s)\n",
+                errno, strerror(errno));
+        return 1;
+    }
+
+    first = only_cpu >= 0 ? only_cpu : 0;
+    last = only_cpu >= 0 ? only_cpu : physinfo.max_cpu_id;
+
+    entries = calloc(max, sizeof(*entries));
+    total = calloc(1, sizeof(*total));
+    t = calloc(1, sizeof(*t));
+    if ( !entries || !total || !t )
+    {
+        fprintf(stderr, "Out of memory\n");
+        goto out;
+    }
+
+    for ( cpu = first; cpu <= last; cpu++ )
+    {
+        nr = max;
+        if ( xc_exitlat_query(xch, cpu, &nr, entries, &info) )
+        {
+            if ( errno == EINVAL && only_cpu < 0 )
+                continue;
+            fprintf(stderr, "Failed to query CPU%u: %d (%s)\n",
+                    cpu, errno, strerror(errno));
+            goto out;
+        }
+
+        if ( cpu == first && !info.enabled )
+            printf("(exit timing is disabled)\n");
+
+        t->nr = 0;
+        for ( i = 0; i < nr && i < max; i++ )
+        {
+            table_add(t, &entries[i]);
+            table_add(total, &entries[i]);
+        }
+
+        if ( per_cpu && t->nr )
+        {
+            printf("CPU%u:\n", cpu);
+            print_table(t, info.vendor, info.cpu_khz, hist);
+            printf("\n");
+        }
+    }
+
+    if ( !per_cpu )
+        print_table(total, info.vendor, info.cpu_khz, hist);
+
+    rc = 0;
+
+ out:
+    free(entries);
+    free(total);
+    free(t);
+    return rc;
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s enable|disable|reset\n"
+           "       %s [show] [-c cpu] [-p] [-H]\n"
+           "Time HVM exits from the exit to the next VM entry, by exit reason.\n"
+           "  enable  start timing exits (allocates the histograms)\n"
+           "  disable stop timing exits\n"
+           "  reset   clear the histograms\n"
+           "  show    print the time taken by each exit reason, most time first\n"
+           "    -c cpu  only this pCPU\n"
+           "    -p      one table per pCPU, rather than summed\n"
+           "    -H      also print the histograms\n"
+           "Percentiles are upper bounds of the power-of-two bucket holding\n"
+           "them.  Blocking exits (e.g. HLT) include the time blocked.\n",
+           prog, prog);
+}
+
+int main(int argc, char *argv[])
+{
+    xc_interface *xch;
+    const char *prog = argv[0], *cmd = "show";
+    int opt, only_cpu = -1, per_cpu = 0, hist = 0, rc;
+
+    if ( argc > 1 && argv[1][0] != '-' )
+    {
+        cmd = argv[1];
+        argv++;
+        argc--;
+    }
+
+    while ( (opt = getopt(argc, argv, "c:pHh")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'c':
+            only_cpu = atoi(optarg);
+            break;
+        case 'p':
+            per_cpu = 1;
+            break;
+        case 'H':
+            hist = 1;
+            break;
+        default:
+            usage(prog);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    if ( !xch )
+    {
+        fprintf(stderr, "Failed to open xc interface: %d (%s)\n",
+                errno, strerror(errno));
+        return 1;
+    }
+
+    if ( !strcmp(cmd, "enable") )
+        rc = xc_exitlat_enable(xch);
+    else if ( !strcmp(cmd, "disable") )
+        rc = xc_exitlat_disable(xch);
+    else if ( !strcmp(cmd, "reset") )
+        rc = xc_exitlat_reset(xch);
+    else if ( !strcmp(cmd, "show") )
+    {
+        rc = show(xch, only_cpu, per_cpu, hist);
+        xc_interface_close(xch);
+        return rc;
+    }
+    else
+    {
+        usage(prog);
+        xc_interface_close(xch);
+        return 1;
+    }
+
+    if ( rc )
+        fprintf(stderr, "Failed to %s exit timing: %d (%s)\n",
+                cmd, errno, strerror(errno));
+
+    xc_interface_close(xch);
+
+    return rc ? 1 : 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,327 @@
+/*
+ * xen-hcallprof: hypercall cost profiler
+ *
+ * Controls and prints the per-domain hypercall counts and times which Xen
+ * keeps while profiling is enabled (see XEN_SYSCTL_hcall_prof_op), ranked
+ * so that the costliest callers come first.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <xenctrl.h>
+
+#define X(name) [__HYPERVISOR_##name] = #name
+static const char *const hypercall_names[64] = {
+    X(set_trap_table),
+    X(mmu_update),
+    X(set_gdt),
+    X(stack_switch),
+    X(set_callbacks),
+    X(fpu_taskswitch),
+    X(sched_op_compat),
+    X(platform_op),
+    X(set_debugreg),
+    X(get_debugreg),
+    X(update_descriptor),
+    X(memory_op),
+    X(multicall),
+    X(update_va_mapping),
+    X(set_timer_op),
+    X(event_channel_op_compat),
+    X(xen_version),
+    X(console_io),
+    X(physdev_op_compat),
+    X(grant_table_op),
+    X(vm_assist),
+    X(update_va_mapping_otherdomain),
+    X(iret),
+    X(vcpu_op),
+    X(set_segment_base),
+    X(mmuext_op),
+    X(xsm_op),
+    X(nmi_op),
+    X(sched_op),
+    X(callback_op),
+    X(xenoprof_op),
+    X(event_channel_op),
+    X(physdev_op),
+    X(hvm_op),
+    X(sysctl),
+    X(domctl),
+    X(kexec_op),
+    X(tmem_op),
+    X(xc_reserved_op),
+    X(xenpmu_op),
+    X(arch_0),
+    X(arch_1),
+    X(arch_2),
+    X(arch_3),
+    X(arch_4),
+    X(arch_5),
+    X(arch_6),
+    X(arch_7),
+};
+#undef X
+
+static const char *hypercall_str(uint32_t op, char *buf, size_t len)
+{
+    if ( op < sizeof(hypercall_names) / sizeof(hypercall_names[0]) &&
+         hypercall_names[op] )
+        return hypercall_names[op];
+    snprintf(buf, len, "[%u]", op);
+    return buf;
+}
+
+enum sort_key { SORT_TIME, SORT_COUNT, SORT_MEAN, SORT_MAX };
+
+static enum sort_key sort_key;
+
+static uint64_t key_of(const xc_hcall_prof_t *e)
+{
+    switch ( sort_key )
+    {
+    case SORT_COUNT: return e->count;
+    case SORT_MEAN:  return e->count ? e->time / e->count : 0;
+    case SORT_MAX:   return e->max;
+    default:         return e->time;
+    }
+}
+
+static int compare_entry(const void *a, const void *b)
+{
+    const xc_hcall_prof_t *ea = a, *eb = b;
+    uint64_t ka = key_of(ea), kb = key_of(eb);
+
+    if ( ka != kb )
+        return ka < kb ? 1 : -1;
+    if ( ea->domid != eb->domid )
+        return ea->domid < eb->domid ? -1 : 1;
+    return ea->op < eb->op ? -1 : ea->op > eb->op;
+}
+
+/*
+ * Fold the entries into one per domain.  Calls made from a multicall are
+ * already included in the count and time of the multicall, so they are
+ * only added to the batched count.
+ */
+static unsigned int fold_domains(xc_hcall_prof_t *e, unsigned int nr)
+{
+    unsigned int i, j, n = 0;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        for ( j = 0; j < n; j++ )
+            if ( e[j].domid == e[i].domid )
+                break;
+        if ( j == n )
+        {
+            e[n] = e[i];
+            e[n].count -= e[n].subcalls;
+            e[n].time -= e[n].subcall_time;
+            e[n].op = ~0U;
+            n++;
+            continue;
+        }
+        e[j].count += e[i].count - e[i].subcalls;
+        e[j].time += e[i].time - e[i].subcall_time;
+        if ( e[i].max > e[j].max )
+            e[j].max = e[i].max;
+        e[j].preempted += e[i].preempted;
+        e[j].subcalls += e[i].subcalls;
+    }
+
+    return n;
+}
+
+static int show(xc_interface *xch, domid_t domid, unsigned int top,
+                int per_domain)
+{
+    xc_hcall_prof_t *entries = NULL;
+    uint32_t nr = 0, max;
+    unsigned int i;
+    int enabled = 0, rc = 1;
+    char buf[16];
+
+    /* Size the buffer, leaving room for calls made meanwhile. */
+    if ( xc_hcall_prof_query(xch, domid, &nr, NULL, &enabled) )
+        goto fail;
+
+    max = nr + 64;
+    entries = calloc(max, sizeof(*entries));
+    if ( !entries )
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    nr = max;
+    if ( xc_hcall_prof_query(xch, domid, &nr, entries, &enabled) )
+        goto fail;
+    if ( nr > max )
+        nr = max;
+
+    if ( !enabled )
+        printf("(hypercall profiling is disabled)\n");
+
+    if ( per_domain )
+        nr = fold_domains(entries, nr);
+
+    qsort(entries, nr, sizeof(*entries), compare_entry);
+    if ( top && nr > top )
+        nr = top;
+
+    printf("%5s %-24s %12s %12s %10s %10s %10s %10s\n", "domid",
+           per_domain ? "" : "hypercall", "count", "total(ms)", "mean(us)",
+           "max(us)", "preempted", "batched");
+    for ( i = 0; i < nr; i++ )
+    {
+        const xc_hcall_prof_t *e = &entries[i];
+
+        printf("%5u %-24s %12"PRIu64" %12.3f %10.2f %10.2f %10"PRIu64
+               " %10"PRIu64"\n",
+               e->domid, per_domain ? "" : hypercall_str(e->op, buf,
+                                                         sizeof(buf)),
+               e->count, e->time / 1e6,
+               e->count ? (double)e->time / e->count / 1e3 : 0,
+               e->max / 1e3, e->preempted, e->subcalls);
+    }
+
+    rc = 0;
+    goto out;
+
+ fail:
+    fprintf(stderr, "Failed to query hypercall profile: %d (%s)\n",
+            errno, strerror(errno));
+ out:
+    free(entries);
+    return rc;
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s enable|disable|reset\n"
+           "       %s [show] [-d domid] [-n top] [-s key] [-D]\n"
+           "Account the time guests spend in each hypercall.\n"
+           "  enable  start accounting hypercalls\n"
+           "  disable stop accounting hypercalls\n"
+           "  reset   clear the counts of all domains\n"
+           "  show    print the costliest callers first\n"
+           "    -d domid  only this domain\n"
+           "    -n top    only the first top rows\n"
+           "    -s key    rank by time (default), count, mean or max\n"
+           "    -D        one row per domain, rather than per hypercall\n"
+           "The time of a multicall includes that of the calls it batches,\n"
+           "which also appear under their own names, counted as batched.\n",
+           prog, prog);
+}
+
+int main(int argc, char *argv[])
+{
+    xc_interface *xch;
+    const char *prog = argv[0], *cmd = "show";
+    domid_t domid = DOMID_INVALID;
+    unsigned int top = 0;
+    int opt, per_domain = 0, rc;
+
+    if ( argc > 1 && argv[1][0] != '-' )
+    {
+        cmd = argv[1];
+        argv++;
+        argc--;
+    }
+
+    while ( (opt = getopt(argc, argv, "d:n:s:Dh")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'd':
+            domid = atoi(optarg);
+            break;
+        case 'n':
+            top = atoi(optarg);
+            break;
+        case 's':
+            if ( !strcmp(optarg, "time") )
+                sort_key = SORT_TIME;
+            else if ( !strcmp(optarg, "count") )
+                sort_key = SORT_COUNT;
+            else if ( !strcmp(optarg, "mean") )
+                sort_key = SORT_MEAN;
+            else if ( !strcmp(optarg, "max") )
+                sort_key = SORT_MAX;
+            else
+            {
+                usage(prog);
+                return 1;
+            }
+            break;
+        case 'D':
+            per_domain = 1;
+            break;
+        default:
+            usage(prog);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    if ( !xch )
+    {
+        fprintf(stderr, "Failed to open xc interface: %d (%s)\n",
+                errno, strerror(errno));
+        return 1;
+    }
+
+    if ( !strcmp(cmd, "enable") )
+        rc = xc_hcall_prof_enable(xch);
+    else if ( !strcmp(cmd, "disable") )
+        rc = xc_hcall_prof_disable(xch);
+    else if ( !strcmp(cmd, "reset") )
+        rc = xc_hcall_prof_reset(xch);
+    else if ( !strcmp(cmd, "show") )
+    {
+        rc = show(xch, domid, top, per_domain);
+        xc_interface_close(xch);
+        return rc;
+    }
+    else
+    {
+        usage(prog);
+        xc_interface_close(xch);
+        return 1;
+    }
+
+    if ( rc )
+        fprintf(stderr, "Failed to %s hypercall profiling: %d (%s)\n",
+                cmd, errno, strerror(errno));
+
+    xc_interface_close(xch);
+
+    return rc ? 1 : 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -17,6 +17,109 @@
 #include <errno.h>
 #include <string.h>
 #include <inttypes.h>
+#include <unistd.h>
+
+/* Format the upper bound of histogram bucket b, i.e. 2^(b+1) ns. */
+static const char *bucket_str(unsigned int b, char *buf, size_t len)
+{
+    static const char *const units[] = { "ns", "us", "ms", "s" };
+    uint64_t v = 2ULL << b;
+    unsigned int u = 0;
+
+    while ( v >= 1000 && u < 3 )
+    {
+        v /= 1000;
+        u++;
+    }
+    snprintf(buf, len, "%"PRIu64"%s", v, units[u]);
+    return buf;
+}
+
+/* Bucket below whose upper bound pct percent of the samples fall. */
+static unsigned int hist_pct(const uint32_t *hist, uint64_t total,
+                             unsigned int pct)
+{
+    uint64_t sum = 0;
+    unsigned int b;
+
+    for ( b = 0; b < LOCKPROF_HIST_BUCKETS - 1; b++ )
+    {
+        sum += hist[b];
+        if ( sum * 100 >= total * pct )
+            break;
+    }
+    return b;
+}
+
+static void print_hist(const char *what, const uint32_t *hist)
+{
+    uint64_t total = 0;
+    unsigned int b, last = 0;
+    char s1[16], s2[16], s3[16];
+
+    for ( b = 0; b < LOCKPROF_HIST_BUCKETS; b++ )
+    {
+        total += hist[b];
+        if ( hist[b] )
+            last = b;
+    }
+    if ( !total )
+        return;
+
+    printf("    %s: p50 <%s, p99 <%s, max <%s\n      ", what,
+           bucket_str(hist_pct(hist, total, 50), s1, sizeof(s1)),
+           bucket_str(hist_pct(hist, total, 99), s2, sizeof(s2)),
+           bucket_str(last, s3, sizeof(s3)));
+    for ( b = 0; b <= last; b++ )
+        if ( hist[b] )
+            printf(" <%s:%u", bucket_str(b, s1, sizeof(s1)), hist[b]);
+    printf("\n");
+}
+
+static int print_waits(xc_interface *xc_handle)
+{
+    uint32_t i, n = 64;
+    uint64_t time;
+    DECLARE_HYPERCALL_BUFFER(xc_lockprof_wait_t, waits);
+
+    waits = xc_hypercall_buffer_alloc(xc_handle, waits, sizeof(*waits) * n);
+    if ( waits == NULL )
+    {
+        fprintf(stderr, "Could not allocate buffers: %d (%s)\n",
+                errno, strerror(errno));
+        return 1;
+    }
+
+    if ( xc_lockprof_query_waits(xc_handle, &n, &time,
+                                 HYPERCALL_BUFFER(waits)) != 0 )
+    {
+        fprintf(stderr, "Error getting longest waits: %d (%s)\n",
+                errno, strerror(errno));
+        xc_hypercall_buffer_free(xc_handle, waits);
+        return 1;
+    }
+
+    printf("longest waits (resolve callers with addr2line -e xen-syms):\n");
+    for ( i = 0; i < n && i < 64; i++ )
+        printf("%20.9fs  %-30s lock %#"PRIx64" caller %#"PRIx64
+               " cpu %u at %.9fs\n",
+               (double)waits[i].wait_time / 1E+09, waits[i].name,
+               waits[i].lock, waits[i].caller, waits[i].cpu,
+               (double)waits[i].when / 1E+09);
+
+    xc_hypercall_buffer_free(xc_handle, waits);
+
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    printf("%s: [-r] [-H] [-w]\n", prog);
+    printf("no args: print lock profile data\n");
+    printf("    -r : reset profile data\n");
+    printf("    -H : also print wait and hold time histograms\n");
+    printf("    -w : also print the longest waits and their callers\n");
+}
 
 int main(int argc, char *argv[])
 {
@@ -25,13 +128,31 @@ int main(int argc, char *argv[])
     uint64_t           time;
     double             l, b, sl, sb;
     char               name[60];
+    int                opt, reset = 0, hist = 0, waits = 0;
     DECLARE_HYPERCALL_BUFFER(xc_lockprof_data_t, data);
 
-    if ( (argc > 2) || ((argc == 2) && (strcmp(argv[1], "-r") != 0)) )
+    while ( (opt = getopt(argc, argv, "rHwh")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'r':
+            reset = 1;
+            break;
+        case 'H':
+            hist = 1;
+            break;
+        case 'w':
+            waits = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if ( optind != argc || (reset && (hist || waits)) )
     {
-        printf("%s: [-r]\n", argv[0]);
-        printf("no args: print lock profile data\n");
-        printf("    -r : reset profile data\n");
+        usage(argv[0]);
         return 1;
     }
 
@@ -42,7 +163,7 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    if ( argc > 1 )
+    if ( reset )
     {
         if ( xc_lockprof_reset(xc_handle) != 0 )
         {
@@ -108,6 +229,11 @@ int main(int argc, char *argv[])
         printf("%-50s: lock:%12"PRId64"(%20.9fs), "
                "block:%12"PRId64"(%20.9fs)\n",
                name, data[j].lock_cnt, l, data[j].block_cnt, b);
+        if ( hist )
+        {
+            print_hist("wait", data[j].block_hist);
+            print_hist("hold", data[j].hold_hist);
+        }
     }
     l = (double)time / 1E+09;
     printf("total profiling time: %20.9fs\n", l);
@@ -116,5 +242,11 @@ int main(int argc, char *argv[])
 
     xc_hypercall_buffer_free(xc_handle, data);
 
+    if ( waits )
+    {
+        printf("\n");
+        return print_waits(xc_handle);
+    }
+
     return 0;
 }
@@ -16,6 +16,9 @@
 #include <sys/mman.h>
 #include <errno.h>
 #include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
 
 #define X(name) [__HYPERVISOR_##name] = #name
 const char *hypercall_name_table[64] =
@@ -68,49 +71,298 @@ const char *hypercall_name_table[64] =
 };
 #undef X
 
+static const char *hypercall_str(unsigned int nr)
+{
+    static char buf[16];
+
+    if ( nr < 64 && hypercall_name_table[nr] )
+        return hypercall_name_table[nr];
+    snprintf(buf, sizeof(buf), "[%u]", nr);
+    return buf;
+}
+
+/* One snapshot of all counters, arrays broken down per CPU. */
+struct sample {
+    int num_desc, num_val, nr_cpus;
+    xc_perfc_desc_t *pcd;
+    xc_perfc_val_t *pcv;
+    struct timespec when;
+};
+
+/* A counter, or one element of an array, with its rate over the interval. */
+struct rate {
+    int desc, elem;
+    double total;
+    double *cpu;
+};
+
+static int take_sample(xc_interface *xch, struct sample *s)
+{
+    DECLARE_HYPERCALL_BUFFER(xc_perfc_desc_t, pcd);
+    DECLARE_HYPERCALL_BUFFER(xc_perfc_val_t, pcv);
+    int num_desc, num_val, i, rc = -1;
+
+    if ( xc_perfc_query_number_percpu(xch, &num_desc, &num_val) != 0 )
+    {
+        fprintf(stderr, "Error getting number of perf counters: %d (%s)\n",
+                errno, strerror(errno));
+        return -1;
+    }
+
+    pcd = xc_hypercall_buffer_alloc(xch, pcd, sizeof(*pcd) * num_desc);
+    pcv = xc_hypercall_buffer_alloc(xch, pcv, sizeof(*pcv) * num_val);
+    if ( pcd == NULL || pcv == NULL )
+    {
+        fprintf(stderr, "Could not allocate buffers: %d (%s)\n",
+                errno, strerror(errno));
+        goto out;
+    }
+
+    if ( xc_perfc_query_percpu(xch, HYPERCALL_BUFFER(pcd),
+                               HYPERCALL_BUFFER(pcv)) != 0 )
+    {
+        fprintf(stderr, "Error getting perf counter: %d (%s)\n",
+                errno, strerror(errno));
+        goto out;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &s->when);
+
+    free(s->pcd);
+    free(s->pcv);
+    s->pcd = malloc(sizeof(*pcd) * num_desc);
+    s->pcv = malloc(sizeof(*pcv) * num_val);
+    if ( s->pcd == NULL || s->pcv == NULL )
+    {
+        fprintf(stderr, "Out of memory\n");
+        goto out;
+    }
+    memcpy(s->pcd, pcd, sizeof(*pcd) * num_desc);
+    memcpy(s->pcv, pcv, sizeof(*pcv) * num_val);
+    s->num_desc = num_desc;
+    s->num_val = num_val;
+
+    /* Every counter has nr_elems values for each online CPU. */
+    s->nr_cpus = 0;
+    for ( i = 0; i < num_desc; i++ )
+        if ( pcd[i].nr_elems )
+        {
+            s->nr_cpus = pcd[i].nr_vals / pcd[i].nr_elems;
+            break;
+        }
+
+    rc = 0;
+
+ out:
+    xc_hypercall_buffer_free(xch, pcd);
+    xc_hypercall_buffer_free(xch, pcv);
+    return rc;
+}
+
+static int compare_rate(const void *a, const void *b)
+{
+    const struct rate *ra = a, *rb = b;
+
+    if ( ra->total != rb->total )
+        return ra->total < rb->total ? 1 : -1;
+    if ( ra->desc != rb->desc )
+        return ra->desc - rb->desc;
+    return ra->elem - rb->elem;
+}
+
+static void print_rates(const struct sample *prev, const struct sample *cur,
+                        unsigned int top, int percpu)
+{
+    double secs = (cur->when.tv_sec - prev->when.tv_sec) +
+                  (cur->when.tv_nsec - prev->when.tv_nsec) / 1e9;
+    int nr_rows = 0, base, i, j, c, v;
+    struct rate *rows;
+    double *cpu;
+    char name[128];
+
+    if ( secs <= 0 )
+        return;
+
+    /* The layouts only differ if a CPU went on- or offline. */
+    if ( prev->num_desc != cur->num_desc || prev->num_val != cur->num_val )
+    {
+        printf("Counter layout changed, restarting\n");
+        return;
+    }
+
+    for ( i = 0; i < cur->num_desc; i++ )
+        nr_rows += cur->pcd[i].nr_elems;
+    rows = calloc(nr_rows, sizeof(*rows));
+    cpu = calloc((size_t)nr_rows * cur->nr_cpus, sizeof(*cpu));
+    if ( rows == NULL || cpu == NULL )
+    {
+        fprintf(stderr, "Out of memory\n");
+        goto out;
+    }
+
+    nr_rows = 0;
+    for ( i = v = base = 0; i < cur->num_desc; i++ )
+    {
+        int nr_elems = cur->pcd[i].nr_elems;
+        struct rate *r = &rows[nr_rows];
+
+        for ( j = 0; j < nr_elems; j++ )
+        {
+            r[j].desc = i;
+            r[j].elem = nr_elems > 1 ? j : -1;
+            r[j].total = 0;
+            r[j].cpu = cpu + (size_t)(base + j) * cur->nr_cpus;
+        }
+        base += nr_elems;
+
+        for ( c = 0; c < cur->nr_cpus; c++ )
+            for ( j = 0; j < nr_elems; j++, v++ )
+            {
+                /* Counters wrap at 32 bits. */
+                double d = (uint32_t)(cur->pcv[v] - prev->pcv[v]) / secs;
+
+                r[j].cpu[c] = d;
+                r[j].total += d;
+            }
+
+        /* Only keep the elements which moved. */
+        for ( j = 0; j < nr_elems; j++ )
+            if ( r[j].total > 0 )
+                rows[nr_rows++] = r[j];
+    }
+
+    qsort(rows, nr_rows, sizeof(*rows), compare_rate);
+
+    printf("%-40s %12s", "counter (per second)", "total");
+    if ( percpu )
+        for ( c = 0; c < cur->nr_cpus; c++ )
+        {
+            snprintf(name, sizeof(name), "CPU%d", c);
+            printf("  %10s", name);
+        }
+    printf("\n");
+
+    for ( i = 0; i < nr_rows && (!top || i < top); i++ )
+    {
+        const struct rate *r = &rows[i];
+        const char *desc = cur->pcd[r->desc].name;
+
+        if ( r->elem < 0 )
+            snprintf(name, sizeof(name), "%s", desc);
+        else if ( !strcmp(desc, "hypercalls") )
+            snprintf(name, sizeof(name), "%s %s", desc,
+                     hypercall_str(r->elem));
+        else
+            snprintf(name, sizeof(name), "%s[%d]", desc, r->elem);
+
+        printf("%-40.40s %12.1f", name, r->total);
+        if ( percpu )
+            for ( c = 0; c < cur->nr_cpus; c++ )
+                printf("  %10.1f", r->cpu[c]);
+        printf("\n");
+    }
+    printf("\n");
+
+ out:
+    free(rows);
+    free(cpu);
+}
+
+static int sample_loop(xc_interface *xch, double interval, unsigned int count,
+                       unsigned int top, int percpu)
+{
+    struct sample s[2] = { { 0 } };
+    unsigned int n = 0, i;
+    struct timespec ts = {
+        .tv_sec = interval,
+        .tv_nsec = (interval - (time_t)interval) * 1e9,
+    };
+    int rc = 1;
+
+    if ( take_sample(xch, &s[0]) )
+        goto out;
+
+    for ( i = 1; !count || n < count; i ^= 1 )
+    {
+        nanosleep(&ts, NULL);
+        if ( take_sample(xch, &s[i]) )
+            goto out;
+        print_rates(&s[i ^ 1], &s[i], top, percpu);
+        fflush(stdout);
+        n++;
+    }
+
+    rc = 0;
+
+ out:
+    free(s[0].pcd); free(s[0].pcv);
+    free(s[1].pcd); free(s[1].pcv);
+    return rc;
+}
+
+static void usage(const char *prog)
+{
+    printf("%s: [-r] [-f|-p] [-i interval [-n count] [-t top] [-c]]\n",
+           prog);
+    printf("no args: print digested counters\n");
+    printf("    -f : print full arrays/histograms\n");
+    printf("    -p : print full arrays/histograms in pretty format\n");
+    printf("    -r : reset counters\n");
+    printf("    -i interval : print rates over each interval (in seconds),\n"
+           "                  sorted by rate\n");
+    printf("    -n count    : stop after count intervals\n");
+    printf("    -t top      : only print the top highest rates\n");
+    printf("    -c          : break rates down per CPU\n");
+}
+
 int main(int argc, char *argv[])
 {
-    int              i, j;
+    int              i, j, opt;
     xc_interface    *xc_handle;
     DECLARE_HYPERCALL_BUFFER(xc_perfc_desc_t, pcd);
     DECLARE_HYPERCALL_BUFFER(xc_perfc_val_t, pcv);
     xc_perfc_val_t  *val;
     int num_desc, num_val;
     unsigned int    sum, reset = 0, full = 0, pretty = 0;
+    unsigned int    count = 0, top = 0, percpu = 0;
+    double          interval = 0;
     char hypercall_name[36];
 
-    if ( argc > 1 )
+    while ( (opt = getopt(argc, argv, "fpri:n:t:c")) != -1 )
     {
-        char *p = argv[1];
-        if ( p[0] == '-' )
+        switch ( opt )
         {
-            switch ( p[1] )
-            {
-            case 'f':
-                full = 1;
-                break;
-            case 'p':
-                full = 1;
-                pretty = 1;
-                break;
-            case 'r':
-                reset = 1;
-                break;
-            default:
+        case 'f':
+            full = 1;
+            break;
+        case 'p':
+            full = 1;
+            pretty = 1;
+            break;
+        case 'r':
+            reset = 1;
+            break;
+        case 'i':
+            interval = strtod(optarg, NULL);
+            if ( interval <= 0 )
                 goto error;
-            }
-        }
-        else
-        {
+            break;
+        case 'n':
+            count = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            top = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            percpu = 1;
+            break;
+        default:
         error:
-            printf("%s: [-r]\n", argv[0]);
-            printf("no args: print digested counters\n");
-            printf("    -f : print full arrays/histograms\n");
-            printf("    -p : print full arrays/histograms in pretty format\n");
-            printf("    -r : reset counters\n");
+            usage(argv[0]);
             return 0;
         }
-    }   
+    }
+    if ( optind != argc )
+        goto error;
 
     if ( (xc_handle = xc_interface_open(0,0,0)) == 0 )
     {
@@ -131,6 +383,9 @@ int main(int argc, char *argv[])
         return 0;
     }
 
+    if ( interval )
+        return sample_loop(xc_handle, interval, count, top, percpu);
+
     if ( xc_perfc_query_number(xc_handle, &num_desc, &num_val) != 0 )
     {
         fprintf(stderr, "Error getting number of perf counters: %d (%s)\n",
@@ -0,0 +1,98 @@
+/*
+ * Xen emulation for the HVM internal I/O handler dispatch
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License Version 2 (GPLv2)
+ * as published by the Free Software Foundation.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details. <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <public/hvm/ioreq.h>
+
+typedef int bool_t;
+typedef int spinlock_t;
+typedef uint64_t paddr_t;
+
+#define likely(x)       __builtin_expect(!!(x), 1)
+#define unlikely(x)     __builtin_expect(!!(x), 0)
+
+#define BUG() abort()
+#define BUG_ON(p) do { if ( p ) BUG(); } while ( 0 )
+#define ASSERT(p) BUG_ON(!(p))
+#define ASSERT_UNREACHABLE() BUG()
+
+#define smp_rmb() __asm__ __volatile__ ( "" : : : "memory" )
+#define smp_wmb() __asm__ __volatile__ ( "" : : : "memory" )
+#define read_atomic(p) (*(volatile typeof(*(p)) *)(p))
+#define write_atomic(p, x) (*(volatile typeof(*(p)) *)(p) = (x))
+
+#define spin_lock_init(l) (*(l) = 0)
+#define spin_lock(l) (*(l) = 1)
+#define spin_unlock(l) (*(l) = 0)
+#define spin_is_locked(l) (*(l))
+
+#define X86EMUL_OKAY          0
+#define X86EMUL_UNHANDLEABLE  1
+
+enum hvm_copy_result {
+    HVMCOPY_okay = 0,
+    HVMCOPY_bad_gva_to_gfn,
+    HVMCOPY_bad_gfn_to_mfn,
+    HVMCOPY_unhandleable,
+    HVMCOPY_gfn_paged_out,
+    HVMCOPY_gfn_shared,
+};
+
+struct vcpu;
+struct domain;
+struct page_info;
+struct npfec;
+union vioapic_redir_entry;
+
+#include "io.h"
+
+struct domain {
+    struct {
+        struct {
+            struct hvm_io_handler *io_handler;
+            unsigned int          io_handler_count;
+            struct hvm_io_index   *io_index;
+        } hvm_domain;
+    } arch;
+};
+
+struct vcpu {
+    struct domain *domain;
+    struct {
+        struct {
+            struct {
+                unsigned int mmio_handler;
+            } hvm_io;
+        } hvm_vcpu;
+    } arch;
+};
+
+extern struct vcpu *current;
+
+void domain_crash(struct domain *d);
+
+enum hvm_copy_result hvm_copy_to_guest_phys(
+    paddr_t paddr, void *buf, int size);
+enum hvm_copy_result hvm_copy_from_guest_phys(
+    void *buf, paddr_t paddr, int size);
+
+static inline void sort(void *base, size_t num, size_t size,
+                        int (*cmp)(const void *, const void *),
+                        void (*swap)(void *, void *, int))
+{
+    qsort(base, num, size, cmp);
+}
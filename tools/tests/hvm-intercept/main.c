@@ -0,0 +1,267 @@
+/*
+ * Test and benchmark of the HVM internal I/O handler dispatch
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License Version 2 (GPLv2)
+ * as published by the Free Software Foundation.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details. <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Builds intercept.c from the hypervisor sources against stubs, registers
+ * port and MMIO handlers the way hvm_domain_initialise() and the vCPU
+ * setup do, then
+ *  - checks that hvm_find_io_handler() picks the same handler as offering
+ *    the access to each handler in registration order did, also once
+ *    ports and MMIO ranges have been moved over others, and
+ *  - times both, for the handler which the guest hits most, registered
+ *    last, as the handler count grows.
+ *
+ * Usage: test_hvm_intercept [iterations]
+ */
+
+#include <time.h>
+
+#include "emul.h"
+
+#define MMIO_BASE   0xfe000000UL
+#define MMIO_STRIDE 0x1000UL
+
+static struct domain domain;
+static struct vcpu vcpu0 = { .domain = &domain };
+struct vcpu *current = &vcpu0;
+
+void domain_crash(struct domain *d)
+{
+    fprintf(stderr, "domain crashed\n");
+    exit(1);
+}
+
+enum hvm_copy_result hvm_copy_to_guest_phys(
+    paddr_t paddr, void *buf, int size)
+{
+    return HVMCOPY_okay;
+}
+
+enum hvm_copy_result hvm_copy_from_guest_phys(
+    void *buf, paddr_t paddr, int size)
+{
+    return HVMCOPY_okay;
+}
+
+static int portio(int dir, unsigned int port, unsigned int bytes,
+                  uint32_t *val)
+{
+    return X86EMUL_OKAY;
+}
+
+/* MMIO handlers only get the address, so each needs a check of its own. */
+#define MMIO_CHECK(n)                                                   \
+static int mmio_check_##n(struct vcpu *v, unsigned long addr)           \
+{                                                                       \
+    return addr - (MMIO_BASE + (n) * MMIO_STRIDE) < MMIO_STRIDE;        \
+}
+MMIO_CHECK(0)  MMIO_CHECK(1)  MMIO_CHECK(2)  MMIO_CHECK(3)
+MMIO_CHECK(4)  MMIO_CHECK(5)  MMIO_CHECK(6)  MMIO_CHECK(7)
+MMIO_CHECK(8)  MMIO_CHECK(9)  MMIO_CHECK(10) MMIO_CHECK(11)
+MMIO_CHECK(12) MMIO_CHECK(13) MMIO_CHECK(14) MMIO_CHECK(15)
+
+#define MMIO_OPS(n) { .check = mmio_check_##n }
+static const struct hvm_mmio_ops mmio_ops_n[] = {
+    MMIO_OPS(0),  MMIO_OPS(1),  MMIO_OPS(2),  MMIO_OPS(3),
+    MMIO_OPS(4),  MMIO_OPS(5),  MMIO_OPS(6),  MMIO_OPS(7),
+    MMIO_OPS(8),  MMIO_OPS(9),  MMIO_OPS(10), MMIO_OPS(11),
+    MMIO_OPS(12), MMIO_OPS(13), MMIO_OPS(14), MMIO_OPS(15),
+};
+
+/* Like the vLAPIC: a page wherever the guest puts it. */
+static unsigned long movable_base = MMIO_BASE + 16 * MMIO_STRIDE;
+
+static int movable_check(struct vcpu *v, unsigned long addr)
+{
+    return addr - movable_base < MMIO_STRIDE;
+}
+
+static const struct hvm_mmio_ops movable_ops = { .check = movable_check };
+
+/* Like the passthrough port handler, with no ports passed through. */
+static bool_t dpci_accept(const struct hvm_io_handler *handler,
+                          const ioreq_t *p)
+{
+    return 0;
+}
+
+static const struct hvm_io_ops dpci_ops = { .accept = dpci_accept };
+
+/* Like the VGA memory handler. */
+static bool_t vga_accept(const struct hvm_io_handler *handler,
+                         const ioreq_t *p)
+{
+    return hvm_mmio_first_byte(p) >= 0xa0000 &&
+           hvm_mmio_last_byte(p) < 0xc0000;
+}
+
+static const struct hvm_io_ops vga_ops = { .accept = vga_accept };
+
+static void setup(unsigned int nr_pio, unsigned int nr_mmio, int catch_all)
+{
+    struct hvm_io_handler *handler;
+    unsigned int i;
+
+    free(domain.arch.hvm_domain.io_handler);
+    free(domain.arch.hvm_domain.io_index);
+    memset(&domain, 0, sizeof(domain));
+    memset(&vcpu0.arch, 0, sizeof(vcpu0.arch));
+
+    domain.arch.hvm_domain.io_handler =
+        calloc(NR_IO_HANDLERS, sizeof(struct hvm_io_handler));
+    domain.arch.hvm_domain.io_index = calloc(1, sizeof(struct hvm_io_index));
+
+    handler = hvm_next_io_handler(&domain, IOREQ_TYPE_PIO);
+    handler->ops = &dpci_ops;
+
+    if ( catch_all )
+        register_portio_handler(&domain, 0x100, 0x100, portio);
+
+    handler = hvm_next_io_handler(&domain, IOREQ_TYPE_COPY);
+    handler->ops = &vga_ops;
+
+    for ( i = 0; i < nr_pio || i < nr_mmio; i++ )
+    {
+        if ( i < nr_pio )
+            register_portio_handler(&domain, 0x20 + i * 0x18, 4 + (i & 3),
+                                    portio);
+        if ( i < nr_mmio )
+            register_mmio_handler(&domain, &mmio_ops_n[i]);
+    }
+}
+
+/* What hvm_find_io_handler() used to do. */
+static const struct hvm_io_handler *linear_find(ioreq_t *p)
+{
+    struct domain *d = current->domain;
+    unsigned int i;
+
+    for ( i = 0; i < d->arch.hvm_domain.io_handler_count; i++ )
+    {
+        const struct hvm_io_handler *handler =
+            &d->arch.hvm_domain.io_handler[i];
+
+        if ( handler->type != p->type )
+            continue;
+
+        if ( handler->ops->accept(handler, p) )
+            return handler;
+    }
+
+    return NULL;
+}
+
+static unsigned int check(void)
+{
+    unsigned int i, errors = 0;
+    ioreq_t p = { .count = 1 };
+
+    for ( i = 0; i < 200000; i++ )
+    {
+        p.size = 1 << (rand() % 3);
+        if ( rand() & 1 )
+        {
+            p.type = IOREQ_TYPE_PIO;
+            p.addr = rand() % 0x400;
+        }
+        else
+        {
+            p.type = IOREQ_TYPE_COPY;
+            p.addr = rand() & 1 ? 0xa0000 + rand() % 0x30000 :
+                     MMIO_BASE - 8 + rand() % (17 * MMIO_STRIDE);
+            /* Accesses straddling two handlers crash the domain. */
+            p.addr &= ~(p.size - 1UL);
+        }
+
+        if ( hvm_find_io_handler(&p) != linear_find(&p) )
+        {
+            if ( errors++ < 10 )
+                printf("mismatch: type %u addr %#lx size %u\n",
+                       p.type, (unsigned long)p.addr, p.size);
+        }
+    }
+
+    return errors;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double bench(const struct hvm_io_handler *(*find)(ioreq_t *),
+                    ioreq_t *p, unsigned long iterations)
+{
+    unsigned long i;
+    double start = now();
+
+    for ( i = 0; i < iterations; i++ )
+        if ( !find(p) )
+            abort();
+
+    return (now() - start) / iterations;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 5000000;
+    static const unsigned int counts[] = { 1, 2, 4, 8, 12, 15 };
+    unsigned int i, errors = 0;
+
+    setup(15, 15, 0);
+    errors += check();
+    setup(14, 14, 1);
+    errors += check();
+    relocate_portio_handler(&domain, 0x20, 0x300, 4);
+    errors += check();
+    register_mmio_handler(&domain, &movable_ops);
+    errors += check();
+    /* Half over the last handler registered before it, half clear. */
+    movable_base = MMIO_BASE + 13 * MMIO_STRIDE + MMIO_STRIDE / 2;
+    relocate_mmio_handler(&domain, &movable_ops);
+    errors += check();
+    setup(3, 0, 0);
+    errors += check();
+
+    printf("dispatch correctness: %s\n", errors ? "FAILED" : "ok");
+    if ( errors )
+        return 1;
+
+    printf("%9s %14s %14s %14s %14s\n", "handlers",
+           "pio linear", "pio indexed", "mmio linear", "mmio indexed");
+    for ( i = 0; i < sizeof(counts) / sizeof(counts[0]); i++ )
+    {
+        unsigned int n = counts[i];
+        ioreq_t pio = {
+            .type = IOREQ_TYPE_PIO, .size = 4, .count = 1,
+            .addr = 0x20 + (n - 1) * 0x18,
+        };
+        ioreq_t mmio = {
+            .type = IOREQ_TYPE_COPY, .size = 4, .count = 1,
+            .addr = MMIO_BASE + (n - 1) * MMIO_STRIDE + 0x30,
+        };
+
+        setup(n, n, 0);
+        printf("%9u %11.1f ns %11.1f ns %11.1f ns %11.1f ns\n",
+               domain.arch.hvm_domain.io_handler_count,
+               bench(linear_find, &pio, iterations),
+               bench(hvm_find_io_handler, &pio, iterations),
+               bench(linear_find, &mmio, iterations),
+               bench(hvm_find_io_handler, &mmio, iterations));
+    }
+
+    return 0;
+}
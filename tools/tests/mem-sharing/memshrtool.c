@@ -26,6 +26,12 @@ static int usage(const char* prog)
     printf("                          - Share two pages.\n");
     printf("  range <source-domid> <destination-domid> <first-gfn> <last-gfn>\n");
     printf("                          - Share pages between domains in a range.\n");
+    printf("  bulk <source-domid> <destination-domid> <source-gfn>:<gfn> [...]\n");
+    printf("                          - Share many gfn pairs in one hypercall.\n");
+    printf("  fork <parent-domid> [<domid>]\n");
+    printf("                          - Fork a paused domain, into a new empty domain\n");
+    printf("                            unless one is given.\n");
+    printf("  fork-reset <domid>      - Reset a fork to the state of its parent.\n");
     printf("  unshare <domid> <gfn>   - Unshare a page by grabbing a writable map.\n");
     printf("  add-to-physmap <domid> <gfn> <source> <source-gfn> <source-handle>\n");
     printf("                          - Populate a page in a domain with a shared page.\n");
@@ -203,5 +209,101 @@ int main(int argc, const char** argv)
             return rc;
         }
     }
+    else if( !strcasecmp(cmd, "fork") )
+    {
+        domid_t pdomid;
+        uint32_t domid;
+
+        if ( argc != 3 && argc != 4 )
+            return usage(argv[0]);
+
+        pdomid = strtol(argv[2], NULL, 0);
+
+        if ( argc == 4 )
+            domid = strtol(argv[3], NULL, 0);
+        else
+        {
+            xc_dominfo_t info;
+            xc_domain_configuration_t config = {
+                .emulation_flags = XEN_X86_EMU_ALL,
+            };
+
+            if ( xc_domain_getinfo(xch, pdomid, 1, &info) != 1 ||
+                 info.domid != pdomid )
+            {
+                printf("error getting info for domain %u\n", pdomid);
+                return 1;
+            }
+
+            domid = 0;
+            R(xc_domain_create(xch, info.ssidref, info.handle,
+                               XEN_DOMCTL_CDF_hvm_guest | XEN_DOMCTL_CDF_hap,
+                               &domid, &config));
+            R(xc_domain_max_vcpus(xch, domid, info.max_vcpu_id + 1));
+            R(xc_domain_setmaxmem(xch, domid, info.max_memkb));
+        }
+
+        R(xc_memshr_fork(xch, pdomid, domid));
+        printf("fork = %u\n", domid);
+    }
+    else if( !strcasecmp(cmd, "fork-reset") )
+    {
+        domid_t domid;
+
+        if ( argc != 3 )
+            return usage(argv[0]);
+
+        domid = strtol(argv[2], NULL, 0);
+        R(xc_memshr_fork_reset(xch, domid));
+    }
+    else if( !strcasecmp(cmd, "bulk") )
+    {
+        domid_t sdomid, cdomid;
+        int rc, i;
+        uint32_t nr, nr_shared = 0;
+        uint64_t *sgfns, *cgfns;
+
+        if ( argc < 5 )
+            return usage(argv[0]);
+
+        sdomid = strtol(argv[2], NULL, 0);
+        cdomid = strtol(argv[3], NULL, 0);
+        nr = argc - 4;
+
+        sgfns = calloc(nr, sizeof(*sgfns));
+        cgfns = calloc(nr, sizeof(*cgfns));
+        if ( !sgfns || !cgfns )
+        {
+            free(sgfns);
+            free(cgfns);
+            printf("error allocating gfn lists: %s\n", strerror(errno));
+            return 1;
+        }
+
+        for ( i = 0; i < nr; i++ )
+        {
+            char *sep;
+
+            sgfns[i] = strtoul(argv[i + 4], &sep, 0);
+            if ( *sep != ':' )
+            {
+                free(sgfns);
+                free(cgfns);
+                return usage(argv[0]);
+            }
+            cgfns[i] = strtoul(sep + 1, NULL, 0);
+        }
+
+        rc = xc_memshr_bulk_share(xch, sdomid, cdomid, sgfns, cgfns, nr,
+                                  &nr_shared);
+        free(sgfns);
+        free(cgfns);
+        if ( rc < 0 )
+        {
+            printf("error executing xc_memshr_bulk_share: %s\n", strerror(errno));
+            return rc;
+        }
+        printf("shared %u of %u pairs\n", nr_shared, nr);
+    }
     return 0;
 }
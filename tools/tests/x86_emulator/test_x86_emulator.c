@@ -232,6 +232,72 @@ static struct x86_emulate_ops emulops = {
     .get_fpu    = get_fpu,
 };
 
+/*
+ * For comparing the memory operands of cached and fresh decodes, in any
+ * mode: instructions are fetched from replay_insn as if at REPLAY_EIP, and
+ * memory accesses are only recorded.
+ */
+#define REPLAY_EIP 0x1000
+static const uint8_t *replay_insn;
+static unsigned long replay_addr;
+
+static int replay_fetch(
+    unsigned int seg,
+    unsigned long offset,
+    void *p_data,
+    unsigned int bytes,
+    struct x86_emulate_ctxt *ctxt)
+{
+    memcpy(p_data, replay_insn + offset - REPLAY_EIP, bytes);
+    return X86EMUL_OKAY;
+}
+
+static int replay_read(
+    unsigned int seg,
+    unsigned long offset,
+    void *p_data,
+    unsigned int bytes,
+    struct x86_emulate_ctxt *ctxt)
+{
+    replay_addr = offset;
+    memset(p_data, 0xa5, bytes);
+    return X86EMUL_OKAY;
+}
+
+static int replay_write(
+    unsigned int seg,
+    unsigned long offset,
+    void *p_data,
+    unsigned int bytes,
+    struct x86_emulate_ctxt *ctxt)
+{
+    replay_addr = offset;
+    return X86EMUL_OKAY;
+}
+
+static const struct {
+    uint8_t insn[10];
+    unsigned int len;
+    unsigned int addr_size;
+    const char *name;
+} replays[] = {
+    { { 0x8b, 0x42, 0x02 }, 3, 16, "mov 2(%bp,%si),%ax" },
+    { { 0x8b, 0x47, 0x7f }, 3, 16, "mov 0x7f(%bx),%ax" },
+    { { 0x8b, 0x1e, 0x34, 0x12 }, 4, 16, "mov 0x1234,%bx" },
+    { { 0x66, 0x89, 0x00 }, 3, 16, "mov %eax,(%bx,%si)" },
+    { { 0x8b, 0x44, 0x4d, 0xfc }, 4, 32, "mov -4(%ebp,%ecx,2),%eax" },
+    { { 0x67, 0x8b, 0x00 }, 3, 32, "mov (%bx,%si),%eax" },
+    { { 0x8f, 0x44, 0x24, 0x08 }, 4, 32, "pop 8(%esp)" },
+#ifdef __x86_64__
+    { { 0x8b, 0x04, 0xb3 }, 3, 64, "mov (%rbx,%rsi,4),%eax" },
+    { { 0x42, 0x8b, 0x44, 0x2d, 0x08 }, 5, 64, "mov 8(%rbp,%r13),%eax" },
+    { { 0x8b, 0x05, 0x10, 0x00, 0x00, 0x00 }, 6, 64, "mov 0x10(%rip),%eax" },
+    { { 0x67, 0x89, 0x44, 0x8b, 0x10 }, 5, 64, "mov %eax,0x10(%ebx,%ecx,4)" },
+    { { 0x8b, 0x04, 0x25, 0x00, 0x30, 0x00, 0x00 }, 7, 64, "mov 0x3000,%eax" },
+    { { 0xc7, 0x07, 0x01, 0x02, 0x03, 0x04 }, 6, 64, "movl $0x4030201,(%rdi)" },
+#endif
+};
+
 int main(int argc, char **argv)
 {
     struct x86_emulate_ctxt ctxt;
@@ -1407,6 +1473,77 @@ int main(int argc, char **argv)
     else
         printf("skipped\n");
 
+    printf("%-40s", "Testing cached decode replays...");
+    for ( j = 0; j < sizeof(replays) / sizeof(*replays); j++ )
+    {
+        struct x86_emulate_ops replay_ops = emulops;
+        struct x86_emulate_state *cache = x86_emulate_alloc_state();
+        struct cpu_user_regs cached_regs;
+        unsigned long addr;
+        unsigned int len = 0;
+
+        if ( !cache )
+            goto fail;
+
+        replay_ops.insn_fetch = replay_fetch;
+        replay_ops.read = replay_read;
+        replay_ops.write = replay_write;
+        replay_insn = replays[j].insn;
+        ctxt.addr_size = ctxt.sp_size = replays[j].addr_size;
+
+        /*
+         * Decode once, then replay the decode with the base and index
+         * registers (and the upper bits truncated away) changing, against
+         * fresh decodes.
+         */
+        for ( i = 0; i < 64; i++ )
+        {
+            unsigned long v = (i + 1) * (~0UL / 0x3fd);
+
+            memset(&regs, 0, sizeof(regs));
+            regs.eax = v;
+            regs.ebx = v * 3;
+            regs.ecx = v * 5 + i;
+            regs.edx = v * 7;
+            regs.esi = v * 11 - i;
+            regs.edi = v * 13;
+            regs.ebp = v * 17;
+            regs.esp = v * 19;
+#ifdef __x86_64__
+            regs.r13 = v * 23;
+#endif
+            regs.eip = REPLAY_EIP;
+            regs.eflags = 2;
+            cached_regs = regs;
+
+            ctxt.regs = &regs;
+            replay_addr = ~0UL;
+            rc = x86_emulate(&ctxt, &replay_ops);
+            if ( rc != X86EMUL_OKAY )
+                break;
+            addr = replay_addr;
+
+            ctxt.regs = &cached_regs;
+            replay_addr = ~0UL;
+            rc = x86_emulate_cached(&ctxt, &replay_ops, cache, &len);
+            if ( rc != X86EMUL_OKAY || len != replays[j].len ||
+                 replay_addr != addr ||
+                 cached_regs.eip != REPLAY_EIP + replays[j].len ||
+                 memcmp(&cached_regs, &regs, sizeof(regs)) )
+                break;
+        }
+
+        free(cache);
+        ctxt.regs = &regs;
+        if ( i < 64 )
+        {
+            printf("%s: ", replays[j].name);
+            goto fail;
+        }
+    }
+    ctxt.addr_size = ctxt.sp_size = 8 * sizeof(void *);
+    printf("okay\n");
+
     for ( j = 0; j < sizeof(blobs) / sizeof(*blobs); j++ )
     {
         memcpy(res, blobs[j].code, blobs[j].size);
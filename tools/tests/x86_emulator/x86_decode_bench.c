@@ -0,0 +1,199 @@
+/*
+ * Decode throughput benchmark for x86_emulate.
+ *
+ * Emulates a mix of the instructions emulation heavy guests keep hitting
+ * (MMIO accesses, shadow page table writes, real mode code), once through
+ * x86_emulate() and once through x86_emulate_cached() with the decodes
+ * kept, and reports the time per instruction of each: the difference is
+ * what fetching and decoding the instruction costs.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <xen/xen.h>
+
+#include "x86_emulate/x86_emulate.h"
+
+static const struct insn {
+    const char *name;
+    unsigned int mode;
+    unsigned int len;
+    uint8_t bytes[15];
+} insns[] = {
+    { "mov %eax,0x10(%rbx,%rcx,4)", 64, 4, { 0x89, 0x44, 0x8b, 0x10 } },
+    { "mov (%rdi),%eax",            64, 2, { 0x8b, 0x07 } },
+    { "mov %rax,(%rdi)",            64, 3, { 0x48, 0x89, 0x07 } },
+    { "movl $imm32,(%rdi)",         64, 6, { 0xc7, 0x07, 0x01, 0x02, 0x03,
+                                             0x04 } },
+    { "mov 0x100(%rip),%eax",       64, 6, { 0x8b, 0x05, 0x00, 0x01 } },
+    { "movzwl (%rsi),%eax",         64, 3, { 0x0f, 0xb7, 0x06 } },
+    { "testl $imm32,(%rdi)",        64, 6, { 0xf7, 0x07, 0x00, 0x01 } },
+    { "incl (%rdi)",                64, 2, { 0xff, 0x07 } },
+    { "orb $imm8,8(%rdi)",          64, 4, { 0x80, 0x4f, 0x08, 0x40 } },
+    { "mov %eax,%fs:(%rbx)",        64, 3, { 0x64, 0x89, 0x03 } },
+    { "mov -4(%ebp,%esi,2),%eax",   32, 4, { 0x8b, 0x44, 0x75, 0xfc } },
+    { "movzbl (%ebx),%eax",         32, 3, { 0x0f, 0xb6, 0x03 } },
+    { "mov 2(%bp,%si),%ax",         16, 3, { 0x8b, 0x42, 0x02 } },
+    { "mov %al,(%bx)",              16, 2, { 0x88, 0x07 } },
+    { "mov %eax,(%bx,%si)",         16, 3, { 0x66, 0x89, 0x00 } },
+};
+
+static unsigned char *code;
+/*
+ * Data accesses wrap within a 64k buffer.  The padding past its end takes
+ * an access which starts near the end and straddles it.
+ */
+#define MEM_SIZE 0x10000
+static unsigned char mem[MEM_SIZE + 64];
+
+static int read(
+    enum x86_segment seg,
+    unsigned long offset,
+    void *p_data,
+    unsigned int bytes,
+    struct x86_emulate_ctxt *ctxt)
+{
+    memcpy(p_data, &mem[offset & (MEM_SIZE - 1)], bytes);
+    return X86EMUL_OKAY;
+}
+
+static int fetch(
+    enum x86_segment seg,
+    unsigned long offset,
+    void *p_data,
+    unsigned int bytes,
+    struct x86_emulate_ctxt *ctxt)
+{
+    memcpy(p_data, &code[offset], bytes);
+    return X86EMUL_OKAY;
+}
+
+static int write(
+    enum x86_segment seg,
+    unsigned long offset,
+    void *p_data,
+    unsigned int bytes,
+    struct x86_emulate_ctxt *ctxt)
+{
+    memcpy(&mem[offset & (MEM_SIZE - 1)], p_data, bytes);
+    return X86EMUL_OKAY;
+}
+
+static int read_cr(
+    unsigned int reg,
+    unsigned long *val,
+    struct x86_emulate_ctxt *ctxt)
+{
+    /* Protected mode, for the emulator's mode checks. */
+    *val = reg ? 0 : 1;
+    return X86EMUL_OKAY;
+}
+
+static const struct x86_emulate_ops emulops = {
+    .read       = read,
+    .insn_fetch = fetch,
+    .write      = write,
+    .read_cr    = read_cr,
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Time per emulated instruction in ns, with or without decode caching:
+ * the best of @rounds batches, so as to filter out interference.
+ */
+#define BATCH 1000
+
+static double run(const struct insn *insn, unsigned int rounds, bool cached)
+{
+    struct cpu_user_regs regs;
+    struct x86_emulate_ctxt ctxt = {
+        .regs = &regs,
+        .addr_size = insn->mode,
+        .sp_size = insn->mode,
+    };
+    struct x86_emulate_state *cache = x86_emulate_alloc_state();
+    unsigned int len = 0, i, r;
+    double t, best = 0;
+
+    if ( !cache )
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    memset(code, 0x90, 16);
+    memcpy(code, insn->bytes, insn->len);
+
+    for ( r = 0; r < rounds; r++ )
+    {
+        t = now();
+        for ( i = 0; i < BATCH; i++ )
+        {
+            memset(&regs, 0, sizeof(regs));
+            regs.eflags = 2;
+            regs.ebx = 0x100;
+            regs.ecx = 4;
+            regs.esi = 0x200;
+            regs.edi = 0x300 + (i & 0x3c);
+            regs.ebp = 0x400;
+
+            if ( (cached ? x86_emulate_cached(&ctxt, &emulops, cache, &len)
+                         : x86_emulate(&ctxt, &emulops)) != X86EMUL_OKAY ||
+                 regs.eip != insn->len )
+            {
+                fprintf(stderr, "%s: emulation failed\n", insn->name);
+                exit(1);
+            }
+        }
+        t = now() - t;
+        if ( !r || t < best )
+            best = t;
+    }
+
+    free(cache);
+
+    return best / BATCH;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int rounds = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000;
+    double full = 0, exec = 0;
+    unsigned int i;
+
+    code = calloc(1, 64);
+    if ( !code )
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    printf("%-30s %10s %10s %10s\n", "instruction", "emulate", "cached",
+           "decode");
+    for ( i = 0; i < sizeof(insns) / sizeof(insns[0]); i++ )
+    {
+        double t0 = run(&insns[i], rounds, false);
+        double t1 = run(&insns[i], rounds, true);
+
+        printf("%-30s %8.1fns %8.1fns %8.1fns\n", insns[i].name, t0, t1,
+               t0 - t1);
+        full += t0;
+        exec += t1;
+    }
+    printf("%-30s %8.1fns %8.1fns %8.1fns\n", "mean", full / i, exec / i,
+           (full - exec) / i);
+
+    return 0;
+}
@@ -16,6 +16,7 @@ typedef bool bool_t;
 #define EFER_LMA       (1 << 10)
 
 #define BUG() abort()
+#define xzalloc(type) ((type *)calloc(1, sizeof(type)))
 #define ASSERT assert
 #define ASSERT_UNREACHABLE() assert(!__LINE__)
 
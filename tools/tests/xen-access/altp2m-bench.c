@@ -0,0 +1,259 @@
+/*
+ * altp2m-bench.c
+ *
+ * Measures the cost of propagating host p2m changes to altp2m views.
+ *
+ * Creates a number of views which all map a range of gfns, then repeatedly
+ * changes the access permissions of that range in the host p2m, and reports
+ * the propagation time and the INVEPTs it caused per change, as counted by
+ * the hypervisor's performance counters (needs a perfc=y build).
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <xenctrl.h>
+
+#define ERROR(a, b...) fprintf(stderr, a "\n", ## b)
+#define PERROR(a, b...) fprintf(stderr, a ": %s\n", ## b, strerror(errno))
+
+/* From xen/include/asm-x86/domain.h */
+#define MAX_ALTP2M 10
+
+/* Counters of interest, by their description in asm-x86/perfc_defn.h. */
+static const char *const counter_names[] = {
+    "altp2m host p2m changes propagated",
+    "altp2m propagation time (ns)",
+    "altp2m view entries invalidated",
+    "altp2m view entries updated",
+    "altp2m propagation TLB flushes",
+    "INVEPT single context",
+    "INVEPT all contexts",
+};
+#define NR_COUNTERS (sizeof(counter_names) / sizeof(counter_names[0]))
+
+enum {
+    PROPAGATE,
+    PROPAGATE_NS,
+    PROPAGATE_LAZY,
+    PROPAGATE_EAGER,
+    PROPAGATE_FLUSH,
+    INVEPT_SINGLE,
+    INVEPT_ALL,
+};
+
+static int read_counters(xc_interface *xch, uint64_t *counters)
+{
+    DECLARE_HYPERCALL_BUFFER(xc_perfc_desc_t, pcd);
+    DECLARE_HYPERCALL_BUFFER(xc_perfc_val_t, pcv);
+    xc_perfc_val_t *val;
+    int num_desc, num_val, i, j, rc = -1;
+    unsigned int c;
+
+    memset(counters, 0, NR_COUNTERS * sizeof(*counters));
+
+    if ( xc_perfc_query_number(xch, &num_desc, &num_val) )
+    {
+        PERROR("Failed to get number of perf counters");
+        return -1;
+    }
+
+    pcd = xc_hypercall_buffer_alloc(xch, pcd, sizeof(*pcd) * num_desc);
+    pcv = xc_hypercall_buffer_alloc(xch, pcv, sizeof(*pcv) * num_val);
+    if ( !pcd || !pcv )
+    {
+        PERROR("Failed to allocate perf counter buffers");
+        goto out;
+    }
+
+    if ( xc_perfc_query(xch, HYPERCALL_BUFFER(pcd), HYPERCALL_BUFFER(pcv)) )
+    {
+        PERROR("Failed to read perf counters");
+        goto out;
+    }
+
+    val = pcv;
+    for ( i = 0; i < num_desc; i++ )
+    {
+        for ( c = 0; c < NR_COUNTERS; c++ )
+            if ( !strcmp(pcd[i].name, counter_names[c]) )
+                for ( j = 0; j < pcd[i].nr_vals; j++ )
+                    counters[c] += val[j];
+        val += pcd[i].nr_vals;
+    }
+
+    rc = 0;
+
+ out:
+    xc_hypercall_buffer_free(xch, pcd);
+    xc_hypercall_buffer_free(xch, pcv);
+    return rc;
+}
+
+static void usage(const char *progname)
+{
+    fprintf(stderr,
+            "Usage: %s <domain_id> <views> <iterations> [<first gfn> [<nr gfns>]]\n"
+            "\n"
+            "Creates <views> altp2m views mapping <nr gfns> (default 1) gfns\n"
+            "from <first gfn> (default 0x100), and toggles the host p2m\n"
+            "access of the range <iterations> times.\n", progname);
+}
+
+int main(int argc, char *argv[])
+{
+    xc_interface *xch;
+    domid_t domid;
+    unsigned int nr_views, iterations, nr_gfns = 1, i, v, created = 0;
+    uint64_t first_gfn = 0x100;
+    uint16_t views[MAX_ALTP2M];
+    uint64_t counters[NR_COUNTERS];
+    struct timespec t0, t1;
+    uint64_t wall_ns, changes;
+    int rc = 1;
+
+    if ( argc < 4 || argc > 6 )
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    domid = atoi(argv[1]);
+    nr_views = strtoul(argv[2], NULL, 0);
+    iterations = strtoul(argv[3], NULL, 0);
+    if ( argc > 4 )
+        first_gfn = strtoull(argv[4], NULL, 0);
+    if ( argc > 5 )
+        nr_gfns = strtoul(argv[5], NULL, 0);
+
+    /* View 0 is the host p2m. */
+    if ( !nr_views || nr_views >= MAX_ALTP2M || !iterations || !nr_gfns )
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    if ( !xch )
+    {
+        PERROR("Failed to open xc interface");
+        return 1;
+    }
+
+    if ( xc_altp2m_set_domain_state(xch, domid, 1) )
+    {
+        PERROR("Failed to enable altp2m on domain %u", domid);
+        goto out;
+    }
+
+    for ( ; created < nr_views; created++ )
+    {
+        if ( xc_altp2m_create_view(xch, domid, XENMEM_access_rwx,
+                                   &views[created]) )
+        {
+            PERROR("Failed to create view %u", created);
+            goto out;
+        }
+    }
+
+    if ( xc_perfc_reset(xch) )
+    {
+        PERROR("Failed to reset perf counters");
+        goto out;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for ( i = 0; i < iterations; i++ )
+    {
+        xenmem_access_t access = (i & 1) ? XENMEM_access_rwx
+                                         : XENMEM_access_rw;
+        unsigned int g;
+
+        /* (Re)populate the range in every view, so that there's work. */
+        for ( v = 0; v < nr_views; v++ )
+            for ( g = 0; g < nr_gfns; g++ )
+                if ( xc_altp2m_set_mem_access(xch, domid, views[v],
+                                              first_gfn + g,
+                                              XENMEM_access_rwx) )
+                {
+                    PERROR("Failed to populate gfn %#"PRIx64" in view %u",
+                           first_gfn + g, views[v]);
+                    goto out;
+                }
+
+        if ( xc_set_mem_access(xch, domid, access, first_gfn, nr_gfns) )
+        {
+            PERROR("Failed to change host p2m access");
+            goto out;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if ( read_counters(xch, counters) )
+        goto out;
+
+    wall_ns = (t1.tv_sec - t0.tv_sec) * 1000000000ULL +
+              t1.tv_nsec - t0.tv_nsec;
+    changes = counters[PROPAGATE];
+
+    printf("views: %u, iterations: %u, gfns: %u, wall time: %"PRIu64" ms\n",
+           nr_views, iterations, nr_gfns, wall_ns / 1000000);
+    printf("host p2m changes propagated: %"PRIu64"\n", changes);
+    if ( !changes )
+    {
+        ERROR("No propagations counted: is Xen built with perfc=y?");
+        goto out;
+    }
+
+    printf("per change: %"PRIu64" ns propagating, %.2f INVEPTs "
+           "(%"PRIu64" single, %"PRIu64" all), %.2f flushes\n",
+           counters[PROPAGATE_NS] / changes,
+           (double)(counters[INVEPT_SINGLE] + counters[INVEPT_ALL]) / changes,
+           counters[INVEPT_SINGLE], counters[INVEPT_ALL],
+           (double)counters[PROPAGATE_FLUSH] / changes);
+    printf("view entries: %"PRIu64" invalidated, %"PRIu64" updated\n",
+           counters[PROPAGATE_LAZY], counters[PROPAGATE_EAGER]);
+
+    rc = 0;
+
+ out:
+    while ( created-- )
+        xc_altp2m_destroy_view(xch, domid, views[created]);
+    xc_altp2m_set_domain_state(xch, domid, 0);
+    xc_interface_close(xch);
+
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -64,6 +64,7 @@ typedef struct vm_event {
     vm_event_back_ring_t back_ring;
     uint32_t evtchn_port;
     void *ring_page;
+    unsigned int nr_frames;
 } vm_event_t;
 
 typedef struct xenaccess {
@@ -77,6 +78,11 @@ typedef struct xenaccess {
 static int interrupted;
 bool evtchn_bind = 0, evtchn_open = 0, mem_access_enable = 0;
 
+/* Benchmark mode: count events instead of logging each one. */
+static bool benchmark;
+
+#define EVENT_LOG(a...) do { if ( !benchmark ) printf(a); } while (0)
+
 static void close_handler(int sig)
 {
     interrupted = sig;
@@ -132,7 +138,8 @@ int xenaccess_teardown(xc_interface *xch, xenaccess_t *xenaccess)
 
     /* Tear down domain xenaccess in Xen */
     if ( xenaccess->vm_event.ring_page )
-        munmap(xenaccess->vm_event.ring_page, XC_PAGE_SIZE);
+        munmap(xenaccess->vm_event.ring_page,
+               xenaccess->vm_event.nr_frames * XC_PAGE_SIZE);
 
     if ( mem_access_enable )
     {
@@ -182,7 +189,8 @@ int xenaccess_teardown(xc_interface *xch, xenaccess_t *xenaccess)
     return 0;
 }
 
-xenaccess_t *xenaccess_init(xc_interface **xch_r, domid_t domain_id)
+xenaccess_t *xenaccess_init(xc_interface **xch_r, domid_t domain_id,
+                            unsigned int nr_frames)
 {
     xenaccess_t *xenaccess = 0;
     xc_interface *xch;
@@ -206,10 +214,12 @@ xenaccess_t *xenaccess_init(xc_interface **xch_r, domid_t domain_id)
     xenaccess->vm_event.domain_id = domain_id;
 
     /* Enable mem_access */
+    xenaccess->vm_event.nr_frames = nr_frames;
     xenaccess->vm_event.ring_page =
-            xc_monitor_enable(xenaccess->xc_handle,
-                              xenaccess->vm_event.domain_id,
-                              &xenaccess->vm_event.evtchn_port);
+            xc_monitor_enable_frames(xenaccess->xc_handle,
+                                     xenaccess->vm_event.domain_id,
+                                     nr_frames,
+                                     &xenaccess->vm_event.evtchn_port);
     if ( xenaccess->vm_event.ring_page == NULL )
     {
         switch ( errno ) {
@@ -252,7 +262,10 @@ xenaccess_t *xenaccess_init(xc_interface **xch_r, domid_t domain_id)
     SHARED_RING_INIT((vm_event_sring_t *)xenaccess->vm_event.ring_page);
     BACK_RING_INIT(&xenaccess->vm_event.back_ring,
                    (vm_event_sring_t *)xenaccess->vm_event.ring_page,
-                   XC_PAGE_SIZE);
+                   nr_frames * XC_PAGE_SIZE);
+
+    DPRINTF("ring: %u pages, %u slots\n", nr_frames,
+            RING_SIZE(&xenaccess->vm_event.back_ring));
 
     /* Get max_gpfn */
     rc = xc_domain_maximum_gpfn(xenaccess->xc_handle,
@@ -315,6 +328,9 @@ static void get_request(vm_event_t *vm_event, vm_event_request_t *req)
 
 /*
  * Note that this function is not thread safe.
+ *
+ * Responses are only queued here; they are made visible to Xen in one go
+ * by RING_PUSH_RESPONSES() once the pending requests have been drained.
  */
 static void put_response(vm_event_t *vm_event, vm_event_response_t *rsp)
 {
@@ -330,12 +346,20 @@ static void put_response(vm_event_t *vm_event, vm_event_response_t *rsp)
 
     /* Update ring */
     back_ring->rsp_prod_pvt = rsp_prod;
-    RING_PUSH_RESPONSES(back_ring);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
 void usage(char* progname)
 {
-    fprintf(stderr, "Usage: %s [-m] <domain_id> write|exec", progname);
+    fprintf(stderr, "Usage: %s [-m] [-b] [-r <pages>] <domain_id> write|exec",
+            progname);
 #if defined(__i386__) || defined(__x86_64__)
             fprintf(stderr, "|breakpoint|altp2m_write|altp2m_exec|debug|cpuid");
 #elif defined(__arm__) || defined(__aarch64__)
@@ -345,7 +369,10 @@ void usage(char* progname)
             "\n"
             "Logs first page writes, execs, or breakpoint traps that occur on the domain.\n"
             "\n"
-            "-m requires this program to run, or else the domain may pause\n");
+            "-m requires this program to run, or else the domain may pause\n"
+            "-b benchmark: report events handled per second instead of logging them\n"
+            "-r use a vm_event ring of <pages> pages (default 1, max %u)\n",
+            XEN_VM_EVENT_MAX_RING_FRAMES);
 }
 
 int main(int argc, char *argv[])
@@ -369,15 +396,30 @@ int main(int argc, char *argv[])
     int debug = 0;
     int cpuid = 0;
     uint16_t altp2m_view_id = 0;
+    unsigned int nr_frames = 1;
+    uint64_t nr_events = 0, total_events = 0, start_ns, last_ns;
 
     char* progname = argv[0];
     argv++;
     argc--;
 
-    if ( argc == 3 && argv[0][0] == '-' )
+    while ( argc > 2 && argv[0][0] == '-' )
     {
         if ( !strcmp(argv[0], "-m") )
             required = 1;
+        else if ( !strcmp(argv[0], "-b") )
+            benchmark = 1;
+        else if ( !strcmp(argv[0], "-r") && argc > 3 )
+        {
+            nr_frames = strtoul(argv[1], NULL, 0);
+            if ( nr_frames == 0 || nr_frames > XEN_VM_EVENT_MAX_RING_FRAMES )
+            {
+                usage(progname);
+                return -1;
+            }
+            argv++;
+            argc--;
+        }
         else
         {
             usage(progname);
@@ -446,7 +488,7 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    xenaccess = xenaccess_init(&xch, domain_id);
+    xenaccess = xenaccess_init(&xch, domain_id, nr_frames);
     if ( xenaccess == NULL )
     {
         ERROR("Error initialising xenaccess");
@@ -581,6 +623,8 @@ int main(int argc, char *argv[])
         }
     }
 
+    start_ns = last_ns = now_ns();
+
     /* Wait for access */
     for (;;)
     {
@@ -621,7 +665,7 @@ int main(int argc, char *argv[])
             interrupted = -1;
             continue;
         }
-        else if ( rc != -1 )
+        else if ( rc != -1 && !benchmark )
         {
             DPRINTF("Got event from Xen\n");
         }
@@ -645,7 +689,7 @@ int main(int argc, char *argv[])
 
             switch (req.reason) {
             case VM_EVENT_REASON_MEM_ACCESS:
-                if ( !shutting_down )
+                if ( !shutting_down && !benchmark )
                 {
                     /*
                      * This serves no other purpose here then demonstrating the use of the API.
@@ -661,7 +705,7 @@ int main(int argc, char *argv[])
                     }
                 }
 
-                printf("PAGE ACCESS: %c%c%c for GFN %"PRIx64" (offset %06"
+                EVENT_LOG("PAGE ACCESS: %c%c%c for GFN %"PRIx64" (offset %06"
                        PRIx64") gla %016"PRIx64" (valid: %c; fault in gpt: %c; fault with gla: %c) (vcpu %u [%c], altp2m view %u)\n",
                        (req.u.mem_access.flags & MEM_ACCESS_R) ? 'r' : '-',
                        (req.u.mem_access.flags & MEM_ACCESS_W) ? 'w' : '-',
@@ -699,7 +743,7 @@ int main(int argc, char *argv[])
                 rsp.u.mem_access = req.u.mem_access;
                 break;
             case VM_EVENT_REASON_SOFTWARE_BREAKPOINT:
-                printf("Breakpoint: rip=%016"PRIx64", gfn=%"PRIx64" (vcpu %d)\n",
+                EVENT_LOG("Breakpoint: rip=%016"PRIx64", gfn=%"PRIx64" (vcpu %d)\n",
                        req.data.regs.x86.rip,
                        req.u.software_breakpoint.gfn,
                        req.vcpu_id);
@@ -717,7 +761,7 @@ int main(int argc, char *argv[])
                 }
                 break;
             case VM_EVENT_REASON_PRIVILEGED_CALL:
-                printf("Privileged call: pc=%"PRIx64" (vcpu %d)\n",
+                EVENT_LOG("Privileged call: pc=%"PRIx64" (vcpu %d)\n",
                        req.data.regs.arm.pc,
                        req.vcpu_id);
 
@@ -726,14 +770,14 @@ int main(int argc, char *argv[])
                 rsp.flags |= VM_EVENT_FLAG_SET_REGISTERS;
                 break;
             case VM_EVENT_REASON_SINGLESTEP:
-                printf("Singlestep: rip=%016"PRIx64", vcpu %d, altp2m %u\n",
+                EVENT_LOG("Singlestep: rip=%016"PRIx64", vcpu %d, altp2m %u\n",
                        req.data.regs.x86.rip,
                        req.vcpu_id,
                        req.altp2m_idx);
 
                 if ( altp2m )
                 {
-                    printf("\tSwitching altp2m to view %u!\n", altp2m_view_id);
+                    EVENT_LOG("\tSwitching altp2m to view %u!\n", altp2m_view_id);
 
                     rsp.flags |= VM_EVENT_FLAG_ALTERNATE_P2M;
                     rsp.altp2m_idx = altp2m_view_id;
@@ -743,7 +787,7 @@ int main(int argc, char *argv[])
 
                 break;
             case VM_EVENT_REASON_DEBUG_EXCEPTION:
-                printf("Debug exception: rip=%016"PRIx64", vcpu %d. Type: %u. Length: %u\n",
+                EVENT_LOG("Debug exception: rip=%016"PRIx64", vcpu %d. Type: %u. Length: %u\n",
                        req.data.regs.x86.rip,
                        req.vcpu_id,
                        req.u.debug_exception.type,
@@ -764,7 +808,7 @@ int main(int argc, char *argv[])
 
                 break;
             case VM_EVENT_REASON_CPUID:
-                printf("CPUID executed: rip=%016"PRIx64", vcpu %d. Insn length: %"PRIu32" " \
+                EVENT_LOG("CPUID executed: rip=%016"PRIx64", vcpu %d. Insn length: %"PRIu32" " \
                        "0x%"PRIx32" 0x%"PRIx32": EAX=0x%"PRIx64" EBX=0x%"PRIx64" ECX=0x%"PRIx64" EDX=0x%"PRIx64"\n",
                        req.data.regs.x86.rip,
                        req.vcpu_id,
@@ -785,6 +829,24 @@ int main(int argc, char *argv[])
 
             /* Put the response on the ring */
             put_response(&xenaccess->vm_event, &rsp);
+            nr_events++;
+        }
+
+        /* Publish all of this round's responses at once */
+        RING_PUSH_RESPONSES(&xenaccess->vm_event.back_ring);
+
+        if ( benchmark )
+        {
+            uint64_t ns = now_ns();
+
+            if ( ns - last_ns >= 1000000000 )
+            {
+                printf("%"PRIu64" events/s\n",
+                       nr_events * 1000000000 / (ns - last_ns));
+                total_events += nr_events;
+                nr_events = 0;
+                last_ns = ns;
+            }
         }
 
         /* Tell Xen page is ready */
@@ -802,6 +864,16 @@ int main(int argc, char *argv[])
     }
     DPRINTF("xenaccess shut down on signal %d\n", interrupted);
 
+    if ( benchmark )
+    {
+        uint64_t ns = now_ns() - start_ns;
+
+        total_events += nr_events;
+        printf("%"PRIu64" events in %"PRIu64" ms (%"PRIu64" events/s)\n",
+               total_events, ns / 1000000,
+               ns ? total_events * 1000000000 / ns : 0);
+    }
+
 exit:
     if ( altp2m )
     {
@@ -24,8 +24,10 @@
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <sys/mman.h>
 
 #include "xenstat_priv.h"
+#include <xen/vcpu.h>
 
 /*
  * Data-collection types
@@ -124,6 +126,8 @@ void xenstat_uninit(xenstat_handle * handle)
 	if (handle) {
 		for (i = 0; i < NUM_COLLECTORS; i++)
 			collectors[i].uninit(handle);
+		if (handle->stats)
+			munmap(handle->stats, handle->stats_size);
 		xc_interface_close(handle->xc_handle);
 		xs_daemon_close(handle->xshandle);
 		free(handle->priv);
@@ -158,6 +162,200 @@ void domain_get_tmem_stats(xenstat_handle * handle, xenstat_domain * domain)
 	domain->tmem_stats.succ_pers_gets = parse(buffer,"Gp");
 }
 
+/*
+ * Shared statistics region
+ *
+ * Where the hypervisor provides it, and somebody has turned its updates
+ * on, all of the node, domain and vcpu information is read from a region
+ * of memory it shares with us and refreshes periodically, rather than
+ * with hypercalls per domain and vcpu.
+ */
+#define XENSTAT_STATS_RETRIES 100
+
+int xenstat_stats_enable(xenstat_handle * handle, unsigned int period_ms)
+{
+	xc_stats_info_t info;
+
+	if (period_ms == 0)
+		return xc_stats_disable(handle->xc_handle);
+
+	return xc_stats_enable(handle->xc_handle, period_ms, 0, 0, &info);
+}
+
+static int xenstat_stats_map(xenstat_handle * handle)
+{
+	xc_stats_info_t info;
+
+	if (handle->stats)
+		return 1;
+	if (handle->stats_unavailable)
+		return 0;
+
+	if (xc_stats_get_info(handle->xc_handle, &info) < 0)
+		goto unavailable;
+	/* Not turned on (yet): use the hypercalls, and look again next time. */
+	if (info.period_ms == 0)
+		return 0;
+
+	handle->stats = xc_stats_map(handle->xc_handle, &info);
+	if (handle->stats == NULL)
+		goto unavailable;
+	handle->stats_size = (size_t)info.nr_frames << XC_PAGE_SHIFT;
+
+	if (handle->stats->version != XEN_STATS_VERSION) {
+		munmap(handle->stats, handle->stats_size);
+		handle->stats = NULL;
+		goto unavailable;
+	}
+
+	return 1;
+
+unavailable:
+	handle->stats_unavailable = 1;
+	return 0;
+}
+
+/* Take a consistent copy of the region.  Returns 1 on success, 0 if the
+ * hypercalls should be used instead, and -1 on fatal error. */
+static int xenstat_stats_snapshot(xenstat_handle * handle,
+				  struct xen_stats_header *hdr,
+				  struct xen_stats_domain **domains,
+				  struct xen_stats_vcpu **vcpus)
+{
+	volatile struct xen_stats_header *shared = handle->stats;
+	unsigned int tries;
+	uint32_t seq;
+
+	*domains = NULL;
+	*vcpus = NULL;
+
+	for (tries = 0; tries < XENSTAT_STATS_RETRIES; tries++) {
+		seq = shared->seq;
+		if (seq & 1) {
+			usleep(100);
+			continue;
+		}
+		xen_rmb();
+
+		memcpy(hdr, (void *)shared, sizeof(*hdr));
+		if (hdr->period_ms == 0 || (hdr->flags & XEN_STATS_F_overflow)
+		    || hdr->nr_domains > hdr->max_domains
+		    || hdr->nr_vcpus > hdr->max_vcpus)
+			break;
+
+		free(*domains);
+		free(*vcpus);
+		*domains = malloc((hdr->nr_domains + 1) * sizeof(**domains));
+		*vcpus = malloc((hdr->nr_vcpus + 1) * sizeof(**vcpus));
+		if (*domains == NULL || *vcpus == NULL)
+			goto fatal;
+
+		memcpy(*domains, (char *)handle->stats + hdr->domain_offset,
+		       hdr->nr_domains * sizeof(**domains));
+		memcpy(*vcpus, (char *)handle->stats + hdr->vcpu_offset,
+		       hdr->nr_vcpus * sizeof(**vcpus));
+
+		xen_rmb();
+		if (shared->seq == seq)
+			return 1;
+	}
+
+	free(*domains);
+	free(*vcpus);
+	return 0;
+
+fatal:
+	free(*domains);
+	free(*vcpus);
+	return -1;
+}
+
+/* Fill in the node and its domains from the shared statistics region.
+ * Returns 1 on success, 0 if the hypercalls should be used instead, and -1
+ * on fatal error. */
+static int xenstat_get_node_stats(xenstat_handle * handle, xenstat_node *node)
+{
+	struct xen_stats_header hdr;
+	struct xen_stats_domain *sd;
+	struct xen_stats_vcpu *sv;
+	unsigned int i;
+	int rc;
+
+	if (!xenstat_stats_map(handle))
+		return 0;
+
+	rc = xenstat_stats_snapshot(handle, &hdr, &sd, &sv);
+	if (rc <= 0)
+		return rc;
+
+	node->timestamp = hdr.timestamp;
+	node->cpu_hz = ((unsigned long long)hdr.cpu_khz) * 1000ULL;
+	node->num_cpus = hdr.nr_cpus;
+	node->tot_mem = ((unsigned long long)hdr.total_pages)
+	    * handle->page_size;
+	node->free_mem = ((unsigned long long)hdr.free_pages)
+	    * handle->page_size;
+	node->freeable_mb = 0;
+	if (hdr.flags & XEN_STATS_F_tmem) {
+		rc = xc_tmem_control(handle->xc_handle, -1,
+				     XEN_SYSCTL_TMEM_OP_QUERY_FREEABLE_MB,
+				     -1, 0, 0, NULL);
+		node->freeable_mb = (rc < 0) ? 0 : rc;
+	}
+
+	node->domains = calloc(hdr.nr_domains + 1, sizeof(xenstat_domain));
+	if (node->domains == NULL)
+		goto fatal;
+	node->stats_vcpus = sv;
+	node->stats_nr_vcpus = hdr.nr_vcpus;
+	node->num_domains = 0;
+
+	for (i = 0; i < hdr.nr_domains; i++) {
+		xenstat_domain *domain = node->domains + node->num_domains;
+
+		domain->id = sd[i].domain;
+		domain->name = xenstat_get_domain_name(handle, domain->id);
+		if (domain->name == NULL) {
+			if (errno == ENOMEM)
+				goto fatal;
+			/* Being destroyed: ignore it */
+			continue;
+		}
+		domain->state = sd[i].flags;
+		domain->cpu_ns = sd[i].cpu_time;
+		domain->num_vcpus = sd[i].max_vcpu_id + 1;
+		domain->stats_first_vcpu = sd[i].first_vcpu;
+		if (domain->stats_first_vcpu + domain->num_vcpus > hdr.nr_vcpus)
+			domain->num_vcpus = 0;
+		domain->vcpus = NULL;
+		domain->cur_mem = ((unsigned long long)sd[i].tot_pages)
+		    * handle->page_size;
+		domain->max_mem = sd[i].max_pages == UINT_MAX
+		    ? (unsigned long long)-1
+		    : (unsigned long long)(sd[i].max_pages * handle->page_size);
+		domain->ssid = sd[i].ssidref;
+		if (hdr.flags & XEN_STATS_F_tmem)
+			domain_get_tmem_stats(handle, domain);
+
+		node->num_domains++;
+	}
+
+	free(sd);
+	return 1;
+
+fatal:
+	if (node->domains) {
+		for (i = 0; i < node->num_domains; i++)
+			free(node->domains[i].name);
+		free(node->domains);
+		node->domains = NULL;
+	}
+	node->stats_vcpus = NULL;
+	free(sd);
+	free(sv);
+	return -1;
+}
+
 xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
 {
 #define DOMAIN_CHUNK_SIZE 256
@@ -176,6 +374,14 @@ xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
 	/* Store the handle in the node for later access */
 	node->handle = handle;
 
+	rc = xenstat_get_node_stats(handle, node);
+	if (rc < 0) {
+		free(node);
+		return NULL;
+	}
+	if (rc > 0)
+		goto collect;
+
 	/* Get information about the physical system */
 	if (xc_physinfo(handle->xc_handle, &physinfo) < 0) {
 		free(node);
@@ -267,7 +473,7 @@ xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags)
 		}
 	} while (new_domains == DOMAIN_CHUNK_SIZE);
 
-
+collect:
 	/* Run all the extra data collectors requested */
 	node->flags = 0;
 	for (i = 0; i < NUM_COLLECTORS; i++) {
@@ -302,15 +508,26 @@ void xenstat_free_node(xenstat_node * node)
 					collectors[i].free(node);
 			free(node->domains);
 		}
+		free(node->stats_vcpus);
 		free(node);
 	}
 }
 
 xenstat_domain *xenstat_node_domain(xenstat_node * node, unsigned int domid)
 {
-	unsigned int i;
+	unsigned int i, lo = 0, hi = node->num_domains;
+
+	/* Domains are collected in ascending domid order, so bisect first. */
+	while (lo < hi) {
+		i = lo + (hi - lo) / 2;
+		if (node->domains[i].id == domid)
+			return &(node->domains[i]);
+		if (node->domains[i].id < domid)
+			lo = i + 1;
+		else
+			hi = i;
+	}
 
-	/* FIXME: binary search */
 	/* Find the appropriate domain entry in the node struct. */
 	for (i = 0; i < node->num_domains; i++) {
 		if (node->domains[i].id == domid)
@@ -363,6 +580,12 @@ unsigned long long xenstat_node_cpu_hz(xenstat_node * node)
 	return node->cpu_hz;
 }
 
+/* Get the Xen system time at which the statistics were sampled */
+unsigned long long xenstat_node_timestamp(xenstat_node * node)
+{
+	return node->timestamp;
+}
+
 /* Get the domain ID for this domain */
 unsigned xenstat_domain_id(xenstat_domain * domain)
 {
@@ -493,6 +716,19 @@ static int xenstat_collect_vcpus(xenstat_node * node)
 						* sizeof(xenstat_vcpu));
 		if (node->domains[i].vcpus == NULL)
 			return 0;
+
+		if (node->stats_vcpus) {
+			struct xen_stats_vcpu *sv = node->stats_vcpus
+				+ node->domains[i].stats_first_vcpu;
+
+			for (vcpu = 0; vcpu < node->domains[i].num_vcpus; vcpu++) {
+				node->domains[i].vcpus[vcpu].online =
+					!!(sv[vcpu].flags & XEN_STATS_VCPU_online);
+				node->domains[i].vcpus[vcpu].ns =
+					sv[vcpu].runstate_time[RUNSTATE_running];
+			}
+			continue;
+		}
 	
 		for (vcpu = 0; vcpu < node->domains[i].num_vcpus; vcpu++) {
 			/* FIXME: need to be using a more efficient mechanism*/
@@ -36,6 +36,13 @@ xenstat_handle *xenstat_init(void);
 /* Release the handle to libxc, free resources, etc. */
 void xenstat_uninit(xenstat_handle * handle);
 
+/* Turn the hypervisor's shared statistics region on, refreshed every
+ * period_ms, or off if period_ms is 0.  This affects the whole host, and
+ * stays in effect after the handle is released.  While the region is on,
+ * xenstat_get_node() reads from it rather than making hypercalls for
+ * every domain and vcpu.  Returns 0 on success, -1 on error. */
+int xenstat_stats_enable(xenstat_handle * handle, unsigned int period_ms);
+
 /* Flags for types of information to collect in xenstat_get_node */
 #define XENSTAT_VCPU 0x1
 #define XENSTAT_NETWORK 0x2
@@ -82,6 +89,14 @@ unsigned int xenstat_node_num_cpus(xenstat_node * node);
 /* Get information about the CPU speed */
 unsigned long long xenstat_node_cpu_hz(xenstat_node * node);
 
+/* Get the Xen system time, in nanoseconds, at which the statistics were
+ * sampled.  This is 0 if they were read directly, at the time of the
+ * xenstat_get_node() call, rather than from the shared statistics region,
+ * whose samples may be up to one update period old.  Rates should be
+ * computed over the difference between two nodes' timestamps where both
+ * have one. */
+unsigned long long xenstat_node_timestamp(xenstat_node * node);
+
 /*
  * Domain functions - extract information from a xenstat_domain
  */
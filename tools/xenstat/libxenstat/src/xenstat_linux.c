@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <regex.h>
 
@@ -34,24 +35,69 @@
 
 #define SYSFS_VBD_PATH "/sys/bus/xen-backend/devices"
 
+/* How often (in seconds) to look for a new bonding bridge */
+#define BRIDGE_REFRESH_SECS 10
+
+#define CACHE_HASH_SIZE 256
+
+/* A network interface seen in /proc/net/dev, and what it belongs to */
+struct iface_entry {
+	struct iface_entry *next;
+	char name[16];
+	int is_vif;
+	unsigned int domid, netid;
+	unsigned int gen;
+};
+
+#define VBD_NR_ATTRS 5
+static const char *const vbd_attrs[VBD_NR_ATTRS] = {
+	"statistics/oo_req", "statistics/rd_req", "statistics/wr_req",
+	"statistics/rd_sect", "statistics/wr_sect",
+};
+
+/* A backend VBD directory, with its statistics files kept open */
+struct vbd_entry {
+	struct vbd_entry *next;
+	char name[64];
+	int fd[VBD_NR_ATTRS];
+	unsigned int gen;
+};
+
+/*
+ * State kept across collections, so that a poll costs one pass over
+ * /proc/net/dev and one pread() per VBD statistic rather than a walk of
+ * sysfs opening every file again.  Entries which are not seen during a
+ * pass (their gen is stale) are dropped at the end of it.
+ */
 struct priv_data {
 	FILE *procnetdev;
 	DIR *sysfsvbd;
+	char bridge[16];
+	time_t bridge_time;
+	unsigned int net_gen, vbd_gen;
+	struct iface_entry *ifaces[CACHE_HASH_SIZE];
+	struct vbd_entry *vbds[CACHE_HASH_SIZE];
 };
 
+static unsigned int cache_hash(const char *name)
+{
+	unsigned int h = 5381;
+
+	while (*name)
+		h = h * 33 + (unsigned char)*name++;
+	return h % CACHE_HASH_SIZE;
+}
+
 static struct priv_data *
 get_priv_data(xenstat_handle *handle)
 {
 	if (handle->priv != NULL)
 		return handle->priv;
 
-	handle->priv = malloc(sizeof(struct priv_data));
+	handle->priv = calloc(1, sizeof(struct priv_data));
 	if (handle->priv == NULL)
 		return (NULL);
 
-	((struct priv_data *)handle->priv)->procnetdev = NULL;
-	((struct priv_data *)handle->priv)->sysfsvbd = NULL;
-
 	return handle->priv;
 }
 
@@ -72,6 +118,8 @@ void getBridge(char *excludeName, char *result, size_t resultLen)
 	char tmp[256] = { 0 };
 
 	d = opendir("/sys/class/net");
+	if (d == NULL)
+		return;
 	while ((de = readdir(d)) != NULL) {
 		if ((strlen(de->d_name) > 0) && (de->d_name[0] != '.')
 			&& (strstr(de->d_name, excludeName) == NULL)) {
@@ -100,7 +148,8 @@ int parseNetDevLine(char *line, char *iface, unsigned long long *rxBytes, unsign
 	int ret;
 	char *tmp;
 	int i = 0, x = 0, col = 0;
-	regex_t r;
+	static regex_t r;
+	static int r_compiled;
 	regmatch_t matches[19];
 	int num = 19;
 
@@ -145,9 +194,13 @@ int parseNetDevLine(char *line, char *iface, unsigned long long *rxBytes, unsign
 	if (txComp != NULL)
 		*txComp = 0;
 
-	if ((ret = regcomp(&r, regex, REG_EXTENDED))) {
-		regfree(&r);
-		return ret;
+	/* Compiling the expression dominates the cost of a line, do it once */
+	if (!r_compiled) {
+		if ((ret = regcomp(&r, regex, REG_EXTENDED))) {
+			regfree(&r);
+			return ret;
+		}
+		r_compiled = 1;
 	}
 
 	tmp = (char *)malloc( sizeof(char) );
@@ -231,7 +284,6 @@ int parseNetDevLine(char *line, char *iface, unsigned long long *rxBytes, unsign
 	}
 
 	free(tmp);
-	regfree(&r);
 
 	return 0;
 }
@@ -259,6 +311,72 @@ static int get_iface_domid_network(const char *iface, unsigned int *domid_p, uns
 	return 0;
 }
 
+/* Look up (or resolve and remember) what iface belongs to */
+static struct iface_entry *get_iface_entry(struct priv_data *priv,
+					   const char *iface, int refresh)
+{
+	unsigned int h = cache_hash(iface);
+	struct iface_entry *e;
+
+	for (e = priv->ifaces[h]; e != NULL; e = e->next)
+		if (strcmp(e->name, iface) == 0)
+			break;
+
+	if (e == NULL) {
+		e = malloc(sizeof(*e));
+		if (e == NULL)
+			return NULL;
+		strncpy(e->name, iface, sizeof(e->name) - 1);
+		e->name[sizeof(e->name) - 1] = '\0';
+		e->next = priv->ifaces[h];
+		priv->ifaces[h] = e;
+		refresh = 1;
+	}
+
+	if (refresh)
+		e->is_vif = get_iface_domid_network(iface, &e->domid,
+						    &e->netid);
+	e->gen = priv->net_gen;
+
+	return e;
+}
+
+/* Forget interfaces which were not in /proc/net/dev this time round */
+static void prune_ifaces(struct priv_data *priv, int all)
+{
+	struct iface_entry **pe, *e;
+	unsigned int h;
+
+	for (h = 0; h < CACHE_HASH_SIZE; h++) {
+		pe = &priv->ifaces[h];
+		while ((e = *pe) != NULL) {
+			if (all || e->gen != priv->net_gen) {
+				*pe = e->next;
+				free(e);
+			} else
+				pe = &e->next;
+		}
+	}
+}
+
+/* Parse a /proc/net/dev line without going through parseNetDevLine()'s
+ * regular expression.  Returns 0 if the line isn't in the expected form. */
+static int parse_net_dev_fast(const char *line, char *iface,
+			      unsigned long long *rxBytes,
+			      unsigned long long *rxPackets,
+			      unsigned long long *rxErrs,
+			      unsigned long long *rxDrops,
+			      unsigned long long *txBytes,
+			      unsigned long long *txPackets,
+			      unsigned long long *txErrs,
+			      unsigned long long *txDrops)
+{
+	return sscanf(line, " %15[^:]:%llu %llu %llu %llu %*s %*s %*s %*s"
+		      " %llu %llu %llu %llu", iface, rxBytes, rxPackets,
+		      rxErrs, rxDrops, txBytes, txPackets, txErrs,
+		      txDrops) == 9;
+}
+
 /* Collect information about networks */
 int xenstat_collect_networks(xenstat_node * node)
 {
@@ -298,21 +416,36 @@ int xenstat_collect_networks(xenstat_node * node)
 	}
 
 	/* Fill in networks */
-	/* FIXME: optimize this */
 	fseek(priv->procnetdev, sizeof(PROCNETDEV_HEADER) - 1,
 	      SEEK_SET);
 
 	/* We get the bridge devices for use with bonding interface to get bonding interface stats */
-	getBridge("vir", devBridge, sizeof(devBridge));
+	if (priv->bridge_time == 0 ||
+	    time(NULL) - priv->bridge_time >= BRIDGE_REFRESH_SECS) {
+		priv->bridge[0] = '\0';
+		getBridge("vir", priv->bridge, sizeof(priv->bridge));
+		priv->bridge_time = time(NULL);
+	}
+	strcpy(devBridge, priv->bridge);
 	snprintf(devNoBridge, 16, "p%s", devBridge);
 
+	priv->net_gen++;
+
 	while (fgets(line, 512, priv->procnetdev)) {
 		xenstat_domain *domain;
 		xenstat_network net;
+		struct iface_entry *entry;
 		unsigned int domid;
 
-		parseNetDevLine(line, iface, &rxBytes, &rxPackets, &rxErrs, &rxDrops, NULL, NULL, NULL,
-				NULL, &txBytes, &txPackets, &txErrs, &txDrops, NULL, NULL, NULL, NULL);
+		if (!parse_net_dev_fast(line, iface, &rxBytes, &rxPackets,
+					&rxErrs, &rxDrops, &txBytes,
+					&txPackets, &txErrs, &txDrops))
+			parseNetDevLine(line, iface, &rxBytes, &rxPackets, &rxErrs, &rxDrops, NULL, NULL, NULL,
+					NULL, &txBytes, &txPackets, &txErrs, &txDrops, NULL, NULL, NULL, NULL);
+
+		entry = get_iface_entry(priv, iface, 0);
+		if (entry == NULL)
+			return 0;
 
 		/* If the device parsed is network bridge and both tx & rx packets are zero, we are most */
 		/* likely using bonding so we alter the configuration for dom0 to have bridge stats */
@@ -335,7 +468,9 @@ int xenstat_collect_networks(xenstat_node * node)
 			}
 		}
 		else /* Otherwise we need to preserve old behaviour */
-		if (get_iface_domid_network(iface, &domid, &net.id)) {
+		if (entry->is_vif) {
+			domid = entry->domid;
+			net.id = entry->netid;
 
 			net.tbytes = txBytes;
 			net.tpackets = txPackets;
@@ -346,8 +481,16 @@ int xenstat_collect_networks(xenstat_node * node)
 			net.rerrs = rxErrs;
 			net.rdrop = rxDrops;
 
-		/* FIXME: this does a search for the domid */
 		  domain = xenstat_node_domain(node, domid);
+		  if (domain == NULL) {
+			/* The name may have been reused since we cached it */
+			entry = get_iface_entry(priv, iface, 1);
+			if (entry->is_vif) {
+				domid = entry->domid;
+				net.id = entry->netid;
+				domain = xenstat_node_domain(node, domid);
+			}
+		  }
 		  if (domain == NULL) {
 			fprintf(stderr,
 				"Found interface vif%u.%u but domain %u"
@@ -374,6 +517,8 @@ int xenstat_collect_networks(xenstat_node * node)
           }
         }
 
+	prune_ifaces(priv, 0);
+
 	return 1;
 }
 
@@ -381,24 +526,80 @@ int xenstat_collect_networks(xenstat_node * node)
 void xenstat_uninit_networks(xenstat_handle * handle)
 {
 	struct priv_data *priv = get_priv_data(handle);
-	if (priv != NULL && priv->procnetdev != NULL)
+	if (priv == NULL)
+		return;
+	if (priv->procnetdev != NULL)
 		fclose(priv->procnetdev);
+	prune_ifaces(priv, 1);
 }
 
-static int read_attributes_vbd(const char *vbd_directory, const char *what, char *ret, int cap)
+/* Look up (or open and remember) the statistics files of a VBD */
+static struct vbd_entry *get_vbd_entry(struct priv_data *priv,
+				       const char *vbd_directory)
 {
-	static char file_name[80];
-	int fd, num_read;
-
-	snprintf(file_name, sizeof(file_name), "%s/%s/%s",
-		SYSFS_VBD_PATH, vbd_directory, what);
-	fd = open(file_name, O_RDONLY, 0);
-	if (fd==-1) return -1;
-	num_read = read(fd, ret, cap - 1);
-	close(fd);
-	if (num_read<=0) return -1;
-	ret[num_read] = '\0';
-	return num_read;
+	unsigned int h = cache_hash(vbd_directory);
+	struct vbd_entry *e;
+	char file_name[128];
+	int i;
+
+	for (e = priv->vbds[h]; e != NULL; e = e->next)
+		if (strcmp(e->name, vbd_directory) == 0)
+			goto out;
+
+	e = malloc(sizeof(*e));
+	if (e == NULL)
+		return NULL;
+	strncpy(e->name, vbd_directory, sizeof(e->name) - 1);
+	e->name[sizeof(e->name) - 1] = '\0';
+	for (i = 0; i < VBD_NR_ATTRS; i++) {
+		snprintf(file_name, sizeof(file_name), "%s/%s/%s",
+			 SYSFS_VBD_PATH, vbd_directory, vbd_attrs[i]);
+		e->fd[i] = open(file_name, O_RDONLY | O_CLOEXEC, 0);
+	}
+	e->next = priv->vbds[h];
+	priv->vbds[h] = e;
+
+ out:
+	e->gen = priv->vbd_gen;
+	return e;
+}
+
+/* Close the files of VBDs which have gone away */
+static void prune_vbds(struct priv_data *priv, int all)
+{
+	struct vbd_entry **pe, *e;
+	unsigned int h;
+	int i;
+
+	for (h = 0; h < CACHE_HASH_SIZE; h++) {
+		pe = &priv->vbds[h];
+		while ((e = *pe) != NULL) {
+			if (all || e->gen != priv->vbd_gen) {
+				*pe = e->next;
+				for (i = 0; i < VBD_NR_ATTRS; i++)
+					if (e->fd[i] != -1)
+						close(e->fd[i]);
+				free(e);
+			} else
+				pe = &e->next;
+		}
+	}
+}
+
+/* Re-read a sysfs attribute through its open file */
+static int read_attribute_vbd(struct vbd_entry *e, int attr,
+			      unsigned long long *val)
+{
+	char buf[32];
+	ssize_t num_read;
+
+	if (e->fd[attr] == -1)
+		return -1;
+	num_read = pread(e->fd[attr], buf, sizeof(buf) - 1, 0);
+	if (num_read <= 0)
+		return -1;
+	buf[num_read] = '\0';
+	return sscanf(buf, "%llu", val) == 1 ? 0 : -1;
 }
 
 /* Collect information about VBDs */
@@ -424,11 +625,13 @@ int xenstat_collect_vbds(xenstat_node * node)
 	read_attributes_qdisk(node);
 
 	rewinddir(priv->sysfsvbd);
+	priv->vbd_gen++;
 
 	for(dp = readdir(priv->sysfsvbd); dp != NULL ;
 	    dp = readdir(priv->sysfsvbd)) {
 		xenstat_domain *domain;
 		xenstat_vbd vbd;
+		struct vbd_entry *entry;
 		unsigned int domid;
 		int ret;
 		char buf[256];
@@ -453,33 +656,19 @@ int xenstat_collect_vbds(xenstat_node * node)
 			continue;
 		}
 
-		if((read_attributes_vbd(dp->d_name, "statistics/oo_req", buf, 256)<=0)
-		   || ((ret = sscanf(buf, "%llu", &vbd.oo_reqs)) != 1))
-		{
-			continue;
-		}
-
-		if((read_attributes_vbd(dp->d_name, "statistics/rd_req", buf, 256)<=0)
-		   || ((ret = sscanf(buf, "%llu", &vbd.rd_reqs)) != 1))
-		{
-			continue;
-		}
-
-		if((read_attributes_vbd(dp->d_name, "statistics/wr_req", buf, 256)<=0)
-		   || ((ret = sscanf(buf, "%llu", &vbd.wr_reqs)) != 1))
-		{
-			continue;
-		}
-
-		if((read_attributes_vbd(dp->d_name, "statistics/rd_sect", buf, 256)<=0)
-		   || ((ret = sscanf(buf, "%llu", &vbd.rd_sects)) != 1))
-		{
-			continue;
+		entry = get_vbd_entry(priv, dp->d_name);
+		if (entry == NULL) {
+			perror("Allocation error");
+			return 0;
 		}
 
-		if((read_attributes_vbd(dp->d_name, "statistics/wr_sect", buf, 256)<=0)
-		   || ((ret = sscanf(buf, "%llu", &vbd.wr_sects)) != 1))
-		{
+		if (read_attribute_vbd(entry, 0, &vbd.oo_reqs) ||
+		    read_attribute_vbd(entry, 1, &vbd.rd_reqs) ||
+		    read_attribute_vbd(entry, 2, &vbd.wr_reqs) ||
+		    read_attribute_vbd(entry, 3, &vbd.rd_sects) ||
+		    read_attribute_vbd(entry, 4, &vbd.wr_sects)) {
+			/* Reopen next time, the device may have been replaced */
+			entry->gen--;
 			continue;
 		}
 
@@ -489,13 +678,18 @@ int xenstat_collect_vbds(xenstat_node * node)
 		}
 	}
 
-	return 1;	
+	prune_vbds(priv, 0);
+
+	return 1;
 }
 
 /* Free VBD information in handle */
 void xenstat_uninit_vbds(xenstat_handle * handle)
 {
 	struct priv_data *priv = get_priv_data(handle);
-	if (priv != NULL && priv->sysfsvbd != NULL)
+	if (priv == NULL)
+		return;
+	if (priv->sysfsvbd != NULL)
 		closedir(priv->sysfsvbd);
+	prune_vbds(priv, 1);
 }
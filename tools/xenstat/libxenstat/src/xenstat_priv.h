@@ -38,11 +38,16 @@ struct xenstat_handle {
 	int page_size;
 	void *priv;
 	char xen_version[VERSION_SIZE]; /* xen version running on this node */
+	/* Hypervisor's shared statistics region, if available */
+	struct xen_stats_header *stats;
+	size_t stats_size;
+	int stats_unavailable;
 };
 
 struct xenstat_node {
 	xenstat_handle *handle;
 	unsigned int flags;
+	unsigned long long timestamp;	/* 0 unless from the stats region */
 	unsigned long long cpu_hz;
 	unsigned int num_cpus;
 	unsigned long long tot_mem;
@@ -50,6 +55,9 @@ struct xenstat_node {
 	unsigned int num_domains;
 	xenstat_domain *domains;	/* Array of length num_domains */
 	long freeable_mb;
+	/* Copy of the vcpus in the shared statistics region, if used */
+	struct xen_stats_vcpu *stats_vcpus;
+	unsigned int stats_nr_vcpus;
 };
 
 struct xenstat_tmem {
@@ -74,6 +82,7 @@ struct xenstat_domain {
 	unsigned int num_vbds;
 	xenstat_vbd *vbds;
 	xenstat_tmem tmem_stats;
+	unsigned int stats_first_vcpu;	/* Index into node->stats_vcpus */
 };
 
 struct xenstat_vcpu {
@@ -0,0 +1,933 @@
+/*
+ *  xenstat-exporter: serve libxenstat statistics in the Prometheus text
+ *  exposition format.
+ *
+ *  The daemon samples the node once per interval, keeps the previous
+ *  sample of every domain so that it can publish rates as well as the raw
+ *  counters, and renders the result once per sample.  Scrapes, over a
+ *  local socket (and optionally a loopback TCP port), are then served from
+ *  that rendered page and never cause a collection of their own.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; under version 2 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xenstat.h>
+
+#include "_paths.h"
+
+#define DEFAULT_SOCKET XEN_RUN_DIR "/xenstat-exporter.sock"
+#define DEFAULT_INTERVAL_MS 1000
+#define MIN_INTERVAL_MS 100
+
+#define MAX_CLIENTS 64
+#define CLIENT_TIMEOUT_MS 5000
+#define REQUEST_MAX 4096
+
+#define SECTOR_SIZE 512
+
+/* Counters kept from one sample to the next for each domain */
+struct dom_state {
+	unsigned int domid;
+	unsigned long long cpu_ns;
+	unsigned long long net[8];	/* rx/tx bytes, packets, errs, drops */
+	unsigned long long vbd[5];	/* oo, rd, wr reqs, rd, wr sectors */
+	double cpu_rate;
+	double net_rate[2];		/* rx, tx bytes */
+	double vbd_rate[4];		/* rd, wr reqs, rd, wr bytes */
+	int have_rates;
+};
+
+enum { NET_RBYTES, NET_TBYTES, NET_RPKTS, NET_TPKTS,
+       NET_RERRS, NET_TERRS, NET_RDROP, NET_TDROP };
+enum { VBD_OO, VBD_RD, VBD_WR, VBD_RD_SECT, VBD_WR_SECT };
+
+/* A rendered page, shared by every client still sending it */
+struct page {
+	unsigned int refs;
+	size_t len;
+	char data[];
+};
+
+struct client {
+	int fd;
+	struct timespec start;
+	char req[REQUEST_MAX];
+	size_t req_len;
+	char hdr[256];
+	size_t hdr_len, sent;
+	struct page *page;	/* NULL while reading the request */
+	const char *body;
+	size_t body_len;
+};
+
+/* Output being rendered */
+struct outbuf {
+	char *buf;
+	size_t len, size;
+	int oom;
+};
+
+static struct {
+	unsigned int interval_ms;
+	const char *socket_path;
+	const char *address;
+	int port;
+	int foreground;
+} opts = {
+	.interval_ms = DEFAULT_INTERVAL_MS,
+	.socket_path = DEFAULT_SOCKET,
+	.address = "127.0.0.1",
+	.port = -1,
+};
+
+static xenstat_handle *xhandle;
+
+/* Previous sample, sorted by domid like the domains of a node */
+static struct dom_state *states;
+static unsigned int nr_states;
+static struct timespec last_sample;
+static unsigned long long last_timestamp;	/* Xen time of the sample, or 0 */
+
+static struct page *current_page;
+static unsigned long long nr_collections, nr_collect_errors;
+static double last_collect_secs;
+
+static struct client clients[MAX_CLIENTS];
+static unsigned int nr_clients;
+static int listen_fds[2] = { -1, -1 };
+
+static volatile sig_atomic_t quit;
+
+static void log_msg(int prio, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void log_msg(int prio, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (opts.foreground) {
+		vfprintf(stderr, fmt, ap);
+		fputc('\n', stderr);
+	} else
+		vsyslog(prio, fmt, ap);
+	va_end(ap);
+}
+
+static double ts_diff(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) + (a->tv_nsec - b->tv_nsec) / 1e9;
+}
+
+static void ts_add_ms(struct timespec *ts, unsigned int ms)
+{
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (ms % 1000) * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+static void out_printf(struct outbuf *o, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void out_printf(struct outbuf *o, const char *fmt, ...)
+{
+	va_list ap;
+	char *tmp;
+	int n;
+
+	if (o->oom)
+		return;
+
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(o->buf + o->len, o->size - o->len, fmt, ap);
+		va_end(ap);
+		if (n < 0) {
+			o->oom = 1;
+			return;
+		}
+		if ((size_t)n < o->size - o->len)
+			break;
+		tmp = realloc(o->buf, (o->size + n + 1) * 2);
+		if (tmp == NULL) {
+			o->oom = 1;
+			return;
+		}
+		o->buf = tmp;
+		o->size = (o->size + n + 1) * 2;
+	}
+	o->len += n;
+}
+
+static void out_family(struct outbuf *o, const char *name, const char *type,
+		       const char *help)
+{
+	out_printf(o, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* Label values need \, " and newline escaped */
+static const char *escape_label(const char *s)
+{
+	static char buf[256];
+	size_t i = 0;
+
+	for (; *s && i < sizeof(buf) - 3; s++) {
+		if (*s == '\\' || *s == '"') {
+			buf[i++] = '\\';
+			buf[i++] = *s;
+		} else if (*s == '\n') {
+			buf[i++] = '\\';
+			buf[i++] = 'n';
+		} else
+			buf[i++] = *s;
+	}
+	buf[i] = '\0';
+	return buf;
+}
+
+/* Sum the counters of all the devices of a domain */
+static void domain_counters(xenstat_domain *domain, struct dom_state *st)
+{
+	unsigned int i, n;
+
+	memset(st->net, 0, sizeof(st->net));
+	memset(st->vbd, 0, sizeof(st->vbd));
+
+	n = xenstat_domain_num_networks(domain);
+	for (i = 0; i < n; i++) {
+		xenstat_network *net = xenstat_domain_network(domain, i);
+
+		st->net[NET_RBYTES] += xenstat_network_rbytes(net);
+		st->net[NET_TBYTES] += xenstat_network_tbytes(net);
+		st->net[NET_RPKTS] += xenstat_network_rpackets(net);
+		st->net[NET_TPKTS] += xenstat_network_tpackets(net);
+		st->net[NET_RERRS] += xenstat_network_rerrs(net);
+		st->net[NET_TERRS] += xenstat_network_terrs(net);
+		st->net[NET_RDROP] += xenstat_network_rdrop(net);
+		st->net[NET_TDROP] += xenstat_network_tdrop(net);
+	}
+
+	n = xenstat_domain_num_vbds(domain);
+	for (i = 0; i < n; i++) {
+		xenstat_vbd *vbd = xenstat_domain_vbd(domain, i);
+
+		st->vbd[VBD_OO] += xenstat_vbd_oo_reqs(vbd);
+		st->vbd[VBD_RD] += xenstat_vbd_rd_reqs(vbd);
+		st->vbd[VBD_WR] += xenstat_vbd_wr_reqs(vbd);
+		st->vbd[VBD_RD_SECT] += xenstat_vbd_rd_sects(vbd);
+		st->vbd[VBD_WR_SECT] += xenstat_vbd_wr_sects(vbd);
+	}
+}
+
+/* Rate of a counter, treating a decrease (e.g. a reused domid) as a reset */
+static double rate(unsigned long long now, unsigned long long prev, double dt)
+{
+	return now >= prev ? (now - prev) / dt : 0;
+}
+
+/*
+ * Build the new per-domain state from a node.  Both the node's domains
+ * and the previous states are in domid order, so the two lists are
+ * merged rather than searched.  cpu_dt is the time between the two
+ * samples of the domains' CPU time, and io_dt that between the two reads
+ * of the network and block device counters.
+ */
+static struct dom_state *update_states(xenstat_node *node, double cpu_dt,
+				       double io_dt)
+{
+	unsigned int n = xenstat_node_num_domains(node), i, j = 0;
+	struct dom_state *new = calloc(n ? n : 1, sizeof(*new));
+
+	if (new == NULL)
+		return NULL;
+
+	for (i = 0; i < n; i++) {
+		xenstat_domain *domain = xenstat_node_domain_by_index(node, i);
+		struct dom_state *st = &new[i], *prev = NULL;
+
+		st->domid = xenstat_domain_id(domain);
+		st->cpu_ns = xenstat_domain_cpu_ns(domain);
+		domain_counters(domain, st);
+
+		while (j < nr_states && states[j].domid < st->domid)
+			j++;
+		if (j < nr_states && states[j].domid == st->domid)
+			prev = &states[j];
+
+		if (prev == NULL || cpu_dt <= 0 || io_dt <= 0)
+			continue;
+
+		st->have_rates = 1;
+		st->cpu_rate = rate(st->cpu_ns, prev->cpu_ns, cpu_dt) / 1e9;
+		st->net_rate[0] = rate(st->net[NET_RBYTES],
+				       prev->net[NET_RBYTES], io_dt);
+		st->net_rate[1] = rate(st->net[NET_TBYTES],
+				       prev->net[NET_TBYTES], io_dt);
+		st->vbd_rate[0] = rate(st->vbd[VBD_RD], prev->vbd[VBD_RD],
+				       io_dt);
+		st->vbd_rate[1] = rate(st->vbd[VBD_WR], prev->vbd[VBD_WR],
+				       io_dt);
+		st->vbd_rate[2] = rate(st->vbd[VBD_RD_SECT],
+				       prev->vbd[VBD_RD_SECT], io_dt)
+				  * SECTOR_SIZE;
+		st->vbd_rate[3] = rate(st->vbd[VBD_WR_SECT],
+				       prev->vbd[VBD_WR_SECT], io_dt)
+				  * SECTOR_SIZE;
+	}
+
+	return new;
+}
+
+#define FOR_EACH_DOMAIN(node, i, domain, st)				\
+	for (i = 0; i < nr_states &&					\
+	     ((domain = xenstat_node_domain_by_index(node, i)),	\
+	      (st = &states[i]), 1); i++)
+
+#define LABELS "{domid=\"%u\",name=\"%s\"}"
+#define LABEL_ARGS(domain)						\
+	xenstat_domain_id(domain), escape_label(xenstat_domain_name(domain))
+
+static void render_counter(struct outbuf *o, xenstat_node *node,
+			   const char *name, const char *help,
+			   int net, unsigned int idx, unsigned int scale)
+{
+	xenstat_domain *domain;
+	struct dom_state *st;
+	unsigned int i;
+
+	out_family(o, name, "counter", help);
+	FOR_EACH_DOMAIN(node, i, domain, st)
+		out_printf(o, "%s" LABELS " %llu\n", name, LABEL_ARGS(domain),
+			   (net ? st->net[idx] : st->vbd[idx]) * scale);
+}
+
+static void render_rate(struct outbuf *o, xenstat_node *node,
+			const char *name, const char *help,
+			const double *(*get)(struct dom_state *),
+			unsigned int idx)
+{
+	xenstat_domain *domain;
+	struct dom_state *st;
+	unsigned int i;
+
+	out_family(o, name, "gauge", help);
+	FOR_EACH_DOMAIN(node, i, domain, st)
+		if (st->have_rates)
+			out_printf(o, "%s" LABELS " %.6g\n", name,
+				   LABEL_ARGS(domain), get(st)[idx]);
+}
+
+static const double *get_net_rate(struct dom_state *st)
+{
+	return st->net_rate;
+}
+
+static const double *get_vbd_rate(struct dom_state *st)
+{
+	return st->vbd_rate;
+}
+
+static void render(struct outbuf *o, xenstat_node *node)
+{
+	static const struct {
+		const char *name;
+		unsigned int (*get)(xenstat_domain *);
+	} states_info[] = {
+		{ "running", xenstat_domain_running },
+		{ "blocked", xenstat_domain_blocked },
+		{ "paused", xenstat_domain_paused },
+		{ "shutdown", xenstat_domain_shutdown },
+		{ "crashed", xenstat_domain_crashed },
+		{ "dying", xenstat_domain_dying },
+	};
+	xenstat_domain *domain;
+	struct dom_state *st;
+	unsigned int i, s;
+
+	out_family(o, "xen_node_cpus", "gauge", "Physical CPUs.");
+	out_printf(o, "xen_node_cpus %u\n", xenstat_node_num_cpus(node));
+	out_family(o, "xen_node_cpu_hz", "gauge", "Physical CPU frequency.");
+	out_printf(o, "xen_node_cpu_hz %llu\n", xenstat_node_cpu_hz(node));
+	out_family(o, "xen_node_memory_bytes", "gauge",
+		   "Total host memory.");
+	out_printf(o, "xen_node_memory_bytes %llu\n",
+		   xenstat_node_tot_mem(node));
+	out_family(o, "xen_node_memory_free_bytes", "gauge",
+		   "Free host memory.");
+	out_printf(o, "xen_node_memory_free_bytes %llu\n",
+		   xenstat_node_free_mem(node));
+	out_family(o, "xen_node_domains", "gauge", "Domains.");
+	out_printf(o, "xen_node_domains %u\n", nr_states);
+
+	out_family(o, "xen_domain_cpu_seconds_total", "counter",
+		   "CPU time used by the domain.");
+	FOR_EACH_DOMAIN(node, i, domain, st)
+		out_printf(o, "xen_domain_cpu_seconds_total" LABELS " %.9f\n",
+			   LABEL_ARGS(domain), st->cpu_ns / 1e9);
+
+	out_family(o, "xen_domain_cpu_usage", "gauge",
+		   "CPU seconds used per second over the last interval.");
+	FOR_EACH_DOMAIN(node, i, domain, st)
+		if (st->have_rates)
+			out_printf(o, "xen_domain_cpu_usage" LABELS " %.6f\n",
+				   LABEL_ARGS(domain), st->cpu_rate);
+
+	out_family(o, "xen_domain_vcpus", "gauge", "VCPUs of the domain.");
+	FOR_EACH_DOMAIN(node, i, domain, st)
+		out_printf(o, "xen_domain_vcpus" LABELS " %u\n",
+			   LABEL_ARGS(domain), xenstat_domain_num_vcpus(domain));
+
+	out_family(o, "xen_domain_vcpus_online", "gauge",
+		   "Online VCPUs of the domain.");
+	FOR_EACH_DOMAIN(node, i, domain, st) {
+		unsigned int v, online = 0;
+
+		for (v = 0; v < xenstat_domain_num_vcpus(domain); v++) {
+			xenstat_vcpu *vcpu = xenstat_domain_vcpu(domain, v);
+
+			if (vcpu != NULL && xenstat_vcpu_online(vcpu))
+				online++;
+		}
+		out_printf(o, "xen_domain_vcpus_online" LABELS " %u\n",
+			   LABEL_ARGS(domain), online);
+	}
+
+	out_family(o, "xen_domain_memory_bytes", "gauge",
+		   "Memory allocated to the domain.");
+	FOR_EACH_DOMAIN(node, i, domain, st)
+		out_printf(o, "xen_domain_memory_bytes" LABELS " %llu\n",
+			   LABEL_ARGS(domain), xenstat_domain_cur_mem(domain));
+
+	out_family(o, "xen_domain_memory_max_bytes", "gauge",
+		   "Memory limit of the domain.");
+	FOR_EACH_DOMAIN(node, i, domain, st)
+		out_printf(o, "xen_domain_memory_max_bytes" LABELS " %llu\n",
+			   LABEL_ARGS(domain), xenstat_domain_max_mem(domain));
+
+	out_family(o, "xen_domain_state", "gauge",
+		   "Whether the domain is in the given state.");
+	FOR_EACH_DOMAIN(node, i, domain, st)
+		for (s = 0; s < sizeof(states_info) / sizeof(states_info[0]);
+		     s++)
+			out_printf(o, "xen_domain_state{domid=\"%u\",name=\"%s\","
+				   "state=\"%s\"} %u\n", LABEL_ARGS(domain),
+				   states_info[s].name,
+				   !!states_info[s].get(domain));
+
+	render_counter(o, node, "xen_domain_network_receive_bytes_total",
+		       "Bytes received by the domain's VIFs.", 1,
+		       NET_RBYTES, 1);
+	render_counter(o, node, "xen_domain_network_transmit_bytes_total",
+		       "Bytes transmitted by the domain's VIFs.", 1,
+		       NET_TBYTES, 1);
+	render_counter(o, node, "xen_domain_network_receive_packets_total",
+		       "Packets received by the domain's VIFs.", 1,
+		       NET_RPKTS, 1);
+	render_counter(o, node, "xen_domain_network_transmit_packets_total",
+		       "Packets transmitted by the domain's VIFs.", 1,
+		       NET_TPKTS, 1);
+	render_counter(o, node, "xen_domain_network_receive_errors_total",
+		       "Receive errors on the domain's VIFs.", 1,
+		       NET_RERRS, 1);
+	render_counter(o, node, "xen_domain_network_transmit_errors_total",
+		       "Transmit errors on the domain's VIFs.", 1,
+		       NET_TERRS, 1);
+	render_counter(o, node, "xen_domain_network_receive_drops_total",
+		       "Receive drops on the domain's VIFs.", 1,
+		       NET_RDROP, 1);
+	render_counter(o, node, "xen_domain_network_transmit_drops_total",
+		       "Transmit drops on the domain's VIFs.", 1,
+		       NET_TDROP, 1);
+	render_rate(o, node, "xen_domain_network_receive_bytes_per_second",
+		    "Receive rate over the last interval.", get_net_rate, 0);
+	render_rate(o, node, "xen_domain_network_transmit_bytes_per_second",
+		    "Transmit rate over the last interval.", get_net_rate, 1);
+
+	render_counter(o, node, "xen_domain_vbd_oo_requests_total",
+		       "Times the domain's VBD request rings were full.", 0,
+		       VBD_OO, 1);
+	render_counter(o, node, "xen_domain_vbd_read_requests_total",
+		       "Read requests issued on the domain's VBDs.", 0,
+		       VBD_RD, 1);
+	render_counter(o, node, "xen_domain_vbd_write_requests_total",
+		       "Write requests issued on the domain's VBDs.", 0,
+		       VBD_WR, 1);
+	render_counter(o, node, "xen_domain_vbd_read_bytes_total",
+		       "Bytes read through the domain's VBDs.", 0,
+		       VBD_RD_SECT, SECTOR_SIZE);
+	render_counter(o, node, "xen_domain_vbd_write_bytes_total",
+		       "Bytes written through the domain's VBDs.", 0,
+		       VBD_WR_SECT, SECTOR_SIZE);
+	render_rate(o, node, "xen_domain_vbd_read_requests_per_second",
+		    "Read request rate over the last interval.",
+		    get_vbd_rate, 0);
+	render_rate(o, node, "xen_domain_vbd_write_requests_per_second",
+		    "Write request rate over the last interval.",
+		    get_vbd_rate, 1);
+	render_rate(o, node, "xen_domain_vbd_read_bytes_per_second",
+		    "Read throughput over the last interval.",
+		    get_vbd_rate, 2);
+	render_rate(o, node, "xen_domain_vbd_write_bytes_per_second",
+		    "Write throughput over the last interval.",
+		    get_vbd_rate, 3);
+
+	out_family(o, "xen_exporter_collections_total", "counter",
+		   "Samples taken by the exporter.");
+	out_printf(o, "xen_exporter_collections_total %llu\n",
+		   nr_collections);
+	out_family(o, "xen_exporter_collect_errors_total", "counter",
+		   "Samples which failed.");
+	out_printf(o, "xen_exporter_collect_errors_total %llu\n",
+		   nr_collect_errors);
+	out_family(o, "xen_exporter_collect_seconds", "gauge",
+		   "Time taken by the last sample.");
+	out_printf(o, "xen_exporter_collect_seconds %.6f\n",
+		   last_collect_secs);
+}
+
+static void page_put(struct page *page)
+{
+	if (page != NULL && --page->refs == 0)
+		free(page);
+}
+
+/* Take a sample and replace the current page with its rendering */
+static void collect(void)
+{
+	struct timespec start, end;
+	struct outbuf o = { NULL, 0, 0, 0 };
+	struct dom_state *new;
+	struct page *page;
+	xenstat_node *node;
+	unsigned long long timestamp;
+	double io_dt, cpu_dt;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	nr_collections++;
+	node = xenstat_get_node(xhandle, XENSTAT_VCPU | XENSTAT_NETWORK |
+					 XENSTAT_VBD);
+	if (node == NULL) {
+		nr_collect_errors++;
+		log_msg(LOG_WARNING, "Failed to collect statistics");
+		return;
+	}
+
+	/*
+	 * Domain and vcpu statistics read from the shared statistics region
+	 * were sampled by Xen at the node's timestamp, up to one update period
+	 * ago, so rates of them are over the difference between timestamps.
+	 * If the region hasn't been updated since the last sample there is
+	 * nothing new: keep the current page.  The network and block device
+	 * counters are read by the library as it's called.
+	 */
+	timestamp = xenstat_node_timestamp(node);
+	if (states != NULL && timestamp != 0 && timestamp == last_timestamp) {
+		xenstat_free_node(node);
+		return;
+	}
+	io_dt = states != NULL ? ts_diff(&start, &last_sample) : 0;
+	if (timestamp != 0 && last_timestamp != 0)
+		cpu_dt = timestamp > last_timestamp ?
+			 (timestamp - last_timestamp) / 1e9 : 0;
+	else
+		cpu_dt = io_dt;
+
+	new = update_states(node, cpu_dt, io_dt);
+	if (new == NULL) {
+		nr_collect_errors++;
+		xenstat_free_node(node);
+		return;
+	}
+	free(states);
+	states = new;
+	nr_states = xenstat_node_num_domains(node);
+	last_sample = start;
+	last_timestamp = timestamp;
+
+	/* Leave room to place the page header in front of the text. */
+	o.size = current_page ? current_page->len + 4096 : 65536;
+	o.buf = malloc(o.size);
+	if (o.buf == NULL) {
+		xenstat_free_node(node);
+		return;
+	}
+	o.len = sizeof(struct page);
+	render(&o, node);
+	xenstat_free_node(node);
+
+	if (o.oom) {
+		nr_collect_errors++;
+		free(o.buf);
+		return;
+	}
+
+	page = (struct page *)o.buf;
+	page->refs = 1;
+	page->len = o.len - sizeof(struct page);
+	page_put(current_page);
+	current_page = page;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	last_collect_secs = ts_diff(&end, &start);
+}
+
+static int set_nonblock(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		return -1;
+	return fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+static int listen_unix(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		log_msg(LOG_ERR, "Socket path too long: %s", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+	    chmod(path, 0660) == -1 || listen(fd, 16) == -1 ||
+	    set_nonblock(fd) == -1) {
+		log_msg(LOG_ERR, "Failed to listen on %s: %s", path,
+			strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int listen_tcp(const char *address, int port)
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET };
+	int fd, one = 1;
+
+	addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+		log_msg(LOG_ERR, "Bad listen address: %s", address);
+		return -1;
+	}
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+	    listen(fd, 16) == -1 || set_nonblock(fd) == -1) {
+		log_msg(LOG_ERR, "Failed to listen on %s:%d: %s", address,
+			port, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void client_close(unsigned int i)
+{
+	close(clients[i].fd);
+	page_put(clients[i].page);
+	clients[i] = clients[--nr_clients];
+}
+
+static void client_accept(int lfd)
+{
+	struct client *c;
+	int fd;
+
+	while ((fd = accept(lfd, NULL, NULL)) != -1) {
+		if (nr_clients == MAX_CLIENTS || set_nonblock(fd) == -1) {
+			close(fd);
+			continue;
+		}
+		c = &clients[nr_clients++];
+		memset(c, 0, sizeof(*c));
+		c->fd = fd;
+		clock_gettime(CLOCK_MONOTONIC, &c->start);
+	}
+}
+
+/* Prepare the response once the request has been read */
+static void client_respond(struct client *c)
+{
+	static const char not_ready[] = "No sample taken yet\n";
+	static const char not_found[] = "Not found\n";
+	const char *status = "200 OK";
+	char path[64] = "";
+
+	c->req[c->req_len] = '\0';
+	if (sscanf(c->req, "GET %63s", path) != 1) {
+		status = "405 Method Not Allowed";
+		c->body = not_found;
+		c->body_len = sizeof(not_found) - 1;
+	} else if (strcmp(path, "/") && strcmp(path, "/metrics")) {
+		status = "404 Not Found";
+		c->body = not_found;
+		c->body_len = sizeof(not_found) - 1;
+	} else if (current_page == NULL) {
+		status = "503 Service Unavailable";
+		c->body = not_ready;
+		c->body_len = sizeof(not_ready) - 1;
+	} else {
+		c->page = current_page;
+		c->page->refs++;
+		c->body = c->page->data;
+		c->body_len = c->page->len;
+	}
+
+	c->hdr_len = snprintf(c->hdr, sizeof(c->hdr),
+			      "HTTP/1.0 %s\r\n"
+			      "Content-Type: text/plain; version=0.0.4\r\n"
+			      "Content-Length: %zu\r\n"
+			      "Connection: close\r\n\r\n", status, c->body_len);
+	c->sent = 0;
+}
+
+/* Returns 0 when the client should be closed */
+static int client_io(struct client *c, short revents)
+{
+	struct iovec iov[2];
+	ssize_t n;
+
+	if (c->body == NULL) {
+		if (!(revents & (POLLIN | POLLHUP)))
+			return 1;
+		n = read(c->fd, c->req + c->req_len,
+			 sizeof(c->req) - 1 - c->req_len);
+		if (n < 0)
+			return errno == EAGAIN || errno == EINTR;
+		c->req_len += n;
+		c->req[c->req_len] = '\0';
+		if (n > 0 && !strstr(c->req, "\r\n\r\n") &&
+		    !strstr(c->req, "\n\n") &&
+		    c->req_len < sizeof(c->req) - 1)
+			return 1;
+		client_respond(c);
+	}
+
+	if (c->sent < c->hdr_len) {
+		iov[0].iov_base = c->hdr + c->sent;
+		iov[0].iov_len = c->hdr_len - c->sent;
+		iov[1].iov_base = (void *)c->body;
+		iov[1].iov_len = c->body_len;
+		n = writev(c->fd, iov, 2);
+	} else
+		n = write(c->fd, c->body + (c->sent - c->hdr_len),
+			  c->body_len - (c->sent - c->hdr_len));
+	if (n < 0)
+		return errno == EAGAIN || errno == EINTR;
+	c->sent += n;
+
+	return c->sent < c->hdr_len + c->body_len;
+}
+
+static void handle_signal(int sig)
+{
+	quit = 1;
+}
+
+static void usage(const char *program)
+{
+	printf("Usage: %s [OPTION]\n"
+	       "Serves Xen domain statistics in the Prometheus text format\n\n"
+	       "-h, --help           display this help and exit\n"
+	       "-i, --interval=MS    milliseconds between samples (default %u)\n"
+	       "-s, --socket=PATH    local socket to serve on (default %s)\n"
+	       "-p, --port=PORT      also serve on this TCP port\n"
+	       "-a, --address=ADDR   address for --port (default %s)\n"
+	       "-f, --foreground     do not daemonize, log to stderr\n",
+	       program, DEFAULT_INTERVAL_MS, DEFAULT_SOCKET, opts.address);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option lopts[] = {
+		{ "help",       no_argument,       NULL, 'h' },
+		{ "interval",   required_argument, NULL, 'i' },
+		{ "socket",     required_argument, NULL, 's' },
+		{ "port",       required_argument, NULL, 'p' },
+		{ "address",    required_argument, NULL, 'a' },
+		{ "foreground", no_argument,       NULL, 'f' },
+		{ 0, 0, 0, 0 },
+	};
+	struct pollfd pfds[2 + MAX_CLIENTS];
+	struct sigaction sa = { .sa_handler = handle_signal };
+	struct timespec next, now;
+	unsigned int i, nfds;
+	int opt, timeout;
+
+	while ((opt = getopt_long(argc, argv, "hi:s:p:a:f", lopts,
+				  NULL)) != -1) {
+		switch (opt) {
+		case 'i':
+			opts.interval_ms = strtoul(optarg, NULL, 10);
+			if (opts.interval_ms < MIN_INTERVAL_MS)
+				opts.interval_ms = MIN_INTERVAL_MS;
+			break;
+		case 's':
+			opts.socket_path = optarg;
+			break;
+		case 'p':
+			opts.port = atoi(optarg);
+			break;
+		case 'a':
+			opts.address = optarg;
+			break;
+		case 'f':
+			opts.foreground = 1;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!opts.foreground)
+		openlog("xenstat-exporter", LOG_PID, LOG_DAEMON);
+
+	xhandle = xenstat_init();
+	if (xhandle == NULL) {
+		log_msg(LOG_ERR, "Failed to initialize xenstat library");
+		return 1;
+	}
+
+	listen_fds[0] = listen_unix(opts.socket_path);
+	if (listen_fds[0] == -1)
+		return 1;
+	if (opts.port >= 0) {
+		listen_fds[1] = listen_tcp(opts.address, opts.port);
+		if (listen_fds[1] == -1)
+			return 1;
+	}
+
+	if (!opts.foreground && daemon(0, 0) == -1) {
+		log_msg(LOG_ERR, "Failed to daemonize: %s", strerror(errno));
+		return 1;
+	}
+
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	while (!quit) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (ts_diff(&now, &next) >= 0) {
+			collect();
+			ts_add_ms(&next, opts.interval_ms);
+			/* Don't try to catch up after a stall */
+			if (ts_diff(&now, &next) >= 0) {
+				next = now;
+				ts_add_ms(&next, opts.interval_ms);
+			}
+			clock_gettime(CLOCK_MONOTONIC, &now);
+		}
+
+		/* Drop clients which are too slow or never send a request */
+		for (i = 0; i < nr_clients; )
+			if (ts_diff(&now, &clients[i].start) * 1000 >
+			    CLIENT_TIMEOUT_MS)
+				client_close(i);
+			else
+				i++;
+
+		nfds = 0;
+		for (i = 0; i < 2; i++)
+			if (listen_fds[i] != -1) {
+				pfds[nfds].fd = listen_fds[i];
+				pfds[nfds++].events = POLLIN;
+			}
+		for (i = 0; i < nr_clients; i++) {
+			pfds[nfds + i].fd = clients[i].fd;
+			pfds[nfds + i].events = clients[i].body ? POLLOUT
+								: POLLIN;
+		}
+
+		timeout = ts_diff(&next, &now) * 1000 + 1;
+		if (timeout < 0)
+			timeout = 0;
+		if (poll(pfds, nfds + nr_clients, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			log_msg(LOG_ERR, "poll failed: %s", strerror(errno));
+			break;
+		}
+
+		/*
+		 * Service clients before accepting, as accepting may move
+		 * them around in clients[].  Closing does too, so walk
+		 * backwards.
+		 */
+		for (i = nr_clients; i-- > 0; )
+			if (pfds[nfds + i].revents &&
+			    !client_io(&clients[i], pfds[nfds + i].revents))
+				client_close(i);
+
+		for (i = 0; i < nfds; i++)
+			if (pfds[i].revents & POLLIN)
+				client_accept(pfds[i].fd);
+	}
+
+	while (nr_clients)
+		client_close(0);
+	for (i = 0; i < 2; i++)
+		if (listen_fds[i] != -1)
+			close(listen_fds[i]);
+	unlink(opts.socket_path);
+	page_put(current_page);
+	free(states);
+	xenstat_uninit(xhandle);
+
+	return 0;
+}
@@ -212,6 +212,7 @@ int show_vbds = 0;
 int show_tmem = 0;
 int repeat_header = 0;
 int show_full_name = 0;
+int stats_period = -1;
 #define PROMPT_VAL_LEN 80
 char *prompt = NULL;
 char prompt_val[PROMPT_VAL_LEN];
@@ -241,6 +242,8 @@ static void usage(const char *program)
 	       "-b, --batch	     output in batch mode, no user input accepted\n"
 	       "-i, --iterations     number of iterations before exiting\n"
 	       "-f, --full-name      output the full domain name (not truncated)\n"
+	       "-S, --stats-period=MS turn the shared statistics region on, updated\n"
+	       "                     every MS milliseconds, or off if MS is 0\n"
 	       "\n" XENTOP_BUGSTO,
 	       program);
 	return;
@@ -514,9 +517,17 @@ static double get_cpu_pct(xenstat_domain *domain)
 	if(old_domain == NULL)
 		return 0.0;
 
-	/* Calculate the time elapsed in microseconds */
-	us_elapsed = ((curtime.tv_sec-oldtime.tv_sec)*1000000.0
-		      +(curtime.tv_usec - oldtime.tv_usec));
+	/* Calculate the time elapsed in microseconds, between the samples
+	 * themselves if they came from the shared statistics region */
+	if(xenstat_node_timestamp(cur_node) != 0 &&
+	   xenstat_node_timestamp(prev_node) != 0)
+		us_elapsed = (xenstat_node_timestamp(cur_node)
+			      -xenstat_node_timestamp(prev_node))/1000.0;
+	else
+		us_elapsed = ((curtime.tv_sec-oldtime.tv_sec)*1000000.0
+			      +(curtime.tv_usec - oldtime.tv_usec));
+	if(us_elapsed <= 0.0)
+		return 0.0;
 
 	/* In the following, nanoseconds must be multiplied by 1000.0 to
 	 * convert to microseconds, then divided by 100.0 to get a percentage,
@@ -1106,16 +1117,26 @@ void do_tmem(xenstat_domain *domain)
 static void top(void)
 {
 	xenstat_domain **domains;
+	xenstat_node *node;
 	unsigned int i, num_domains = 0;
 
 	/* Now get the node information */
-	if (prev_node != NULL)
-		xenstat_free_node(prev_node);
-	prev_node = cur_node;
-	cur_node = xenstat_get_node(xhandle, XENSTAT_ALL);
-	if (cur_node == NULL)
+	node = xenstat_get_node(xhandle, XENSTAT_ALL);
+	if (node == NULL)
 		fail("Failed to retrieve statistics from libxenstat\n");
 
+	/* If the shared statistics region hasn't been updated since the last
+	 * sample, keep measuring from the one before it. */
+	if (cur_node != NULL && xenstat_node_timestamp(node) != 0 &&
+	    xenstat_node_timestamp(node) == xenstat_node_timestamp(cur_node)) {
+		xenstat_free_node(cur_node);
+	} else {
+		if (prev_node != NULL)
+			xenstat_free_node(prev_node);
+		prev_node = cur_node;
+	}
+	cur_node = node;
+
 	/* dump summary top information */
 	if (!batch)
 		do_summary();
@@ -1188,9 +1209,10 @@ int main(int argc, char **argv)
 		{ "batch",	   no_argument,	      NULL, 'b' },
 		{ "iterations",	   required_argument, NULL, 'i' },
 		{ "full-name",     no_argument,       NULL, 'f' },
+		{ "stats-period",  required_argument, NULL, 'S' },
 		{ 0, 0, 0, 0 },
 	};
-	const char *sopts = "hVnxrvd:bi:f";
+	const char *sopts = "hVnxrvd:bi:fS:";
 
 	if (atexit(cleanup) != 0)
 		fail("Failed to install cleanup handler.\n");
@@ -1235,6 +1257,9 @@ int main(int argc, char **argv)
 		case 't':
 			show_tmem = 1;
 			break;
+		case 'S':
+			stats_period = atoi(optarg);
+			break;
 		}
 	}
 
@@ -1243,6 +1268,9 @@ int main(int argc, char **argv)
 	if (xhandle == NULL)
 		fail("Failed to initialize xenstat library\n");
 
+	if (stats_period >= 0 && xenstat_stats_enable(xhandle, stats_period) < 0)
+		fail("Failed to set the statistics region period\n");
+
 	if (!batch) {
 		/* Begin curses stuff */
 		cwin = initscr();
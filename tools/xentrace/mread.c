@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <strings.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -27,9 +29,30 @@ mread_handle_t mread_init(int fd)
     fstat(fd, &s);
     h->file_size = s.st_size;
 
+    /*
+     * Where the address space allows, map the whole file once: records
+     * can then be read without any remapping, and by several threads.
+     * Otherwise fall back to the cache of windows below.
+     */
+    if ( h->file_size > 0 && (uint64_t)h->file_size <= SIZE_MAX / 2 )
+    {
+        h->whole = mmap(NULL, h->file_size, PROT_READ, MAP_SHARED, fd, 0);
+        if ( h->whole == MAP_FAILED )
+            h->whole = NULL;
+    }
+
     return h;
 }
 
+const void *mread_ptr(mread_handle_t h, off_t offset, size_t len)
+{
+    if ( !h->whole || offset < 0 || offset > h->file_size
+         || len > (uint64_t)(h->file_size - offset) )
+        return NULL;
+
+    return h->whole + offset;
+}
+
 ssize_t mread64(mread_handle_t h, void *rec, ssize_t len, off_t offset)
 {
     /* Idea: have a "cache" of N mmaped regions.  If the offset is
@@ -66,6 +89,12 @@ ssize_t mread64(mread_handle_t h, void *rec, ssize_t len, off_t offset)
         len = h->file_size - offset;
     }
 
+    if ( h->whole )
+    {
+        memcpy(rec, h->whole + offset, len);
+        return len;
+    }
+
     /* Try to find the offset in our range */
     dprintf(warn, " Trying last, %d\n", last);
     if ( h->map[h->last].buffer
@@ -1,3 +1,8 @@
+#ifndef __MREAD_H
+#define __MREAD_H
+
+#include <sys/types.h>
+
 #define MREAD_MAPS 8
 #define MREAD_BUF_SHIFT 9
 #define PAGE_SHIFT 12
@@ -6,6 +11,8 @@
 typedef struct mread_ctrl {
     int fd;
     off_t file_size;
+    /* The whole file, if it could be mapped in one go. */
+    char * whole;
     struct mread_buffer {
         char * buffer;
         off_t start_offset;
@@ -16,3 +23,7 @@ typedef struct mread_ctrl {
 
 mread_handle_t mread_init(int fd);
 ssize_t mread64(mread_handle_t h, void *dst, ssize_t len, off_t offset);
+/* Thread-safe; returns a pointer into the file, or NULL if not mapped whole. */
+const void *mread_ptr(mread_handle_t h, off_t offset, size_t len);
+
+#endif
@@ -0,0 +1,225 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <xen/trace.h>
+#include "analyze.h"
+#include "tindex.h"
+
+#define TINDEX_MAGIC "XAIDX001"
+
+struct tindex_header {
+    char magic[8];
+    uint64_t file_size;
+    int64_t mtime;
+    uint64_t nr, end;
+};
+
+static void tindex_header_init(struct tindex_header *hdr, mread_handle_t h)
+{
+    struct stat s;
+
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, TINDEX_MAGIC, sizeof(hdr->magic));
+    hdr->file_size = h->file_size;
+    if ( !fstat(h->fd, &s) )
+        hdr->mtime = s.st_mtime;
+}
+
+static tindex_handle_t tindex_load(const char *fn, mread_handle_t h)
+{
+    struct tindex_header want, hdr;
+    tindex_handle_t ix = NULL;
+    int fd;
+
+    if ( (fd = open(fn, O_RDONLY)) < 0 )
+        return NULL;
+
+    tindex_header_init(&want, h);
+    if ( read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+         || memcmp(hdr.magic, want.magic, sizeof(hdr.magic))
+         || hdr.file_size != want.file_size
+         || hdr.mtime != want.mtime
+         || hdr.end > hdr.file_size
+         || hdr.nr > hdr.file_size / TINDEX_CPU_CHANGE_SIZE )
+        goto out;
+
+    if ( (ix = calloc(1, sizeof(*ix))) == NULL
+         || (ix->w = malloc((hdr.nr ?: 1) * sizeof(*ix->w))) == NULL )
+        goto fail;
+
+    if ( read(fd, ix->w, hdr.nr * sizeof(*ix->w))
+         != (ssize_t)(hdr.nr * sizeof(*ix->w)) )
+        goto fail;
+
+    ix->nr = hdr.nr;
+    ix->end = hdr.end;
+    goto out;
+
+ fail:
+    tindex_free(ix);
+    ix = NULL;
+ out:
+    close(fd);
+    return ix;
+}
+
+static void tindex_save(const char *fn, mread_handle_t h, tindex_handle_t ix)
+{
+    struct tindex_header hdr;
+    char *tmp;
+    int fd, ok;
+
+    if ( asprintf(&tmp, "%s.tmp", fn) < 0 )
+        return;
+
+    if ( (fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0 )
+    {
+        fprintf(stderr, "%s: can't create %s, not saving index\n",
+                __func__, tmp);
+        free(tmp);
+        return;
+    }
+
+    tindex_header_init(&hdr, h);
+    hdr.nr = ix->nr;
+    hdr.end = ix->end;
+
+    ok = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr)
+        && write(fd, ix->w, ix->nr * sizeof(*ix->w))
+           == (ssize_t)(ix->nr * sizeof(*ix->w));
+    ok = !close(fd) && ok;
+
+    /* Only ever expose complete index files. */
+    if ( !ok || rename(tmp, fn) )
+    {
+        fprintf(stderr, "%s: failed to write %s\n", __func__, fn);
+        unlink(tmp);
+    }
+
+    free(tmp);
+}
+
+static tindex_handle_t tindex_build(mread_handle_t h)
+{
+    tindex_handle_t ix;
+    uint64_t offset = 0, max = 1024;
+    struct trace_record rec;
+
+    if ( (ix = calloc(1, sizeof(*ix))) == NULL
+         || (ix->w = malloc(max * sizeof(*ix->w))) == NULL )
+    {
+        perror("malloc");
+        exit(1);
+    }
+
+    /* Walk the chain of cpu_change records, which xentrace writes at the
+     * start of every window. */
+    while ( mread64(h, &rec, TINDEX_CPU_CHANGE_SIZE, offset)
+            == TINDEX_CPU_CHANGE_SIZE )
+    {
+        struct tindex_window *w;
+        uint32_t cpu = rec.u.notsc.data[0], size = rec.u.notsc.data[1];
+
+        if ( rec.event != TRC_TRACE_CPU_CHANGE || rec.cycle_flag
+             || rec.extra_words != 2 )
+        {
+            fprintf(stderr, "%s: unexpected record %x at offset %llx, "
+                    "index stops here\n", __func__, rec.event,
+                    (unsigned long long)offset);
+            break;
+        }
+
+        /* Truncated window */
+        if ( offset + TINDEX_CPU_CHANGE_SIZE + size
+             > (uint64_t)h->file_size )
+            break;
+
+        if ( ix->nr == max )
+        {
+            max *= 2;
+            if ( (ix->w = realloc(ix->w, max * sizeof(*ix->w))) == NULL )
+            {
+                perror("realloc");
+                exit(1);
+            }
+        }
+
+        w = ix->w + ix->nr++;
+        w->offset = offset;
+        w->cpu = cpu;
+        w->size = size;
+        w->first_tsc = 0;
+
+        offset += TINDEX_CPU_CHANGE_SIZE;
+        if ( size >= sizeof(uint32_t) + sizeof(uint64_t)
+             && mread64(h, &rec, sizeof(uint32_t) + sizeof(uint64_t),
+                        offset) > 0
+             && rec.cycle_flag )
+            w->first_tsc = ((uint64_t)rec.u.tsc.tsc_hi << 32)
+                | rec.u.tsc.tsc_lo;
+
+        offset += size;
+        ix->end = offset;
+    }
+
+    return ix;
+}
+
+tindex_handle_t tindex_open(mread_handle_t h, const char *trace_file,
+                            int save)
+{
+    tindex_handle_t ix;
+    char *fn;
+
+    if ( asprintf(&fn, "%s.idx", trace_file) < 0 )
+    {
+        perror("asprintf");
+        exit(1);
+    }
+
+    if ( (ix = tindex_load(fn, h)) != NULL )
+        fprintf(stderr, "Using index %s (%llu windows)\n", fn,
+                (unsigned long long)ix->nr);
+    else
+    {
+        ix = tindex_build(h);
+        fprintf(stderr, "Indexed %llu windows\n",
+                (unsigned long long)ix->nr);
+        if ( save )
+            tindex_save(fn, h, ix);
+    }
+
+    free(fn);
+    return ix;
+}
+
+uint64_t tindex_find(tindex_handle_t ix, uint64_t offset)
+{
+    uint64_t lo = 0, hi = ix->nr;
+
+    while ( lo < hi )
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+
+        if ( ix->w[mid].offset < offset )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+void tindex_free(tindex_handle_t ix)
+{
+    if ( !ix )
+        return;
+    free(ix->w);
+    free(ix);
+}
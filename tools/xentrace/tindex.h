@@ -0,0 +1,37 @@
+#ifndef __TINDEX_H
+#define __TINDEX_H
+
+#include <stdint.h>
+#include "mread.h"
+
+/*
+ * Index of the per-cpu windows in a trace file, i.e. of the cpu_change
+ * records written by xentrace, so that a cpu's records can be found
+ * without walking the whole chain of windows.
+ */
+struct tindex_window {
+    uint64_t offset;    /* Of the cpu_change record */
+    uint64_t first_tsc; /* Of the first record with one, or 0 */
+    uint32_t cpu;
+    uint32_t size;      /* Not including the cpu_change record */
+};
+
+typedef struct tindex {
+    uint64_t nr;
+    uint64_t end;       /* Just past the last complete window */
+    struct tindex_window *w;
+} *tindex_handle_t;
+
+#define TINDEX_CPU_CHANGE_SIZE 12
+
+/*
+ * Load the index from the sidecar file "<trace_file>.idx" if it is there
+ * and up to date, or build it and (if @save) write it out.
+ */
+tindex_handle_t tindex_open(mread_handle_t h, const char *trace_file,
+                            int save);
+/* The first window at or after @offset; ix->nr if there is none. */
+uint64_t tindex_find(tindex_handle_t ix, uint64_t offset);
+void tindex_free(tindex_handle_t ix);
+
+#endif
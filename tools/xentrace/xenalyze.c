@@ -28,9 +28,11 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <xen/trace.h>
 #include "analyze.h"
 #include "mread.h"
+#include "tindex.h"
 #include "pv.h"
 #include <errno.h>
 #include <strings.h>
@@ -66,6 +68,7 @@ struct array_struct {
 struct {
     int fd;
     struct mread_ctrl *mh;
+    struct tindex *index;
     struct symbol_struct * symbols;
     char * symbol_file;
     char * trace_file;
@@ -179,6 +182,8 @@ struct {
         summary:1,
         report_pcpu:1,
         tsc_loop_fatal:1,
+        index:1,
+        index_summary:1,
         summary_info;
     long long cpu_qhz, cpu_hz;
     int scatterplot_interrupt_vector;
@@ -189,6 +194,7 @@ struct {
     int interrupt_eip_enumeration_vector;
     int default_guest_paging_levels;
     int sample_size, sample_max;
+    int threads;
     enum error_level tolerance; /* Tolerate up to this level of error */
     struct {
         tsc_t cycles;
@@ -9104,6 +9110,37 @@ int find_toplevel_event(struct record_info *ri)
 }
 
 
+/*
+ * Use the index to skip over the windows of other cpus without reading
+ * them, stopping at the next window of this pcpu.  Windows which the
+ * normal scan would act on (those of pcpus not yet seen) are still left
+ * to be read, as is anything past the last complete window.
+ */
+static void index_skip_windows(struct pcpu_info *p)
+{
+    struct tindex *ix = G.index;
+    uint64_t i = tindex_find(ix, p->file_offset);
+
+    if(i == ix->nr || ix->w[i].offset != p->file_offset)
+        return;
+
+    for( ; i < ix->nr; i++) {
+        struct tindex_window *w = ix->w + i;
+
+        if(w->cpu == p->pid || w->cpu >= MAX_CPUS
+           || (!P.pcpu[w->cpu].active && P.pcpu[w->cpu].file_offset == 0))
+            break;
+
+        /* As in process_cpu_change() */
+        if((p->last_cpu_change_pid > w->cpu)
+           && (w->offset > P.last_epoch_offset))
+            P.last_epoch_offset = w->offset;
+        p->last_cpu_change_pid = w->cpu;
+    }
+
+    p->file_offset = (i < ix->nr) ? ix->w[i].offset : ix->end;
+}
+
 void process_cpu_change(struct pcpu_info *p) {
     struct record_info *ri = &p->ri;
     struct cpu_change_data *r = (typeof(r))ri->d;
@@ -9166,6 +9203,8 @@ void process_cpu_change(struct pcpu_info *p) {
     if(p->pid != r->cpu)
     {
         p->file_offset += ri->size + r->window_size;
+        if(G.index)
+            index_skip_windows(p);
         p->next_cpu_change_offset = p->file_offset;
 
         if(p->file_offset > G.file_size) {
@@ -9858,6 +9897,219 @@ void report_pcpu(void) {
 
 }
 
+/*
+ * Index summary: per-pcpu statistics which don't depend on the order of
+ * records across pcpus can be gathered from each pcpu's windows on its
+ * own.  The pcpus are shared out between worker threads, and the results
+ * merged at the end.
+ *
+ * This is the only parallel pass.  The per-domain, per-vcpu and irq
+ * summaries of --summary follow vcpus as they move between pcpus, and
+ * need the records of all pcpus in tsc order; they stay on the serial
+ * pass.  The irq counts here are totals of HW_IRQ_HANDLED records only.
+ */
+struct index_summary_pcpu {
+    unsigned long long windows, records, bytes, lost;
+    tsc_t first_tsc, last_tsc;
+    struct trace_volume volume;
+    unsigned long long irq_handled[MAX_IRQ];
+};
+
+static struct {
+    struct index_summary_pcpu *pcpu[MAX_CPUS];
+    int threads;
+} index_summary_state;
+
+static const void *index_window_data(const struct tindex_window *w,
+                                     char **buf, size_t *buf_size)
+{
+    off_t offset = w->offset + TINDEX_CPU_CHANGE_SIZE;
+    const void *d = mread_ptr(G.mh, offset, w->size);
+
+    if(d)
+        return d;
+
+    /* Not mapped: mread64() isn't thread-safe, so read it ourselves. */
+    if(*buf_size < w->size) {
+        free(*buf);
+        *buf_size = w->size;
+        if((*buf = malloc(*buf_size)) == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+    }
+
+    if(pread(G.fd, *buf, w->size, offset) != w->size) {
+        fprintf(stderr, "%s: short read at offset %llx\n", __func__,
+                (unsigned long long)offset);
+        return NULL;
+    }
+
+    return *buf;
+}
+
+static void index_summary_window(struct index_summary_pcpu *s,
+                                 const char *d, unsigned size)
+{
+    unsigned off = 0;
+
+    s->windows++;
+
+    while(off + sizeof(uint32_t) <= size) {
+        const struct trace_record *rec = (const void *)(d + off);
+        const uint32_t *data = rec->u.notsc.data;
+        ssize_t rsize = get_rec_size((struct trace_record *)rec);
+        unsigned mainbits = (rec->event >> 16) & 0xfff;
+        int toplevel;
+
+        if(off + rsize > size)
+            break;
+
+        if(rec->cycle_flag) {
+            tsc_t tsc = ((tsc_t)rec->u.tsc.tsc_hi << 32) | rec->u.tsc.tsc_lo;
+
+            if(!s->first_tsc)
+                s->first_tsc = tsc;
+            s->last_tsc = tsc;
+            data = rec->u.tsc.data;
+        }
+
+        /* One and only one bit should be set; the main pass complains. */
+        if(mainbits && !(mainbits & (mainbits - 1))) {
+            toplevel = ffs(mainbits) - 1;
+            if(toplevel < TOPLEVEL_MAX)
+                s->volume.toplevel[toplevel] += rsize;
+        }
+
+        if(rec->event == TRC_LOST_RECORDS)
+            s->lost += data[0];
+        else if(rec->event == TRC_HW_IRQ_HANDLED && rec->extra_words >= 1
+                && data[0] < MAX_IRQ)
+            s->irq_handled[data[0]]++;
+
+        s->records++;
+        s->bytes += rsize;
+        off += rsize;
+    }
+}
+
+static void *index_summary_worker(void *arg)
+{
+    struct tindex *ix = G.index;
+    int id = (long)arg;
+    char *buf = NULL;
+    size_t buf_size = 0;
+    uint64_t i;
+
+    for(i = 0; i < ix->nr; i++) {
+        const struct tindex_window *w = ix->w + i;
+        const void *d;
+
+        /* Each pcpu is handled by one thread only. */
+        if(w->cpu >= MAX_CPUS
+           || w->cpu % index_summary_state.threads != id)
+            continue;
+
+        if((d = index_window_data(w, &buf, &buf_size)) != NULL)
+            index_summary_window(index_summary_state.pcpu[w->cpu],
+                                 d, w->size);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+void index_summary(void) {
+    struct tindex *ix = G.index;
+    struct index_summary_pcpu total = { 0 }, *s;
+    pthread_t *threads;
+    uint64_t i;
+    int t, j, k;
+
+    for(i = 0; i < ix->nr; i++) {
+        unsigned cpu = ix->w[i].cpu;
+
+        if(cpu < MAX_CPUS && !index_summary_state.pcpu[cpu]
+           && !(index_summary_state.pcpu[cpu] =
+                calloc(1, sizeof(struct index_summary_pcpu)))) {
+            perror("calloc");
+            error(ERR_SYSTEM, NULL);
+        }
+    }
+
+    index_summary_state.threads = opt.threads;
+    if(index_summary_state.threads <= 0)
+        index_summary_state.threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(index_summary_state.threads <= 0)
+        index_summary_state.threads = 1;
+    if(index_summary_state.threads > MAX_CPUS)
+        index_summary_state.threads = MAX_CPUS;
+
+    if((threads = calloc(index_summary_state.threads,
+                          sizeof(*threads))) == NULL) {
+        perror("calloc");
+        error(ERR_SYSTEM, NULL);
+    }
+
+    for(t = 0; t < index_summary_state.threads; t++)
+        if(pthread_create(&threads[t], NULL, index_summary_worker,
+                           (void *)(long)t)) {
+            fprintf(stderr, "%s: failed to create thread %d\n",
+                    __func__, t);
+            error(ERR_SYSTEM, NULL);
+        }
+    for(t = 0; t < index_summary_state.threads; t++)
+        pthread_join(threads[t], NULL);
+    free(threads);
+
+    printf("--- Index summary (%llu windows, %d threads) ---\n",
+           (unsigned long long)ix->nr, index_summary_state.threads);
+
+    for(j = 0; j < MAX_CPUS; j++) {
+        if(!(s = index_summary_state.pcpu[j]))
+            continue;
+
+        printf(" - cpu %d -\n", j);
+        printf(" windows %llu records %llu bytes %llu lost %llu\n",
+               s->windows, s->records, s->bytes, s->lost);
+        if(s->last_tsc > s->first_tsc)
+            printf(" time %.2lf seconds\n",
+                   ((double)(s->last_tsc - s->first_tsc)) / opt.cpu_hz);
+        volume_summary(&s->volume);
+
+        /* Merge */
+        total.windows += s->windows;
+        total.records += s->records;
+        total.bytes += s->bytes;
+        total.lost += s->lost;
+        if(s->first_tsc
+           && (!total.first_tsc || s->first_tsc < total.first_tsc))
+            total.first_tsc = s->first_tsc;
+        if(s->last_tsc > total.last_tsc)
+            total.last_tsc = s->last_tsc;
+        for(k = 0; k < TOPLEVEL_MAX; k++)
+            total.volume.toplevel[k] += s->volume.toplevel[k];
+        for(k = 0; k < MAX_IRQ; k++)
+            total.irq_handled[k] += s->irq_handled[k];
+
+        free(s);
+        index_summary_state.pcpu[j] = NULL;
+    }
+
+    printf(" - total -\n");
+    printf(" windows %llu records %llu bytes %llu lost %llu\n",
+           total.windows, total.records, total.bytes, total.lost);
+    if(total.last_tsc > total.first_tsc)
+        printf(" time %.2lf seconds\n",
+               ((double)(total.last_tsc - total.first_tsc)) / opt.cpu_hz);
+    volume_summary(&total.volume);
+
+    printf("--- IRQs handled ---\n");
+    for ( k = 0; k < MAX_IRQ; k++ )
+        if ( total.irq_handled[k] )
+            printf(" irq %3x: %10llu\n", k, total.irq_handled[k]);
+}
+
 void init_pcpus(void) {
     int i=0;
     off_t offset = 0;
@@ -9928,6 +10180,7 @@ enum {
     OPT_SAMPLE_SIZE,
     OPT_SAMPLE_MAX,
     OPT_REPORT_PCPU,
+    OPT_INDEX_SUMMARY,
     /* Guest info */
     OPT_DEFAULT_GUEST_PAGING_LEVELS,
     OPT_SYMBOL_FILE,
@@ -9938,6 +10191,8 @@ enum {
     OPT_PROGRESS,
     OPT_TOLERANCE,
     OPT_TSC_LOOP_FATAL,
+    OPT_INDEX,
+    OPT_THREADS,
     /* Specific letters */
     OPT_DUMP_ALL='a',
     OPT_INTERVAL_LENGTH='i',
@@ -10367,6 +10622,11 @@ error_t cmd_parser(int key, char *arg, struct argp_state *state)
         //opt.summary_info = 1;
         G.output_defined = 1;
         break;
+    case OPT_INDEX_SUMMARY:
+        /* Runs without the full pass, unless other output is asked for */
+        opt.index_summary = 1;
+        opt.index = 1;
+        break;
         /* Guest info group */
     case OPT_DEFAULT_GUEST_PAGING_LEVELS:
     {
@@ -10418,6 +10678,19 @@ error_t cmd_parser(int key, char *arg, struct argp_state *state)
         opt.tsc_loop_fatal = 1;
         break;
 
+    case OPT_INDEX:
+        opt.index = 1;
+        break;
+
+    case OPT_THREADS:
+    {
+        char *inval;
+        opt.threads = (int)strtol(arg, &inval, 0);
+        if( inval == arg || opt.threads < 0 )
+            argp_usage(state);
+        break;
+    }
+
     case ARGP_KEY_ARG:
     {
         /* FIXME - strcpy */
@@ -10434,7 +10707,7 @@ error_t cmd_parser(int key, char *arg, struct argp_state *state)
             interval_header();
         }
 
-        if(!G.output_defined)
+        if(!G.output_defined && !opt.index_summary)
         {
             fprintf(stderr, "No output defined, using summary.\n");
             opt.summary = 1;
@@ -10674,6 +10947,15 @@ const struct argp_option cmd_opts[] =  {
       .group = OPT_GROUP_SUMMARY,
       .doc = "Report utilization for pcpus", },
 
+    { .name = "index-summary",
+      .key = OPT_INDEX_SUMMARY,
+      .group = OPT_GROUP_SUMMARY,
+      .doc = "Output a quick per-pcpu summary of record volume, lost records "
+      "and irqs handled, gathered in parallel using the index.  Implies "
+      "--index.  Unless other output is requested, the trace is not "
+      "otherwise processed.  The domain, vcpu and interrupt summaries of "
+      "--summary are still produced by the serial pass.", },
+
     /* Guest info */
     { .name = "default-guest-paging-levels",
       .key = OPT_DEFAULT_GUEST_PAGING_LEVELS,
@@ -10703,6 +10985,18 @@ const struct argp_option cmd_opts[] =  {
       .key = OPT_PROGRESS,
       .doc = "Progress dialog.  Requires the zenity (GTK+) executable.", },
 
+    { .name = "index",
+      .key = OPT_INDEX,
+      .doc = "Index the windows of each pcpu in the trace file, saving the "
+      "index alongside it as <file>.idx for later runs, and use it to skip "
+      "the records of other pcpus.", },
+
+    { .name = "threads",
+      .key = OPT_THREADS,
+      .arg = "N",
+      .doc = "Number of threads for parallel passes (default: one per "
+      "online cpu).", },
+
     { .name = "tsc-loop-fatal",
       .key = OPT_TSC_LOOP_FATAL,
       .doc = "Stop processing and exit if tsc skew tracking detects a dependency loop.", },
@@ -10747,6 +11041,15 @@ int main(int argc, char *argv[]) {
     if ( (G.mh = mread_init(G.fd)) == NULL )
         perror("mread");
 
+    if(opt.index)
+        G.index = tindex_open(G.mh, G.trace_file, 1);
+
+    if(opt.index_summary) {
+        index_summary();
+        if(!G.output_defined)
+            return 0;
+    }
+
     if (G.symbol_file != NULL)
         parse_symbol_file(G.symbol_file);
 
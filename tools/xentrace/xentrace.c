@@ -26,6 +26,8 @@
 #include <ctype.h>
 #include <sys/poll.h>
 #include <sys/statvfs.h>
+#include <sys/uio.h>
+#include <limits.h>
 
 #include <xen/xen.h>
 #include <xen/trace.h>
@@ -62,7 +64,8 @@ typedef struct settings_st {
     unsigned long memory_buffer;
     uint8_t discard:1,
         disable_tracing:1,
-        start_disabled:1;
+        start_disabled:1,
+        merge:1;
 } settings_t;
 
 struct t_struct {
@@ -332,50 +335,116 @@ fail:
     return;
 }
 
-/**
- * write_buffer - write a section of the trace buffer
- * @cpu      - source buffer CPU ID
- * @start
- * @size     - size of write (may be less than total window size)
- * @total_size - total size of the window (0 on 2nd write of wrapped windows)
- * @out      - output stream
+/*
+ * Output batching.
  *
- * Outputs the trace buffer to a filestream, prepending the CPU and size
- * of the buffer write.
+ * Everything collected in a polling round is written out with a single
+ * writev(), pointing straight into the mapped trace buffers rather than
+ * copying the records.  The buffers' consumer pointers must therefore only
+ * be advanced after out_flush().
  */
-static void write_buffer(unsigned int cpu, unsigned char *start, int size,
-                         int total_size)
+static struct iovec *out_iov;
+static unsigned int out_iov_nr, out_iov_max;
+static struct cpu_change_record *out_recs; /* One window per cpu per round. */
+
+static void out_init(unsigned int num)
 {
-    struct statvfs stat;
-    size_t written = 0;
-    
-    if ( opts.memory_buffer == 0 && opts.disk_rsvd != 0 )
+    /* Per cpu: a cpu change record plus up to two chunks; plus a merge. */
+    out_iov_max = 3 * num + 1;
+    out_iov = calloc(out_iov_max, sizeof(*out_iov));
+    out_recs = calloc(num, sizeof(*out_recs));
+    if ( !out_iov || !out_recs )
     {
-        unsigned long long freespace;
+        PERROR("Failed to allocate output vectors");
+        exit(EXIT_FAILURE);
+    }
+}
 
-        /* Check that filesystem has enough space. */
-        if ( fstatvfs (outfd, &stat) )
-        {
-            fprintf(stderr, "Statfs failed!\n");
-            goto fail;
-        }
+static void out_queue(void *base, size_t len)
+{
+    assert(out_iov_nr < out_iov_max);
+    out_iov[out_iov_nr].iov_base = base;
+    out_iov[out_iov_nr].iov_len = len;
+    out_iov_nr++;
+}
 
-        freespace = stat.f_frsize * (unsigned long long)stat.f_bfree;
+static void out_flush(void)
+{
+    struct iovec *iov = out_iov;
+    unsigned int nr = out_iov_nr;
 
-        if ( total_size )
-            freespace -= total_size;
-        else
-            freespace -= size;
+    while ( nr )
+    {
+        ssize_t written = writev(outfd, iov, nr < IOV_MAX ? nr : IOV_MAX);
 
-        freespace >>= 20; /* Convert to MB */
+        if ( written < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            PERROR("Failed to write trace data");
+            exit(EXIT_FAILURE);
+        }
 
-        if ( freespace <= opts.disk_rsvd )
+        /* Skip what was written, allowing for short writes. */
+        while ( nr && (size_t)written >= iov->iov_len )
+        {
+            written -= iov->iov_len;
+            iov++;
+            nr--;
+        }
+        if ( nr )
         {
-            fprintf(stderr, "Disk space limit reached (free space: %lluMB, limit: %luMB).\n", freespace, opts.disk_rsvd);
-            exit (EXIT_FAILURE);
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
         }
     }
 
+    out_iov_nr = 0;
+}
+
+static void check_disk_space(unsigned long size)
+{
+    struct statvfs stat;
+    unsigned long long freespace;
+
+    if ( opts.memory_buffer != 0 || opts.disk_rsvd == 0 )
+        return;
+
+    /* Check that filesystem has enough space. */
+    if ( fstatvfs (outfd, &stat) )
+    {
+        fprintf(stderr, "Statfs failed!\n");
+        PERROR("Failed to write trace data");
+        exit(EXIT_FAILURE);
+    }
+
+    freespace = stat.f_frsize * (unsigned long long)stat.f_bfree;
+    freespace -= size;
+    freespace >>= 20; /* Convert to MB */
+
+    if ( freespace <= opts.disk_rsvd )
+    {
+        fprintf(stderr, "Disk space limit reached (free space: %lluMB, limit: %luMB).\n", freespace, opts.disk_rsvd);
+        exit (EXIT_FAILURE);
+    }
+}
+
+/**
+ * write_buffer - write a section of the trace buffer
+ * @cpu      - source buffer CPU ID
+ * @start
+ * @size     - size of write (may be less than total window size)
+ * @total_size - total size of the window (0 on 2nd write of wrapped windows)
+ *
+ * Outputs the trace buffer to the memory buffer, or queues it for output to
+ * the file (see out_flush()), prepending the CPU and size of the buffer
+ * write.
+ */
+static void write_buffer(unsigned int cpu, unsigned char *start, int size,
+                         int total_size)
+{
+    check_disk_space(total_size ? total_size : size);
+
     /* Write a CPU_BUF record on each buffer "window" written.  Wrapped
      * windows may involve two writes, so only write the record on the
      * first write. */
@@ -387,19 +456,13 @@ static void write_buffer(unsigned int cpu, unsigned char *start, int size,
         }
         else
         {
-            struct cpu_change_record rec;
+            struct cpu_change_record *rec = &out_recs[cpu];
 
-            rec.header = CPU_CHANGE_HEADER;
-            rec.data.cpu = cpu;
-            rec.data.window_size = total_size;
+            rec->header = CPU_CHANGE_HEADER;
+            rec->data.cpu = cpu;
+            rec->data.window_size = total_size;
 
-            written = write(outfd, &rec, sizeof(rec));
-            if ( written != sizeof(rec) )
-            {
-                fprintf(stderr, "Cannot write cpu change (write returned %zd)\n",
-                        written);
-                goto fail;
-            }
+            out_queue(rec, sizeof(*rec));
         }
     }
 
@@ -409,20 +472,206 @@ static void write_buffer(unsigned int cpu, unsigned char *start, int size,
     }
     else
     {
-        written = write(outfd, start, size);
-        if ( written != size )
-        {
-            fprintf(stderr, "Write failed! (size %d, returned %zd)\n",
-                    size, written);
-            goto fail;
-        }
+        out_queue(start, size);
     }
+}
 
-    return;
+/*
+ * Time-ordered merging (-m).
+ *
+ * The windows collected from all cpus in a polling round are merged by TSC
+ * into a staging buffer, as a sequence of (short) cpu windows.  Records
+ * without a timestamp stay with the record preceding them.  Ordering is
+ * global within a round; records still in flight when the buffers are read
+ * end up in the next one.
+ */
+struct merge_cursor {
+    unsigned int cpu;
+    unsigned char *p, *end;          /* Current chunk of the window. */
+    unsigned char *next, *next_end;  /* Second chunk of wrapped windows. */
+    uint64_t tsc;
+};
 
-fail:
-    PERROR("Failed to write trace data");
-    exit(EXIT_FAILURE);
+static struct {
+    struct merge_cursor *cursors;
+    struct merge_cursor **heap;
+    unsigned int heap_nr;
+    unsigned char *buf;
+    unsigned long len, size;
+} merge;
+
+static unsigned int trace_rec_size(const struct t_rec *rec)
+{
+    return sizeof(uint32_t) * (1 + rec->extra_u32) +
+           (rec->cycles_included ? sizeof(uint64_t) : 0);
+}
+
+static void merge_init(unsigned int num)
+{
+    merge.cursors = calloc(num, sizeof(*merge.cursors));
+    merge.heap = calloc(num, sizeof(*merge.heap));
+    if ( !merge.cursors || !merge.heap )
+    {
+        PERROR("Failed to allocate merge state");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Pick up the timestamp of the record at the cursor, if it has one. */
+static void merge_update_tsc(struct merge_cursor *c)
+{
+    const struct t_rec *rec = (const struct t_rec *)c->p;
+
+    if ( rec->cycles_included )
+        c->tsc = ((uint64_t)rec->u.cycles.cycles_hi << 32) |
+                 rec->u.cycles.cycles_lo;
+}
+
+static int merge_before(const struct merge_cursor *a,
+                        const struct merge_cursor *b)
+{
+    return a->tsc < b->tsc || (a->tsc == b->tsc && a->cpu < b->cpu);
+}
+
+static void merge_push(struct merge_cursor *c)
+{
+    unsigned int i = merge.heap_nr++;
+
+    while ( i && merge_before(c, merge.heap[(i - 1) / 2]) )
+    {
+        merge.heap[i] = merge.heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    merge.heap[i] = c;
+}
+
+static struct merge_cursor *merge_pop(void)
+{
+    struct merge_cursor *top = merge.heap[0], *last;
+    unsigned int i = 0, child;
+
+    last = merge.heap[--merge.heap_nr];
+    while ( (child = 2 * i + 1) < merge.heap_nr )
+    {
+        if ( child + 1 < merge.heap_nr &&
+             merge_before(merge.heap[child + 1], merge.heap[child]) )
+            child++;
+        if ( !merge_before(merge.heap[child], last) )
+            break;
+        merge.heap[i] = merge.heap[child];
+        i = child;
+    }
+    merge.heap[i] = last;
+
+    return top;
+}
+
+static void merge_reserve(unsigned long len)
+{
+    if ( merge.len + len <= merge.size )
+        return;
+
+    merge.size = (merge.len + len) * 2;
+    merge.buf = realloc(merge.buf, merge.size);
+    if ( !merge.buf )
+    {
+        PERROR("Failed to grow merge buffer");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Queue the window [start, end) of @cpu, optionally followed by a 2nd chunk. */
+static void merge_add(unsigned int cpu, unsigned char *start,
+                      unsigned char *end, unsigned char *next,
+                      unsigned char *next_end)
+{
+    struct merge_cursor *c = &merge.cursors[cpu];
+
+    c->cpu = cpu;
+    c->p = start;
+    c->end = end;
+    c->next = next;
+    c->next_end = next_end;
+    if ( c->p == c->end )
+    {
+        c->p = c->next;
+        c->end = c->next_end;
+        c->next = NULL;
+    }
+    if ( c->p == NULL || c->p == c->end )
+        return;
+
+    merge_update_tsc(c);
+    merge_push(c);
+}
+
+static void merge_flush(void)
+{
+    struct cpu_change_record *rec = NULL;
+    unsigned long rec_off = 0, off;
+
+    merge.len = 0;
+
+    while ( merge.heap_nr )
+    {
+        struct merge_cursor *c = merge_pop();
+        uint64_t limit = merge.heap_nr ? merge.heap[0]->tsc : UINT64_MAX;
+
+        /* Start a new window for this cpu. */
+        merge_reserve(sizeof(*rec));
+        rec_off = merge.len;
+        rec = (struct cpu_change_record *)(merge.buf + rec_off);
+        rec->header = CPU_CHANGE_HEADER;
+        rec->data.cpu = c->cpu;
+        merge.len += sizeof(*rec);
+
+        /* Take records from it for as long as it stays the earliest. */
+        do {
+            unsigned int size = trace_rec_size((const struct t_rec *)c->p);
+
+            merge_reserve(size);
+            memcpy(merge.buf + merge.len, c->p, size);
+            merge.len += size;
+
+            c->p += size;
+            if ( c->p >= c->end )
+            {
+                c->p = c->next;
+                c->end = c->next_end;
+                c->next = NULL;
+                if ( !c->p || c->p == c->end )
+                {
+                    c->p = NULL;
+                    break;
+                }
+            }
+            merge_update_tsc(c);
+        } while ( c->tsc <= limit );
+
+        rec = (struct cpu_change_record *)(merge.buf + rec_off);
+        rec->data.window_size = merge.len - rec_off - sizeof(*rec);
+
+        if ( c->p )
+            merge_push(c);
+    }
+
+    if ( !merge.len )
+        return;
+
+    if ( !opts.memory_buffer )
+    {
+        check_disk_space(merge.len);
+        out_queue(merge.buf, merge.len);
+        return;
+    }
+
+    for ( off = 0; off < merge.len;
+          off += sizeof(*rec) + rec->data.window_size )
+    {
+        rec = (struct cpu_change_record *)(merge.buf + off);
+        write_buffer(rec->data.cpu, (unsigned char *)(rec + 1),
+                     rec->data.window_size, rec->data.window_size);
+    }
 }
 
 static void disable_tbufs(void)
@@ -676,6 +925,7 @@ static int monitor_tbufs(void)
     unsigned long size;          /* size of a single trace buffer            */
 
     unsigned long data_size;
+    unsigned long *prods;        /* producer pointers consumed up to */
 
     int last_read = 1;
 
@@ -700,6 +950,17 @@ static int monitor_tbufs(void)
     meta = tbufs->meta;
     data = tbufs->data;
 
+    prods = calloc(num, sizeof(*prods));
+    if ( prods == NULL )
+    {
+        PERROR("Failed to allocate memory for buffer pointers");
+        exit(EXIT_FAILURE);
+    }
+
+    out_init(num);
+    if ( opts.merge )
+        merge_init(num);
+
     if ( opts.discard )
         for ( i = 0; i < num; i++ )
             meta[i]->cons = meta[i]->prod;
@@ -716,6 +977,7 @@ static int monitor_tbufs(void)
             prod = meta[i]->prod;
             xen_rmb(); /* read prod, then read item. */
 
+            prods[i] = cons;
             if ( cons == prod )
                 continue;
            
@@ -734,7 +996,16 @@ static int monitor_tbufs(void)
             start_offset = cons % data_size;
             end_offset = prod % data_size;
 
-            if ( end_offset > start_offset )
+            if ( opts.merge )
+            {
+                if ( end_offset > start_offset )
+                    merge_add(i, data[i] + start_offset, data[i] + end_offset,
+                              NULL, NULL);
+                else
+                    merge_add(i, data[i] + start_offset, data[i] + data_size,
+                              data[i], data[i] + end_offset);
+            }
+            else if ( end_offset > start_offset )
             {
                 /* If window does not wrap, write in one big chunk */
                 write_buffer(i, data[i]+start_offset,
@@ -755,11 +1026,17 @@ static int monitor_tbufs(void)
                              0);
             }
 
-            xen_mb(); /* read buffer, then update cons. */
-            meta[i]->cons = prod;
-
+            prods[i] = prod;
         }
 
+        if ( opts.merge )
+            merge_flush();
+        out_flush();
+
+        xen_mb(); /* read buffer, then update cons. */
+        for ( i = 0; i < num; i++ )
+            meta[i]->cons = prods[i];
+
         if ( interrupted )
         {
             if ( last_read )
@@ -781,6 +1058,7 @@ static int monitor_tbufs(void)
         membuf_dump();
 
     /* cleanup */
+    free(prods);
     free(meta);
     free(data);
     /* don't need to munmap - cleanup is automatic */
@@ -819,6 +1097,9 @@ static void usage(void)
 "                          this argument will be ignored.\n" \
 "  -D  --discard-buffers   Discard all records currently in the trace\n" \
 "                          buffers before beginning.\n" \
+"  -m  --merge             Merge the records of all CPUs into a single\n" \
+"                          stream ordered by TSC (within each polling\n" \
+"                          period), so that it needs no sorting later.\n" \
 "  -x  --dont-disable-tracing\n" \
 "                          By default, xentrace will disable tracing when\n" \
 "                          it exits. Selecting this option will tell it to\n" \
@@ -1081,6 +1362,7 @@ static void parse_args(int argc, char **argv)
         { "time-interval",  required_argument, 0, 'T' },
         { "memory-buffer",  required_argument, 0, 'M' },
         { "discard-buffers", no_argument,      0, 'D' },
+        { "merge",          no_argument,       0, 'm' },
         { "dont-disable-tracing", no_argument, 0, 'x' },
         { "start-disabled", no_argument,       0, 'X' },
         { "help",           no_argument,       0, '?' },
@@ -1088,7 +1370,7 @@ static void parse_args(int argc, char **argv)
         { 0, 0, 0, 0 }
     };
 
-    while ( (option = getopt_long(argc, argv, "t:s:c:e:S:r:T:M:DxX?V",
+    while ( (option = getopt_long(argc, argv, "t:s:c:e:S:r:T:M:DmxX?V",
                     long_options, NULL)) != -1) 
     {
         switch ( option )
@@ -1117,6 +1399,10 @@ static void parse_args(int argc, char **argv)
             opts.discard = 1;
             break;
 
+        case 'm': /* Merge per-cpu records by timestamp */
+            opts.merge = 1;
+            break;
+
         case 'r': /* Disk-space reservation */
             opts.disk_rsvd = argtol(optarg, 0);
             break;
@@ -27,6 +27,7 @@
 #include <xen/livepatch.h>
 #include <xen/mm.h>
 #include <xen/errno.h>
+#include <xen/hcall_prof.h>
 #include <xen/hypercall.h>
 #include <xen/softirq.h>
 #include <xen/domain_page.h>
@@ -1485,6 +1486,7 @@ static void do_trap_hypercall(struct cpu_user_regs *regs, register_t *nr,
                               unsigned long iss)
 {
     arm_hypercall_fn_t call = NULL;
+    s_time_t start;
 #ifndef NDEBUG
     register_t orig_pc = regs->pc;
 #endif
@@ -1509,7 +1511,9 @@ static void do_trap_hypercall(struct cpu_user_regs *regs, register_t *nr,
         return;
     }
 
+    start = hcall_prof_start();
     HYPERCALL_RESULT_REG(regs) = call(HYPERCALL_ARGS(regs));
+    hcall_prof_end(*nr, start, 0);
 
 #ifndef NDEBUG
     /*
@@ -1554,6 +1558,7 @@ enum mc_disposition arch_do_multicall_call(struct mc_state *state)
 {
     struct multicall_entry *multi = &state->call;
     arm_hypercall_fn_t call = NULL;
+    s_time_t start;
 
     if ( multi->op >= ARRAY_SIZE(arm_hypercall_table) )
     {
@@ -1572,9 +1577,11 @@ enum mc_disposition arch_do_multicall_call(struct mc_state *state)
          !check_multicall_32bit_clean(multi) )
         return mc_continue;
 
+    start = hcall_prof_start();
     multi->result = call(multi->args[0], multi->args[1],
                          multi->args[2], multi->args[3],
                          multi->args[4]);
+    hcall_prof_end(multi->op, start, 1);
 
     return likely(!psr_mode_is_user(guest_cpu_user_regs()))
            ? mc_continue : mc_preempt;
@@ -21,6 +21,7 @@
 #include <xen/delay.h>
 #include <xen/softirq.h>
 #include <xen/grant_table.h>
+#include <xen/hcall_prof.h>
 #include <xen/iocap.h>
 #include <xen/kernel.h>
 #include <xen/hypercall.h>
@@ -53,6 +54,7 @@
 #include <asm/hvm/hvm.h>
 #include <asm/hvm/support.h>
 #include <asm/hvm/viridian.h>
+#include <asm/hvm/exitlat.h>
 #include <asm/debugreg.h>
 #include <asm/msr.h>
 #include <asm/traps.h>
@@ -2108,6 +2110,7 @@ void context_switch(struct vcpu *prev, struct vcpu *next)
     {
         _update_runstate_area(prev);
         vpmu_switch_from(prev);
+        hvm_exitlat_descheduled();
     }
 
     if ( is_hvm_domain(prevd) && !list_empty(&prev->arch.hvm_vcpu.tm_list) )
@@ -2220,6 +2223,8 @@ void hypercall_cancel_continuation(void)
     struct cpu_user_regs *regs = guest_cpu_user_regs();
     struct mc_state *mcs = &current->mc_state;
 
+    hcall_prof_preempted(0);
+
     if ( mcs->flags & MCSF_in_multicall )
     {
         __clear_bit(_MCSF_call_preempted, &mcs->flags);
@@ -2242,6 +2247,8 @@ unsigned long hypercall_create_continuation(
     unsigned int i;
     va_list args;
 
+    hcall_prof_preempted(1);
+
     va_start(args, format);
 
     if ( mcs->flags & MCSF_in_multicall )
@@ -2629,6 +2636,9 @@ int domain_relinquish_resources(struct domain *d)
 void arch_dump_domain_info(struct domain *d)
 {
     paging_dump_domain_info(d);
+
+    if ( has_vlapic(d) )
+        vlapic_dump_ipi_stats(d);
 }
 
 void arch_dump_vcpu_info(struct vcpu *v)
@@ -1758,6 +1758,70 @@ static const struct x86_emulate_ops hvm_emulate_ops_no_write = {
     .vmfunc        = hvmemul_vmfunc,
 };
 
+/*
+ * Drivers tend to poke at the same device registers from the same few
+ * instructions over and over.  Look up the decode of the instruction about
+ * to be emulated among the last few ones, by address space, RIP and the
+ * execution mode the decode depends on, and check the bytes prefetched
+ * into insn_buf against those it was decoded from: as these are fetched
+ * anyway, this also catches the code having been rewritten meanwhile.
+ * On a miss, return the entry for x86_emulate_cached() to decode into.
+ */
+static struct hvm_insn_cache *hvmemul_insn_cache(
+    struct hvm_emulate_ctxt *hvmemul_ctxt)
+{
+    struct vcpu *curr = current;
+    struct hvm_vcpu_io *vio = &curr->arch.hvm_vcpu.hvm_io;
+    unsigned long cr3 = curr->arch.hvm_vcpu.guest_cr[3];
+    unsigned long rip = hvmemul_ctxt->insn_buf_eip;
+    unsigned int mode = hvmemul_ctxt->ctxt.addr_size |
+                        (hvmemul_ctxt->ctxt.sp_size << 8) |
+                        (hvmemul_ctxt->ctxt.regs->eflags & X86_EFLAGS_VM) |
+                        ((curr->arch.hvm_vcpu.guest_cr[0] & X86_CR0_PE) << 16);
+    struct hvm_insn_cache *ic;
+    unsigned int i;
+
+    for ( i = 0; i < ARRAY_SIZE(vio->insn_cache); i++ )
+    {
+        ic = &vio->insn_cache[i];
+
+        if ( ic->len && ic->rip == rip && ic->cr3 == cr3 &&
+             ic->mode == mode && ic->len <= hvmemul_ctxt->insn_buf_bytes &&
+             !memcmp(ic->insn, hvmemul_ctxt->insn_buf, ic->len) )
+        {
+            perfc_incr(hvm_insn_cache_hit);
+            return ic;
+        }
+    }
+
+    perfc_incr(hvm_insn_cache_miss);
+
+    ic = &vio->insn_cache[vio->insn_cache_next++ %
+                          ARRAY_SIZE(vio->insn_cache)];
+    if ( !ic->state && (ic->state = x86_emulate_alloc_state()) == NULL )
+        return NULL;
+
+    ic->cr3 = cr3;
+    ic->rip = rip;
+    ic->mode = mode;
+    ic->len = 0;
+
+    return ic;
+}
+
+void hvm_emulate_free_insn_cache(struct vcpu *v)
+{
+    struct hvm_vcpu_io *vio = &v->arch.hvm_vcpu.hvm_io;
+    unsigned int i;
+
+    for ( i = 0; i < ARRAY_SIZE(vio->insn_cache); i++ )
+    {
+        xfree(vio->insn_cache[i].state);
+        vio->insn_cache[i].state = NULL;
+        vio->insn_cache[i].len = 0;
+    }
+}
+
 static int _hvm_emulate_one(struct hvm_emulate_ctxt *hvmemul_ctxt,
     const struct x86_emulate_ops *ops)
 {
@@ -1765,6 +1829,8 @@ static int _hvm_emulate_one(struct hvm_emulate_ctxt *hvmemul_ctxt,
     struct vcpu *curr = current;
     uint32_t new_intr_shadow;
     struct hvm_vcpu_io *vio = &curr->arch.hvm_vcpu.hvm_io;
+    struct hvm_insn_cache *ic;
+    bool_t cached;
     int rc;
 
     hvm_emulate_init_per_insn(hvmemul_ctxt, vio->mmio_insn,
@@ -1779,7 +1845,28 @@ static int _hvm_emulate_one(struct hvm_emulate_ctxt *hvmemul_ctxt,
     else
         hvmemul_ctxt->ctxt.swint_emulate = x86_swint_emulate_all;
 
-    rc = x86_emulate(&hvmemul_ctxt->ctxt, ops);
+    ic = hvmemul_insn_cache(hvmemul_ctxt);
+    if ( !ic )
+        rc = x86_emulate(&hvmemul_ctxt->ctxt, ops);
+    else
+    {
+        cached = !!ic->len;
+        rc = x86_emulate_cached(&hvmemul_ctxt->ctxt, ops, ic->state,
+                                &ic->len);
+
+        /* Remember what a fresh decode was made from. */
+        if ( !cached && ic->len )
+        {
+            if ( ic->len <= hvmemul_ctxt->insn_buf_bytes )
+                memcpy(ic->insn, hvmemul_ctxt->insn_buf, ic->len);
+            else
+                ic->len = 0;
+        }
+    }
+
+    perfc_incr(hvm_emulations);
+    if ( rc == X86EMUL_UNHANDLEABLE )
+        perfc_incr(hvm_emulations_failed);
 
     if ( rc == X86EMUL_OKAY && vio->mmio_retry )
         rc = X86EMUL_RETRY;
@@ -0,0 +1,225 @@
+/*
+ * exitlat.c: HVM exit latency histograms
+ *
+ * Times every VM exit, from the exit handler to the next VM entry on the
+ * same pCPU, and keeps per-pCPU log2 histograms of the cycles taken by
+ * exit reason.  Exits after which the vCPU is descheduled (because it
+ * blocked, or was preempted) aren't counted.  This is much cheaper than
+ * tracing every exit, and is meant to be left enabled to watch the tail
+ * of the virtualization overhead.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <xen/config.h>
+#include <xen/lib.h>
+#include <xen/sched.h>
+#include <xen/time.h>
+#include <xen/xmalloc.h>
+#include <xen/guest_access.h>
+#include <asm/cpufeature.h>
+#include <asm/hvm/hvm.h>
+#include <asm/hvm/exitlat.h>
+#include <asm/hvm/svm/vmcb.h>
+#include <public/sysctl.h>
+
+/*
+ * VMX exit reasons and SVM exit codes are small, except for SVM's nested
+ * page fault, which gets the slot after the last SVM exit code.
+ */
+#define EXITLAT_NPF_SLOT    (VMEXIT_XSETBV + 1)
+#define EXITLAT_SLOTS       (EXITLAT_NPF_SLOT + 1)
+
+struct exitlat_slot {
+    uint64_t count;
+    uint64_t cycles;
+    uint64_t max;
+    uint32_t hist[XEN_SYSCTL_EXITLAT_BUCKETS];
+};
+
+struct exitlat_cpu {
+    uint64_t start;              /* TSC of the pending exit, 0 if none. */
+    const struct vcpu *vcpu;     /* vCPU which took it. */
+    unsigned int slot;
+    struct exitlat_slot slots[EXITLAT_SLOTS];
+};
+
+bool_t __read_mostly hvm_exitlat_enabled;
+
+/*
+ * Only ever written by their own pCPU, except by reset.  Not per-CPU data,
+ * so that they survive CPUs going offline.
+ */
+static struct exitlat_cpu *exitlat[NR_CPUS];
+
+void hvm_exitlat_exit(uint64_t tsc, unsigned long reason)
+{
+    struct exitlat_cpu *s = exitlat[smp_processor_id()];
+
+    if ( !s )
+        return;
+
+    if ( reason == VMEXIT_NPF )
+        reason = EXITLAT_NPF_SLOT;
+    else if ( reason >= EXITLAT_NPF_SLOT )
+    {
+        s->start = 0;
+        return;
+    }
+
+    s->start = tsc;
+    s->vcpu = current;
+    s->slot = reason;
+}
+
+void hvm_exitlat_entry(uint64_t tsc)
+{
+    struct exitlat_cpu *s = exitlat[smp_processor_id()];
+    struct exitlat_slot *slot;
+    uint64_t cycles;
+    unsigned int b;
+
+    if ( !s || !s->start )
+        return;
+
+    /* Don't account the time some other vCPU ran for. */
+    if ( s->vcpu != current )
+    {
+        s->start = 0;
+        return;
+    }
+
+    cycles = tsc - s->start;
+    s->start = 0;
+
+    slot = &s->slots[s->slot];
+    slot->count++;
+    slot->cycles += cycles;
+    if ( cycles > slot->max )
+        slot->max = cycles;
+    b = cycles ? flsl(cycles) - 1 : 0;
+    slot->hist[min_t(unsigned int, b, XEN_SYSCTL_EXITLAT_BUCKETS - 1)]++;
+}
+
+void hvm_exitlat_cancel(void)
+{
+    struct exitlat_cpu *s = exitlat[smp_processor_id()];
+
+    if ( s )
+        s->start = 0;
+}
+
+static int exitlat_query(struct xen_sysctl_exitlat_op *op)
+{
+    const struct exitlat_cpu *s;
+    struct xen_sysctl_exitlat e;
+    unsigned int i, n = 0;
+
+    if ( op->cpu >= nr_cpu_ids )
+        return -EINVAL;
+
+    s = exitlat[op->cpu];
+    for ( i = 0; s && i < EXITLAT_SLOTS; i++ )
+    {
+        const struct exitlat_slot *slot = &s->slots[i];
+
+        if ( !slot->count )
+            continue;
+
+        if ( n < op->nr_entries && !guest_handle_is_null(op->entries) )
+        {
+            memset(&e, 0, sizeof(e));
+            e.reason = i == EXITLAT_NPF_SLOT ? VMEXIT_NPF : i;
+            e.count = slot->count;
+            e.cycles = slot->cycles;
+            e.max = slot->max;
+            memcpy(e.hist, slot->hist, sizeof(e.hist));
+            if ( copy_to_guest_offset(op->entries, n, &e, 1) )
+                return -EFAULT;
+        }
+        n++;
+    }
+
+    op->nr_entries = n;
+
+    return 0;
+}
+
+int hvm_exitlat_control(struct xen_sysctl_exitlat_op *op)
+{
+    unsigned int cpu;
+    int rc = 0;
+
+    if ( !hvm_enabled )
+        return -ENODEV;
+
+    switch ( op->cmd )
+    {
+    case XEN_SYSCTL_EXITLAT_enable:
+        for_each_online_cpu ( cpu )
+        {
+            if ( !exitlat[cpu] )
+                exitlat[cpu] = xzalloc(struct exitlat_cpu);
+            if ( !exitlat[cpu] )
+            {
+                rc = -ENOMEM;
+                break;
+            }
+            /* Forget any exit left pending when timing was last disabled. */
+            exitlat[cpu]->start = 0;
+        }
+        if ( rc )
+            break;
+        smp_wmb();
+        hvm_exitlat_enabled = 1;
+        break;
+
+    case XEN_SYSCTL_EXITLAT_disable:
+        hvm_exitlat_enabled = 0;
+        break;
+
+    case XEN_SYSCTL_EXITLAT_reset:
+        for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+            if ( exitlat[cpu] )
+            {
+                exitlat[cpu]->start = 0;
+                memset(exitlat[cpu]->slots, 0, sizeof(exitlat[cpu]->slots));
+            }
+        break;
+
+    case XEN_SYSCTL_EXITLAT_query:
+        rc = exitlat_query(op);
+        break;
+
+    default:
+        rc = -EOPNOTSUPP;
+        break;
+    }
+
+    op->vendor = cpu_has_vmx ? XEN_SYSCTL_EXITLAT_vmx :
+                 cpu_has_svm ? XEN_SYSCTL_EXITLAT_svm : 0;
+    op->enabled = hvm_exitlat_enabled;
+    op->cpu_khz = cpu_khz;
+
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
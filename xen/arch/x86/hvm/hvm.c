@@ -29,6 +29,7 @@
 #include <xen/domain.h>
 #include <xen/domain_page.h>
 #include <xen/hypercall.h>
+#include <xen/hcall_prof.h>
 #include <xen/guest_access.h>
 #include <xen/event.h>
 #include <xen/cpu.h>
@@ -628,14 +629,18 @@ int hvm_domain_initialise(struct domain *d)
     d->arch.hvm_domain.params = xzalloc_array(uint64_t, HVM_NR_PARAMS);
     d->arch.hvm_domain.io_handler = xzalloc_array(struct hvm_io_handler,
                                                   NR_IO_HANDLERS);
+    d->arch.hvm_domain.io_index = xzalloc(struct hvm_io_index);
     rc = -ENOMEM;
     if ( !d->arch.hvm_domain.pl_time ||
-         !d->arch.hvm_domain.params  || !d->arch.hvm_domain.io_handler )
+         !d->arch.hvm_domain.params  || !d->arch.hvm_domain.io_handler ||
+         !d->arch.hvm_domain.io_index )
         goto fail1;
 
     /* need link to containing domain */
     d->arch.hvm_domain.pl_time->domain = d;
 
+    spin_lock_init(&d->arch.hvm_domain.io_index->lock);
+
     /* Set the default IO Bitmap. */
     if ( is_hardware_domain(d) )
     {
@@ -692,6 +697,7 @@ int hvm_domain_initialise(struct domain *d)
  fail1:
     if ( is_hardware_domain(d) )
         xfree(d->arch.hvm_domain.io_bitmap);
+    xfree(d->arch.hvm_domain.io_index);
     xfree(d->arch.hvm_domain.io_handler);
     xfree(d->arch.hvm_domain.params);
     xfree(d->arch.hvm_domain.pl_time);
@@ -728,6 +734,9 @@ void hvm_domain_destroy(struct domain *d)
     xfree(d->arch.hvm_domain.io_handler);
     d->arch.hvm_domain.io_handler = NULL;
 
+    xfree(d->arch.hvm_domain.io_index);
+    d->arch.hvm_domain.io_index = NULL;
+
     xfree(d->arch.hvm_domain.params);
     d->arch.hvm_domain.params = NULL;
 
@@ -1620,6 +1629,8 @@ void hvm_vcpu_destroy(struct vcpu *v)
     tasklet_kill(&v->arch.hvm_vcpu.assert_evtchn_irq_tasklet);
     hvm_vcpu_cacheattr_destroy(v);
 
+    hvm_emulate_free_insn_cache(v);
+
     if ( is_hvm_vcpu(v) )
         vlapic_destroy(v);
 
@@ -4309,6 +4320,7 @@ int hvm_do_hypercall(struct cpu_user_regs *regs)
     struct segment_register sreg;
     int mode = hvm_guest_x86_mode(curr);
     unsigned long eax = regs->_eax;
+    s_time_t start;
 
     switch ( mode )
     {
@@ -4341,8 +4353,12 @@ int hvm_do_hypercall(struct cpu_user_regs *regs)
         return HVM_HCALL_completed;
     }
 
+    perfc_incra(hypercalls, eax);
+
     curr->arch.hvm_vcpu.hcall_preempted = 0;
 
+    start = hcall_prof_start();
+
     if ( mode == 8 )
     {
         unsigned long rdi = regs->rdi;
@@ -4435,6 +4451,8 @@ int hvm_do_hypercall(struct cpu_user_regs *regs)
 #endif
     }
 
+    hcall_prof_end(eax, start, 0);
+
     HVM_DBG_LOG(DBG_LEVEL_HCALL, "hcall%lu -> %lx",
                 eax, (unsigned long)regs->eax);
 
@@ -5086,47 +5104,25 @@ static int hvm_allow_set_param(struct domain *d,
     return rc;
 }
 
-static int hvmop_set_param(
-    XEN_GUEST_HANDLE_PARAM(xen_hvm_param_t) arg)
+/* Set an HVM param, along with whatever setting it up involves. */
+int hvm_set_param(struct domain *d, uint32_t index, uint64_t value)
 {
-    struct domain *curr_d = current->domain;
-    struct xen_hvm_param a;
-    struct domain *d;
     struct vcpu *v;
-    int rc;
-
-    if ( copy_from_guest(&a, arg, 1) )
-        return -EFAULT;
-
-    if ( a.index >= HVM_NR_PARAMS )
-        return -EINVAL;
-
-    d = rcu_lock_domain_by_any_id(a.domid);
-    if ( d == NULL )
-        return -ESRCH;
-
-    rc = -EINVAL;
-    if ( !has_hvm_container_domain(d) ||
-         (is_pvh_domain(d) && (a.index != HVM_PARAM_CALLBACK_IRQ)) )
-        goto out;
-
-    rc = hvm_allow_set_param(d, &a);
-    if ( rc )
-        goto out;
+    int rc = 0;
 
-    switch ( a.index )
+    switch ( index )
     {
     case HVM_PARAM_CALLBACK_IRQ:
-        hvm_set_callback_via(d, a.value);
+        hvm_set_callback_via(d, value);
         hvm_latch_shinfo_size(d);
         break;
     case HVM_PARAM_TIMER_MODE:
-        if ( a.value > HVMPTM_one_missed_tick_pending )
+        if ( value > HVMPTM_one_missed_tick_pending )
             rc = -EINVAL;
         break;
     case HVM_PARAM_VIRIDIAN:
-        if ( (a.value & ~HVMPV_feature_mask) ||
-             !(a.value & HVMPV_base_freq) )
+        if ( (value & ~HVMPV_feature_mask) ||
+             !(value & HVMPV_base_freq) )
             rc = -EINVAL;
         break;
     case HVM_PARAM_IDENT_PT:
@@ -5136,7 +5132,7 @@ static int hvmop_set_param(
          */
         if ( !paging_mode_hap(d) || !cpu_has_vmx )
         {
-            d->arch.hvm_domain.params[a.index] = a.value;
+            d->arch.hvm_domain.params[index] = value;
             break;
         }
 
@@ -5151,7 +5147,7 @@ static int hvmop_set_param(
 
         rc = 0;
         domain_pause(d);
-        d->arch.hvm_domain.params[a.index] = a.value;
+        d->arch.hvm_domain.params[index] = value;
         for_each_vcpu ( d, v )
             paging_update_cr3(v);
         domain_unpause(d);
@@ -5159,23 +5155,23 @@ static int hvmop_set_param(
         domctl_lock_release();
         break;
     case HVM_PARAM_DM_DOMAIN:
-        if ( a.value == DOMID_SELF )
-            a.value = curr_d->domain_id;
+        if ( value == DOMID_SELF )
+            value = current->domain->domain_id;
 
-        rc = hvm_set_dm_domain(d, a.value);
+        rc = hvm_set_dm_domain(d, value);
         break;
     case HVM_PARAM_ACPI_S_STATE:
         rc = 0;
-        if ( a.value == 3 )
+        if ( value == 3 )
             hvm_s3_suspend(d);
-        else if ( a.value == 0 )
+        else if ( value == 0 )
             hvm_s3_resume(d);
         else
             rc = -EINVAL;
 
         break;
     case HVM_PARAM_ACPI_IOPORTS_LOCATION:
-        rc = pmtimer_change_ioport(d, a.value);
+        rc = pmtimer_change_ioport(d, value);
         break;
     case HVM_PARAM_MEMORY_EVENT_CR0:
     case HVM_PARAM_MEMORY_EVENT_CR3:
@@ -5190,24 +5186,24 @@ static int hvmop_set_param(
         rc = xsm_hvm_param_nested(XSM_PRIV, d);
         if ( rc )
             break;
-        if ( a.value > 1 )
+        if ( value > 1 )
             rc = -EINVAL;
         /*
          * Remove the check below once we have
          * shadow-on-shadow.
          */
-        if ( cpu_has_svm && !paging_mode_hap(d) && a.value )
+        if ( cpu_has_svm && !paging_mode_hap(d) && value )
             rc = -EINVAL;
-        if ( a.value &&
+        if ( value &&
              d->arch.hvm_domain.params[HVM_PARAM_ALTP2M] )
             rc = -EINVAL;
         /* Set up NHVM state for any vcpus that are already up. */
-        if ( a.value &&
+        if ( value &&
              !d->arch.hvm_domain.params[HVM_PARAM_NESTEDHVM] )
             for_each_vcpu(d, v)
                 if ( rc == 0 )
                     rc = nestedhvm_vcpu_initialise(v);
-        if ( !a.value || rc )
+        if ( !value || rc )
             for_each_vcpu(d, v)
                 nestedhvm_vcpu_destroy(v);
         break;
@@ -5215,9 +5211,9 @@ static int hvmop_set_param(
         rc = xsm_hvm_param_altp2mhvm(XSM_PRIV, d);
         if ( rc )
             break;
-        if ( a.value > 1 )
+        if ( value > 1 )
             rc = -EINVAL;
-        if ( a.value &&
+        if ( value &&
              d->arch.hvm_domain.params[HVM_PARAM_NESTEDHVM] )
             rc = -EINVAL;
         break;
@@ -5225,44 +5221,74 @@ static int hvmop_set_param(
         rc = -EINVAL;
         break;
     case HVM_PARAM_TRIPLE_FAULT_REASON:
-        if ( a.value > SHUTDOWN_MAX )
+        if ( value > SHUTDOWN_MAX )
             rc = -EINVAL;
         break;
     case HVM_PARAM_IOREQ_SERVER_PFN:
-        d->arch.hvm_domain.ioreq_gmfn.base = a.value;
+        d->arch.hvm_domain.ioreq_gmfn.base = value;
         break;
     case HVM_PARAM_NR_IOREQ_SERVER_PAGES:
     {
         unsigned int i;
 
-        if ( a.value == 0 ||
-             a.value > sizeof(d->arch.hvm_domain.ioreq_gmfn.mask) * 8 )
+        if ( value == 0 ||
+             value > sizeof(d->arch.hvm_domain.ioreq_gmfn.mask) * 8 )
         {
             rc = -EINVAL;
             break;
         }
-        for ( i = 0; i < a.value; i++ )
+        for ( i = 0; i < value; i++ )
             set_bit(i, &d->arch.hvm_domain.ioreq_gmfn.mask);
 
         break;
     }
     case HVM_PARAM_X87_FIP_WIDTH:
-        if ( a.value != 0 && a.value != 4 && a.value != 8 )
+        if ( value != 0 && value != 4 && value != 8 )
         {
             rc = -EINVAL;
             break;
         }
-        d->arch.x87_fip_width = a.value;
+        d->arch.x87_fip_width = value;
         break;
     }
 
     if ( rc != 0 )
+        return rc;
+
+    d->arch.hvm_domain.params[index] = value;
+
+    HVM_DBG_LOG(DBG_LEVEL_HCALL, "set param %u = %"PRIx64, index, value);
+
+    return 0;
+}
+
+static int hvmop_set_param(
+    XEN_GUEST_HANDLE_PARAM(xen_hvm_param_t) arg)
+{
+    struct xen_hvm_param a;
+    struct domain *d;
+    int rc;
+
+    if ( copy_from_guest(&a, arg, 1) )
+        return -EFAULT;
+
+    if ( a.index >= HVM_NR_PARAMS )
+        return -EINVAL;
+
+    d = rcu_lock_domain_by_any_id(a.domid);
+    if ( d == NULL )
+        return -ESRCH;
+
+    rc = -EINVAL;
+    if ( !has_hvm_container_domain(d) ||
+         (is_pvh_domain(d) && (a.index != HVM_PARAM_CALLBACK_IRQ)) )
         goto out;
 
-    d->arch.hvm_domain.params[a.index] = a.value;
+    rc = hvm_allow_set_param(d, &a);
+    if ( rc )
+        goto out;
 
-    HVM_DBG_LOG(DBG_LEVEL_HCALL, "set param %u = %"PRIx64,
-                a.index, a.value);
+    rc = hvm_set_param(d, a.index, a.value);
 
  out:
     rcu_unlock_domain(d);
@@ -30,6 +30,7 @@
 #include <io_ports.h>
 #include <xen/event.h>
 #include <xen/iommu.h>
+#include <xen/sort.h>
 
 static bool_t hvm_mmio_accept(const struct hvm_io_handler *handler,
                               const ioreq_t *p)
@@ -210,28 +211,199 @@ int hvm_process_io_intercept(const struct hvm_io_handler *handler,
     return rc;
 }
 
+static int cmp_port(const void *a, const void *b)
+{
+    unsigned int pa = *(const unsigned int *)a, pb = *(const unsigned int *)b;
+
+    return pa < pb ? -1 : pa > pb;
+}
+
+/*
+ * Rebuild the port ranges of the index from the handlers registered by
+ * register_portio_handler(), into the set not in use, then switch to it.
+ */
+static void hvm_index_portio(struct domain *d)
+{
+    struct hvm_io_index *index = d->arch.hvm_domain.io_index;
+    const struct hvm_io_handler *handlers = d->arch.hvm_domain.io_handler;
+    unsigned int count = d->arch.hvm_domain.io_handler_count;
+    unsigned int set = !(index->gen & 1), nr = 0, nr_points = 0, i, k;
+    unsigned int points[2 * NR_IO_HANDLERS];
+    struct hvm_portio_range *ranges = index->ranges[set];
+
+    ASSERT(spin_is_locked(&index->lock));
+
+    for ( i = 0; i < count; i++ )
+    {
+        if ( handlers[i].ops != &portio_ops )
+            continue;
+
+        points[nr_points++] = handlers[i].portio.port;
+        points[nr_points++] = handlers[i].portio.port +
+                              handlers[i].portio.size;
+    }
+
+    sort(points, nr_points, sizeof(*points), cmp_port, NULL);
+
+    for ( k = 0; k + 1 < nr_points; k++ )
+    {
+        unsigned int start = points[k], end = points[k + 1];
+
+        if ( start == end )
+            continue;
+
+        /* The first handler to claim a port keeps it, as in a linear scan. */
+        for ( i = 0; i < count; i++ )
+            if ( handlers[i].ops == &portio_ops &&
+                 handlers[i].portio.port <= start &&
+                 start - handlers[i].portio.port < handlers[i].portio.size )
+                break;
+
+        if ( i == count )
+            continue;
+
+        if ( nr && ranges[nr - 1].handler == i && ranges[nr - 1].end == start )
+            ranges[nr - 1].end = end;
+        else
+        {
+            ranges[nr].start = start;
+            ranges[nr].end = end;
+            ranges[nr].handler = i;
+            nr++;
+        }
+    }
+
+    index->nr_ranges[set] = nr;
+    smp_wmb();
+    write_atomic(&index->gen, index->gen + 1);
+}
+
+/*
+ * Returns the first handler registered by register_portio_handler() which
+ * accepts @p, or NR_IO_HANDLERS if there is none.
+ */
+static unsigned int hvm_find_portio_handler(const struct domain *d,
+                                            const ioreq_t *p)
+{
+    const struct hvm_io_index *index = d->arch.hvm_domain.io_index;
+    const struct hvm_io_handler *handlers = d->arch.hvm_domain.io_handler;
+    const struct hvm_portio_range *ranges;
+    unsigned int gen, lo, hi, mid, i;
+
+    /*
+     * The set read from is rebuilt by the second update after the one
+     * which published it, so a lookup overlapping any update is retried.
+     */
+    do {
+        gen = read_atomic(&index->gen);
+        smp_rmb();
+        ranges = index->ranges[gen & 1];
+        lo = 0;
+        hi = index->nr_ranges[gen & 1];
+
+        while ( lo < hi )
+        {
+            mid = (lo + hi) / 2;
+            if ( p->addr < ranges[mid].start )
+                hi = mid;
+            else if ( p->addr >= ranges[mid].end )
+                lo = mid + 1;
+            else
+                break;
+        }
+
+        i = lo < hi ? ranges[mid].handler : NR_IO_HANDLERS;
+        smp_rmb();
+    } while ( unlikely(read_atomic(&index->gen) != gen) );
+
+    /*
+     * The owner of the first port is the first handler which could take
+     * the access.  Should it not take all of it, a later handler may.
+     */
+    for ( ;
+          i < d->arch.hvm_domain.io_handler_count; i++ )
+        if ( handlers[i].ops == &portio_ops &&
+             hvm_portio_accept(&handlers[i], p) )
+            return i;
+
+    return NR_IO_HANDLERS;
+}
+
+/*
+ * Whether @mru, which accepted the last MMIO access, is the first handler
+ * which would accept @p if it accepts it.  Handlers whose range hasn't
+ * moved cover disjoint ranges, but one which has may overlap any other.
+ */
+static bool_t hvm_mmio_mru_first(const struct domain *d, unsigned int mru,
+                                 const ioreq_t *p)
+{
+    const struct hvm_io_index *index = d->arch.hvm_domain.io_index;
+    const struct hvm_io_handler *handlers = d->arch.hvm_domain.io_handler;
+    unsigned int i, nr = read_atomic(&index->nr_relocated);
+
+    smp_rmb();
+    for ( i = 0; i < nr; i++ )
+    {
+        unsigned int h = index->relocated[i];
+
+        if ( h == mru ||
+             (h < mru && handlers[h].ops->accept(&handlers[h], p)) )
+            return 0;
+    }
+
+    return 1;
+}
+
 const struct hvm_io_handler *hvm_find_io_handler(ioreq_t *p)
 {
-    struct domain *curr_d = current->domain;
-    unsigned int i;
+    struct vcpu *curr = current;
+    struct domain *curr_d = curr->domain;
+    const struct hvm_io_index *index = curr_d->arch.hvm_domain.io_index;
+    const struct hvm_io_handler *handlers = curr_d->arch.hvm_domain.io_handler;
+    unsigned int *last = &curr->arch.hvm_vcpu.hvm_io.mmio_handler;
+    unsigned int i, found = NR_IO_HANDLERS, mru = NR_IO_HANDLERS;
 
     BUG_ON((p->type != IOREQ_TYPE_PIO) &&
            (p->type != IOREQ_TYPE_COPY));
 
-    for ( i = 0; i < curr_d->arch.hvm_domain.io_handler_count; i++ )
+    if ( p->type == IOREQ_TYPE_PIO )
+        found = hvm_find_portio_handler(curr_d, p);
+    else
     {
-        const struct hvm_io_handler *handler =
-            &curr_d->arch.hvm_domain.io_handler[i];
-        const struct hvm_io_ops *ops = handler->ops;
+        /*
+         * The internal MMIO handlers mostly cover disjoint ranges, so
+         * whichever accepted the last access can be offered this one first.
+         */
+        mru = *last;
+        if ( mru >= curr_d->arch.hvm_domain.io_handler_count ||
+             handlers[mru].type != IOREQ_TYPE_COPY ||
+             !hvm_mmio_mru_first(curr_d, mru, p) )
+            mru = NR_IO_HANDLERS;
+        else if ( handlers[mru].ops->accept(&handlers[mru], p) )
+            return &handlers[mru];
+    }
+
+    /* Handlers registered earlier take precedence, as in a linear scan. */
+    for ( i = 0; i < index->nr_generic[p->type]; i++ )
+    {
+        unsigned int h = index->generic[p->type][i];
+        const struct hvm_io_handler *handler = &handlers[h];
 
-        if ( handler->type != p->type )
+        if ( h >= found )
+            break;
+
+        if ( h == mru )
             continue;
 
-        if ( ops->accept(handler, p) )
+        if ( handler->ops->accept(handler, p) )
+        {
+            if ( p->type == IOREQ_TYPE_COPY )
+                *last = h;
             return handler;
+        }
     }
 
-    return NULL;
+    return found < NR_IO_HANDLERS ? &handlers[found] : NULL;
 }
 
 int hvm_io_intercept(ioreq_t *p)
@@ -254,9 +426,9 @@ int hvm_io_intercept(ioreq_t *p)
     return rc;
 }
 
-struct hvm_io_handler *hvm_next_io_handler(struct domain *d)
+static struct hvm_io_handler *alloc_io_handler(struct domain *d)
 {
-    unsigned int i = d->arch.hvm_domain.io_handler_count++;
+    unsigned int i = d->arch.hvm_domain.io_handler_count;
 
     ASSERT(d->arch.hvm_domain.io_handler);
 
@@ -266,26 +438,89 @@ struct hvm_io_handler *hvm_next_io_handler(struct domain *d)
         return NULL;
     }
 
+    d->arch.hvm_domain.io_handler_count++;
+
     return &d->arch.hvm_domain.io_handler[i];
 }
 
+/* Allocate a handler of @type with an accept() hook of its own. */
+struct hvm_io_handler *hvm_next_io_handler(struct domain *d, uint8_t type)
+{
+    struct hvm_io_index *index = d->arch.hvm_domain.io_index;
+    struct hvm_io_handler *handler;
+
+    BUG_ON((type != IOREQ_TYPE_PIO) && (type != IOREQ_TYPE_COPY));
+
+    handler = alloc_io_handler(d);
+    if ( handler == NULL )
+        return NULL;
+
+    handler->type = type;
+    index->generic[type][index->nr_generic[type]++] =
+        handler - d->arch.hvm_domain.io_handler;
+
+    return handler;
+}
+
 void register_mmio_handler(struct domain *d,
                            const struct hvm_mmio_ops *ops)
 {
-    struct hvm_io_handler *handler = hvm_next_io_handler(d);
+    struct hvm_io_handler *handler = hvm_next_io_handler(d, IOREQ_TYPE_COPY);
 
     if ( handler == NULL )
         return;
 
-    handler->type = IOREQ_TYPE_COPY;
     handler->ops = &mmio_ops;
     handler->mmio.ops = ops;
 }
 
+void hvm_relocate_io_handler(struct domain *d,
+                             const struct hvm_io_handler *handler)
+{
+    struct hvm_io_index *index = d->arch.hvm_domain.io_index;
+    unsigned int h = handler - d->arch.hvm_domain.io_handler, i;
+
+    ASSERT(h < d->arch.hvm_domain.io_handler_count);
+
+    spin_lock(&index->lock);
+
+    for ( i = 0; i < index->nr_relocated; i++ )
+        if ( index->relocated[i] == h )
+            break;
+
+    if ( i == index->nr_relocated )
+    {
+        index->relocated[i] = h;
+        smp_wmb();
+        write_atomic(&index->nr_relocated, i + 1);
+    }
+
+    spin_unlock(&index->lock);
+}
+
+void relocate_mmio_handler(struct domain *d,
+                           const struct hvm_mmio_ops *ops)
+{
+    unsigned int i;
+
+    for ( i = 0; i < d->arch.hvm_domain.io_handler_count; i++ )
+    {
+        const struct hvm_io_handler *handler =
+            &d->arch.hvm_domain.io_handler[i];
+
+        if ( handler->ops == &mmio_ops && handler->mmio.ops == ops )
+        {
+            hvm_relocate_io_handler(d, handler);
+            break;
+        }
+    }
+}
+
 void register_portio_handler(struct domain *d, unsigned int port,
                              unsigned int size, portio_action_t action)
 {
-    struct hvm_io_handler *handler = hvm_next_io_handler(d);
+    struct hvm_io_index *index = d->arch.hvm_domain.io_index;
+    struct hvm_io_handler *handler = alloc_io_handler(d);
 
     if ( handler == NULL )
         return;
@@ -295,13 +530,20 @@ void register_portio_handler(struct domain *d, unsigned int port,
     handler->portio.port = port;
     handler->portio.size = size;
     handler->portio.action = action;
+
+    spin_lock(&index->lock);
+    hvm_index_portio(d);
+    spin_unlock(&index->lock);
 }
 
 void relocate_portio_handler(struct domain *d, unsigned int old_port,
                              unsigned int new_port, unsigned int size)
 {
+    struct hvm_io_index *index = d->arch.hvm_domain.io_index;
     unsigned int i;
 
+    spin_lock(&index->lock);
+
     for ( i = 0; i < d->arch.hvm_domain.io_handler_count; i++ )
     {
         struct hvm_io_handler *handler =
@@ -311,12 +553,15 @@ void relocate_portio_handler(struct domain *d, unsigned int old_port,
             continue;
 
         if ( (handler->portio.port == old_port) &&
-             (handler->portio.size = size) )
+             (handler->portio.size == size) )
         {
             handler->portio.port = new_port;
+            hvm_index_portio(d);
             break;
         }
     }
+
+    spin_unlock(&index->lock);
 }
 
 bool_t hvm_mmio_internal(paddr_t gpa)
@@ -255,12 +255,11 @@ static const struct hvm_io_ops dpci_portio_ops = {
 
 void register_dpci_portio_handler(struct domain *d)
 {
-    struct hvm_io_handler *handler = hvm_next_io_handler(d);
+    struct hvm_io_handler *handler = hvm_next_io_handler(d, IOREQ_TYPE_PIO);
 
     if ( handler == NULL )
         return;
 
-    handler->type = IOREQ_TYPE_PIO;
     handler->ops = &dpci_portio_ops;
 }
 
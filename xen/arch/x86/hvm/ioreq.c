@@ -27,6 +27,7 @@
 #include <xen/domain.h>
 #include <xen/event.h>
 #include <xen/paging.h>
+#include <xen/perfc.h>
 
 #include <asm/hvm/hvm.h>
 #include <asm/hvm/ioreq.h>
@@ -181,45 +182,54 @@ bool_t handle_hvm_io_completion(struct vcpu *v)
     return 1;
 }
 
-static int hvm_alloc_ioreq_gmfn(struct domain *d, unsigned long *gmfn)
+/* Multi-page buffered ioreq rings take @nr consecutive gmfns. */
+static int hvm_alloc_ioreq_gmfn(struct domain *d, unsigned int nr,
+                                unsigned long *gmfn)
 {
-    unsigned int i;
-    int rc;
+    unsigned long *mask = &d->arch.hvm_domain.ioreq_gmfn.mask;
+    unsigned int i, j;
 
-    rc = -ENOMEM;
-    for ( i = 0; i < sizeof(d->arch.hvm_domain.ioreq_gmfn.mask) * 8; i++ )
+    for ( i = 0; i + nr <= sizeof(*mask) * 8; i++ )
     {
-        if ( test_and_clear_bit(i, &d->arch.hvm_domain.ioreq_gmfn.mask) )
-        {
-            *gmfn = d->arch.hvm_domain.ioreq_gmfn.base + i;
-            rc = 0;
-            break;
-        }
+        for ( j = 0; j < nr; j++ )
+            if ( !test_bit(i + j, mask) )
+                break;
+
+        if ( j < nr )
+            continue;
+
+        for ( j = 0; j < nr; j++ )
+            clear_bit(i + j, mask);
+
+        *gmfn = d->arch.hvm_domain.ioreq_gmfn.base + i;
+        return 0;
     }
 
-    return rc;
+    return -ENOMEM;
 }
 
-static void hvm_free_ioreq_gmfn(struct domain *d, unsigned long gmfn)
+static void hvm_free_ioreq_gmfn(struct domain *d, unsigned int nr,
+                                unsigned long gmfn)
 {
     unsigned int i = gmfn - d->arch.hvm_domain.ioreq_gmfn.base;
 
-    if ( gmfn != gfn_x(INVALID_GFN) )
-        set_bit(i, &d->arch.hvm_domain.ioreq_gmfn.mask);
+    if ( gmfn == gfn_x(INVALID_GFN) )
+        return;
+
+    while ( nr-- )
+        set_bit(i + nr, &d->arch.hvm_domain.ioreq_gmfn.mask);
 }
 
-static void hvm_unmap_ioreq_page(struct hvm_ioreq_server *s, bool_t buf)
+static void hvm_unmap_ioreq_page(struct hvm_ioreq_page *iorp)
 {
-    struct hvm_ioreq_page *iorp = buf ? &s->bufioreq : &s->ioreq;
-
     destroy_ring_for_helper(&iorp->va, iorp->page);
 }
 
 static int hvm_map_ioreq_page(
-    struct hvm_ioreq_server *s, bool_t buf, unsigned long gmfn)
+    struct hvm_ioreq_server *s, struct hvm_ioreq_page *iorp,
+    unsigned long gmfn)
 {
     struct domain *d = s->domain;
-    struct hvm_ioreq_page *iorp = buf ? &s->bufioreq : &s->ioreq;
     struct page_info *page;
     void *va;
     int rc;
@@ -243,6 +253,7 @@ static int hvm_map_ioreq_page(
 bool_t is_ioreq_server_page(struct domain *d, const struct page_info *page)
 {
     const struct hvm_ioreq_server *s;
+    unsigned int i;
     bool_t found = 0;
 
     spin_lock_recursive(&d->arch.hvm_domain.ioreq_server.lock);
@@ -251,12 +262,15 @@ bool_t is_ioreq_server_page(struct domain *d, const struct page_info *page)
                           &d->arch.hvm_domain.ioreq_server.list,
                           list_entry )
     {
-        if ( (s->ioreq.va && s->ioreq.page == page) ||
-             (s->bufioreq.va && s->bufioreq.page == page) )
-        {
+        if ( s->ioreq.va && s->ioreq.page == page )
             found = 1;
+
+        for ( i = 0; i < s->nr_bufioreq_pages; i++ )
+            if ( s->bufioreq[i].va && s->bufioreq[i].page == page )
+                found = 1;
+
+        if ( found )
             break;
-        }
     }
 
     spin_unlock_recursive(&d->arch.hvm_domain.ioreq_server.lock);
@@ -321,7 +335,7 @@ static int hvm_ioreq_server_add_vcpu(struct hvm_ioreq_server *s,
 
     sv->ioreq_evtchn = rc;
 
-    if ( v->vcpu_id == 0 && s->bufioreq.va != NULL )
+    if ( v->vcpu_id == 0 && s->nr_bufioreq_pages )
     {
         struct domain *d = s->domain;
 
@@ -372,7 +386,7 @@ static void hvm_ioreq_server_remove_vcpu(struct hvm_ioreq_server *s,
 
         list_del(&sv->list_entry);
 
-        if ( v->vcpu_id == 0 && s->bufioreq.va != NULL )
+        if ( v->vcpu_id == 0 && s->nr_bufioreq_pages )
             free_xen_event_channel(v->domain, s->bufioreq_evtchn);
 
         free_xen_event_channel(v->domain, sv->ioreq_evtchn);
@@ -399,7 +413,7 @@ static void hvm_ioreq_server_remove_all_vcpus(struct hvm_ioreq_server *s)
 
         list_del(&sv->list_entry);
 
-        if ( v->vcpu_id == 0 && s->bufioreq.va != NULL )
+        if ( v->vcpu_id == 0 && s->nr_bufioreq_pages )
             free_xen_event_channel(v->domain, s->bufioreq_evtchn);
 
         free_xen_event_channel(v->domain, sv->ioreq_evtchn);
@@ -414,24 +428,32 @@ static int hvm_ioreq_server_map_pages(struct hvm_ioreq_server *s,
                                       unsigned long ioreq_pfn,
                                       unsigned long bufioreq_pfn)
 {
+    unsigned int i;
     int rc;
 
-    rc = hvm_map_ioreq_page(s, 0, ioreq_pfn);
+    rc = hvm_map_ioreq_page(s, &s->ioreq, ioreq_pfn);
     if ( rc )
         return rc;
 
-    if ( bufioreq_pfn != gfn_x(INVALID_GFN) )
-        rc = hvm_map_ioreq_page(s, 1, bufioreq_pfn);
+    for ( i = 0; i < s->nr_bufioreq_pages; i++ )
+    {
+        rc = hvm_map_ioreq_page(s, &s->bufioreq[i], bufioreq_pfn + i);
+        if ( rc )
+            break;
+    }
 
     if ( rc )
-        hvm_unmap_ioreq_page(s, 0);
+    {
+        while ( i-- )
+            hvm_unmap_ioreq_page(&s->bufioreq[i]);
+        hvm_unmap_ioreq_page(&s->ioreq);
+    }
 
     return rc;
 }
 
 static int hvm_ioreq_server_setup_pages(struct hvm_ioreq_server *s,
-                                        bool_t is_default,
-                                        bool_t handle_bufioreq)
+                                        bool_t is_default)
 {
     struct domain *d = s->domain;
     unsigned long ioreq_pfn = gfn_x(INVALID_GFN);
@@ -444,24 +466,24 @@ static int hvm_ioreq_server_setup_pages(struct hvm_ioreq_server *s,
          * The default ioreq server must handle buffered ioreqs, for
          * backwards compatibility.
          */
-        ASSERT(handle_bufioreq);
+        ASSERT(s->nr_bufioreq_pages == 1);
         return hvm_ioreq_server_map_pages(s,
                    d->arch.hvm_domain.params[HVM_PARAM_IOREQ_PFN],
                    d->arch.hvm_domain.params[HVM_PARAM_BUFIOREQ_PFN]);
     }
 
-    rc = hvm_alloc_ioreq_gmfn(d, &ioreq_pfn);
+    rc = hvm_alloc_ioreq_gmfn(d, 1, &ioreq_pfn);
 
-    if ( !rc && handle_bufioreq )
-        rc = hvm_alloc_ioreq_gmfn(d, &bufioreq_pfn);
+    if ( !rc && s->nr_bufioreq_pages )
+        rc = hvm_alloc_ioreq_gmfn(d, s->nr_bufioreq_pages, &bufioreq_pfn);
 
     if ( !rc )
         rc = hvm_ioreq_server_map_pages(s, ioreq_pfn, bufioreq_pfn);
 
     if ( rc )
     {
-        hvm_free_ioreq_gmfn(d, ioreq_pfn);
-        hvm_free_ioreq_gmfn(d, bufioreq_pfn);
+        hvm_free_ioreq_gmfn(d, 1, ioreq_pfn);
+        hvm_free_ioreq_gmfn(d, s->nr_bufioreq_pages, bufioreq_pfn);
     }
 
     return rc;
@@ -471,19 +493,19 @@ static void hvm_ioreq_server_unmap_pages(struct hvm_ioreq_server *s,
                                          bool_t is_default)
 {
     struct domain *d = s->domain;
-    bool_t handle_bufioreq = ( s->bufioreq.va != NULL );
+    unsigned int i;
 
-    if ( handle_bufioreq )
-        hvm_unmap_ioreq_page(s, 1);
+    for ( i = 0; i < s->nr_bufioreq_pages; i++ )
+        hvm_unmap_ioreq_page(&s->bufioreq[i]);
 
-    hvm_unmap_ioreq_page(s, 0);
+    hvm_unmap_ioreq_page(&s->ioreq);
 
     if ( !is_default )
     {
-        if ( handle_bufioreq )
-            hvm_free_ioreq_gmfn(d, s->bufioreq.gmfn);
+        if ( s->nr_bufioreq_pages )
+            hvm_free_ioreq_gmfn(d, s->nr_bufioreq_pages, s->bufioreq[0].gmfn);
 
-        hvm_free_ioreq_gmfn(d, s->ioreq.gmfn);
+        hvm_free_ioreq_gmfn(d, 1, s->ioreq.gmfn);
     }
 }
 
@@ -546,7 +568,7 @@ static void hvm_ioreq_server_enable(struct hvm_ioreq_server *s,
 {
     struct domain *d = s->domain;
     struct hvm_ioreq_vcpu *sv;
-    bool_t handle_bufioreq = ( s->bufioreq.va != NULL );
+    unsigned int i;
 
     spin_lock(&s->lock);
 
@@ -557,8 +579,8 @@ static void hvm_ioreq_server_enable(struct hvm_ioreq_server *s,
     {
         hvm_remove_ioreq_gmfn(d, &s->ioreq);
 
-        if ( handle_bufioreq )
-            hvm_remove_ioreq_gmfn(d, &s->bufioreq);
+        for ( i = 0; i < s->nr_bufioreq_pages; i++ )
+            hvm_remove_ioreq_gmfn(d, &s->bufioreq[i]);
     }
 
     s->enabled = 1;
@@ -576,7 +598,7 @@ static void hvm_ioreq_server_disable(struct hvm_ioreq_server *s,
                                     bool_t is_default)
 {
     struct domain *d = s->domain;
-    bool_t handle_bufioreq = ( s->bufioreq.va != NULL );
+    unsigned int i;
 
     spin_lock(&s->lock);
 
@@ -585,8 +607,8 @@ static void hvm_ioreq_server_disable(struct hvm_ioreq_server *s,
 
     if ( !is_default )
     {
-        if ( handle_bufioreq )
-            hvm_add_ioreq_gmfn(d, &s->bufioreq);
+        for ( i = 0; i < s->nr_bufioreq_pages; i++ )
+            hvm_add_ioreq_gmfn(d, &s->bufioreq[i]);
 
         hvm_add_ioreq_gmfn(d, &s->ioreq);
     }
@@ -617,11 +639,24 @@ static int hvm_ioreq_server_init(struct hvm_ioreq_server *s,
     if ( rc )
         return rc;
 
-    if ( bufioreq_handling == HVM_IOREQSRV_BUFIOREQ_ATOMIC )
+    if ( bufioreq_handling & HVM_IOREQSRV_BUFIOREQ_EVTIDX )
+    {
+        unsigned int order = HVM_IOREQSRV_BUFIOREQ_ORDER(bufioreq_handling);
+
         s->bufioreq_atomic = 1;
+        s->bufioreq_evtidx = 1;
+        s->nr_bufioreq_pages = 1u << order;
+        s->bufioreq_slots = IOREQ_BUFFER_EXT_SLOT_NUM(order);
+    }
+    else if ( bufioreq_handling != HVM_IOREQSRV_BUFIOREQ_OFF )
+    {
+        s->bufioreq_atomic =
+            (bufioreq_handling == HVM_IOREQSRV_BUFIOREQ_ATOMIC);
+        s->nr_bufioreq_pages = 1;
+        s->bufioreq_slots = IOREQ_BUFFER_SLOT_NUM;
+    }
 
-    rc = hvm_ioreq_server_setup_pages(
-             s, is_default, bufioreq_handling != HVM_IOREQSRV_BUFIOREQ_OFF);
+    rc = hvm_ioreq_server_setup_pages(s, is_default);
     if ( rc )
         goto fail_map;
 
@@ -686,7 +721,17 @@ int hvm_create_ioreq_server(struct domain *d, domid_t domid,
     struct hvm_ioreq_server *s;
     int rc;
 
-    if ( bufioreq_handling > HVM_IOREQSRV_BUFIOREQ_ATOMIC )
+    if ( bufioreq_handling & HVM_IOREQSRV_BUFIOREQ_EVTIDX )
+    {
+        if ( is_default ||
+             (bufioreq_handling & ~(HVM_IOREQSRV_BUFIOREQ_EVTIDX |
+                                    HVM_IOREQSRV_BUFIOREQ_ORDER_MASK)) !=
+             HVM_IOREQSRV_BUFIOREQ_ATOMIC ||
+             HVM_IOREQSRV_BUFIOREQ_ORDER(bufioreq_handling) >
+             HVM_IOREQSRV_BUFIOREQ_MAX_ORDER )
+            return -EINVAL;
+    }
+    else if ( bufioreq_handling > HVM_IOREQSRV_BUFIOREQ_ATOMIC )
         return -EINVAL;
 
     rc = -ENOMEM;
@@ -795,9 +840,9 @@ int hvm_get_ioreq_server_info(struct domain *d, ioservid_t id,
 
         *ioreq_pfn = s->ioreq.gmfn;
 
-        if ( s->bufioreq.va != NULL )
+        if ( s->nr_bufioreq_pages )
         {
-            *bufioreq_pfn = s->bufioreq.gmfn;
+            *bufioreq_pfn = s->bufioreq[0].gmfn;
             *bufioreq_port = s->bufioreq_evtchn;
         }
 
@@ -1201,11 +1246,53 @@ struct hvm_ioreq_server *hvm_select_ioreq_server(struct domain *d,
     return d->arch.hvm_domain.default_ioreq_server;
 }
 
+static buf_ioreq_t *hvm_bufioreq_slot(struct hvm_ioreq_server *s,
+                                      unsigned int slot)
+{
+    unsigned long off;
+
+    if ( !s->bufioreq_evtidx )
+        return &((buffered_iopage_t *)s->bufioreq[0].va)->buf_ioreq[slot];
+
+    /* Extended rings run on across the consecutive pages. */
+    off = offsetof(buffered_iopage_ext_t, buf_ioreq) +
+          slot * sizeof(buf_ioreq_t);
+
+    return s->bufioreq[off >> PAGE_SHIFT].va + (off & ~PAGE_MASK);
+}
+
+/*
+ * With an extended ring the emulator says how full the ring must be
+ * before it wants to hear about it: only kick the event channel when
+ * the @n slots just written took the fill level across the threshold.
+ */
+static bool_t hvm_bufioreq_notify(struct hvm_ioreq_server *s, unsigned int n)
+{
+    buffered_iopage_ext_t *pg = s->bufioreq[0].va;
+    union bufioreq_pointers ptrs;
+    uint32_t threshold, fill;
+
+    if ( !s->bufioreq_evtidx )
+        return 1;
+
+    /* Order the write_pointer update against reading the threshold. */
+    smp_mb();
+
+    threshold = read_atomic(&pg->notify_threshold);
+    if ( threshold == 0 )
+        return 1;
+
+    ptrs.full = read_atomic(&pg->ptrs.full);
+    fill = ptrs.write_pointer - ptrs.read_pointer;
+
+    return fill >= threshold && fill - n < threshold;
+}
+
 static int hvm_send_buffered_ioreq(struct hvm_ioreq_server *s, ioreq_t *p)
 {
     struct domain *d = current->domain;
-    struct hvm_ioreq_page *iorp;
-    buffered_iopage_t *pg;
+    union bufioreq_pointers *ptrs;
+    unsigned int slots = s->bufioreq_slots, n;
     buf_ioreq_t bp = { .data = p->data,
                        .addr = p->addr,
                        .type = p->type,
@@ -1215,11 +1302,13 @@ static int hvm_send_buffered_ioreq(struct hvm_ioreq_server *s, ioreq_t *p)
 
     /* Ensure buffered_iopage fits in a page */
     BUILD_BUG_ON(sizeof(buffered_iopage_t) > PAGE_SIZE);
+    BUILD_BUG_ON(offsetof(buffered_iopage_t, ptrs) !=
+                 offsetof(buffered_iopage_ext_t, ptrs));
+    BUILD_BUG_ON(offsetof(buffered_iopage_ext_t, buf_ioreq) != 16);
 
-    iorp = &s->bufioreq;
-    pg = iorp->va;
+    ptrs = s->bufioreq[0].va;
 
-    if ( !pg )
+    if ( !ptrs )
         return X86EMUL_UNHANDLEABLE;
 
     /*
@@ -1255,39 +1344,46 @@ static int hvm_send_buffered_ioreq(struct hvm_ioreq_server *s, ioreq_t *p)
 
     spin_lock(&s->bufioreq_lock);
 
-    if ( (pg->ptrs.write_pointer - pg->ptrs.read_pointer) >=
-         (IOREQ_BUFFER_SLOT_NUM - qw) )
+    if ( (ptrs->write_pointer - ptrs->read_pointer) >= (slots - qw) )
     {
         /* The queue is full: send the iopacket through the normal path. */
         spin_unlock(&s->bufioreq_lock);
         return X86EMUL_UNHANDLEABLE;
     }
 
-    pg->buf_ioreq[pg->ptrs.write_pointer % IOREQ_BUFFER_SLOT_NUM] = bp;
+    *hvm_bufioreq_slot(s, ptrs->write_pointer % slots) = bp;
 
     if ( qw )
     {
         bp.data = p->data >> 32;
-        pg->buf_ioreq[(pg->ptrs.write_pointer+1) % IOREQ_BUFFER_SLOT_NUM] = bp;
+        *hvm_bufioreq_slot(s, (ptrs->write_pointer + 1) % slots) = bp;
     }
 
     /* Make the ioreq_t visible /before/ write_pointer. */
     wmb();
-    pg->ptrs.write_pointer += qw ? 2 : 1;
+    n = qw ? 2 : 1;
+    ptrs->write_pointer += n;
 
     /* Canonicalize read/write pointers to prevent their overflow. */
-    while ( s->bufioreq_atomic && qw++ < IOREQ_BUFFER_SLOT_NUM &&
-            pg->ptrs.read_pointer >= IOREQ_BUFFER_SLOT_NUM )
+    while ( s->bufioreq_atomic && qw++ < slots &&
+            ptrs->read_pointer >= slots )
     {
-        union bufioreq_pointers old = pg->ptrs, new;
-        unsigned int n = old.read_pointer / IOREQ_BUFFER_SLOT_NUM;
+        union bufioreq_pointers old = *ptrs, new;
+        unsigned int wraps = old.read_pointer / slots;
 
-        new.read_pointer = old.read_pointer - n * IOREQ_BUFFER_SLOT_NUM;
-        new.write_pointer = old.write_pointer - n * IOREQ_BUFFER_SLOT_NUM;
-        cmpxchg(&pg->ptrs.full, old.full, new.full);
+        new.read_pointer = old.read_pointer - wraps * slots;
+        new.write_pointer = old.write_pointer - wraps * slots;
+        cmpxchg(&ptrs->full, old.full, new.full);
     }
 
-    notify_via_xen_event_channel(d, s->bufioreq_evtchn);
+    if ( hvm_bufioreq_notify(s, n) )
+    {
+        perfc_incr(bufioreq_notified);
+        notify_via_xen_event_channel(d, s->bufioreq_evtchn);
+    }
+    else
+        perfc_incr(bufioreq_suppressed);
+
     spin_unlock(&s->bufioreq_lock);
 
     return X86EMUL_OKAY;
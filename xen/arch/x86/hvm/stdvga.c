@@ -604,12 +604,11 @@ void stdvga_init(struct domain *d)
         register_portio_handler(d, 0x3ce, 2, stdvga_intercept_pio);
 
         /* VGA memory */
-        handler = hvm_next_io_handler(d);
+        handler = hvm_next_io_handler(d, IOREQ_TYPE_COPY);
 
         if ( handler == NULL )
             return;
 
-        handler->type = IOREQ_TYPE_COPY;
         handler->ops = &stdvga_mem_ops;
     }
 }
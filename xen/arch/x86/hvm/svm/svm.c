@@ -57,6 +57,7 @@
 #include <public/sched.h>
 #include <asm/hvm/vpt.h>
 #include <asm/hvm/trace.h>
+#include <asm/hvm/exitlat.h>
 #include <asm/hap.h>
 #include <asm/apic.h>
 #include <asm/debugger.h>
@@ -2302,6 +2303,8 @@ void svm_vmexit_handler(struct cpu_user_regs *regs)
 
     exit_reason = vmcb->exitcode;
 
+    hvm_exitlat_start(exit_reason);
+
     if ( hvm_long_mode_enabled(v) )
         HVMTRACE_ND(VMEXIT64, vcpu_guestmode ? TRC_HVM_NESTEDFLAG : 0,
                     1/*cycles*/, 3, exit_reason,
@@ -2696,6 +2699,13 @@ void svm_vmexit_handler(struct cpu_user_regs *regs)
     vmcb_set_vintr(vmcb, intr);
 }
 
+/* Called directly before VMRUN. */
+void svm_vmenter_helper(void)
+{
+    svm_asid_handle_vmrun();
+    hvm_exitlat_end();
+}
+
 void svm_trace_vmentry(void)
 {
     struct vcpu *curr = current;
@@ -440,6 +440,80 @@ void vlapic_handle_EOI(struct vlapic *vlapic, u8 vector)
     hvm_dpci_msi_eoi(d, vector);
 }
 
+static uint32_t x2apic_ldr(unsigned int vcpu_id)
+{
+    return ((vcpu_id & ~0xf) << 12) | (1 << (vcpu_id & 0xf));
+}
+
+/*
+ * Track whether the vLAPIC is in x2APIC mode with the ID and LDR
+ * set_x2apic_id() gives it.  x2APIC IDs and LDRs are read-only, so while
+ * all of a domain's vLAPICs are, IPI destinations map directly to vCPUs.
+ */
+static void vlapic_update_x2apic_default(struct vlapic *vlapic)
+{
+    const struct vcpu *v = vlapic_vcpu(vlapic);
+    bool_t dflt = vlapic_x2apic_mode(vlapic) &&
+                  vlapic_get_reg(vlapic, APIC_ID) == v->vcpu_id * 2 &&
+                  vlapic_get_reg(vlapic, APIC_LDR) == x2apic_ldr(v->vcpu_id);
+
+    if ( dflt == vlapic->x2apic_default )
+        return;
+
+    vlapic->x2apic_default = dflt;
+    if ( dflt )
+        atomic_dec(&v->domain->arch.hvm_domain.x2apic_nondefault);
+    else
+        atomic_inc(&v->domain->arch.hvm_domain.x2apic_nondefault);
+}
+
+/*
+ * Deliver a fixed (or NMI etc) IPI from an x2APIC without a destination
+ * shorthand to the vCPUs its destination names, when all of the domain's
+ * vLAPICs have their default x2APIC ID and LDR: the physical ID of vCPU n
+ * is 2n, and logical destinations name up to 16 vCPUs of a cluster by a
+ * bitmap.  Returns false if the destination has to be matched against
+ * each vCPU instead.
+ */
+static bool_t vlapic_ipi_direct(struct vlapic *vlapic, uint32_t icr_low,
+                                uint32_t dest, bool_t dest_mode)
+{
+    struct domain *d = vlapic_domain(vlapic);
+    unsigned int id, bits;
+    bool_t batch;
+
+    if ( !vlapic_x2apic_mode(vlapic) ||
+         atomic_read(&d->arch.hvm_domain.x2apic_nondefault) )
+        return 0;
+
+    if ( !dest_mode )
+    {
+        if ( dest == 0xffffffff )
+            return 0;
+        if ( !(dest & 1) && (id = dest / 2) < d->max_vcpus && d->vcpu[id] )
+            vlapic_accept_irq(d->vcpu[id], icr_low);
+        return 1;
+    }
+
+    bits = (uint16_t)dest;
+    batch = !!(bits & (bits - 1));
+    if ( batch )
+        cpu_raise_softirq_batch_begin();
+    for ( id = (dest >> 16) << 4; bits; bits >>= 1, id++ )
+    {
+        if ( !(bits & 1) )
+            continue;
+        if ( id >= d->max_vcpus )
+            break;
+        if ( d->vcpu[id] )
+            vlapic_accept_irq(d->vcpu[id], icr_low);
+    }
+    if ( batch )
+        cpu_raise_softirq_batch_finish();
+
+    return 1;
+}
+
 static bool_t is_multicast_dest(struct vlapic *vlapic, unsigned int short_hand,
                                 uint32_t dest, bool_t dest_mode)
 {
@@ -466,6 +540,8 @@ void vlapic_ipi(
     unsigned int dest;
     unsigned int short_hand = icr_low & APIC_SHORT_MASK;
     bool_t dest_mode = !!(icr_low & APIC_DEST_MASK);
+    s_time_t start = NOW();
+    uint64_t ns;
 
     HVM_DBG_LOG(DBG_LEVEL_VLAPIC, "icr = 0x%08x:%08x", icr_high, icr_low);
 
@@ -506,8 +582,16 @@ void vlapic_ipi(
         /* fall through */
     default: {
         struct vcpu *v;
-        bool_t batch = is_multicast_dest(vlapic, short_hand, dest, dest_mode);
+        bool_t batch;
+
+        if ( !short_hand &&
+             vlapic_ipi_direct(vlapic, icr_low, dest, dest_mode) )
+        {
+            vlapic->ipi_stats.direct++;
+            break;
+        }
 
+        batch = is_multicast_dest(vlapic, short_hand, dest, dest_mode);
         if ( batch )
             cpu_raise_softirq_batch_begin();
         for_each_vcpu ( vlapic_domain(vlapic), v )
@@ -521,6 +605,34 @@ void vlapic_ipi(
         break;
     }
     }
+
+    ns = NOW() - start;
+    vlapic->ipi_stats.sent++;
+    vlapic->ipi_stats.ns += ns;
+    if ( ns > vlapic->ipi_stats.max_ns )
+        vlapic->ipi_stats.max_ns = ns;
+}
+
+void vlapic_dump_ipi_stats(const struct domain *d)
+{
+    const struct vcpu *v;
+    unsigned long sent = 0, direct = 0;
+    uint64_t ns = 0, max_ns = 0;
+
+    for_each_vcpu ( d, v )
+    {
+        const struct vlapic *vlapic = vcpu_vlapic(v);
+
+        sent += vlapic->ipi_stats.sent;
+        direct += vlapic->ipi_stats.direct;
+        ns += vlapic->ipi_stats.ns;
+        if ( vlapic->ipi_stats.max_ns > max_ns )
+            max_ns = vlapic->ipi_stats.max_ns;
+    }
+
+    if ( sent )
+        printk("    IPIs: %lu sent, %lu direct, avg %"PRIu64"ns "
+               "max %"PRIu64"ns\n", sent, direct, ns / sent, max_ns);
 }
 
 static uint32_t vlapic_get_tmcct(struct vlapic *vlapic)
@@ -989,13 +1101,19 @@ static const struct hvm_mmio_ops vlapic_mmio_ops = {
     .write = vlapic_write
 };
 
+/* Once moved, the APIC page may overlap another device's MMIO range. */
+static void vlapic_base_changed(struct vlapic *vlapic)
+{
+    if ( vlapic_base_address(vlapic) != APIC_DEFAULT_PHYS_BASE )
+        relocate_mmio_handler(vlapic_domain(vlapic), &vlapic_mmio_ops);
+}
+
 static void set_x2apic_id(struct vlapic *vlapic)
 {
     u32 id = vlapic_vcpu(vlapic)->vcpu_id;
-    u32 ldr = ((id & ~0xf) << 12) | (1 << (id & 0xf));
 
     vlapic_set_reg(vlapic, APIC_ID, id * 2);
-    vlapic_set_reg(vlapic, APIC_LDR, ldr);
+    vlapic_set_reg(vlapic, APIC_LDR, x2apic_ldr(id));
 }
 
 bool_t vlapic_msr_set(struct vlapic *vlapic, uint64_t value)
@@ -1027,9 +1145,11 @@ bool_t vlapic_msr_set(struct vlapic *vlapic, uint64_t value)
 
     vlapic->hw.apic_base_msr = value;
     memset(&vlapic->loaded, 0, sizeof(vlapic->loaded));
+    vlapic_base_changed(vlapic);
 
     if ( vlapic_x2apic_mode(vlapic) )
         set_x2apic_id(vlapic);
+    vlapic_update_x2apic_default(vlapic);
 
     vmx_vlapic_msr_changed(vlapic_vcpu(vlapic));
 
@@ -1287,6 +1407,7 @@ void vlapic_reset(struct vlapic *vlapic)
 
     vlapic_set_reg(vlapic, APIC_SPIV, 0xff);
     vlapic->hw.disabled |= VLAPIC_SW_DISABLED;
+    vlapic_update_x2apic_default(vlapic);
 
     TRACE_0D(TRC_HVM_EMUL_LAPIC_STOP_TIMER);
     destroy_periodic_time(&vlapic->pt);
@@ -1417,6 +1538,8 @@ static int lapic_load_hidden(struct domain *d, hvm_domain_context_t *h)
     s->loaded.hw = 1;
     if ( s->loaded.regs )
         lapic_load_fixup(s);
+    vlapic_update_x2apic_default(s);
+    vlapic_base_changed(s);
 
     if ( !(s->hw.apic_base_msr & MSR_IA32_APICBASE_ENABLE) &&
          unlikely(vlapic_x2apic_mode(s)) )
@@ -1454,6 +1577,7 @@ static int lapic_load_regs(struct domain *d, hvm_domain_context_t *h)
     s->loaded.regs = 1;
     if ( s->loaded.hw )
         lapic_load_fixup(s);
+    vlapic_update_x2apic_default(s);
 
     if ( hvm_funcs.process_isr )
         hvm_funcs.process_isr(vlapic_find_highest_isr(s), v);
@@ -1510,6 +1634,7 @@ int vlapic_init(struct vcpu *v)
                                 APIC_DEFAULT_PHYS_BASE);
     if ( v->vcpu_id == 0 )
         vlapic->hw.apic_base_msr |= MSR_IA32_APICBASE_BSP;
+    atomic_inc(&v->domain->arch.hvm_domain.x2apic_nondefault);
 
     spin_lock_init(&vlapic->esr_lock);
 
@@ -567,11 +567,12 @@ void msixtbl_init(struct domain *d)
 
     INIT_LIST_HEAD(&d->arch.hvm_domain.msixtbl_list);
 
-    handler = hvm_next_io_handler(d);
+    handler = hvm_next_io_handler(d, IOREQ_TYPE_COPY);
     if ( handler )
     {
-        handler->type = IOREQ_TYPE_COPY;
         handler->ops = &msixtbl_mmio_ops;
+        /* The tables are wherever the guest puts the devices' BARs. */
+        hvm_relocate_io_handler(d, handler);
     }
 }
 
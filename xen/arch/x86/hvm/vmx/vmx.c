@@ -49,6 +49,7 @@
 #include <asm/hvm/vpt.h>
 #include <public/hvm/save.h>
 #include <asm/hvm/trace.h>
+#include <asm/hvm/exitlat.h>
 #include <asm/hvm/monitor.h>
 #include <asm/xenoprof.h>
 #include <asm/debugger.h>
@@ -86,6 +87,7 @@ static int vmx_vmfunc_intercept(struct cpu_user_regs *regs);
 struct vmx_pi_blocking_vcpu {
     struct list_head     list;
     spinlock_t           lock;
+    unsigned int         counter;
 };
 
 /*
@@ -94,6 +96,13 @@ struct vmx_pi_blocking_vcpu {
  */
 static DEFINE_PER_CPU(struct vmx_pi_blocking_vcpu, vmx_pi_blocking);
 
+/*
+ * The wakeup handler walks the whole list of the pCPU it runs on, so keep
+ * the lists short: a vCPU blocking while its own pCPU's list is this long
+ * gets queued on (and its wakeup notifications sent to) another pCPU.
+ */
+#define PI_LIST_LIMIT 128
+
 uint8_t __read_mostly posted_intr_vector;
 static uint8_t __read_mostly pi_wakeup_vector;
 
@@ -103,16 +112,46 @@ void vmx_pi_per_cpu_init(unsigned int cpu)
     spin_lock_init(&per_cpu(vmx_pi_blocking, cpu).lock);
 }
 
+static unsigned int vmx_pi_blocking_cpu(unsigned int cpu)
+{
+    unsigned int i;
+
+    if ( read_atomic(&per_cpu(vmx_pi_blocking, cpu).counter) < PI_LIST_LIMIT )
+        return cpu;
+
+    for ( i = cpumask_cycle(cpu, &cpu_online_map); i != cpu;
+          i = cpumask_cycle(i, &cpu_online_map) )
+        if ( read_atomic(&per_cpu(vmx_pi_blocking, i).counter) <
+             PI_LIST_LIMIT )
+            return i;
+
+    return cpu;
+}
+
 static void vmx_vcpu_block(struct vcpu *v)
 {
     unsigned long flags;
-    unsigned int dest;
+    unsigned int dest, pi_cpu = vmx_pi_blocking_cpu(v->processor);
     spinlock_t *old_lock;
     spinlock_t *pi_blocking_list_lock =
-		&per_cpu(vmx_pi_blocking, v->processor).lock;
+		&per_cpu(vmx_pi_blocking, pi_cpu).lock;
     struct pi_desc *pi_desc = &v->arch.hvm_vmx.pi_desc;
 
     spin_lock_irqsave(pi_blocking_list_lock, flags);
+
+    /*
+     * A pCPU going down moves its list elsewhere once offline; don't add
+     * to the list of one which may have been through that already.  The
+     * pCPU we are running on can't be.
+     */
+    if ( unlikely(!cpu_online(pi_cpu)) )
+    {
+        spin_unlock_irqrestore(pi_blocking_list_lock, flags);
+        pi_cpu = v->processor;
+        pi_blocking_list_lock = &per_cpu(vmx_pi_blocking, pi_cpu).lock;
+        spin_lock_irqsave(pi_blocking_list_lock, flags);
+    }
+
     old_lock = cmpxchg(&v->arch.hvm_vmx.pi_blocking.lock, NULL,
                        pi_blocking_list_lock);
 
@@ -123,16 +162,20 @@ static void vmx_vcpu_block(struct vcpu *v)
      */
     ASSERT(old_lock == NULL);
 
+    per_cpu(vmx_pi_blocking, pi_cpu).counter++;
     list_add_tail(&v->arch.hvm_vmx.pi_blocking.list,
-                  &per_cpu(vmx_pi_blocking, v->processor).list);
+                  &per_cpu(vmx_pi_blocking, pi_cpu).list);
     spin_unlock_irqrestore(pi_blocking_list_lock, flags);
 
     ASSERT(!pi_test_sn(pi_desc));
 
-    dest = cpu_physical_id(v->processor);
-
-    ASSERT(pi_desc->ndst ==
-           (x2apic_enabled ? dest : MASK_INSR(dest, PI_xAPIC_NDST_MASK)));
+    /*
+     * Pending interrupts posted while NV and NDST still have their running
+     * values get noticed by vcpu_block() checking for events after this.
+     */
+    dest = cpu_physical_id(pi_cpu);
+    write_atomic(&pi_desc->ndst,
+                 x2apic_enabled ? dest : MASK_INSR(dest, PI_xAPIC_NDST_MASK));
 
     write_atomic(&pi_desc->nv, pi_wakeup_vector);
 }
@@ -161,11 +204,21 @@ static void vmx_pi_switch_to(struct vcpu *v)
 static void vmx_pi_do_resume(struct vcpu *v)
 {
     unsigned long flags;
+    unsigned int dest = cpu_physical_id(v->processor);
     spinlock_t *pi_blocking_list_lock;
     struct pi_desc *pi_desc = &v->arch.hvm_vmx.pi_desc;
 
     ASSERT(!test_bit(_VPF_blocked, &v->pause_flags));
 
+    /*
+     * The vCPU may have been queued on another pCPU's blocking list, with
+     * NDST pointing there, and may resume without a context switch.
+     */
+    if ( !x2apic_enabled )
+        dest = MASK_INSR(dest, PI_xAPIC_NDST_MASK);
+    if ( pi_desc->ndst != dest )
+        write_atomic(&pi_desc->ndst, dest);
+
     /*
      * Set 'NV' field back to posted_intr_vector, so the
      * Posted-Interrupts can be delivered to the vCPU when
@@ -192,12 +245,77 @@ static void vmx_pi_do_resume(struct vcpu *v)
     {
         ASSERT(v->arch.hvm_vmx.pi_blocking.lock == pi_blocking_list_lock);
         list_del(&v->arch.hvm_vmx.pi_blocking.list);
+        container_of(pi_blocking_list_lock,
+                     struct vmx_pi_blocking_vcpu, lock)->counter--;
         v->arch.hvm_vmx.pi_blocking.lock = NULL;
     }
 
     spin_unlock_irqrestore(pi_blocking_list_lock, flags);
 }
 
+/*
+ * Move the vCPUs blocked on a pCPU which went down to the list of one
+ * which is online, or wake them if a notification is already pending.
+ */
+void vmx_pi_desc_fixup(unsigned int cpu)
+{
+    unsigned int new_cpu, dest;
+    unsigned long flags;
+    struct arch_vmx_struct *vmx, *tmp;
+    spinlock_t *new_lock, *old_lock = &per_cpu(vmx_pi_blocking, cpu).lock;
+    struct list_head *blocked_vcpus = &per_cpu(vmx_pi_blocking, cpu).list;
+
+    if ( !iommu_intpost )
+        return;
+
+    /*
+     * We are in the context of CPU_DEAD or CPU_UP_CANCELED notification,
+     * and no other pCPU can go down in parallel, so the locks of the old
+     * and the new pCPU can safely be nested.
+     */
+    spin_lock_irqsave(old_lock, flags);
+
+    list_for_each_entry_safe(vmx, tmp, blocked_vcpus, pi_blocking.list)
+    {
+        /* Suppress notifications to the dead pCPU while moving. */
+        pi_set_sn(&vmx->pi_desc);
+
+        if ( pi_test_on(&vmx->pi_desc) )
+        {
+            list_del(&vmx->pi_blocking.list);
+            vmx->pi_blocking.lock = NULL;
+            vcpu_unblock(container_of(vmx, struct vcpu, arch.hvm_vmx));
+        }
+        else
+        {
+            new_cpu = vmx_pi_blocking_cpu(cpumask_any(&cpu_online_map));
+            new_lock = &per_cpu(vmx_pi_blocking, new_cpu).lock;
+
+            spin_lock(new_lock);
+
+            ASSERT(vmx->pi_blocking.lock == old_lock);
+
+            dest = cpu_physical_id(new_cpu);
+            write_atomic(&vmx->pi_desc.ndst,
+                         x2apic_enabled ? dest
+                                        : MASK_INSR(dest, PI_xAPIC_NDST_MASK));
+
+            list_move(&vmx->pi_blocking.list,
+                      &per_cpu(vmx_pi_blocking, new_cpu).list);
+            per_cpu(vmx_pi_blocking, new_cpu).counter++;
+            vmx->pi_blocking.lock = new_lock;
+
+            spin_unlock(new_lock);
+        }
+
+        pi_clear_sn(&vmx->pi_desc);
+    }
+
+    per_cpu(vmx_pi_blocking, cpu).counter = 0;
+
+    spin_unlock_irqrestore(old_lock, flags);
+}
+
 /* This function is called when pcidevs_lock is held */
 void vmx_pi_hooks_assign(struct domain *d)
 {
@@ -2232,15 +2350,16 @@ static void pi_wakeup_interrupt(struct cpu_user_regs *regs)
     spin_lock(lock);
 
     /*
-     * XXX: The length of the list depends on how many vCPU is current
-     * blocked on this specific pCPU. This may hurt the interrupt latency
-     * if the list grows to too many entries.
+     * The length of the list depends on how many vCPUs are currently
+     * blocked on this specific pCPU, which vmx_vcpu_block() keeps around
+     * PI_LIST_LIMIT.
      */
     list_for_each_entry_safe(vmx, tmp, blocked_vcpus, pi_blocking.list)
     {
         if ( pi_test_on(&vmx->pi_desc) )
         {
             list_del(&vmx->pi_blocking.list);
+            this_cpu(vmx_pi_blocking).counter--;
             ASSERT(vmx->pi_blocking.lock == lock);
             vmx->pi_blocking.lock = NULL;
             vcpu_unblock(container_of(vmx, struct vcpu, arch.hvm_vmx));
@@ -3319,6 +3438,8 @@ void vmx_vmexit_handler(struct cpu_user_regs *regs)
 
     __vmread(VM_EXIT_REASON, &exit_reason);
 
+    hvm_exitlat_start((uint16_t)exit_reason);
+
     if ( hvm_long_mode_enabled(v) )
         HVMTRACE_ND(VMEXIT64, 0, 1/*cycles*/, 3, exit_reason,
                     (uint32_t)regs->eip, (uint32_t)((uint64_t)regs->eip >> 32),
@@ -4012,14 +4133,52 @@ void vmx_vmenter_helper(const struct cpu_user_regs *regs)
 
     if ( paging_mode_hap(curr->domain) )
     {
-        struct ept_data *ept = &p2m_get_hostp2m(curr->domain)->ept;
+        struct domain *currd = curr->domain;
+        struct ept_data *ept = &p2m_get_hostp2m(currd)->ept;
         unsigned int cpu = smp_processor_id();
+        unsigned int inv = 0;
 
         if ( cpumask_test_cpu(cpu, ept->invalidate) )
         {
             cpumask_clear_cpu(cpu, ept->invalidate);
+            inv++;
+        }
+
+        /*
+         * Changes to altp2m views are flushed the same way, and any of them
+         * may be reachable without a VM exit (VMFUNC), so check them all.
+         * If more than one context needs invalidating, do them in one go.
+         */
+        if ( altp2m_active(currd) )
+        {
+            unsigned int i;
+
+            for ( i = 0; i < MAX_ALTP2M; i++ )
+            {
+                struct ept_data *aept = &currd->arch.altp2m_p2m[i]->ept;
+
+                if ( currd->arch.altp2m_eptp[i] == mfn_x(INVALID_MFN) )
+                    continue;
+
+                if ( cpumask_test_cpu(cpu, aept->invalidate) )
+                {
+                    cpumask_clear_cpu(cpu, aept->invalidate);
+                    ept = aept;
+                    inv++;
+                }
+            }
+        }
+
+        if ( inv == 1 )
+        {
+            perfc_incr(invept_single);
             __invept(INVEPT_SINGLE_CONTEXT, ept_get_eptp(ept), 0);
         }
+        else if ( inv )
+        {
+            perfc_incr(invept_all);
+            __invept(INVEPT_ALL_CONTEXT, 0, 0);
+        }
     }
 
  out:
@@ -4028,6 +4187,8 @@ void vmx_vmenter_helper(const struct cpu_user_regs *regs)
     __vmwrite(GUEST_RIP,    regs->rip);
     __vmwrite(GUEST_RSP,    regs->rsp);
     __vmwrite(GUEST_RFLAGS, regs->rflags | X86_EFLAGS_MBS);
+
+    hvm_exitlat_end();
 }
 
 /*
@@ -16,6 +16,7 @@
  * this program; If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <xen/init.h>
 #include <xen/time.h>
 #include <asm/hvm/support.h>
 #include <asm/hvm/vpt.h>
@@ -26,6 +27,10 @@
 #define mode_is(d, name) \
     ((d)->arch.hvm_domain.params[HVM_PARAM_TIMER_MODE] == HVMPTM_##name)
 
+/* Tick coalescing window, in microseconds (0 = off). */
+static unsigned int __read_mostly vpt_coalesce;
+integer_param("vpt_coalesce", vpt_coalesce);
+
 void hvm_init_guest_time(struct domain *d)
 {
     struct pl_time *pl = d->arch.hvm_domain.pl_time;
@@ -134,6 +139,22 @@ static void pt_unlock(struct periodic_time *pt)
     spin_unlock(&pt->vcpu->arch.hvm_vcpu.tm_lock);
 }
 
+/*
+ * When the host timer for the next tick should go off.  Periodic ticks are
+ * rounded up to the end of their coalescing window, so that all ticks due
+ * in the same window, whichever vCPU and timer source they belong to, are
+ * handled by one timer interrupt on each pCPU.
+ */
+static s_time_t pt_deadline(const struct periodic_time *pt)
+{
+    s_time_t window = MICROSECS(vpt_coalesce);
+
+    if ( !window || pt->one_shot )
+        return pt->scheduled;
+
+    return (pt->scheduled + window - 1) / window * window;
+}
+
 static void pt_process_missed_ticks(struct periodic_time *pt)
 {
     s_time_t missed_ticks, now = NOW();
@@ -149,7 +170,10 @@ static void pt_process_missed_ticks(struct periodic_time *pt)
     if ( mode_is(pt->vcpu->domain, no_missed_ticks_pending) )
         pt->do_not_freeze = !pt->pending_intr_nr;
     else
+    {
         pt->pending_intr_nr += missed_ticks;
+        pt->vcpu->arch.hvm_vcpu.tm_pending = 1;
+    }
     pt->scheduled += missed_ticks * pt->period;
 }
 
@@ -204,7 +228,7 @@ void pt_restore_timer(struct vcpu *v)
         if ( pt->pending_intr_nr == 0 )
         {
             pt_process_missed_ticks(pt);
-            set_timer(&pt->timer, pt->scheduled);
+            set_timer(&pt->timer, pt_deadline(pt));
         }
     }
 
@@ -222,6 +246,7 @@ static void pt_timer_fn(void *data)
     pt->pending_intr_nr++;
     pt->scheduled += pt->period;
     pt->do_not_freeze = 0;
+    pt->vcpu->arch.hvm_vcpu.tm_pending = 1;
 
     vcpu_kick(pt->vcpu);
 
@@ -235,6 +260,15 @@ int pt_update_irq(struct vcpu *v)
     uint64_t max_lag;
     int irq, is_lapic;
 
+    /*
+     * This runs on every VM entry, and most of the time no tick is due:
+     * tm_pending is set (with tm_lock held) whenever a timer on the list
+     * gets a tick, before the vCPU gets kicked, and only cleared below
+     * when no timer on the list has any.
+     */
+    if ( !read_atomic(&v->arch.hvm_vcpu.tm_pending) )
+        return -1;
+
     spin_lock(&v->arch.hvm_vcpu.tm_lock);
 
     earliest_pt = NULL;
@@ -263,6 +297,7 @@ int pt_update_irq(struct vcpu *v)
 
     if ( earliest_pt == NULL )
     {
+        v->arch.hvm_vcpu.tm_pending = 0;
         spin_unlock(&v->arch.hvm_vcpu.tm_lock);
         return -1;
     }
@@ -316,7 +351,8 @@ void pt_intr_post(struct vcpu *v, struct hvm_intack intack)
     time_cb *cb;
     void *cb_priv;
 
-    if ( intack.source == hvm_intsrc_vector )
+    if ( intack.source == hvm_intsrc_vector ||
+         !read_atomic(&v->arch.hvm_vcpu.tm_pending) )
         return;
 
     spin_lock(&v->arch.hvm_vcpu.tm_lock);
@@ -343,7 +379,7 @@ void pt_intr_post(struct vcpu *v, struct hvm_intack intack)
         pt->last_plt_gtime = hvm_get_guest_time(v);
         pt_process_missed_ticks(pt);
         pt->pending_intr_nr = 0; /* 'collapse' all missed ticks */
-        set_timer(&pt->timer, pt->scheduled);
+        set_timer(&pt->timer, pt_deadline(pt));
     }
     else
     {
@@ -352,7 +388,7 @@ void pt_intr_post(struct vcpu *v, struct hvm_intack intack)
         {
             pt_process_missed_ticks(pt);
             if ( pt->pending_intr_nr == 0 )
-                set_timer(&pt->timer, pt->scheduled);
+                set_timer(&pt->timer, pt_deadline(pt));
         }
     }
 
@@ -437,7 +473,7 @@ void create_periodic_time(
     list_add(&pt->list, &v->arch.hvm_vcpu.tm_list);
 
     init_timer(&pt->timer, pt_timer_fn, pt, v->processor);
-    set_timer(&pt->timer, pt->scheduled);
+    set_timer(&pt->timer, pt_deadline(pt));
 
     spin_unlock(&v->arch.hvm_vcpu.tm_lock);
 }
@@ -484,6 +520,8 @@ static void pt_adjust_vcpu(struct periodic_time *pt, struct vcpu *v)
     {
         pt->on_list = 1;
         list_add(&pt->list, &v->arch.hvm_vcpu.tm_list);
+        if ( pt->pending_intr_nr )
+            v->arch.hvm_vcpu.tm_pending = 1;
 
         migrate_timer(&pt->timer, v->processor);
     }
@@ -528,6 +566,7 @@ static void pt_resume(struct periodic_time *pt)
     {
         pt->on_list = 1;
         list_add(&pt->list, &pt->vcpu->arch.hvm_vcpu.tm_list);
+        pt->vcpu->arch.hvm_vcpu.tm_pending = 1;
         vcpu_kick(pt->vcpu);
     }
     pt_unlock(pt);
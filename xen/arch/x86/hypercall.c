@@ -18,6 +18,7 @@
  */
 
 #include <xen/compiler.h>
+#include <xen/hcall_prof.h>
 #include <xen/hypercall.h>
 #include <xen/trace.h>
 
@@ -143,6 +144,7 @@ void pv_hypercall(struct cpu_user_regs *regs)
     unsigned long old_rip = regs->rip;
 #endif
     unsigned long eax;
+    s_time_t start;
 
     ASSERT(guest_kernel_mode(curr, regs));
 
@@ -158,6 +160,8 @@ void pv_hypercall(struct cpu_user_regs *regs)
         return;
     }
 
+    start = hcall_prof_start();
+
     if ( !is_pv_32bit_vcpu(curr) )
     {
         unsigned long rdi = regs->rdi;
@@ -252,13 +256,16 @@ void pv_hypercall(struct cpu_user_regs *regs)
 #endif
     }
 
-    perfc_incr(hypercalls);
+    hcall_prof_end(eax, start, 0);
+
+    perfc_incra(hypercalls, eax);
 }
 
 enum mc_disposition arch_do_multicall_call(struct mc_state *state)
 {
     struct vcpu *curr = current;
     unsigned long op;
+    s_time_t start = hcall_prof_start();
 
     if ( !is_pv_32bit_vcpu(curr) )
     {
@@ -289,6 +296,8 @@ enum mc_disposition arch_do_multicall_call(struct mc_state *state)
     }
 #endif
 
+    hcall_prof_end(op, start, 1);
+
     return unlikely(op == __HYPERVISOR_iret)
            ? mc_exit
            : likely(guest_kernel_mode(curr, guest_cpu_user_regs()))
@@ -2294,6 +2294,11 @@ static void dump_irqs(unsigned char key)
                        (evtchn_port_is_pending(d, evtchn) ? 'P' : '-'),
                        (evtchn_port_is_masked(d, evtchn) ? 'M' : '-'),
                        (info->masked ? 'M' : '-'));
+                if ( has_hvm_container_domain(d) &&
+                     (pirq_dpci(info)->flags & HVM_IRQ_DPCI_MAPPED) )
+                    printk("[%s slow:%lu]",
+                           pirq_dpci(info)->posted ? "posted" : "remapped",
+                           pirq_dpci(info)->slow_path);
                 if ( i != action->nr_guests )
                     printk(",");
             }
@@ -29,6 +29,8 @@
 #include <xen/sched.h>
 #include <xen/rcupdate.h>
 #include <xen/guest_access.h>
+#include <xen/hash.h>
+#include <xen/hvm/save.h>
 #include <xen/vm_event.h>
 #include <asm/page.h>
 #include <asm/string.h>
@@ -53,15 +55,21 @@ DEFINE_PER_CPU(pg_lock_data_t, __pld);
     debugtrace_printk("mem_sharing_debug: %s(): " _f, __func__, ##_a)
 
 /* Reverse map defines */
-#define RMAP_HASHTAB_ORDER  0
-#define RMAP_HASHTAB_SIZE   \
-        ((PAGE_SIZE << RMAP_HASHTAB_ORDER) / sizeof(struct list_head))
+#define RMAP_HASHTAB_ORDER      0
+#define RMAP_HASHTAB_MAX_ORDER  4
+/* A bucket is a struct list_head, i.e. two pointers. */
+#define RMAP_HASHTAB_BITS(order) \
+        (PAGE_SHIFT + (order) - (LONG_BYTEORDER + 1))
+#define RMAP_HASHTAB_SIZE(order) \
+        (1UL << RMAP_HASHTAB_BITS(order))
 #define RMAP_USES_HASHTAB(page) \
         ((page)->sharing->hash_table.flag == NULL)
-#define RMAP_HEAVY_SHARED_PAGE   RMAP_HASHTAB_SIZE
+#define RMAP_HEAVY_SHARED_PAGE   RMAP_HASHTAB_SIZE(RMAP_HASHTAB_ORDER)
 /* A bit of hysteresis. We don't want to be mutating between list and hash
  * table constantly. */
 #define RMAP_LIGHT_SHARED_PAGE   (RMAP_HEAVY_SHARED_PAGE >> 2)
+/* Double the number of buckets once the average chain exceeds this. */
+#define RMAP_HASHTAB_LOAD        2
 
 #if MEM_SHARING_AUDIT
 
@@ -89,7 +97,7 @@ static inline void page_sharing_dispose(struct page_info *page)
     /* Unlikely given our thresholds, but we should be careful. */
     if ( unlikely(RMAP_USES_HASHTAB(page)) )
         free_xenheap_pages(page->sharing->hash_table.bucket, 
-                            RMAP_HASHTAB_ORDER);
+                           page->sharing->hash_table.order);
 
     spin_lock(&shr_audit_lock);
     list_del_rcu(&page->sharing->entry);
@@ -111,7 +119,7 @@ static inline void page_sharing_dispose(struct page_info *page)
     /* Unlikely given our thresholds, but we should be careful. */
     if ( unlikely(RMAP_USES_HASHTAB(page)) )
         free_xenheap_pages(page->sharing->hash_table.bucket, 
-                            RMAP_HASHTAB_ORDER);
+                           page->sharing->hash_table.order);
     xfree(page->sharing);
 }
 
@@ -171,7 +179,8 @@ static atomic_t nr_shared_mfns  = ATOMIC_INIT(0);
 /* Every shared frame keeps a reverse map (rmap) of <domain, gfn> tuples that
  * this shared frame backs. For pages with a low degree of sharing, a O(n)
  * search linked list is good enough. For pages with higher degree of sharing,
- * we use a hash table instead. */
+ * we use a hash table instead, which is grown as the page gathers more
+ * sharers (e.g. a zero page backing hundreds of cloned VMs). */
 
 typedef struct gfn_info
 {
@@ -187,35 +196,61 @@ rmap_init(struct page_info *page)
     INIT_LIST_HEAD(&page->sharing->gfns);
 }
 
-/* Exceedingly simple "hash function" */
-#define HASH(domain, gfn)       \
-    (((gfn) + (domain)) % RMAP_HASHTAB_SIZE)
+/* Consecutive gfns of one domain and equal gfns of sibling domains (the
+ * common case for clones) must both spread evenly across the buckets. */
+static inline unsigned long
+rmap_hash(domid_t domain, unsigned long gfn, unsigned int order)
+{
+    return hash_long(gfn ^ ((unsigned long)domain << (BITS_PER_LONG - 16)),
+                     RMAP_HASHTAB_BITS(order));
+}
 
-/* Conversions. Tuned by the thresholds. Should only happen twice 
- * (once each) during the lifetime of a shared page */
-static inline int
-rmap_list_to_hash_table(struct page_info *page)
+static struct list_head *
+rmap_hash_table_alloc(unsigned int order)
 {
-    unsigned int i;
-    struct list_head *pos, *tmp, *b =
-        alloc_xenheap_pages(RMAP_HASHTAB_ORDER, 0);
+    unsigned long i;
+    struct list_head *b = alloc_xenheap_pages(order, 0);
 
     if ( b == NULL )
-        return -ENOMEM;
+        return NULL;
 
-    for ( i = 0; i < RMAP_HASHTAB_SIZE; i++ )
+    for ( i = 0; i < RMAP_HASHTAB_SIZE(order); i++ )
         INIT_LIST_HEAD(b + i);
 
-    list_for_each_safe(pos, tmp, &page->sharing->gfns)
+    return b;
+}
+
+/* Move all entries on a list into the buckets of a hash table. */
+static inline void
+rmap_hash_table_fill(struct list_head *b, unsigned int order,
+                     struct list_head *head)
+{
+    struct list_head *pos, *tmp;
+
+    list_for_each_safe(pos, tmp, head)
     {
         gfn_info_t *gfn_info = list_entry(pos, gfn_info_t, list);
-        struct list_head *bucket = b + HASH(gfn_info->domain, gfn_info->gfn);
+
         list_del(pos);
-        list_add(pos, bucket);
+        list_add(pos, b + rmap_hash(gfn_info->domain, gfn_info->gfn, order));
     }
+}
+
+/* Conversions. Tuned by the thresholds. Should only happen twice 
+ * (once each) during the lifetime of a shared page */
+static inline int
+rmap_list_to_hash_table(struct page_info *page)
+{
+    struct list_head *b = rmap_hash_table_alloc(RMAP_HASHTAB_ORDER);
+
+    if ( b == NULL )
+        return -ENOMEM;
+
+    rmap_hash_table_fill(b, RMAP_HASHTAB_ORDER, &page->sharing->gfns);
 
     page->sharing->hash_table.bucket = b;
     page->sharing->hash_table.flag   = NULL;
+    page->sharing->hash_table.order  = RMAP_HASHTAB_ORDER;
 
     return 0;
 }
@@ -223,12 +258,13 @@ rmap_list_to_hash_table(struct page_info *page)
 static inline void
 rmap_hash_table_to_list(struct page_info *page)
 {
-    unsigned int i;
+    unsigned long i;
     struct list_head *bucket = page->sharing->hash_table.bucket;
+    unsigned int order = page->sharing->hash_table.order;
 
     INIT_LIST_HEAD(&page->sharing->gfns);
 
-    for ( i = 0; i < RMAP_HASHTAB_SIZE; i++ )
+    for ( i = 0; i < RMAP_HASHTAB_SIZE(order); i++ )
     {
         struct list_head *pos, *tmp, *head = bucket + i;
         list_for_each_safe(pos, tmp, head)
@@ -238,7 +274,30 @@ rmap_hash_table_to_list(struct page_info *page)
         }
     }
 
-    free_xenheap_pages(bucket, RMAP_HASHTAB_ORDER);
+    free_xenheap_pages(bucket, order);
+}
+
+/* Rehash into a table twice the size. Each doubling is paid for by as many
+ * insertions as there are entries, so the cost is amortised O(1). */
+static int
+rmap_hash_table_grow(struct page_info *page)
+{
+    unsigned long i;
+    struct list_head *old = page->sharing->hash_table.bucket;
+    unsigned int order = page->sharing->hash_table.order;
+    struct list_head *b = rmap_hash_table_alloc(order + 1);
+
+    if ( b == NULL )
+        return -ENOMEM;
+
+    for ( i = 0; i < RMAP_HASHTAB_SIZE(order); i++ )
+        rmap_hash_table_fill(b, order + 1, old + i);
+
+    page->sharing->hash_table.bucket = b;
+    page->sharing->hash_table.order  = order + 1;
+    free_xenheap_pages(old, order);
+
+    return 0;
 }
 
 /* Generic accessors to the rmap */
@@ -273,15 +332,22 @@ rmap_add(gfn_info_t *gfn_info, struct page_info *page)
 {
     struct list_head *head;
 
-    if ( !RMAP_USES_HASHTAB(page) &&
-         (rmap_count(page) >= RMAP_HEAVY_SHARED_PAGE) )
-        /* The conversion may fail with ENOMEM. We'll be less efficient,
-         * but no reason to panic. */
-        (void)rmap_list_to_hash_table(page);
+    /* The conversion and growth may fail with ENOMEM. We'll be less
+     * efficient, but no reason to panic. */
+    if ( !RMAP_USES_HASHTAB(page) )
+    {
+        if ( rmap_count(page) >= RMAP_HEAVY_SHARED_PAGE )
+            (void)rmap_list_to_hash_table(page);
+    }
+    else if ( (page->sharing->hash_table.order < RMAP_HASHTAB_MAX_ORDER) &&
+              (rmap_count(page) >= RMAP_HASHTAB_LOAD *
+               RMAP_HASHTAB_SIZE(page->sharing->hash_table.order)) )
+        (void)rmap_hash_table_grow(page);
 
     head = (RMAP_USES_HASHTAB(page)) ?
-        page->sharing->hash_table.bucket + 
-                            HASH(gfn_info->domain, gfn_info->gfn) :
+        page->sharing->hash_table.bucket +
+            rmap_hash(gfn_info->domain, gfn_info->gfn,
+                      page->sharing->hash_table.order) :
         &page->sharing->gfns;
 
     INIT_LIST_HEAD(&gfn_info->list);
@@ -296,7 +362,8 @@ rmap_retrieve(uint16_t domain_id, unsigned long gfn,
     struct list_head *le, *head;
 
     head = (RMAP_USES_HASHTAB(page)) ?
-        page->sharing->hash_table.bucket + HASH(domain_id, gfn) :
+        page->sharing->hash_table.bucket +
+            rmap_hash(domain_id, gfn, page->sharing->hash_table.order) :
         &page->sharing->gfns;
 
     list_for_each(le, head)
@@ -327,7 +394,7 @@ static inline int rmap_has_entries(struct page_info *page)
 struct rmap_iterator {
     struct list_head *curr;
     struct list_head *next;
-    unsigned int bucket;
+    unsigned long bucket;
 };
 
 static inline void
@@ -353,7 +420,8 @@ retry:
         if ( RMAP_USES_HASHTAB(page) )
         {
             ri->bucket++;
-            if ( ri->bucket >= RMAP_HASHTAB_SIZE )
+            if ( ri->bucket >=
+                 RMAP_HASHTAB_SIZE(page->sharing->hash_table.order) )
                 /* No more hash table buckets */
                 return NULL;
             head = page->sharing->hash_table.bucket + ri->bucket;
@@ -1221,6 +1289,317 @@ private_page_found:
     return 0;
 }
 
+/*
+ * Whether an ancestor has nothing at all at a gfn, as opposed to a page
+ * which can't be shared (or is paged out): only then may a fork look
+ * further up its ancestry for the page.
+ */
+static bool_t fork_gfn_absent(struct domain *pd, unsigned long gfn)
+{
+    p2m_type_t p2mt;
+
+    get_gfn_query(pd, gfn, &p2mt);
+    put_gfn(pd, gfn);
+
+    return p2mt == p2m_invalid || p2mt == p2m_mmio_dm;
+}
+
+/*
+ * Populate an absent gfn of a fork from its closest ancestor having it.
+ * Called without the fork's gfn lock held, as the ancestors' gfn locks
+ * are taken here, and get_two_gfns() orders them by domain ID: the fork's
+ * entry is checked again once locked, and left alone if it got populated
+ * meanwhile.
+ */
+int mem_sharing_fork_page(struct domain *d, unsigned long gfn,
+                          bool_t unsharing)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    struct domain *pd;
+    struct page_info *page, *spage;
+    p2m_type_t p2mt;
+    p2m_access_t p2ma;
+    mfn_t mfn, new_mfn;
+    shr_handle_t handle;
+    int rc;
+
+    ASSERT(!gfn_locked_by_me(p2m, gfn));
+
+    if ( !d->arch.hvm_domain.fork.parent )
+        return -ENOENT;
+
+    /* Pages of a dying ancestor may already have been freed. */
+    for ( pd = d->arch.hvm_domain.fork.parent; pd;
+          pd = pd->arch.hvm_domain.fork.parent )
+        if ( pd->is_dying )
+            return -ENOENT;
+
+    /* For reads, map the closest ancestor's page as a shared entry. */
+    if ( !unsharing )
+    {
+        for ( pd = d->arch.hvm_domain.fork.parent; pd;
+              pd = pd->arch.hvm_domain.fork.parent )
+        {
+            rc = mem_sharing_nominate_page(pd, gfn, 0, &handle);
+            if ( !rc )
+            {
+                if ( !mem_sharing_add_to_physmap(pd, gfn, handle, d, gfn) )
+                    return 0;
+                break;
+            }
+            if ( !fork_gfn_absent(pd, gfn) )
+                break;
+        }
+    }
+
+    /* For writes, or if the page could not be shared, copy it. */
+    for ( pd = d->arch.hvm_domain.fork.parent; pd;
+          pd = pd->arch.hvm_domain.fork.parent )
+    {
+        mfn = get_gfn_query(pd, gfn, &p2mt);
+        if ( p2mt != p2m_invalid && p2mt != p2m_mmio_dm )
+            break;
+        put_gfn(pd, gfn);
+    }
+
+    if ( !pd )
+        return -ENOENT;
+
+    /* Anything but RAM in the closest ancestor having the gfn fails. */
+    spage = mfn_valid(mfn) && p2m_is_ram(p2mt) ? mfn_to_page(mfn) : NULL;
+    if ( !spage || !get_page(spage, p2m_is_shared(p2mt) ? dom_cow : pd) )
+    {
+        put_gfn(pd, gfn);
+        return -EINVAL;
+    }
+    put_gfn(pd, gfn);
+
+    page = alloc_domheap_page(d, 0);
+    if ( !page )
+    {
+        put_page(spage);
+        return -ENOMEM;
+    }
+
+    new_mfn = page_to_mfn(page);
+    copy_domain_page(new_mfn, mfn);
+    put_page(spage);
+
+    gfn_lock(p2m, gfn, 0);
+    p2m->get_entry(p2m, gfn, &p2mt, &p2ma, 0, NULL, NULL);
+    if ( p2mt == p2m_invalid || p2mt == p2m_mmio_dm )
+    {
+        rc = p2m->set_entry(p2m, gfn, new_mfn, PAGE_ORDER_4K, p2m_ram_rw,
+                            p2m->default_access, -1);
+        if ( !rc )
+            set_gpfn_from_mfn(mfn_x(new_mfn), gfn);
+    }
+    else
+        rc = -EEXIST;
+    gfn_unlock(p2m, gfn, 0);
+
+    if ( rc )
+    {
+        if ( test_and_clear_bit(_PGC_allocated, &page->count_info) )
+            put_page(page);
+        if ( rc == -EEXIST )
+            rc = 0;
+    }
+
+    return rc;
+}
+
+/*
+ * Copy the parent's HVM params into a fork, setting them up as the fork's
+ * own.  Those naming resources of the parent's own (its ioreq pages and
+ * servers, event channels and vm_event rings), or its power state, are
+ * left to the toolstack.
+ */
+static int fork_hvm_params(struct domain *cd, struct domain *pd)
+{
+    const uint64_t *params = pd->arch.hvm_domain.params;
+    unsigned int i;
+    int rc;
+
+    for ( i = 0; i < HVM_NR_PARAMS; i++ )
+    {
+        switch ( i )
+        {
+        case HVM_PARAM_IOREQ_PFN:
+        case HVM_PARAM_BUFIOREQ_PFN:
+        case HVM_PARAM_BUFIOREQ_EVTCHN:
+        case HVM_PARAM_IOREQ_SERVER_PFN:
+        case HVM_PARAM_NR_IOREQ_SERVER_PAGES:
+        case HVM_PARAM_DM_DOMAIN:
+        case HVM_PARAM_STORE_EVTCHN:
+        case HVM_PARAM_CONSOLE_EVTCHN:
+        case HVM_PARAM_PAGING_RING_PFN:
+        case HVM_PARAM_MONITOR_RING_PFN:
+        case HVM_PARAM_SHARING_RING_PFN:
+        case HVM_PARAM_ACPI_S_STATE:
+            continue;
+
+        case HVM_PARAM_IDENT_PT:
+            /*
+             * The fork is paused, and we hold the domctl lock already: its
+             * vCPUs pick the value up when their state gets loaded.
+             */
+            cd->arch.hvm_domain.params[i] = params[i];
+            continue;
+        }
+
+        if ( cd->arch.hvm_domain.params[i] == params[i] )
+            continue;
+
+        rc = hvm_set_param(cd, i, params[i]);
+        if ( rc )
+            return rc;
+    }
+
+    return 0;
+}
+
+/* Load the parent's HVM params, and vCPU and HVM device state, into a fork. */
+static int fork_hvm_context(struct domain *cd, struct domain *pd)
+{
+    hvm_domain_context_t c = { .size = hvm_save_size(pd) };
+    int rc;
+
+    rc = fork_hvm_params(cd, pd);
+    if ( rc )
+        return rc;
+
+    if ( (c.data = xmalloc_bytes(c.size)) == NULL )
+        return -ENOMEM;
+
+    rc = hvm_save(pd, &c);
+    if ( !rc )
+    {
+        c.size = c.cur;
+        c.cur = 0;
+        if ( hvm_load(cd, &c) )
+            rc = -EINVAL;
+    }
+
+    xfree(c.data);
+
+    return rc;
+}
+
+static int mem_sharing_fork(struct domain *cd, struct domain *pd)
+{
+    unsigned int i;
+    int rc;
+
+    if ( cd == pd || !hap_enabled(pd) ||
+         cd->arch.hvm_domain.fork.parent )
+        return -EINVAL;
+
+    /* The fork must be empty, with a vCPU for each of the parent's. */
+    if ( cd->tot_pages || cd->max_vcpus != pd->max_vcpus )
+        return -EINVAL;
+    for ( i = 0; i < pd->max_vcpus; i++ )
+        if ( !pd->vcpu[i] != !cd->vcpu[i] )
+            return -EINVAL;
+
+    /* Lazily populated pages must come from a parent that no longer runs. */
+    if ( !atomic_read(&pd->pause_count) )
+        return -EBUSY;
+
+    if ( unlikely(need_iommu(cd) || need_iommu(pd)) )
+        return -EXDEV;
+
+    domain_pause(cd);
+
+    rc = fork_hvm_context(cd, pd);
+    if ( !rc )
+    {
+        /* Both references are dropped when the fork is torn down. */
+        get_knownalive_domain(pd);
+        domain_pause(pd);
+        pd->arch.hvm_domain.mem_sharing_enabled = 1;
+        cd->arch.hvm_domain.mem_sharing_enabled = 1;
+        cd->arch.hvm_domain.fork.parent = pd;
+    }
+
+    domain_unpause(cd);
+
+    return rc;
+}
+
+/* Drop all pages privately populated in a fork, preemptibly. Shared
+ * entries still reflect the parent and are left alone. */
+static int fork_drop_private_pages(struct domain *d)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned long gfn, count = 0;
+    int rc = 0;
+
+    p2m_lock(p2m);
+    for ( gfn = d->arch.hvm_domain.fork.next_reset_gfn;
+          gfn <= p2m->max_mapped_pfn; gfn++ )
+    {
+        struct page_info *page;
+        p2m_access_t a;
+        p2m_type_t t;
+        mfn_t mfn;
+
+        mfn = p2m->get_entry(p2m, gfn, &t, &a, 0, NULL, NULL);
+        page = mfn_valid(mfn) ? mfn_to_page(mfn) : NULL;
+        if ( page && p2m_is_sharable(t) && get_page(page, d) )
+        {
+            /* Must succeed: we just read the old entry and we hold the
+             * p2m lock. */
+            rc = p2m->set_entry(p2m, gfn, INVALID_MFN, PAGE_ORDER_4K,
+                                p2m_invalid, p2m_access_rwx, -1);
+            ASSERT(rc == 0);
+            set_gpfn_from_mfn(mfn_x(mfn), INVALID_M2P_ENTRY);
+            if ( test_and_clear_bit(_PGC_allocated, &page->count_info) )
+                put_page(page);
+            put_page(page);
+            count += 0x10;
+        }
+        else
+            ++count;
+
+        /* Preempt every 2MiB (dropped) or 32MiB (untouched) - arbitrary. */
+        if ( count >= 0x2000 )
+        {
+            if ( hypercall_preempt_check() )
+            {
+                d->arch.hvm_domain.fork.next_reset_gfn = gfn + 1;
+                rc = -ERESTART;
+                break;
+            }
+            count = 0;
+        }
+    }
+    p2m_unlock(p2m);
+
+    if ( rc != -ERESTART )
+        d->arch.hvm_domain.fork.next_reset_gfn = 0;
+
+    return rc;
+}
+
+static int mem_sharing_fork_reset(struct domain *d)
+{
+    int rc;
+
+    if ( !d->arch.hvm_domain.fork.parent )
+        return -EINVAL;
+
+    domain_pause(d);
+
+    rc = fork_drop_private_pages(d);
+    if ( !rc )
+        rc = fork_hvm_context(d, d->arch.hvm_domain.fork.parent);
+
+    domain_unpause(d);
+
+    return rc;
+}
+
 int relinquish_shared_pages(struct domain *d)
 {
     int rc = 0;
@@ -1272,6 +1651,17 @@ int relinquish_shared_pages(struct domain *d)
     }
 
     p2m_unlock(p2m);
+
+    /* A fork no longer needs its parent once all its shared pages are gone. */
+    if ( !rc && d->arch.hvm_domain.fork.parent )
+    {
+        struct domain *pd = d->arch.hvm_domain.fork.parent;
+
+        d->arch.hvm_domain.fork.parent = NULL;
+        domain_unpause(pd);
+        put_domain(pd);
+    }
+
     return rc;
 }
 
@@ -1327,6 +1717,65 @@ static int range_share(struct domain *d, struct domain *cd,
     return rc;
 }
 
+/* Nominate and share one <source, client> gfn pair. */
+static int share_pair(struct domain *d, unsigned long sgfn,
+                      struct domain *cd, unsigned long cgfn)
+{
+    shr_handle_t sh, ch;
+    int rc;
+
+    rc = mem_sharing_nominate_page(d, sgfn, 0, &sh);
+    if ( rc )
+        return rc;
+
+    rc = mem_sharing_nominate_page(cd, cgfn, 0, &ch);
+    if ( rc )
+        return rc;
+
+    return mem_sharing_share_pages(d, sgfn, sh, cd, cgfn, ch);
+}
+
+static int bulk_share(struct domain *d, struct domain *cd,
+                      struct mem_sharing_op_bulk *bulk)
+{
+    int rc = 0;
+    uint32_t i = bulk->opaque;
+
+    while ( i < bulk->nr )
+    {
+        uint64_t sgfn, cgfn;
+
+        if ( copy_from_guest_offset(&sgfn, bulk->source_gfns, i, 1) ||
+             copy_from_guest_offset(&cgfn, bulk->client_gfns, i, 1) )
+        {
+            rc = -EFAULT;
+            break;
+        }
+
+        /*
+         * As with range sharing, only running out of memory is fatal:
+         * individual pairs may legitimately be unsharable.
+         */
+        rc = share_pair(d, sgfn, cd, cgfn);
+        if ( rc == -ENOMEM )
+            break;
+        if ( !rc )
+            bulk->nr_shared++;
+        rc = 0;
+
+        /* Check for continuation if it's not the last iteration. */
+        if ( ++i < bulk->nr && hypercall_preempt_check() )
+        {
+            rc = 1;
+            break;
+        }
+    }
+
+    bulk->opaque = i;
+
+    return rc;
+}
+
 int mem_sharing_memop(XEN_GUEST_HANDLE_PARAM(xen_mem_sharing_op_t) arg)
 {
     int rc;
@@ -1595,6 +2044,55 @@ int mem_sharing_memop(XEN_GUEST_HANDLE_PARAM(xen_mem_sharing_op_t) arg)
         }
         break;
 
+        case XENMEM_sharing_op_bulk_share:
+        {
+            struct domain *cd;
+
+            rc = -EINVAL;
+            if ( mso.u.bulk._pad || mso.u.bulk.opaque > mso.u.bulk.nr )
+                goto out;
+
+            if ( !mem_sharing_enabled(d) )
+                goto out;
+
+            rc = rcu_lock_live_remote_domain_by_id(mso.u.bulk.client_domain,
+                                                   &cd);
+            if ( rc )
+                goto out;
+
+            /* As for range sharing, reuse the XENMEM_sharing_op_share check. */
+            rc = xsm_mem_sharing_op(XSM_DM_PRIV, d, cd,
+                                    XENMEM_sharing_op_share);
+            if ( rc )
+            {
+                rcu_unlock_domain(cd);
+                goto out;
+            }
+
+            if ( !mem_sharing_enabled(cd) )
+            {
+                rcu_unlock_domain(cd);
+                rc = -EINVAL;
+                goto out;
+            }
+
+            rc = bulk_share(d, cd, &mso.u.bulk);
+            rcu_unlock_domain(cd);
+
+            if ( rc > 0 )
+            {
+                if ( __copy_to_guest(arg, &mso, 1) )
+                    rc = -EFAULT;
+                else
+                    rc = hypercall_create_continuation(__HYPERVISOR_memory_op,
+                                                       "lh", XENMEM_sharing_op,
+                                                       arg);
+            }
+            else
+                mso.u.bulk.opaque = 0;
+        }
+        break;
+
         case XENMEM_sharing_op_debug_gfn:
         {
             unsigned long gfn = mso.u.debug.u.gfn;
@@ -1642,6 +2140,34 @@ int mem_sharing_domctl(struct domain *d, xen_domctl_mem_sharing_op_t *mec)
         }
         break;
 
+        case XEN_DOMCTL_MEM_SHARING_FORK:
+        {
+            struct domain *pd;
+
+            rc = -EINVAL;
+            if ( mec->u.fork._pad[0] || mec->u.fork._pad[1] ||
+                 mec->u.fork._pad[2] )
+                break;
+
+            rc = rcu_lock_live_remote_domain_by_id(mec->u.fork.parent_domain,
+                                                   &pd);
+            if ( rc )
+                break;
+
+            /* A fork shares every page of its parent. */
+            rc = xsm_mem_sharing_op(XSM_DM_PRIV, pd, d,
+                                    XENMEM_sharing_op_share);
+            if ( !rc )
+                rc = mem_sharing_fork(d, pd);
+
+            rcu_unlock_domain(pd);
+        }
+        break;
+
+        case XEN_DOMCTL_MEM_SHARING_FORK_RESET:
+            rc = mem_sharing_fork_reset(d);
+            break;
+
         default:
             rc = -ENOSYS;
     }
@@ -198,6 +198,7 @@ static void p2m_teardown_altp2m(struct domain *d)
             continue;
         p2m = d->arch.altp2m_p2m[i];
         d->arch.altp2m_p2m[i] = NULL;
+        radix_tree_destroy(&p2m->remapped_gfns, NULL);
         p2m_free_one(p2m);
     }
 }
@@ -219,6 +220,7 @@ static int p2m_init_altp2m(struct domain *d)
         p2m->p2m_class = p2m_alternate;
         p2m->access_required = 1;
         _atomic_set(&p2m->active_vcpus, 0);
+        radix_tree_init(&p2m->remapped_gfns);
     }
 
     return 0;
@@ -376,6 +378,25 @@ mfn_t __get_gfn_type_access(struct p2m_domain *p2m, unsigned long gfn,
 
     mfn = p2m->get_entry(p2m, gfn, t, a, q, page_order, NULL);
 
+    /*
+     * Forks are populated from their parent on first access.  That takes
+     * the ancestors' gfn locks, which must not nest inside the fork's, so
+     * it is only done when the lock isn't held further up the stack.
+     */
+    if ( locked && (q & P2M_ALLOC) &&
+         (*t == p2m_invalid || *t == p2m_mmio_dm) &&
+         p2m_is_hostp2m(p2m) && p2m->domain->arch.hvm_domain.fork.parent &&
+         p2m->lock.recurse_count == 1 )
+    {
+        int rc;
+
+        gfn_unlock(p2m, gfn, 0);
+        rc = mem_sharing_fork_page(p2m->domain, gfn, !!(q & P2M_UNSHARE));
+        gfn_lock(p2m, gfn, 0);
+        if ( !rc )
+            mfn = p2m->get_entry(p2m, gfn, t, a, q, page_order, NULL);
+    }
+
     if ( (q & P2M_UNSHARE) && p2m_is_shared(*t) )
     {
         ASSERT(p2m_is_hostp2m(p2m));
@@ -641,22 +662,8 @@ p2m_remove_page(struct p2m_domain *p2m, unsigned long gfn, unsigned long mfn,
     p2m_access_t a;
 
     if ( !paging_mode_translate(p2m->domain) )
-    {
-        int rc = 0;
-
-        if ( need_iommu(p2m->domain) )
-        {
-            for ( i = 0; i < (1 << page_order); i++ )
-            {
-                int ret = iommu_unmap_page(p2m->domain, mfn + i);
-
-                if ( !rc )
-                    rc = ret;
-            }
-        }
-
-        return rc;
-    }
+        return need_iommu(p2m->domain)
+               ? iommu_unmap_pages(p2m->domain, mfn, page_order) : 0;
 
     ASSERT(gfn_locked_by_me(p2m, gfn));
     P2M_DEBUG("removing gfn=%#lx mfn=%#lx\n", gfn, mfn);
@@ -702,23 +709,8 @@ guest_physmap_add_entry(struct domain *d, gfn_t gfn, mfn_t mfn,
     if ( !paging_mode_translate(d) )
     {
         if ( need_iommu(d) && t == p2m_ram_rw )
-        {
-            for ( i = 0; i < (1 << page_order); i++ )
-            {
-                rc = iommu_map_page(d, mfn_x(mfn_add(mfn, i)),
-                                    mfn_x(mfn_add(mfn, i)),
-                                    IOMMUF_readable|IOMMUF_writable);
-                if ( rc != 0 )
-                {
-                    while ( i-- > 0 )
-                        /* If statement to satisfy __must_check. */
-                        if ( iommu_unmap_page(d, mfn_x(mfn_add(mfn, i))) )
-                            continue;
-
-                    return rc;
-                }
-            }
-        }
+            return iommu_map_pages(d, mfn_x(mfn), mfn_x(mfn), page_order,
+                                   IOMMUF_readable|IOMMUF_writable);
         return 0;
     }
 
@@ -2457,6 +2449,47 @@ bool_t p2m_altp2m_lazy_copy(struct vcpu *v, paddr_t gpa,
     return 1;
 }
 
+/*
+ * Remapped gfn tracking for alternate p2m's.  Entries are keyed by the gfn
+ * whose mfn was borrowed and hold the gfn remapped onto it, or
+ * ALTP2M_REMAP_MULTI if there is more than one of those.  The tree may hold
+ * stale entries: acting on one only costs the view a refault.
+ */
+#define ALTP2M_REMAP_MULTI ((void *)~1UL)
+
+static inline void *altp2m_remap_to_ptr(unsigned long gfn)
+{
+    /* Same encoding as radix_tree_int_to_ptr(), without truncation. */
+    return (void *)((gfn << 2) | 2);
+}
+
+static inline unsigned long altp2m_ptr_to_remap(void *ptr)
+{
+    return (unsigned long)ptr >> 2;
+}
+
+static int altp2m_track_remap(struct p2m_domain *ap2m, unsigned long gfn,
+                              unsigned long target)
+{
+    void **slot = radix_tree_lookup_slot(&ap2m->remapped_gfns, target);
+    void *item = altp2m_remap_to_ptr(gfn);
+
+    if ( !slot )
+        return radix_tree_insert(&ap2m->remapped_gfns, target, item);
+
+    if ( radix_tree_deref_slot(slot) != item )
+        radix_tree_replace_slot(slot, ALTP2M_REMAP_MULTI);
+
+    return 0;
+}
+
+static void altp2m_forget_remaps(struct p2m_domain *ap2m)
+{
+    p2m_lock(ap2m);
+    radix_tree_destroy(&ap2m->remapped_gfns, NULL);
+    p2m_unlock(ap2m);
+}
+
 void p2m_flush_altp2m(struct domain *d)
 {
     unsigned int i;
@@ -2469,6 +2502,7 @@ void p2m_flush_altp2m(struct domain *d)
         /* Uninit and reinit ept to force TLB shootdown */
         ept_p2m_uninit(d->arch.altp2m_p2m[i]);
         ept_p2m_init(d->arch.altp2m_p2m[i]);
+        altp2m_forget_remaps(d->arch.altp2m_p2m[i]);
         d->arch.altp2m_eptp[i] = mfn_x(INVALID_MFN);
     }
 
@@ -2551,6 +2585,7 @@ int p2m_destroy_altp2m_by_id(struct domain *d, unsigned int idx)
             /* Uninit and reinit ept to force TLB shootdown */
             ept_p2m_uninit(d->arch.altp2m_p2m[idx]);
             ept_p2m_init(d->arch.altp2m_p2m[idx]);
+            altp2m_forget_remaps(d->arch.altp2m_p2m[idx]);
             d->arch.altp2m_eptp[idx] = mfn_x(INVALID_MFN);
             rc = 0;
         }
@@ -2658,6 +2693,11 @@ int p2m_change_altp2m_gfn(struct domain *d, unsigned int idx,
     if ( !mfn_valid(mfn) || (t != p2m_ram_rw) )
         goto out;
 
+    rc = altp2m_track_remap(ap2m, gfn_x(old_gfn), gfn_x(new_gfn));
+    if ( rc )
+        goto out;
+    rc = -EINVAL;
+
     if ( !ap2m->set_entry(ap2m, gfn_x(old_gfn), mfn, PAGE_ORDER_4K, t, a,
                           (current->domain != d)) )
     {
@@ -2683,23 +2723,66 @@ static void p2m_reset_altp2m(struct p2m_domain *p2m)
     ept_p2m_init(p2m);
     p2m->min_remapped_gfn = gfn_x(INVALID_GFN);
     p2m->max_remapped_gfn = 0;
+    radix_tree_destroy(&p2m->remapped_gfns, NULL);
 }
 
+/*
+ * Invalidate only the entries of @p2m remapped onto the dropped range
+ * [gfn, gfn + 2^page_order).  Returns 0 if that can't be done precisely,
+ * and the view has to be reset as a whole instead.
+ */
+static bool_t p2m_reset_altp2m_range(struct p2m_domain *p2m,
+                                     unsigned long gfn,
+                                     unsigned int page_order)
+{
+    unsigned long i;
+
+    if ( page_order > PAGE_ORDER_2M )
+        return 0;
+
+    for ( i = 0; i < (1UL << page_order); i++ )
+    {
+        void *item = radix_tree_delete(&p2m->remapped_gfns, gfn + i);
+
+        if ( !item )
+            continue;
+
+        if ( item == ALTP2M_REMAP_MULTI ||
+             p2m_set_entry(p2m, altp2m_ptr_to_remap(item), INVALID_MFN,
+                           PAGE_ORDER_4K, p2m_invalid, p2m->default_access) )
+            return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Propagate a change of the host p2m to the altp2m views.
+ *
+ * Views with an entry for the gfn are updated while they are in use, but
+ * views no vCPU is currently on just have the entry dropped: should they be
+ * switched to again, p2m_altp2m_lazy_copy() picks up the new host entry on
+ * the resulting EPT violation.  The TLB flushes of all views are deferred
+ * and done with a single round of IPIs at the end.
+ */
 void p2m_altp2m_propagate_change(struct domain *d, gfn_t gfn,
                                  mfn_t mfn, unsigned int page_order,
                                  p2m_type_t p2mt, p2m_access_t p2ma)
 {
-    struct p2m_domain *p2m;
+    struct p2m_domain *p2m, *flush_p2m = NULL;
     p2m_access_t a;
     p2m_type_t t;
     mfn_t m;
     unsigned int i;
-    unsigned int reset_count = 0;
-    unsigned int last_reset_idx = ~0;
+#ifdef CONFIG_PERF_COUNTERS
+    s_time_t start = NOW();
+#endif
 
     if ( !altp2m_active(d) )
         return;
 
+    perfc_incr(altp2m_propagate);
+
     altp2m_list_lock(d);
 
     for ( i = 0; i < MAX_ALTP2M; i++ )
@@ -2710,44 +2793,63 @@ void p2m_altp2m_propagate_change(struct domain *d, gfn_t gfn,
         p2m = d->arch.altp2m_p2m[i];
         m = get_gfn_type_access(p2m, gfn_x(gfn), &t, &a, 0, NULL);
 
+        p2m->defer_flush++;
+
         /* Check for a dropped page that may impact this altp2m */
         if ( mfn_eq(mfn, INVALID_MFN) &&
-             gfn_x(gfn) >= p2m->min_remapped_gfn &&
+             gfn_x(gfn) + (1UL << page_order) > p2m->min_remapped_gfn &&
              gfn_x(gfn) <= p2m->max_remapped_gfn )
         {
-            if ( !reset_count++ )
+            if ( p2m_reset_altp2m_range(p2m, gfn_x(gfn), page_order) )
+                perfc_incr(altp2m_reset_range);
+            else
             {
                 p2m_reset_altp2m(p2m);
-                last_reset_idx = i;
+                perfc_incr(altp2m_reset_full);
+                m = INVALID_MFN;
+            }
+        }
+
+        if ( !mfn_eq(m, INVALID_MFN) )
+        {
+            if ( !_atomic_read(p2m->active_vcpus) )
+            {
+                p2m_set_entry(p2m, gfn_x(gfn), INVALID_MFN, page_order,
+                              p2m_invalid, p2m->default_access);
+                perfc_incr(altp2m_propagate_lazy);
             }
             else
             {
-                /* At least 2 altp2m's impacted, so reset everything */
-                __put_gfn(p2m, gfn_x(gfn));
-
-                for ( i = 0; i < MAX_ALTP2M; i++ )
-                {
-                    if ( i == last_reset_idx ||
-                         d->arch.altp2m_eptp[i] == mfn_x(INVALID_MFN) )
-                        continue;
-
-                    p2m = d->arch.altp2m_p2m[i];
-                    p2m_lock(p2m);
-                    p2m_reset_altp2m(p2m);
-                    p2m_unlock(p2m);
-                }
-
-                goto out;
+                p2m_set_entry(p2m, gfn_x(gfn), mfn, page_order, p2mt, p2ma);
+                perfc_incr(altp2m_propagate_eager);
             }
         }
-        else if ( !mfn_eq(m, INVALID_MFN) )
-            p2m_set_entry(p2m, gfn_x(gfn), mfn, page_order, p2mt, p2ma);
+
+        p2m->defer_flush--;
+        if ( p2m->need_flush )
+        {
+            p2m->need_flush = 0;
+            flush_p2m = p2m;
+        }
 
         __put_gfn(p2m, gfn_x(gfn));
     }
 
- out:
+    /*
+     * Each view's invalidation is already pending (see ept_sync_domain()),
+     * so kicking the domain's dirty CPUs once covers all of them.
+     */
+    if ( flush_p2m )
+    {
+        flush_p2m->tlb_flush(flush_p2m);
+        perfc_incr(altp2m_propagate_flush);
+    }
+
     altp2m_list_unlock(d);
+
+#ifdef CONFIG_PERF_COUNTERS
+    perfc_add(altp2m_propagate_ns, NOW() - start);
+#endif
 }
 
 /*** Audit ***/
@@ -23,6 +23,7 @@
 #include <asm/irq.h>
 #include <asm/hvm/hvm.h>
 #include <asm/hvm/support.h>
+#include <asm/hvm/exitlat.h>
 #include <asm/processor.h>
 #include <asm/smp.h>
 #include <asm/numa.h>
@@ -248,6 +249,12 @@ long arch_do_sysctl(
         break;
     }
 
+    case XEN_SYSCTL_exitlat_op:
+        ret = hvm_exitlat_control(&sysctl->u.exitlat_op);
+        if ( !ret && __copy_to_guest(u_sysctl, sysctl, 1) )
+            ret = -EFAULT;
+        break;
+
     default:
         ret = -ENOSYS;
         break;
@@ -1761,6 +1761,17 @@ struct x86_emulate_state {
      */
     struct operand ea;
 
+    /*
+     * Registers (EA_NO_REG if none) the memory operand's effective address
+     * was computed from, as base + (index << scale), so that a cached decode
+     * can be rebased onto the current register values.
+     */
+    uint8_t ea_base, ea_index, ea_scale;
+#define EA_NO_REG 0xff
+
+    /* Canonical opcode, as left in ctxt->opcode by the decode. */
+    unsigned int opcode;
+
     /* Immediate operand values, if any. Use otherwise unused fields. */
 #define imm1 ea.val
 #define imm2 ea.orig_val
@@ -1914,6 +1925,7 @@ x86_decode(
     ea.type = OP_MEM;
     ea.mem.seg = x86_seg_ds;
     ea.reg = PTR_POISON;
+    state->ea_base = state->ea_index = EA_NO_REG;
     state->regs = ctxt->regs;
     state->eip = ctxt->regs->eip;
 
@@ -2302,6 +2314,19 @@ x86_decode(
                 break;
             }
             ea.mem.off = truncate_ea(ea.mem.off);
+
+            if ( modrm_rm != 6 || modrm_mod != 0 )
+            {
+                static const uint8_t ea16_base[8] = {
+                    3, 3, 5, 5, 6, 7, 5, 3
+                };
+                static const uint8_t ea16_index[8] = {
+                    6, 7, 6, 7, EA_NO_REG, EA_NO_REG, EA_NO_REG, EA_NO_REG
+                };
+
+                state->ea_base = ea16_base[modrm_rm];
+                state->ea_index = ea16_index[modrm_rm];
+            }
         }
         else
         {
@@ -2312,9 +2337,15 @@ x86_decode(
                 sib_index = ((sib >> 3) & 7) | ((rex_prefix << 2) & 8);
                 sib_base  = (sib & 7) | ((rex_prefix << 3) & 8);
                 if ( sib_index != 4 )
+                {
                     ea.mem.off = *(long *)decode_register(sib_index,
                                                           state->regs, 0);
+                    state->ea_index = sib_index;
+                    state->ea_scale = (sib >> 6) & 3;
+                }
                 ea.mem.off <<= (sib >> 6) & 3;
+                if ( (modrm_mod != 0) || ((sib_base & 7) != 5) )
+                    state->ea_base = sib_base;
                 if ( (modrm_mod == 0) && ((sib_base & 7) == 5) )
                     ea.mem.off += insn_fetch_type(int32_t);
                 else if ( sib_base == 4 )
@@ -2340,6 +2371,7 @@ x86_decode(
                 modrm_rm |= (rex_prefix & 1) << 3;
                 ea.mem.off = *(long *)decode_register(modrm_rm,
                                                       state->regs, 0);
+                state->ea_base = modrm_rm;
                 if ( (modrm_rm == 5) && (modrm_mod != 0) )
                     ea.mem.seg = x86_seg_ss;
             }
@@ -2349,6 +2381,7 @@ x86_decode(
                 if ( (modrm_rm & 7) != 5 )
                     break;
                 ea.mem.off = insn_fetch_type(int32_t);
+                state->ea_base = EA_NO_REG;
                 if ( !mode_64bit() )
                     break;
                 /* Relative to RIP of next instruction. Argh! */
@@ -2439,6 +2472,8 @@ x86_decode(
          (ctxt->opcode & X86EMUL_OPC_PFX_MASK) == X86EMUL_OPC_66(0, 0) )
         op_bytes = 4;
 
+    state->opcode = ctxt->opcode;
+
  done:
     return rc;
 }
@@ -2447,10 +2482,57 @@ x86_decode(
 #undef insn_fetch_bytes
 #undef insn_fetch_type
 
+static unsigned long
+decode_ea_regs(
+    const struct x86_emulate_state *state,
+    struct cpu_user_regs *regs)
+{
+    unsigned long off = 0;
+
+    if ( state->ea_base != EA_NO_REG )
+        off = *(long *)decode_register(state->ea_base, regs, 0);
+    if ( state->ea_index != EA_NO_REG )
+        off += *(long *)decode_register(state->ea_index, regs, 0) <<
+               state->ea_scale;
+
+    return off;
+}
+
+/*
+ * Decodes are cached with the register part taken out of the memory
+ * operand's effective address: truncation to the address size commutes
+ * with the addition, so it can be redone for whatever the registers hold
+ * when the decode gets reused.
+ */
+static void
+x86_decode_save(struct x86_emulate_state *state)
+{
+    ea.mem.off -= decode_ea_regs(state, state->regs);
+    state->regs = NULL;
+}
+
+static void
+x86_decode_restore(
+    struct x86_emulate_state *state,
+    const struct x86_emulate_state *cache,
+    struct x86_emulate_ctxt *ctxt)
+{
+    *state = *cache;
+    state->regs = ctxt->regs;
+    if ( ea.type == OP_MEM )
+        ea.mem.off = truncate_ea(ea.mem.off +
+                                 decode_ea_regs(state, ctxt->regs));
+
+    ctxt->retire.byte = 0;
+    ctxt->opcode = state->opcode;
+}
+
 int
-x86_emulate(
+x86_emulate_cached(
     struct x86_emulate_ctxt *ctxt,
-    const struct x86_emulate_ops *ops)
+    const struct x86_emulate_ops *ops,
+    struct x86_emulate_state *cache,
+    unsigned int *insn_len)
 {
     /* Shadow copy of register state. Committed on successful emulation. */
     struct cpu_user_regs _regs = *ctxt->regs;
@@ -2464,9 +2546,21 @@ x86_emulate(
     struct x86_emulate_stub stub = {};
     DECLARE_ALIGNED(mmval_t, mmval);
 
-    rc = x86_decode(&state, ctxt, ops);
-    if ( rc != X86EMUL_OKAY )
-        return rc;
+    if ( cache && *insn_len )
+        x86_decode_restore(&state, cache, ctxt);
+    else
+    {
+        rc = x86_decode(&state, ctxt, ops);
+        if ( rc != X86EMUL_OKAY )
+            return rc;
+
+        if ( cache )
+        {
+            *cache = state;
+            x86_decode_save(cache);
+            *insn_len = state.eip - ctxt->regs->eip;
+        }
+    }
 
     /* Sync rIP to post decode value. */
     _regs.eip = state.eip;
@@ -5503,6 +5597,14 @@ x86_emulate(
 #undef state
 }
 
+int
+x86_emulate(
+    struct x86_emulate_ctxt *ctxt,
+    const struct x86_emulate_ops *ops)
+{
+    return x86_emulate_cached(ctxt, ops, NULL, NULL);
+}
+
 #undef op_bytes
 #undef ad_bytes
 #undef ext
@@ -5527,6 +5629,12 @@ static void __init __maybe_unused build_assertions(void)
     BUILD_BUG_ON(x86_seg_gs != 5);
 }
 
+struct x86_emulate_state *
+x86_emulate_alloc_state(void)
+{
+    return xzalloc(struct x86_emulate_state);
+}
+
 #ifdef __XEN__
 
 #include <xen/err.h>
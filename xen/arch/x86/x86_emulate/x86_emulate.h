@@ -520,6 +520,27 @@ x86_emulate(
     struct x86_emulate_ctxt *ctxt,
     const struct x86_emulate_ops *ops);
 
+struct x86_emulate_state;
+
+/*
+ * x86_emulate_cached: Emulate an instruction like x86_emulate(), reusing
+ * an earlier decode of it.  If *@insn_len is non-zero, @cache holds the
+ * decode of the *@insn_len bytes at ctxt->regs->eip, made by a previous
+ * call in the same execution mode; it is up to the caller to make sure that
+ * these are still the bytes there.  Otherwise the instruction is fetched
+ * and decoded into @cache as usual, setting *@insn_len on success.
+ */
+int
+x86_emulate_cached(
+    struct x86_emulate_ctxt *ctxt,
+    const struct x86_emulate_ops *ops,
+    struct x86_emulate_state *cache,
+    unsigned int *insn_len);
+
+/* Space for x86_emulate_cached() to keep a decode in; xfree() it. */
+struct x86_emulate_state *
+x86_emulate_alloc_state(void);
+
 /*
  * Given the 'reg' portion of a ModRM byte, and a register block, return a
  * pointer into the block that addresses the relevant register.
@@ -0,0 +1,193 @@
+/******************************************************************************
+ * common/hcall_prof.c
+ *
+ * Per-domain hypercall cost accounting.  Each vcpu lazily gets a table of
+ * counts and times by hypercall number, which only that vcpu updates, so
+ * that accounting takes no locks.  See XEN_SYSCTL_hcall_prof_op in
+ * public/sysctl.h for what is reported.
+ */
+
+#include <xen/lib.h>
+#include <xen/sched.h>
+#include <xen/xmalloc.h>
+#include <xen/guest_access.h>
+#include <xen/hcall_prof.h>
+#include <public/sysctl.h>
+
+struct hcall_prof {
+    bool_t preempted;           /* Current call created a continuation. */
+    struct hcall_prof_entry {
+        uint64_t count;
+        uint64_t time;
+        uint64_t max;
+        uint64_t preempted;
+        uint64_t subcalls;
+        uint64_t subcall_time;
+    } calls[NR_hypercalls];
+};
+
+bool_t __read_mostly hcall_prof_enabled;
+
+s_time_t hcall_prof_begin(void)
+{
+    struct vcpu *curr = current;
+
+    if ( !curr->hcall_prof )
+    {
+        curr->hcall_prof = xzalloc(struct hcall_prof);
+        if ( !curr->hcall_prof )
+            return 0;
+    }
+
+    /*
+     * A continuation created by a call which wasn't accounted (e.g. one
+     * begun before accounting was enabled) isn't this call's.
+     */
+    curr->hcall_prof->preempted = 0;
+
+    return NOW();
+}
+
+void hcall_prof_account(unsigned long op, s_time_t start, bool_t subcall)
+{
+    struct hcall_prof *prof = current->hcall_prof;
+    struct hcall_prof_entry *e;
+    uint64_t time = NOW() - start;
+
+    if ( op >= NR_hypercalls )
+        return;
+
+    e = &prof->calls[op];
+    e->count++;
+    e->time += time;
+    if ( time > e->max )
+        e->max = time;
+    if ( prof->preempted )
+    {
+        e->preempted++;
+        prof->preempted = 0;
+    }
+    if ( subcall )
+    {
+        e->subcalls++;
+        e->subcall_time += time;
+    }
+}
+
+void hcall_prof_set_preempted(bool_t preempted)
+{
+    struct hcall_prof *prof = current->hcall_prof;
+
+    if ( prof )
+        prof->preempted = preempted;
+}
+
+static int hcall_prof_query(struct xen_sysctl_hcall_prof_op *op)
+{
+    struct domain *d;
+    struct vcpu *v;
+    struct xen_sysctl_hcall_prof e;
+    unsigned int i, n = 0;
+    int rc = 0;
+
+    rcu_read_lock(&domlist_read_lock);
+
+    for_each_domain ( d )
+    {
+        if ( op->domid != DOMID_INVALID && d->domain_id != op->domid )
+            continue;
+
+        for ( i = 0; i < NR_hypercalls; i++ )
+        {
+            memset(&e, 0, sizeof(e));
+
+            for_each_vcpu ( d, v )
+            {
+                const struct hcall_prof_entry *c;
+
+                if ( !v->hcall_prof )
+                    continue;
+
+                c = &v->hcall_prof->calls[i];
+                e.count += c->count;
+                e.time += c->time;
+                e.max = max(e.max, c->max);
+                e.preempted += c->preempted;
+                e.subcalls += c->subcalls;
+                e.subcall_time += c->subcall_time;
+            }
+
+            if ( !e.count )
+                continue;
+
+            if ( n < op->nr_entries && !guest_handle_is_null(op->entries) )
+            {
+                e.domid = d->domain_id;
+                e.op = i;
+                if ( copy_to_guest_offset(op->entries, n, &e, 1) )
+                {
+                    rc = -EFAULT;
+                    goto out;
+                }
+            }
+            n++;
+        }
+    }
+
+    op->nr_entries = n;
+
+ out:
+    rcu_read_unlock(&domlist_read_lock);
+
+    return rc;
+}
+
+int hcall_prof_control(struct xen_sysctl_hcall_prof_op *op)
+{
+    struct domain *d;
+    struct vcpu *v;
+    int rc = 0;
+
+    switch ( op->cmd )
+    {
+    case XEN_SYSCTL_HCALL_PROF_enable:
+        hcall_prof_enabled = 1;
+        break;
+
+    case XEN_SYSCTL_HCALL_PROF_disable:
+        hcall_prof_enabled = 0;
+        break;
+
+    case XEN_SYSCTL_HCALL_PROF_reset:
+        rcu_read_lock(&domlist_read_lock);
+        for_each_domain ( d )
+            for_each_vcpu ( d, v )
+                if ( v->hcall_prof )
+                    memset(v->hcall_prof->calls, 0,
+                           sizeof(v->hcall_prof->calls));
+        rcu_read_unlock(&domlist_read_lock);
+        break;
+
+    case XEN_SYSCTL_HCALL_PROF_query:
+        rc = hcall_prof_query(op);
+        break;
+
+    default:
+        rc = -EOPNOTSUPP;
+        break;
+    }
+
+    op->enabled = hcall_prof_enabled;
+
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
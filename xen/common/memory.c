@@ -24,6 +24,7 @@
 #include <xen/numa.h>
 #include <xen/mem_access.h>
 #include <xen/trace.h>
+#include <xen/vmap.h>
 #include <asm/current.h>
 #include <asm/hardirq.h>
 #include <asm/p2m.h>
@@ -1389,13 +1390,11 @@ void destroy_ring_for_helper(
     }
 }
 
-int prepare_ring_for_helper(
-    struct domain *d, unsigned long gmfn, struct page_info **_page,
-    void **_va)
+static int get_ring_page_for_helper(
+    struct domain *d, unsigned long gmfn, struct page_info **_page)
 {
     struct page_info *page;
     p2m_type_t p2mt;
-    void *va;
 
     page = get_page_from_gfn(d, gmfn, &p2mt, P2M_UNSHARE);
 
@@ -1426,6 +1425,23 @@ int prepare_ring_for_helper(
         return -EINVAL;
     }
 
+    *_page = page;
+
+    return 0;
+}
+
+int prepare_ring_for_helper(
+    struct domain *d, unsigned long gmfn, struct page_info **_page,
+    void **_va)
+{
+    struct page_info *page;
+    void *va;
+    int rc;
+
+    rc = get_ring_page_for_helper(d, gmfn, &page);
+    if ( rc )
+        return rc;
+
     va = __map_domain_page_global(page);
     if ( va == NULL )
     {
@@ -1439,6 +1455,66 @@ int prepare_ring_for_helper(
     return 0;
 }
 
+void destroy_ring_frames_for_helper(
+    void **_va, struct page_info **pages, unsigned int nr)
+{
+    void *va = *_va;
+    unsigned int i;
+
+    if ( va != NULL )
+    {
+        vunmap(va);
+        for ( i = 0; i < nr; i++ )
+            put_page_and_type(pages[i]);
+        *_va = NULL;
+    }
+}
+
+/*
+ * Multi-page variant of prepare_ring_for_helper(): the ring lives in the
+ * @nr guest frames starting at @gmfn, and is mapped virtually contiguous.
+ */
+int prepare_ring_frames_for_helper(
+    struct domain *d, unsigned long gmfn, unsigned int nr,
+    struct page_info **pages, void **_va)
+{
+    mfn_t *mfns = xmalloc_array(mfn_t, nr);
+    unsigned int i;
+    void *va = NULL;
+    int rc = 0;
+
+    if ( !mfns )
+        return -ENOMEM;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        rc = get_ring_page_for_helper(d, gmfn + i, &pages[i]);
+        if ( rc )
+            break;
+        mfns[i] = _mfn(page_to_mfn(pages[i]));
+    }
+
+    if ( !rc )
+    {
+        va = vmap(mfns, nr);
+        if ( va == NULL )
+            rc = -ENOMEM;
+    }
+
+    xfree(mfns);
+
+    if ( rc )
+    {
+        while ( i-- )
+            put_page_and_type(pages[i]);
+        return rc;
+    }
+
+    *_va = va;
+
+    return 0;
+}
+
 /*
  * Local variables:
  * mode: C
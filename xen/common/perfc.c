@@ -10,10 +10,7 @@
 #include <public/sysctl.h>
 #include <asm/perfc.h>
 
-#define PERFCOUNTER( var, name )              { name, TYPE_SINGLE, 0 },
-#define PERFCOUNTER_ARRAY( var, name, size )  { name, TYPE_ARRAY,  size },
-#define PERFSTATUS( var, name )               { name, TYPE_S_SINGLE, 0 },
-#define PERFSTATUS_ARRAY( var, name, size )   { name, TYPE_S_ARRAY,  size },
+/* Same order as enum perfcounter: the light counters first. */
 static const struct {
     const char *name;
     enum { TYPE_SINGLE, TYPE_ARRAY,
@@ -21,7 +18,28 @@ static const struct {
     } type;
     unsigned int nr_elements;
 } perfc_info[] = {
+#define PERFCOUNTER_LIGHT( var, name )             { name, TYPE_SINGLE, 0 },
+#define PERFCOUNTER_ARRAY_LIGHT( var, name, size ) { name, TYPE_ARRAY,  size },
+#define PERFCOUNTER( var, name )
+#define PERFCOUNTER_ARRAY( var, name, size )
+#define PERFSTATUS( var, name )
+#define PERFSTATUS_ARRAY( var, name, size )
 #include <xen/perfc_defn.h>
+#ifdef CONFIG_PERF_COUNTERS
+#undef PERFCOUNTER_LIGHT
+#undef PERFCOUNTER_ARRAY_LIGHT
+#undef PERFCOUNTER
+#undef PERFCOUNTER_ARRAY
+#undef PERFSTATUS
+#undef PERFSTATUS_ARRAY
+#define PERFCOUNTER_LIGHT( var, name )
+#define PERFCOUNTER_ARRAY_LIGHT( var, name, size )
+#define PERFCOUNTER( var, name )              { name, TYPE_SINGLE, 0 },
+#define PERFCOUNTER_ARRAY( var, name, size )  { name, TYPE_ARRAY,  size },
+#define PERFSTATUS( var, name )               { name, TYPE_S_SINGLE, 0 },
+#define PERFSTATUS_ARRAY( var, name, size )   { name, TYPE_S_ARRAY,  size },
+#include <xen/perfc_defn.h>
+#endif
 };
 
 #define NR_PERFCTRS (sizeof(perfc_info) / sizeof(perfc_info[0]))
@@ -155,21 +173,26 @@ void perfc_reset(unsigned char key)
 static xen_sysctl_perfc_desc_t perfc_d[NR_PERFCTRS];
 static xen_sysctl_perfc_val_t *perfc_vals;
 static unsigned int      perfc_nbr_vals;
+static unsigned int      perfc_nbr_vals_percpu;
 static cpumask_t         perfc_cpumap;
 
+/*
+ * Without XEN_SYSCTL_PERFC_F_percpu arrays are summed over all CPUs.  With
+ * it every counter gets nr_elems values per online CPU, CPU-major.
+ */
 static int perfc_copy_info(XEN_GUEST_HANDLE_64(xen_sysctl_perfc_desc_t) desc,
-                           XEN_GUEST_HANDLE_64(xen_sysctl_perfc_val_t) val)
+                           XEN_GUEST_HANDLE_64(xen_sysctl_perfc_val_t) val,
+                           bool_t percpu)
 {
-    unsigned int i, j, v;
+    unsigned int i, j, v, nr_cpus;
 
     /* We only copy the name and array-size information once. */
     if ( !cpumask_equal(&cpu_online_map, &perfc_cpumap) )
     {
-        unsigned int nr_cpus;
         perfc_cpumap = cpu_online_map;
         nr_cpus = cpumask_weight(&perfc_cpumap);
 
-        perfc_nbr_vals = 0;
+        perfc_nbr_vals = perfc_nbr_vals_percpu = 0;
 
         for ( i = 0; i < NR_PERFCTRS; i++ )
         {
@@ -179,18 +202,21 @@ static int perfc_copy_info(XEN_GUEST_HANDLE_64(xen_sysctl_perfc_desc_t) desc,
             {
             case TYPE_SINGLE:
             case TYPE_S_SINGLE:
-                perfc_d[i].nr_vals = nr_cpus;
+                perfc_d[i].nr_elems = 1;
+                perfc_nbr_vals += nr_cpus;
                 break;
             case TYPE_ARRAY:
             case TYPE_S_ARRAY:
-                perfc_d[i].nr_vals = perfc_info[i].nr_elements;
+                perfc_d[i].nr_elems = perfc_info[i].nr_elements;
+                perfc_nbr_vals += perfc_info[i].nr_elements;
                 break;
             }
-            perfc_nbr_vals += perfc_d[i].nr_vals;
+            perfc_nbr_vals_percpu += perfc_d[i].nr_elems * nr_cpus;
         }
 
         xfree(perfc_vals);
-        perfc_vals = xmalloc_array(xen_sysctl_perfc_val_t, perfc_nbr_vals);
+        perfc_vals = xmalloc_array(xen_sysctl_perfc_val_t,
+                                   perfc_nbr_vals_percpu);
     }
 
     if ( guest_handle_is_null(desc) )
@@ -199,43 +225,61 @@ static int perfc_copy_info(XEN_GUEST_HANDLE_64(xen_sysctl_perfc_desc_t) desc,
     if ( perfc_vals == NULL )
         return -ENOMEM;
 
+    nr_cpus = cpumask_weight(&perfc_cpumap);
+
     /* Architecture may fill counters from hardware.  */
     arch_perfc_gather();
 
     /* We gather the counts together every time. */
     for ( i = j = v = 0; i < NR_PERFCTRS; i++ )
     {
-        unsigned int cpu;
+        unsigned int cpu, k;
 
         switch ( perfc_info[i].type )
         {
         case TYPE_SINGLE:
         case TYPE_S_SINGLE:
+            perfc_d[i].nr_vals = nr_cpus;
             for_each_cpu ( cpu, &perfc_cpumap )
                 perfc_vals[v++] = per_cpu(perfcounters, cpu)[j];
             ++j;
             break;
         case TYPE_ARRAY:
         case TYPE_S_ARRAY:
-            memset(perfc_vals + v, 0, perfc_d[i].nr_vals * sizeof(*perfc_vals));
-            for_each_cpu ( cpu, &perfc_cpumap )
+            if ( percpu )
             {
-                perfc_t *counters = per_cpu(perfcounters, cpu) + j;
-                unsigned int k;
+                perfc_d[i].nr_vals = perfc_d[i].nr_elems * nr_cpus;
+                for_each_cpu ( cpu, &perfc_cpumap )
+                {
+                    perfc_t *counters = per_cpu(perfcounters, cpu) + j;
 
-                for ( k = 0; k < perfc_d[i].nr_vals; k++ )
-                    perfc_vals[v + k] += counters[k];
+                    for ( k = 0; k < perfc_d[i].nr_elems; k++ )
+                        perfc_vals[v++] = counters[k];
+                }
+            }
+            else
+            {
+                perfc_d[i].nr_vals = perfc_d[i].nr_elems;
+                memset(perfc_vals + v, 0,
+                       perfc_d[i].nr_vals * sizeof(*perfc_vals));
+                for_each_cpu ( cpu, &perfc_cpumap )
+                {
+                    perfc_t *counters = per_cpu(perfcounters, cpu) + j;
+
+                    for ( k = 0; k < perfc_d[i].nr_vals; k++ )
+                        perfc_vals[v + k] += counters[k];
+                }
+                v += perfc_d[i].nr_vals;
             }
-            v += perfc_d[i].nr_vals;
             j += perfc_info[i].nr_elements;
             break;
         }
     }
-    BUG_ON(v != perfc_nbr_vals);
+    BUG_ON(v != (percpu ? perfc_nbr_vals_percpu : perfc_nbr_vals));
 
     if ( copy_to_guest(desc, perfc_d, NR_PERFCTRS) )
         return -EFAULT;
-    if ( copy_to_guest(val, perfc_vals, perfc_nbr_vals) )
+    if ( copy_to_guest(val, perfc_vals, v) )
         return -EFAULT;
     return 0;
 }
@@ -244,19 +288,23 @@ static int perfc_copy_info(XEN_GUEST_HANDLE_64(xen_sysctl_perfc_desc_t) desc,
 int perfc_control(xen_sysctl_perfc_op_t *pc)
 {
     static DEFINE_SPINLOCK(lock);
+    bool_t percpu = !!(pc->flags & XEN_SYSCTL_PERFC_F_percpu);
     int rc;
 
+    if ( pc->flags & ~XEN_SYSCTL_PERFC_F_percpu )
+        return -EINVAL;
+
     spin_lock(&lock);
 
     switch ( pc->cmd )
     {
     case XEN_SYSCTL_PERFCOP_reset:
-        rc = perfc_copy_info(pc->desc, pc->val);
+        rc = perfc_copy_info(pc->desc, pc->val, percpu);
         perfc_reset(0);
         break;
 
     case XEN_SYSCTL_PERFCOP_query:
-        rc = perfc_copy_info(pc->desc, pc->val);
+        rc = perfc_copy_info(pc->desc, pc->val, percpu);
         break;
 
     default:
@@ -267,7 +315,7 @@ int perfc_control(xen_sysctl_perfc_op_t *pc)
     spin_unlock(&lock);
 
     pc->nr_counters = NR_PERFCTRS;
-    pc->nr_vals = perfc_nbr_vals;
+    pc->nr_vals = percpu ? perfc_nbr_vals_percpu : perfc_nbr_vals;
 
     return rc;
 }
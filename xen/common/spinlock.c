@@ -87,10 +87,23 @@ void spin_debug_disable(void)
 
 #ifdef CONFIG_LOCK_PROFILE
 
+static void lock_profile_wait(spinlock_t *lock, s_time_t wait,
+                              const void *caller);
+
+static inline unsigned int lock_profile_bucket(s_time_t t)
+{
+    unsigned int b = t > 0 ? flsl(t) : 0;
+
+    b = b ? b - 1 : 0;
+    return min(b, LOCKPROF_HIST_BUCKETS - 1u);
+}
+
 #define LOCK_PROFILE_REL                                                     \
     if (lock->profile)                                                       \
     {                                                                        \
-        lock->profile->time_hold += NOW() - lock->profile->time_locked;      \
+        s_time_t held = NOW() - lock->profile->time_locked;                  \
+        lock->profile->time_hold += held;                                    \
+        lock->profile->hold_hist[lock_profile_bucket(held)]++;               \
         lock->profile->lock_cnt++;                                           \
     }
 #define LOCK_PROFILE_VAR    s_time_t block = 0
@@ -101,8 +114,11 @@ void spin_debug_disable(void)
         lock->profile->time_locked = NOW();                                  \
         if (block)                                                           \
         {                                                                    \
-            lock->profile->time_block += lock->profile->time_locked - block; \
+            s_time_t wait = lock->profile->time_locked - block;              \
+            lock->profile->time_block += wait;                               \
+            lock->profile->block_hist[lock_profile_bucket(wait)]++;          \
             lock->profile->block_cnt++;                                      \
+            lock_profile_wait(lock, wait, __builtin_return_address(0));      \
         }                                                                    \
     }
 
@@ -130,7 +146,11 @@ static always_inline u16 observe_head(spinlock_tickets_t *t)
     return read_atomic(&t->head);
 }
 
-void _spin_lock(spinlock_t *lock)
+/*
+ * Always inlined, so that __builtin_return_address(0) in LOCK_PROFILE_GOT
+ * is the caller of the spin_lock*() function rather than one of these.
+ */
+static always_inline void spin_lock_common(spinlock_t *lock)
 {
     spinlock_tickets_t tickets = SPINLOCK_TICKET_INC;
     LOCK_PROFILE_VAR;
@@ -148,11 +168,16 @@ void _spin_lock(spinlock_t *lock)
     arch_lock_acquire_barrier();
 }
 
+void _spin_lock(spinlock_t *lock)
+{
+    spin_lock_common(lock);
+}
+
 void _spin_lock_irq(spinlock_t *lock)
 {
     ASSERT(local_irq_is_enabled());
     local_irq_disable();
-    _spin_lock(lock);
+    spin_lock_common(lock);
 }
 
 unsigned long _spin_lock_irqsave(spinlock_t *lock)
@@ -160,7 +185,7 @@ unsigned long _spin_lock_irqsave(spinlock_t *lock)
     unsigned long flags;
 
     local_irq_save(flags);
-    _spin_lock(lock);
+    spin_lock_common(lock);
     return flags;
 }
 
@@ -241,7 +266,9 @@ void _spin_barrier(spinlock_t *lock)
 #ifdef CONFIG_LOCK_PROFILE
         if ( lock->profile )
         {
-            lock->profile->time_block += NOW() - block;
+            block = NOW() - block;
+            lock->profile->time_block += block;
+            lock->profile->block_hist[lock_profile_bucket(block)]++;
             lock->profile->block_cnt++;
         }
 #endif
@@ -278,7 +305,7 @@ void _spin_lock_recursive(spinlock_t *lock)
 
     if ( likely(lock->recurse_cpu != cpu) )
     {
-        _spin_lock(lock);
+        spin_lock_common(lock);
         lock->recurse_cpu = cpu;
     }
 
@@ -314,6 +341,94 @@ static struct lock_profile_anc lock_profile_ancs[LOCKPROF_TYPE_N];
 static struct lock_profile_qhead lock_profile_glb_q;
 static spinlock_t lock_profile_lock = SPIN_LOCK_UNLOCKED;
 
+/* The longest waits since the last reset, in no particular order. */
+#define LOCKPROF_NR_WAITS 32
+struct lock_profile_wait {
+    const char *name;
+    const void *lock;
+    const void *caller;
+    s_time_t    wait;
+    s_time_t    when;
+    unsigned int cpu;
+};
+static struct lock_profile_wait lock_profile_waits[LOCKPROF_NR_WAITS];
+static s_time_t lock_profile_wait_min;  /* shortest recorded wait */
+static spinlock_t lock_profile_wait_lock = SPIN_LOCK_UNLOCKED;
+
+static void lock_profile_wait(spinlock_t *lock, s_time_t wait,
+                              const void *caller)
+{
+    struct lock_profile_wait *slot;
+    unsigned long flags;
+    unsigned int i;
+
+    /*
+     * Unlocked check, so that the common case of a wait no longer than
+     * any recorded one costs nothing more.  Once all slots are in use
+     * the threshold only ever grows, so a stale value is just a little
+     * less selective.
+     */
+    if ( wait <= lock_profile_wait_min )
+        return;
+
+    /* Locks may be taken from IRQ context. */
+    spin_lock_irqsave(&lock_profile_wait_lock, flags);
+
+    slot = &lock_profile_waits[0];
+    for ( i = 1; i < LOCKPROF_NR_WAITS; i++ )
+        if ( lock_profile_waits[i].wait < slot->wait )
+            slot = &lock_profile_waits[i];
+
+    if ( wait > slot->wait )
+    {
+        slot->name = lock->profile->name;
+        slot->lock = lock;
+        slot->caller = caller;
+        slot->wait = wait;
+        slot->when = lock->profile->time_locked;
+        slot->cpu = smp_processor_id();
+
+        lock_profile_wait_min = lock_profile_waits[0].wait;
+        for ( i = 1; i < LOCKPROF_NR_WAITS; i++ )
+            lock_profile_wait_min = min(lock_profile_wait_min,
+                                        lock_profile_waits[i].wait);
+    }
+
+    spin_unlock_irqrestore(&lock_profile_wait_lock, flags);
+}
+
+/* Take a copy of the recorded waits, longest first; returns their number. */
+static unsigned int lock_profile_get_waits(struct lock_profile_wait *waits)
+{
+    unsigned long flags;
+    unsigned int i, j, nr = 0;
+
+    spin_lock_irqsave(&lock_profile_wait_lock, flags);
+    for ( i = 0; i < LOCKPROF_NR_WAITS; i++ )
+    {
+        struct lock_profile_wait w = lock_profile_waits[i];
+
+        if ( !w.wait )
+            continue;
+        for ( j = nr++; j && waits[j - 1].wait < w.wait; j-- )
+            waits[j] = waits[j - 1];
+        waits[j] = w;
+    }
+    spin_unlock_irqrestore(&lock_profile_wait_lock, flags);
+
+    return nr;
+}
+
+static void lock_profile_reset_waits(void)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&lock_profile_wait_lock, flags);
+    memset(lock_profile_waits, 0, sizeof(lock_profile_waits));
+    lock_profile_wait_min = 0;
+    spin_unlock_irqrestore(&lock_profile_wait_lock, flags);
+}
+
 static void spinlock_profile_iterate(lock_profile_subfunc *sub, void *par)
 {
     int i;
@@ -343,14 +458,24 @@ static void spinlock_profile_print_elem(struct lock_profile *data,
 
 void spinlock_profile_printall(unsigned char key)
 {
+    struct lock_profile_wait waits[LOCKPROF_NR_WAITS];
     s_time_t now = NOW();
     s_time_t diff;
+    unsigned int i, nr;
 
     diff = now - lock_profile_start;
     printk("Xen lock profile info SHOW  (now = %08X:%08X, "
         "total = %08X:%08X)\n", (u32)(now>>32), (u32)now,
         (u32)(diff>>32), (u32)diff);
     spinlock_profile_iterate(spinlock_profile_print_elem, NULL);
+
+    nr = lock_profile_get_waits(waits);
+    if ( nr )
+        printk("Longest waits:\n");
+    for ( i = 0; i < nr; i++ )
+        printk("  %12"PRId64"ns %s (%p) from %pS on CPU%u\n",
+               waits[i].wait, waits[i].name, waits[i].lock,
+               waits[i].caller, waits[i].cpu);
 }
 
 static void spinlock_profile_reset_elem(struct lock_profile *data,
@@ -360,6 +485,8 @@ static void spinlock_profile_reset_elem(struct lock_profile *data,
     data->block_cnt = 0;
     data->time_hold = 0;
     data->time_block = 0;
+    memset(data->block_hist, 0, sizeof(data->block_hist));
+    memset(data->hold_hist, 0, sizeof(data->hold_hist));
 }
 
 void spinlock_profile_reset(unsigned char key)
@@ -371,6 +498,7 @@ void spinlock_profile_reset(unsigned char key)
             (u32)(now>>32), (u32)now);
     lock_profile_start = now;
     spinlock_profile_iterate(spinlock_profile_reset_elem, NULL);
+    lock_profile_reset_waits();
 }
 
 typedef struct {
@@ -396,6 +524,9 @@ static void spinlock_profile_ucopy_elem(struct lock_profile *data,
         elem.block_cnt = data->block_cnt;
         elem.lock_time = data->time_hold;
         elem.block_time = data->time_block;
+        BUILD_BUG_ON(sizeof(elem.block_hist) != sizeof(data->block_hist));
+        memcpy(elem.block_hist, data->block_hist, sizeof(elem.block_hist));
+        memcpy(elem.hold_hist, data->hold_hist, sizeof(elem.hold_hist));
         if ( copy_to_guest_offset(p->pc->data, p->pc->nr_elem, &elem, 1) )
             p->rc = -EFAULT;
     }
@@ -404,6 +535,29 @@ static void spinlock_profile_ucopy_elem(struct lock_profile *data,
         p->pc->nr_elem++;
 }
 
+static int spinlock_profile_copy_waits(xen_sysctl_lockprof_op_t *pc)
+{
+    struct lock_profile_wait waits[LOCKPROF_NR_WAITS];
+    xen_sysctl_lockprof_wait_t elem;
+    unsigned int i, nr = lock_profile_get_waits(waits);
+
+    for ( i = 0; i < nr && i < pc->max_elem; i++ )
+    {
+        memset(&elem, 0, sizeof(elem));
+        safe_strcpy(elem.name, waits[i].name);
+        elem.lock = (unsigned long)waits[i].lock;
+        elem.caller = (unsigned long)waits[i].caller;
+        elem.wait_time = waits[i].wait;
+        elem.when = waits[i].when;
+        elem.cpu = waits[i].cpu;
+        if ( copy_to_guest_offset(pc->waits, i, &elem, 1) )
+            return -EFAULT;
+    }
+    pc->nr_elem = nr;
+
+    return 0;
+}
+
 /* Dom0 control of lock profiling */
 int spinlock_profile_control(xen_sysctl_lockprof_op_t *pc)
 {
@@ -423,6 +577,10 @@ int spinlock_profile_control(xen_sysctl_lockprof_op_t *pc)
         pc->time = NOW() - lock_profile_start;
         rc = par.rc;
         break;
+    case XEN_SYSCTL_LOCKPROF_query_waits:
+        rc = spinlock_profile_copy_waits(pc);
+        pc->time = NOW() - lock_profile_start;
+        break;
     default:
         rc = -EINVAL;
         break;
@@ -0,0 +1,235 @@
+/******************************************************************************
+ * common/stats.c
+ *
+ * Statistics region shared read-only with the control domain, so that
+ * monitoring tools can sample every domain and vcpu without a hypercall per
+ * domain or vcpu.  See XEN_SYSCTL_stats_op in public/sysctl.h for the
+ * layout and the reader protocol.
+ */
+
+#include <xen/lib.h>
+#include <xen/sched.h>
+#include <xen/mm.h>
+#include <xen/time.h>
+#include <xen/timer.h>
+#include <xen/stats.h>
+#include <xen/tmem_xen.h>
+#include <public/sysctl.h>
+
+#define STATS_DEFAULT_DOMAINS  512
+#define STATS_DEFAULT_VCPUS    4096
+#define STATS_MAX_ORDER        10
+
+static struct xen_stats_header *stats;
+static unsigned int stats_order;
+static unsigned int stats_period_ms;
+static struct timer stats_timer;
+/* Serialises updates from the timer and from stats_control(). */
+static DEFINE_SPINLOCK(stats_lock);
+
+static void stats_fill_domain(struct domain *d, struct xen_stats_domain *sd,
+                              struct xen_stats_vcpu *sv)
+{
+    struct xen_domctl_getdomaininfo info;
+    struct vcpu_runstate_info runstate;
+    struct vcpu *v;
+    uint64_t notifications = 0;
+    unsigned int i;
+
+    getdomaininfo(d, &info);
+
+    sd->domain = d->domain_id;
+    sd->flags = info.flags;
+    sd->nr_online_vcpus = info.nr_online_vcpus;
+    sd->max_vcpu_id = info.max_vcpu_id;
+    sd->ssidref = info.ssidref;
+    sd->tot_pages = info.tot_pages;
+    sd->max_pages = info.max_pages;
+    sd->shr_pages = info.shr_pages;
+    sd->paged_pages = info.paged_pages;
+    sd->cpu_time = info.cpu_time;
+    memcpy(sd->handle, info.handle, sizeof(sd->handle));
+
+    if ( info.max_vcpu_id == XEN_INVALID_MAX_VCPU_ID )
+    {
+        sd->evtchn_notifications = 0;
+        return;
+    }
+
+    for ( i = 0; i <= info.max_vcpu_id; i++, sv++ )
+    {
+        memset(sv, 0, sizeof(*sv));
+        sv->domain = d->domain_id;
+        sv->vcpu_id = i;
+
+        if ( (v = d->vcpu[i]) == NULL )
+            continue;
+
+        vcpu_runstate_get(v, &runstate);
+        memcpy(sv->runstate_time, runstate.time, sizeof(sv->runstate_time));
+        sv->cpu = v->processor;
+        sv->flags = (!(v->pause_flags & VPF_down) ? XEN_STATS_VCPU_online : 0) |
+                    ((v->pause_flags & VPF_blocked) ? XEN_STATS_VCPU_blocked
+                                                    : 0) |
+                    (v->is_running ? XEN_STATS_VCPU_running : 0);
+        sv->evtchn_notifications = v->evtchn_notifications;
+        notifications += v->evtchn_notifications;
+    }
+
+    sd->evtchn_notifications = notifications;
+}
+
+static void stats_update(void *unused)
+{
+    struct xen_stats_domain *sd;
+    struct xen_stats_vcpu *sv;
+    struct domain *d;
+    unsigned int nr_domains = 0, nr_vcpus = 0, flags = 0;
+
+    spin_lock(&stats_lock);
+
+    sd = (void *)stats + stats->domain_offset;
+    sv = (void *)stats + stats->vcpu_offset;
+
+    stats->seq++;
+    smp_wmb();
+
+    rcu_read_lock(&domlist_read_lock);
+
+    for_each_domain ( d )
+    {
+        unsigned int vcpus = d->max_vcpus;
+
+        if ( nr_domains == stats->max_domains ||
+             nr_vcpus + vcpus > stats->max_vcpus )
+        {
+            flags |= XEN_STATS_F_overflow;
+            break;
+        }
+
+        sd[nr_domains].first_vcpu = nr_vcpus;
+        stats_fill_domain(d, &sd[nr_domains], &sv[nr_vcpus]);
+        nr_vcpus += sd[nr_domains].max_vcpu_id == XEN_INVALID_MAX_VCPU_ID
+                    ? 0 : sd[nr_domains].max_vcpu_id + 1;
+        nr_domains++;
+    }
+
+    rcu_read_unlock(&domlist_read_lock);
+
+    if ( tmem_enabled() )
+        flags |= XEN_STATS_F_tmem;
+
+    stats->nr_domains = nr_domains;
+    stats->nr_vcpus = nr_vcpus;
+    stats->flags = flags;
+    stats->nr_cpus = num_online_cpus();
+    stats->cpu_khz = cpu_khz;
+    stats->total_pages = total_pages;
+    stats->free_pages = total_free_pages();
+    stats->period_ms = stats_period_ms;
+    stats->timestamp = NOW();
+
+    smp_wmb();
+    stats->seq++;
+
+    if ( stats_period_ms )
+        set_timer(&stats_timer, NOW() + MILLISECS(stats_period_ms));
+
+    spin_unlock(&stats_lock);
+}
+
+static int stats_alloc(unsigned int max_domains, unsigned int max_vcpus)
+{
+    unsigned long size;
+    unsigned int i;
+
+    if ( !max_domains )
+        max_domains = STATS_DEFAULT_DOMAINS;
+    if ( !max_vcpus )
+        max_vcpus = STATS_DEFAULT_VCPUS;
+    if ( max_domains > DOMID_FIRST_RESERVED )
+        return -EINVAL;
+
+    size = ROUNDUP(sizeof(*stats), SMP_CACHE_BYTES) +
+           max_domains * sizeof(struct xen_stats_domain) +
+           (unsigned long)max_vcpus * sizeof(struct xen_stats_vcpu);
+    stats_order = get_order_from_bytes(size);
+    if ( stats_order > STATS_MAX_ORDER )
+        return -E2BIG;
+
+    stats = alloc_xenheap_pages(stats_order, 0);
+    if ( !stats )
+        return -ENOMEM;
+
+    memset(stats, 0, PAGE_SIZE << stats_order);
+    stats->version = XEN_STATS_VERSION;
+    stats->max_domains = max_domains;
+    stats->max_vcpus = max_vcpus;
+    stats->domain_offset = ROUNDUP(sizeof(*stats), SMP_CACHE_BYTES);
+    stats->vcpu_offset = stats->domain_offset +
+                         max_domains * sizeof(struct xen_stats_domain);
+
+    for ( i = 0; i < (1u << stats_order); i++ )
+        share_xen_page_with_privileged_guests(virt_to_page(stats) + i,
+                                              XENSHARE_readonly);
+
+    init_timer(&stats_timer, stats_update, NULL, 0);
+
+    return 0;
+}
+
+int stats_control(struct xen_sysctl_stats_op *op)
+{
+    int rc = 0;
+
+    /* Serialised by the sysctl lock. */
+    switch ( op->cmd )
+    {
+    case XEN_SYSCTL_STATS_OP_get_info:
+        break;
+
+    case XEN_SYSCTL_STATS_OP_enable:
+        if ( op->period_ms < XEN_STATS_MIN_PERIOD_MS )
+            return -EINVAL;
+        if ( !stats && (rc = stats_alloc(op->max_domains, op->max_vcpus)) )
+            return rc;
+        spin_lock(&stats_lock);
+        stats_period_ms = op->period_ms;
+        spin_unlock(&stats_lock);
+        /* Populate the region before handing it out; this rearms the timer. */
+        stats_update(NULL);
+        break;
+
+    case XEN_SYSCTL_STATS_OP_disable:
+        if ( stats )
+        {
+            spin_lock(&stats_lock);
+            stats_period_ms = 0;
+            stats->period_ms = 0;
+            spin_unlock(&stats_lock);
+            stop_timer(&stats_timer);
+        }
+        break;
+
+    default:
+        return -EOPNOTSUPP;
+    }
+
+    op->period_ms = stats_period_ms;
+    op->max_domains = stats ? stats->max_domains : 0;
+    op->max_vcpus = stats ? stats->max_vcpus : 0;
+    op->nr_frames = stats ? 1u << stats_order : 0;
+    op->mfn = stats ? virt_to_mfn(stats) : 0;
+
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
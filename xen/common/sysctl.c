@@ -29,6 +29,8 @@
 #include <xen/pmstat.h>
 #include <xen/gcov.h>
 #include <xen/livepatch.h>
+#include <xen/stats.h>
+#include <xen/hcall_prof.h>
 
 long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
 {
@@ -71,6 +73,14 @@ long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
         ret = tb_control(&op->u.tbuf_op);
         break;
 
+    case XEN_SYSCTL_stats_op:
+        ret = stats_control(&op->u.stats_op);
+        break;
+
+    case XEN_SYSCTL_hcall_prof_op:
+        ret = hcall_prof_control(&op->u.hcall_prof_op);
+        break;
+
     case XEN_SYSCTL_sched_id:
         op->u.sched_id.sched_id = sched_id();
         break;
@@ -115,7 +125,7 @@ long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
     }
     break;
 
-#ifdef CONFIG_PERF_COUNTERS
+#ifdef CONFIG_PERF_COUNTERS_LIGHT
     case XEN_SYSCTL_perfc_op:
         ret = perfc_control(&op->u.perfc_op);
         break;
@@ -49,6 +49,7 @@ static int vm_event_enable(
 {
     int rc;
     unsigned long ring_gfn = d->arch.hvm_domain.params[param];
+    unsigned int nr_frames = vec->nr_frames ?: 1;
 
     /* Only one helper at a time. If the helper crashed,
      * the ring is in an undefined state and so is the guest.
@@ -56,6 +57,13 @@ static int vm_event_enable(
     if ( ved->ring_page )
         return -EBUSY;
 
+    if ( nr_frames > XEN_VM_EVENT_MAX_RING_FRAMES )
+        return -E2BIG;
+
+    /* Multi-page rings are placed explicitly by the helper. */
+    if ( nr_frames > 1 )
+        ring_gfn = vec->ring_gfn;
+
     /* The parameter defaults to zero, and it should be
      * set to something */
     if ( ring_gfn == 0 )
@@ -69,11 +77,13 @@ static int vm_event_enable(
     if ( rc < 0 )
         goto err;
 
-    rc = prepare_ring_for_helper(d, ring_gfn, &ved->ring_pg_struct,
-                                    &ved->ring_page);
+    rc = prepare_ring_frames_for_helper(d, ring_gfn, nr_frames,
+                                        ved->ring_pg_struct, &ved->ring_page);
     if ( rc < 0 )
         goto err;
 
+    ved->nr_frames = nr_frames;
+
     /* Set the number of currently blocked vCPUs to 0. */
     ved->blocked = 0;
 
@@ -88,7 +98,7 @@ static int vm_event_enable(
     /* Prepare ring buffer */
     FRONT_RING_INIT(&ved->front_ring,
                     (vm_event_sring_t *)ved->ring_page,
-                    PAGE_SIZE);
+                    nr_frames * PAGE_SIZE);
 
     /* Save the pause flag for this particular ring. */
     ved->pause_flag = pause_flag;
@@ -100,8 +110,8 @@ static int vm_event_enable(
     return 0;
 
  err:
-    destroy_ring_for_helper(&ved->ring_page,
-                            ved->ring_pg_struct);
+    destroy_ring_frames_for_helper(&ved->ring_page, ved->ring_pg_struct,
+                                   ved->nr_frames);
     vm_event_ring_unlock(ved);
 
     return rc;
@@ -229,8 +239,8 @@ static int vm_event_disable(struct domain *d, struct vm_event_domain *ved)
             }
         }
 
-        destroy_ring_for_helper(&ved->ring_page,
-                                ved->ring_pg_struct);
+        destroy_ring_frames_for_helper(&ved->ring_page, ved->ring_pg_struct,
+                                       ved->nr_frames);
 
         vm_event_cleanup_domain(d);
 
@@ -324,121 +334,147 @@ void vm_event_put_request(struct domain *d,
     notify_via_xen_event_channel(d, ved->xen_port);
 }
 
-int vm_event_get_response(struct domain *d, struct vm_event_domain *ved,
-                          vm_event_response_t *rsp)
+/*
+ * Pull up to @nr responses off the ring in one go.  Consuming a batch under
+ * a single hold of the ring lock, and kicking waiters once for the space
+ * freed by all of it, keeps the cost of draining a busy ring per batch
+ * rather than per response.
+ */
+unsigned int vm_event_get_responses(struct domain *d,
+                                    struct vm_event_domain *ved,
+                                    vm_event_response_t *rsp,
+                                    unsigned int nr)
 {
     vm_event_front_ring_t *front_ring;
     RING_IDX rsp_cons;
+    unsigned int i;
 
     vm_event_ring_lock(ved);
 
     front_ring = &ved->front_ring;
     rsp_cons = front_ring->rsp_cons;
 
-    if ( !RING_HAS_UNCONSUMED_RESPONSES(front_ring) )
+    for ( i = 0; i < nr && RING_HAS_UNCONSUMED_RESPONSES(front_ring); i++ )
     {
-        vm_event_ring_unlock(ved);
-        return 0;
-    }
+        /* Copy response */
+        memcpy(&rsp[i], RING_GET_RESPONSE(front_ring, rsp_cons),
+               sizeof(*rsp));
+        rsp_cons++;
 
-    /* Copy response */
-    memcpy(rsp, RING_GET_RESPONSE(front_ring, rsp_cons), sizeof(*rsp));
-    rsp_cons++;
+        /* Update ring */
+        front_ring->rsp_cons = rsp_cons;
+    }
 
-    /* Update ring */
-    front_ring->rsp_cons = rsp_cons;
-    front_ring->sring->rsp_event = rsp_cons + 1;
+    if ( i )
+    {
+        front_ring->sring->rsp_event = rsp_cons + 1;
 
-    /* Kick any waiters -- since we've just consumed an event,
-     * there may be additional space available in the ring. */
-    vm_event_wake(d, ved);
+        /* Kick any waiters -- since we've just consumed events,
+         * there may be additional space available in the ring. */
+        vm_event_wake(d, ved);
+    }
 
     vm_event_ring_unlock(ved);
 
-    return 1;
+    return i;
 }
 
-/*
- * Pull all responses from the given ring and unpause the corresponding vCPU
- * if required. Based on the response type, here we can also call custom
- * handlers.
- *
- * Note: responses are handled the same way regardless of which ring they
- * arrive on.
- */
-void vm_event_resume(struct domain *d, struct vm_event_domain *ved)
+int vm_event_get_response(struct domain *d, struct vm_event_domain *ved,
+                          vm_event_response_t *rsp)
 {
-    vm_event_response_t rsp;
+    return vm_event_get_responses(d, ved, rsp, 1);
+}
 
-    /* Pull all responses off the ring. */
-    while ( vm_event_get_response(d, ved, &rsp) )
+static void vm_event_handle_response(struct domain *d,
+                                     vm_event_response_t *rsp)
+{
+    struct vcpu *v;
+
+    if ( rsp->version != VM_EVENT_INTERFACE_VERSION )
     {
-        struct vcpu *v;
+        printk(XENLOG_G_WARNING "vm_event interface version mismatch\n");
+        return;
+    }
 
-        if ( rsp.version != VM_EVENT_INTERFACE_VERSION )
-        {
-            printk(XENLOG_G_WARNING "vm_event interface version mismatch\n");
-            continue;
-        }
+    /* Validate the vcpu_id in the response. */
+    if ( (rsp->vcpu_id >= d->max_vcpus) || !d->vcpu[rsp->vcpu_id] )
+        return;
 
-        /* Validate the vcpu_id in the response. */
-        if ( (rsp.vcpu_id >= d->max_vcpus) || !d->vcpu[rsp.vcpu_id] )
-            continue;
+    v = d->vcpu[rsp->vcpu_id];
 
-        v = d->vcpu[rsp.vcpu_id];
+    /*
+     * Make sure the vCPU state has been synchronized for the custom
+     * handlers.
+     */
+    if ( atomic_read(&v->vm_event_pause_count) )
+        sync_vcpu_execstate(v);
+
+    /*
+     * In some cases the response type needs extra handling, so here
+     * we call the appropriate handlers.
+     */
+
+    /* Check flags which apply only when the vCPU is paused */
+    if ( atomic_read(&v->vm_event_pause_count) )
+    {
+#ifdef CONFIG_HAS_MEM_PAGING
+        if ( rsp->reason == VM_EVENT_REASON_MEM_PAGING )
+            p2m_mem_paging_resume(d, rsp);
+#endif
 
         /*
-         * Make sure the vCPU state has been synchronized for the custom
-         * handlers.
+         * Check emulation flags in the arch-specific handler only, as it
+         * has to set arch-specific flags when supported, and to avoid
+         * bitmask overhead when it isn't supported.
          */
-        if ( atomic_read(&v->vm_event_pause_count) )
-            sync_vcpu_execstate(v);
+        vm_event_emulate_check(v, rsp);
 
         /*
-         * In some cases the response type needs extra handling, so here
-         * we call the appropriate handlers.
+         * Check in arch-specific handler to avoid bitmask overhead when
+         * not supported.
          */
+        vm_event_register_write_resume(v, rsp);
 
-        /* Check flags which apply only when the vCPU is paused */
-        if ( atomic_read(&v->vm_event_pause_count) )
-        {
-#ifdef CONFIG_HAS_MEM_PAGING
-            if ( rsp.reason == VM_EVENT_REASON_MEM_PAGING )
-                p2m_mem_paging_resume(d, &rsp);
-#endif
+        /*
+         * Check in arch-specific handler to avoid bitmask overhead when
+         * not supported.
+         */
+        vm_event_toggle_singlestep(d, v, rsp);
 
-            /*
-             * Check emulation flags in the arch-specific handler only, as it
-             * has to set arch-specific flags when supported, and to avoid
-             * bitmask overhead when it isn't supported.
-             */
-            vm_event_emulate_check(v, &rsp);
-
-            /*
-             * Check in arch-specific handler to avoid bitmask overhead when
-             * not supported.
-             */
-            vm_event_register_write_resume(v, &rsp);
-
-            /*
-             * Check in arch-specific handler to avoid bitmask overhead when
-             * not supported.
-             */
-            vm_event_toggle_singlestep(d, v, &rsp);
-
-            /* Check for altp2m switch */
-            if ( rsp.flags & VM_EVENT_FLAG_ALTERNATE_P2M )
-                p2m_altp2m_check(v, rsp.altp2m_idx);
-
-            if ( rsp.flags & VM_EVENT_FLAG_SET_REGISTERS )
-                vm_event_set_registers(v, &rsp);
-
-            if ( rsp.flags & VM_EVENT_FLAG_VCPU_PAUSED )
-                vm_event_vcpu_unpause(v);
-        }
+        /* Check for altp2m switch */
+        if ( rsp->flags & VM_EVENT_FLAG_ALTERNATE_P2M )
+            p2m_altp2m_check(v, rsp->altp2m_idx);
+
+        if ( rsp->flags & VM_EVENT_FLAG_SET_REGISTERS )
+            vm_event_set_registers(v, rsp);
+
+        if ( rsp->flags & VM_EVENT_FLAG_VCPU_PAUSED )
+            vm_event_vcpu_unpause(v);
     }
 }
 
+/* Responses pulled off the ring per lock hold in vm_event_resume(). */
+#define VM_EVENT_RESUME_BATCH 4
+
+/*
+ * Pull all responses from the given ring and unpause the corresponding vCPU
+ * if required. Based on the response type, here we can also call custom
+ * handlers.
+ *
+ * Note: responses are handled the same way regardless of which ring they
+ * arrive on.
+ */
+void vm_event_resume(struct domain *d, struct vm_event_domain *ved)
+{
+    vm_event_response_t rsp[VM_EVENT_RESUME_BATCH];
+    unsigned int i, nr;
+
+    /* Pull all responses off the ring. */
+    while ( (nr = vm_event_get_responses(d, ved, rsp, ARRAY_SIZE(rsp))) != 0 )
+        for ( i = 0; i < nr; i++ )
+            vm_event_handle_response(d, &rsp[i]);
+}
+
 void vm_event_cancel_slot(struct domain *d, struct vm_event_domain *ved)
 {
     vm_event_ring_lock(ved);
@@ -433,34 +433,36 @@ static int iommu_merge_pages(struct domain *d, unsigned long pt_mfn,
     return 0;
 }
 
-/* Walk io page tables and build level page tables if necessary
+/* Walk io page tables down to the target level and build level page
+ * tables if necessary
  * {Re, un}mapping super page frames causes re-allocation of io
  * page tables.
  */
 static int iommu_pde_from_gfn(struct domain *d, unsigned long pfn, 
-                              unsigned long pt_mfn[])
+                              unsigned long pt_mfn[], unsigned int target)
 {
     u64 *pde, *next_table_vaddr;
     unsigned long  next_table_mfn;
     unsigned int level;
     struct page_info *table;
-    const struct domain_iommu *hd = dom_iommu(d);
+    struct domain_iommu *hd = dom_iommu(d);
 
     table = hd->arch.root_table;
     level = hd->arch.paging_mode;
 
     BUG_ON( table == NULL || level < IOMMU_PAGING_MODE_LEVEL_1 || 
-            level > IOMMU_PAGING_MODE_LEVEL_6 );
+            level > IOMMU_PAGING_MODE_LEVEL_6 ||
+            target < IOMMU_PAGING_MODE_LEVEL_1 || target > level );
 
     next_table_mfn = page_to_mfn(table);
 
-    if ( level == IOMMU_PAGING_MODE_LEVEL_1 )
+    if ( level == target )
     {
         pt_mfn[level] = next_table_mfn;
         return 0;
     }
 
-    while ( level > IOMMU_PAGING_MODE_LEVEL_1 )
+    while ( level > target )
     {
         unsigned int next_level = level - 1;
         pt_mfn[level] = next_table_mfn;
@@ -493,6 +495,7 @@ static int iommu_pde_from_gfn(struct domain *d, unsigned long pfn,
                 unmap_domain_page(next_table_vaddr);
                 return 1;
             }
+            hd->arch.pgtable_pages++;
 
             next_table_mfn = page_to_mfn(table);
             set_iommu_pde_present((u32*)pde, next_table_mfn, next_level, 
@@ -521,6 +524,7 @@ static int iommu_pde_from_gfn(struct domain *d, unsigned long pfn,
                     unmap_domain_page(next_table_vaddr);
                     return 1;
                 }
+                hd->arch.pgtable_pages++;
                 next_table_mfn = page_to_mfn(table);
                 set_iommu_pde_present((u32*)pde, next_table_mfn, next_level,
                                       !!IOMMUF_writable, !!IOMMUF_readable);
@@ -536,7 +540,7 @@ static int iommu_pde_from_gfn(struct domain *d, unsigned long pfn,
         level--;
     }
 
-    /* mfn of level 1 page table */
+    /* mfn of target level page table */
     pt_mfn[level] = next_table_mfn;
     return 0;
 }
@@ -576,6 +580,7 @@ static int update_paging_mode(struct domain *d, unsigned long gfn)
                             __func__);
             return -ENOMEM;
         }
+        hd->arch.pgtable_pages++;
 
         new_root_vaddr = __map_domain_page(new_root);
         old_root_mfn = page_to_mfn(old_root);
@@ -662,7 +667,8 @@ int amd_iommu_map_page(struct domain *d, unsigned long gfn, unsigned long mfn,
         }
     }
 
-    if ( iommu_pde_from_gfn(d, gfn, pt_mfn) || (pt_mfn[1] == 0) )
+    if ( iommu_pde_from_gfn(d, gfn, pt_mfn, IOMMU_PAGING_MODE_LEVEL_1) ||
+         (pt_mfn[1] == 0) )
     {
         spin_unlock(&hd->arch.mapping_lock);
         AMD_IOMMU_DEBUG("Invalid IO pagetable entry gfn = %lx\n", gfn);
@@ -706,6 +712,7 @@ int amd_iommu_map_page(struct domain *d, unsigned long gfn, unsigned long mfn,
 
         /* Deallocate lower level page table */
         free_amd_iommu_pgtable(mfn_to_page(pt_mfn[merge_level - 1]));
+        hd->arch.pgtable_pages--;
     }
 
 out:
@@ -743,7 +750,8 @@ int amd_iommu_unmap_page(struct domain *d, unsigned long gfn)
         }
     }
 
-    if ( iommu_pde_from_gfn(d, gfn, pt_mfn) || (pt_mfn[1] == 0) )
+    if ( iommu_pde_from_gfn(d, gfn, pt_mfn, IOMMU_PAGING_MODE_LEVEL_1) ||
+         (pt_mfn[1] == 0) )
     {
         spin_unlock(&hd->arch.mapping_lock);
         AMD_IOMMU_DEBUG("Invalid IO pagetable entry gfn = %lx\n", gfn);
@@ -760,6 +768,111 @@ int amd_iommu_unmap_page(struct domain *d, unsigned long gfn)
     return 0;
 }
 
+/*
+ * Set (mfn != INVALID_MFN) or clear the entry covering a naturally aligned
+ * 2M or 1G range at the level mapping pages of that size.  A leaf table
+ * found in its place gets freed once the IOTLB has been flushed, like the
+ * one replaced when merging in amd_iommu_map_page(); deeper tables are left
+ * to the page by page operations.
+ */
+static int set_iommu_superpage(struct domain *d, unsigned long gfn,
+                               unsigned long mfn, unsigned int order,
+                               unsigned int flags)
+{
+    struct domain_iommu *hd = dom_iommu(d);
+    unsigned long pt_mfn[7];
+    unsigned int level = order / PTE_PER_TABLE_SHIFT + 1;
+    struct page_info *old_table = NULL;
+    u64 *table;
+    u32 *pde;
+
+    BUG_ON( !hd->arch.root_table );
+
+    if ( iommu_use_hap_pt(d) )
+        return 0;
+
+    if ( (order % PTE_PER_TABLE_SHIFT) || order > 2 * PTE_PER_TABLE_SHIFT ||
+         (gfn & ((1UL << order) - 1)) ||
+         (mfn != mfn_x(INVALID_MFN) && (mfn & ((1UL << order) - 1))) )
+        return -EOPNOTSUPP;
+
+    memset(pt_mfn, 0, sizeof(pt_mfn));
+
+    spin_lock(&hd->arch.mapping_lock);
+
+    if ( is_hvm_domain(d) )
+    {
+        int rc = update_paging_mode(d, gfn);
+
+        if ( rc )
+        {
+            spin_unlock(&hd->arch.mapping_lock);
+            AMD_IOMMU_DEBUG("Update page mode failed gfn = %lx\n", gfn);
+            if ( rc != -EADDRNOTAVAIL )
+                domain_crash(d);
+            return rc;
+        }
+    }
+
+    if ( level > hd->arch.paging_mode )
+    {
+        spin_unlock(&hd->arch.mapping_lock);
+        return -EOPNOTSUPP;
+    }
+
+    if ( iommu_pde_from_gfn(d, gfn, pt_mfn, level) || (pt_mfn[level] == 0) )
+    {
+        spin_unlock(&hd->arch.mapping_lock);
+        AMD_IOMMU_DEBUG("Invalid IO pagetable entry gfn = %lx\n", gfn);
+        domain_crash(d);
+        return -EFAULT;
+    }
+
+    table = map_domain_page(_mfn(pt_mfn[level]));
+    pde = (u32 *)(table + pfn_to_pde_idx(gfn, level));
+
+    if ( iommu_is_pte_present(pde) && iommu_next_level(pde) )
+    {
+        if ( iommu_next_level(pde) != IOMMU_PAGING_MODE_LEVEL_1 )
+        {
+            unmap_domain_page(table);
+            spin_unlock(&hd->arch.mapping_lock);
+            return -EOPNOTSUPP;
+        }
+        old_table = maddr_to_page(amd_iommu_get_next_table_from_pte(pde));
+        hd->arch.pgtable_pages--;
+    }
+
+    if ( mfn != mfn_x(INVALID_MFN) )
+        set_iommu_pde_present(pde, mfn, IOMMU_PAGING_MODE_LEVEL_0,
+                              !!(flags & IOMMUF_writable),
+                              !!(flags & IOMMUF_readable));
+    else
+        *(u64 *)pde = 0;
+
+    unmap_domain_page(table);
+    spin_unlock(&hd->arch.mapping_lock);
+
+    amd_iommu_flush_pages(d, gfn, order);
+
+    if ( old_table )
+        free_amd_iommu_pgtable(old_table);
+
+    return 0;
+}
+
+int amd_iommu_map_pages(struct domain *d, unsigned long gfn, unsigned long mfn,
+                        unsigned int order, unsigned int flags)
+{
+    return set_iommu_superpage(d, gfn, mfn, order, flags);
+}
+
+int amd_iommu_unmap_pages(struct domain *d, unsigned long gfn,
+                          unsigned int order)
+{
+    return set_iommu_superpage(d, gfn, mfn_x(INVALID_MFN), order, 0);
+}
+
 int amd_iommu_reserve_domain_unity_map(struct domain *domain,
                                        u64 phys_addr,
                                        unsigned long size, int iw, int ir)
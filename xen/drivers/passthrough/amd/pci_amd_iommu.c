@@ -234,6 +234,7 @@ static int allocate_domain_resources(struct domain_iommu *hd)
             spin_unlock(&hd->arch.mapping_lock);
             return -ENOMEM;
         }
+        hd->arch.pgtable_pages++;
     }
     spin_unlock(&hd->arch.mapping_lock);
     return 0;
@@ -475,6 +476,7 @@ static void deallocate_iommu_page_tables(struct domain *d)
     {
         deallocate_next_page_table(hd->arch.root_table, hd->arch.paging_mode);
         hd->arch.root_table = NULL;
+        hd->arch.pgtable_pages = 0;
     }
     spin_unlock(&hd->arch.mapping_lock);
 }
@@ -609,7 +611,9 @@ static void amd_dump_p2m_table(struct domain *d)
     if ( !hd->arch.root_table )
         return;
 
-    printk("p2m table has %d levels\n", hd->arch.paging_mode);
+    printk("p2m table has %d levels, %lu pages (%lukB)\n",
+           hd->arch.paging_mode, hd->arch.pgtable_pages,
+           hd->arch.pgtable_pages << (PAGE_SHIFT - 10));
     amd_dump_p2m_table_level(hd->arch.root_table, hd->arch.paging_mode, 0, 0);
 }
 
@@ -622,6 +626,8 @@ const struct iommu_ops amd_iommu_ops = {
     .teardown = amd_iommu_domain_destroy,
     .map_page = amd_iommu_map_page,
     .unmap_page = amd_iommu_unmap_page,
+    .map_pages = amd_iommu_map_pages,
+    .unmap_pages = amd_iommu_unmap_pages,
     .free_page_table = deallocate_page_table,
     .reassign_device = reassign_device,
     .get_device_group_id = amd_iommu_group_id,
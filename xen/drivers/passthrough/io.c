@@ -370,6 +370,8 @@ int pt_irq_create_bind(
         {
             pirq_dpci->flags = HVM_IRQ_DPCI_MAPPED | HVM_IRQ_DPCI_MACH_MSI |
                                HVM_IRQ_DPCI_GUEST_MSI;
+            pirq_dpci->posted = 0;
+            pirq_dpci->slow_path = 0;
             pirq_dpci->gmsi.gvec = pt_irq_bind->u.msi.gvec;
             pirq_dpci->gmsi.gflags = pt_irq_bind->u.msi.gflags;
             /*
@@ -452,7 +454,8 @@ int pt_irq_create_bind(
                                           delivery_mode, pirq_dpci->gmsi.gvec);
 
             if ( vcpu )
-                pi_update_irte( vcpu, info, pirq_dpci->gmsi.gvec );
+                pirq_dpci->posted =
+                    !pi_update_irte( vcpu, info, pirq_dpci->gmsi.gvec );
             else
                 dprintk(XENLOG_G_INFO,
                         "%pv: deliver interrupt in remapping mode,gvec:%02x\n",
@@ -742,6 +745,7 @@ int hvm_do_IRQ_dpci(struct domain *d, struct pirq *pirq)
         return 0;
 
     pirq_dpci->masked = 1;
+    pirq_dpci->slow_path++;
     raise_softirq_for(pirq_dpci);
     return 1;
 }
@@ -296,6 +296,124 @@ int iommu_unmap_page(struct domain *d, unsigned long gfn)
     return rc;
 }
 
+int iommu_map_pages(struct domain *d, unsigned long gfn, unsigned long mfn,
+                    unsigned int order, unsigned int flags)
+{
+    const struct domain_iommu *hd = dom_iommu(d);
+    bool_t dont_flush = this_cpu(iommu_dont_flush_iotlb);
+    unsigned long i;
+    int rc = 0, ret;
+
+    if ( !iommu_enabled || !hd->platform_ops )
+        return 0;
+
+    if ( !order )
+        return iommu_map_page(d, gfn, mfn, flags);
+
+    if ( hd->platform_ops->map_pages )
+    {
+        rc = hd->platform_ops->map_pages(d, gfn, mfn, order, flags);
+        if ( rc != -EOPNOTSUPP )
+        {
+            if ( unlikely(rc) )
+            {
+                if ( !d->is_shutting_down && printk_ratelimit() )
+                    printk(XENLOG_ERR
+                           "d%d: IOMMU mapping gfn %#lx to mfn %#lx order %u failed: %d\n",
+                           d->domain_id, gfn, mfn, order, rc);
+
+                if ( !is_hardware_domain(d) )
+                    domain_crash(d);
+            }
+
+            return rc;
+        }
+        rc = 0;
+    }
+
+    this_cpu(iommu_dont_flush_iotlb) = 1;
+
+    for ( i = 0; i < (1UL << order); i++ )
+    {
+        rc = iommu_map_page(d, gfn + i, mfn + i, flags);
+        if ( unlikely(rc) )
+        {
+            while ( i-- )
+                /* If statement to satisfy __must_check. */
+                if ( iommu_unmap_page(d, gfn + i) )
+                    continue;
+
+            break;
+        }
+    }
+
+    this_cpu(iommu_dont_flush_iotlb) = dont_flush;
+
+    if ( !dont_flush )
+    {
+        ret = iommu_iotlb_flush(d, gfn, 1UL << order);
+        if ( !rc )
+            rc = ret;
+    }
+
+    return rc;
+}
+
+int iommu_unmap_pages(struct domain *d, unsigned long gfn, unsigned int order)
+{
+    const struct domain_iommu *hd = dom_iommu(d);
+    bool_t dont_flush = this_cpu(iommu_dont_flush_iotlb);
+    unsigned long i;
+    int rc = 0, ret;
+
+    if ( !iommu_enabled || !hd->platform_ops )
+        return 0;
+
+    if ( !order )
+        return iommu_unmap_page(d, gfn);
+
+    if ( hd->platform_ops->unmap_pages )
+    {
+        rc = hd->platform_ops->unmap_pages(d, gfn, order);
+        if ( rc != -EOPNOTSUPP )
+        {
+            if ( unlikely(rc) )
+            {
+                if ( !d->is_shutting_down && printk_ratelimit() )
+                    printk(XENLOG_ERR
+                           "d%d: IOMMU unmapping gfn %#lx order %u failed: %d\n",
+                           d->domain_id, gfn, order, rc);
+
+                if ( !is_hardware_domain(d) )
+                    domain_crash(d);
+            }
+
+            return rc;
+        }
+        rc = 0;
+    }
+
+    this_cpu(iommu_dont_flush_iotlb) = 1;
+
+    for ( i = 0; i < (1UL << order); i++ )
+    {
+        ret = iommu_unmap_page(d, gfn + i);
+        if ( !rc )
+            rc = ret;
+    }
+
+    this_cpu(iommu_dont_flush_iotlb) = dont_flush;
+
+    if ( !dont_flush )
+    {
+        ret = iommu_iotlb_flush(d, gfn, 1UL << order);
+        if ( !rc )
+            rc = ret;
+    }
+
+    return rc;
+}
+
 static void iommu_free_pagetables(unsigned long unused)
 {
     do {
@@ -272,6 +272,7 @@ static u64 addr_to_dma_page_maddr(struct domain *domain, u64 addr, int alloc)
         drhd = acpi_find_matched_drhd_unit(pdev);
         if ( !alloc || ((hd->arch.pgd_maddr = alloc_pgtable_maddr(drhd, 1)) == 0) )
             goto out;
+        hd->arch.pgtable_pages++;
     }
 
     parent = (struct dma_pte *)map_vtd_domain_page(hd->arch.pgd_maddr);
@@ -291,6 +292,7 @@ static u64 addr_to_dma_page_maddr(struct domain *domain, u64 addr, int alloc)
             pte_maddr = alloc_pgtable_maddr(drhd, 1);
             if ( !pte_maddr )
                 break;
+            hd->arch.pgtable_pages++;
 
             dma_set_pte_addr(*pte, pte_maddr);
 
@@ -551,9 +553,10 @@ static int __must_check iommu_flush_all(void)
     struct acpi_drhd_unit *drhd;
     struct iommu *iommu;
     bool_t flush_dev_iotlb;
-    int rc = 0;
+    int rc = 0, ret;
 
     flush_all_cache();
+    qinval_batch_begin();
     for_each_drhd_unit ( drhd )
     {
         int context_rc, iotlb_rc;
@@ -578,6 +581,10 @@ static int __must_check iommu_flush_all(void)
             rc = iotlb_rc;
     }
 
+    ret = qinval_batch_end();
+    if ( rc >= 0 )
+        rc = ret;
+
     if ( rc > 0 )
         rc = 0;
 
@@ -594,12 +601,13 @@ static int __must_check iommu_flush_iotlb(struct domain *d,
     struct iommu *iommu;
     bool_t flush_dev_iotlb;
     int iommu_domid;
-    int rc = 0;
+    int rc = 0, ret;
 
     /*
      * No need pcideves_lock here because we have flush
      * when assign/deassign device
      */
+    qinval_batch_begin();
     for_each_drhd_unit ( drhd )
     {
         iommu = drhd->iommu;
@@ -612,13 +620,19 @@ static int __must_check iommu_flush_iotlb(struct domain *d,
         if ( iommu_domid == -1 )
             continue;
 
-        if ( page_count != 1 || gfn == gfn_x(INVALID_GFN) )
+        /*
+         * Page selective invalidation covers naturally aligned power of two
+         * ranges, as mapped in one go by iommu_map_pages(); anything else
+         * takes a domain selective one.
+         */
+        if ( gfn == gfn_x(INVALID_GFN) || !page_count ||
+             (page_count & (page_count - 1)) || (gfn & (page_count - 1)) )
             rc = iommu_flush_iotlb_dsi(iommu, iommu_domid,
                                        0, flush_dev_iotlb);
         else
             rc = iommu_flush_iotlb_psi(iommu, iommu_domid,
                                        (paddr_t)gfn << PAGE_SHIFT_4K,
-                                       PAGE_ORDER_4K,
+                                       get_count_order(page_count),
                                        !dma_old_pte_present,
                                        flush_dev_iotlb);
 
@@ -629,6 +643,10 @@ static int __must_check iommu_flush_iotlb(struct domain *d,
         }
     }
 
+    ret = qinval_batch_end();
+    if ( !rc )
+        rc = ret;
+
     return rc;
 }
 
@@ -1467,7 +1485,7 @@ static int domain_context_mapping(struct domain *domain, u8 devfn,
                                   struct pci_dev *pdev)
 {
     struct acpi_drhd_unit *drhd;
-    int ret = 0;
+    int ret = 0, rc;
     u8 seg = pdev->seg, bus = pdev->bus, secbus;
 
     drhd = acpi_find_matched_drhd_unit(pdev);
@@ -1476,6 +1494,13 @@ static int domain_context_mapping(struct domain *domain, u8 devfn,
 
     ASSERT(pcidevs_locked());
 
+    /*
+     * The context entries written here were not present, so the flushes
+     * following them, for the device and any bridge it sits behind, only
+     * need to have completed once they all have been written.
+     */
+    qinval_batch_begin();
+
     switch ( pdev->type )
     {
     case DEV_TYPE_PCI_HOST_BRIDGE:
@@ -1484,7 +1509,7 @@ static int domain_context_mapping(struct domain *domain, u8 devfn,
                    domain->domain_id, seg, bus,
                    PCI_SLOT(devfn), PCI_FUNC(devfn));
         if ( !is_hardware_domain(domain) )
-            return -EPERM;
+            ret = -EPERM;
         break;
 
     case DEV_TYPE_PCIe_BRIDGE:
@@ -1541,6 +1566,10 @@ static int domain_context_mapping(struct domain *domain, u8 devfn,
         break;
     }
 
+    rc = qinval_batch_end();
+    if ( !ret )
+        ret = rc;
+
     if ( !ret && devfn == pdev->devfn )
         pci_vtd_quirk(pdev);
 
@@ -1618,7 +1647,7 @@ static int domain_context_unmap(struct domain *domain, u8 devfn,
 {
     struct acpi_drhd_unit *drhd;
     struct iommu *iommu;
-    int ret = 0;
+    int ret = 0, rc;
     u8 seg = pdev->seg, bus = pdev->bus, tmp_bus, tmp_devfn, secbus;
     int found = 0;
 
@@ -1627,6 +1656,8 @@ static int domain_context_unmap(struct domain *domain, u8 devfn,
         return -ENODEV;
     iommu = drhd->iommu;
 
+    qinval_batch_begin();
+
     switch ( pdev->type )
     {
     case DEV_TYPE_PCI_HOST_BRIDGE:
@@ -1635,7 +1666,7 @@ static int domain_context_unmap(struct domain *domain, u8 devfn,
                    domain->domain_id, seg, bus,
                    PCI_SLOT(devfn), PCI_FUNC(devfn));
         if ( !is_hardware_domain(domain) )
-            return -EPERM;
+            ret = -EPERM;
         goto out;
 
     case DEV_TYPE_PCIe_BRIDGE:
@@ -1672,7 +1703,7 @@ static int domain_context_unmap(struct domain *domain, u8 devfn,
         {
             ret = domain_context_unmap_one(domain, iommu, tmp_bus, tmp_devfn);
             if ( ret )
-                return ret;
+                goto out;
 
             ret = domain_context_unmap_one(domain, iommu, secbus, 0);
         }
@@ -1689,6 +1720,15 @@ static int domain_context_unmap(struct domain *domain, u8 devfn,
         goto out;
     }
 
+    /*
+     * The flushes of the cleared context entries, tagged with this domain's
+     * ID, must have completed before the ID can be released below and given
+     * to another domain.
+     */
+    rc = qinval_batch_end();
+    if ( !ret )
+        ret = rc;
+
     /*
      * if no other devices under the same iommu owned by this domain,
      * clear iommu in iommu_bitmap and clear domain_id in domid_bitmp
@@ -1714,17 +1754,17 @@ static int domain_context_unmap(struct domain *domain, u8 devfn,
 
         iommu_domid = domain_iommu_domid(domain, iommu);
         if ( iommu_domid == -1 )
-        {
-            ret = -EINVAL;
-            goto out;
-        }
+            return -EINVAL;
 
         clear_bit(iommu_domid, iommu->domid_bitmap);
         iommu->domid_map[iommu_domid] = 0;
     }
 
-out:
     return ret;
+
+out:
+    rc = qinval_batch_end();
+    return ret ? ret : rc;
 }
 
 static void iommu_domain_teardown(struct domain *d)
@@ -1747,6 +1787,7 @@ static void iommu_domain_teardown(struct domain *d)
     spin_lock(&hd->arch.mapping_lock);
     iommu_free_pagetable(hd->arch.pgd_maddr, agaw_to_level(hd->arch.agaw));
     hd->arch.pgd_maddr = 0;
+    hd->arch.pgtable_pages = 0;
     spin_unlock(&hd->arch.mapping_lock);
 }
 
@@ -2625,7 +2666,9 @@ static void vtd_dump_p2m_table(struct domain *d)
         return;
 
     hd = dom_iommu(d);
-    printk("p2m table has %d levels\n", agaw_to_level(hd->arch.agaw));
+    printk("p2m table has %d levels, %lu pages (%lukB)\n",
+           agaw_to_level(hd->arch.agaw), hd->arch.pgtable_pages,
+           hd->arch.pgtable_pages << (PAGE_SHIFT_4K - 10));
     vtd_dump_p2m_table_level(hd->arch.pgd_maddr, agaw_to_level(hd->arch.agaw), 0, 0);
 }
 
@@ -505,6 +505,13 @@ extern struct list_head acpi_ioapic_units;
 
 struct qi_ctrl {
     u64 qinval_maddr;  /* queue invalidation page machine address */
+
+    /* Invalidation wait statistics, for the 'V' debug key. */
+    unsigned long waits;         /* synchronous waits */
+    unsigned long deferred;      /* waits left to the end of a batch */
+    unsigned long batches;       /* waits at the end of a batch */
+    u64 wait_ns;                 /* total time spent polling */
+    u64 wait_max_ns;
 };
 
 struct ir_ctrl {
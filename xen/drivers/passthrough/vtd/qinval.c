@@ -31,6 +31,25 @@
 
 #define VTD_QI_TIMEOUT	1
 
+/*
+ * Invalidation batching: between qinval_batch_begin() and qinval_batch_end()
+ * context and IOTLB invalidations don't wait for completion one by one.
+ * Each is followed by a fence instead, so that the hardware still processes
+ * them in order, and qinval_batch_end() submits one wait descriptor to each
+ * IOMMU used and polls them all together.  Nothing relying on an
+ * invalidation having completed (freeing page tables, releasing a domain ID
+ * for reuse, handing a device to another domain) may happen before the
+ * outermost qinval_batch_end(), which returns any error.  Interrupt
+ * remapping and device IOTLB invalidations are always waited for
+ * synchronously.
+ */
+struct qinval_batch {
+    unsigned int depth;
+    unsigned long pending;            /* IOMMUs with waits outstanding */
+    volatile u32 poll[MAX_IOMMUS];
+};
+static DEFINE_PER_CPU(struct qinval_batch, qinval_batch);
+
 static int __must_check invalidate_sync(struct iommu *iommu);
 
 static void print_qi_regs(struct iommu *iommu)
@@ -143,11 +162,10 @@ static int __must_check queue_invalidate_iotlb_sync(struct iommu *iommu,
     return invalidate_sync(iommu);
 }
 
-static int __must_check queue_invalidate_wait(struct iommu *iommu,
-                                              u8 iflag, u8 sw, u8 fn,
-                                              bool_t flush_dev_iotlb)
+static void queue_invalidate_wait_dsc(struct iommu *iommu,
+                                      u8 iflag, u8 sw, u8 fn,
+                                      volatile u32 *poll_slot)
 {
-    volatile u32 poll_slot = QINVAL_STAT_INIT;
     unsigned int index;
     unsigned long flags;
     u64 entry_base;
@@ -167,19 +185,39 @@ static int __must_check queue_invalidate_wait(struct iommu *iommu,
     qinval_entry->q.inv_wait_dsc.lo.res_1 = 0;
     qinval_entry->q.inv_wait_dsc.lo.sdata = QINVAL_STAT_DONE;
     qinval_entry->q.inv_wait_dsc.hi.res_1 = 0;
-    qinval_entry->q.inv_wait_dsc.hi.saddr = virt_to_maddr(&poll_slot) >> 2;
+    qinval_entry->q.inv_wait_dsc.hi.saddr =
+        sw ? virt_to_maddr(poll_slot) >> 2 : 0;
 
     unmap_vtd_domain_page(qinval_entries);
     qinval_update_qtail(iommu, index);
     spin_unlock_irqrestore(&iommu->register_lock, flags);
+}
+
+static void qinval_account_wait(struct qi_ctrl *qi_ctrl, s_time_t start)
+{
+    u64 ns = NOW() - start;
+
+    qi_ctrl->wait_ns += ns;
+    if ( ns > qi_ctrl->wait_max_ns )
+        qi_ctrl->wait_max_ns = ns;
+}
+
+static int __must_check queue_invalidate_wait(struct iommu *iommu,
+                                              u8 iflag, u8 sw, u8 fn,
+                                              bool_t flush_dev_iotlb)
+{
+    volatile u32 poll_slot = QINVAL_STAT_INIT;
+    struct qi_ctrl *qi_ctrl = iommu_qi_ctrl(iommu);
+
+    queue_invalidate_wait_dsc(iommu, iflag, sw, fn, &poll_slot);
 
     /* Now we don't support interrupt method */
     if ( sw )
     {
-        s_time_t timeout;
+        s_time_t start = NOW(), timeout;
 
         /* In case all wait descriptor writes to same addr with same data */
-        timeout = NOW() + MILLISECS(flush_dev_iotlb ?
+        timeout = start + MILLISECS(flush_dev_iotlb ?
                                     iommu_dev_iotlb_timeout : VTD_QI_TIMEOUT);
 
         while ( poll_slot != QINVAL_STAT_DONE )
@@ -193,6 +231,14 @@ static int __must_check queue_invalidate_wait(struct iommu *iommu,
             }
             cpu_relax();
         }
+
+        qi_ctrl->waits++;
+        qinval_account_wait(qi_ctrl, start);
+
+        /* This also completed anything a batch left outstanding. */
+        if ( !in_irq() )
+            __clear_bit(iommu->index, &this_cpu(qinval_batch).pending);
+
         return 0;
     }
 
@@ -202,12 +248,92 @@ static int __must_check queue_invalidate_wait(struct iommu *iommu,
 static int __must_check invalidate_sync(struct iommu *iommu)
 {
     struct qi_ctrl *qi_ctrl = iommu_qi_ctrl(iommu);
+    struct qinval_batch *batch = &this_cpu(qinval_batch);
 
     ASSERT(qi_ctrl->qinval_maddr);
 
+    /*
+     * Interrupt handlers may not know they interrupted a batch, and rely
+     * on their invalidations having completed.
+     */
+    if ( batch->depth && !in_irq() )
+    {
+        queue_invalidate_wait_dsc(iommu, 0, 0, 1, NULL);
+        __set_bit(iommu->index, &batch->pending);
+        qi_ctrl->deferred++;
+        return 0;
+    }
+
     return queue_invalidate_wait(iommu, 0, 1, 1, 0);
 }
 
+void qinval_batch_begin(void)
+{
+    this_cpu(qinval_batch).depth++;
+}
+
+int qinval_batch_end(void)
+{
+    struct qinval_batch *batch = &this_cpu(qinval_batch);
+    struct acpi_drhd_unit *drhd;
+    struct iommu *iommu;
+    s_time_t start, timeout;
+    int rc = 0;
+
+    ASSERT(batch->depth);
+    if ( --batch->depth || !batch->pending )
+        return 0;
+
+    start = NOW();
+    timeout = start + MILLISECS(VTD_QI_TIMEOUT);
+
+    for_each_drhd_unit ( drhd )
+    {
+        iommu = drhd->iommu;
+        if ( !test_bit(iommu->index, &batch->pending) )
+            continue;
+        batch->poll[iommu->index] = QINVAL_STAT_INIT;
+        queue_invalidate_wait_dsc(iommu, 0, 1, 1,
+                                  &batch->poll[iommu->index]);
+    }
+
+    /* All IOMMUs work through their queues at the same time. */
+    while ( batch->pending )
+    {
+        bool_t timed_out = NOW() > timeout;
+
+        for_each_drhd_unit ( drhd )
+        {
+            iommu = drhd->iommu;
+            if ( !test_bit(iommu->index, &batch->pending) )
+                continue;
+
+            if ( batch->poll[iommu->index] == QINVAL_STAT_DONE )
+            {
+                struct qi_ctrl *qi_ctrl = iommu_qi_ctrl(iommu);
+
+                qi_ctrl->batches++;
+                qinval_account_wait(qi_ctrl, start);
+            }
+            else if ( timed_out )
+            {
+                print_qi_regs(iommu);
+                printk(XENLOG_WARNING VTDPREFIX
+                       " Queue invalidate wait descriptor timed out\n");
+                rc = -ETIMEDOUT;
+            }
+            else
+                continue;
+
+            __clear_bit(iommu->index, &batch->pending);
+        }
+
+        cpu_relax();
+    }
+
+    return rc;
+}
+
 static int __must_check dev_invalidate_sync(struct iommu *iommu,
                                             struct pci_dev *pdev, u16 did)
 {
@@ -299,7 +425,8 @@ static int __must_check queue_invalidate_iec_sync(struct iommu *iommu,
     qinval_update_qtail(iommu, index);
     spin_unlock_irqrestore(&iommu->register_lock, flags);
 
-    ret = invalidate_sync(iommu);
+    /* Interrupt remapping changes take effect before returning. */
+    ret = queue_invalidate_wait(iommu, 0, 1, 1, 0);
 
     /*
      * reading vt-d architecture register will ensure
@@ -197,7 +197,17 @@ void vtd_dump_iommu_info(unsigned char key)
         printk("  Queued Invalidation: %ssupported%s.\n",
             ecap_queued_inval(iommu->ecap) ? "" : "not ",
            (status & DMA_GSTS_QIES) ? " and enabled" : "" );
-
+        if ( status & DMA_GSTS_QIES )
+        {
+            const struct qi_ctrl *qi_ctrl = iommu_qi_ctrl(iommu);
+            unsigned long waits = qi_ctrl->waits + qi_ctrl->batches;
+
+            printk("    waits: %lu sync, %lu batched for %lu invalidations, "
+                   "avg %"PRIu64"ns max %"PRIu64"ns\n",
+                   qi_ctrl->waits, qi_ctrl->batches, qi_ctrl->deferred,
+                   waits ? qi_ctrl->wait_ns / waits : 0,
+                   qi_ctrl->wait_max_ns);
+        }
 
         printk("  Interrupt Remapping: %ssupported%s.\n",
             ecap_intr_remap(iommu->ecap) ? "" : "not ",
@@ -50,6 +50,8 @@ struct hvm_ioreq_vcpu {
 #define NR_IO_RANGE_TYPES (HVMOP_IO_RANGE_PCI + 1)
 #define MAX_NR_IO_RANGES  256
 
+#define MAX_NR_BUFIOREQ_PAGES (1u << HVM_IOREQSRV_BUFIOREQ_MAX_ORDER)
+
 struct hvm_ioreq_server {
     struct list_head       list_entry;
     struct domain          *domain;
@@ -62,7 +64,9 @@ struct hvm_ioreq_server {
     ioservid_t             id;
     struct hvm_ioreq_page  ioreq;
     struct list_head       ioreq_vcpu_list;
-    struct hvm_ioreq_page  bufioreq;
+    struct hvm_ioreq_page  bufioreq[MAX_NR_BUFIOREQ_PAGES];
+    unsigned int           nr_bufioreq_pages;
+    unsigned int           bufioreq_slots;
 
     /* Lock to serialize access to buffered ioreq ring */
     spinlock_t             bufioreq_lock;
@@ -70,6 +74,7 @@ struct hvm_ioreq_server {
     struct rangeset        *range[NR_IO_RANGE_TYPES];
     bool_t                 enabled;
     bool_t                 bufioreq_atomic;
+    bool_t                 bufioreq_evtidx;
 };
 
 struct hvm_domain {
@@ -94,6 +99,7 @@ struct hvm_domain {
 
     struct hvm_io_handler *io_handler;
     unsigned int          io_handler_count;
+    struct hvm_io_index   *io_index;
 
     /* Lock protects access to irq, vpic and vioapic. */
     spinlock_t             irq_lock;
@@ -105,6 +111,9 @@ struct hvm_domain {
     /* VCPU which is current target for 8259 interrupts. */
     struct vcpu           *i8259_target;
 
+    /* vLAPICs not in x2APIC mode with their default x2APIC ID and LDR. */
+    atomic_t               x2apic_nondefault;
+
     /* emulated irq to pirq */
     struct radix_tree_root emuirq_pirq;
 
@@ -129,6 +138,11 @@ struct hvm_domain {
 
     bool_t                 hap_enabled;
     bool_t                 mem_sharing_enabled;
+    /* Memory sharing fork state, see XEN_DOMCTL_MEM_SHARING_FORK. */
+    struct {
+        struct domain     *parent;
+        unsigned long      next_reset_gfn;
+    } fork;
     bool_t                 qemu_mapcache_invalidate;
     bool_t                 is_s3_suspended;
 
@@ -72,6 +72,7 @@ struct segment_register *hvmemul_get_seg_reg(
     enum x86_segment seg,
     struct hvm_emulate_ctxt *hvmemul_ctxt);
 int hvm_emulate_one_mmio(unsigned long mfn, unsigned long gla);
+void hvm_emulate_free_insn_cache(struct vcpu *v);
 
 int hvmemul_insn_fetch(enum x86_segment seg,
                        unsigned long offset,
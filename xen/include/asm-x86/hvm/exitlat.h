@@ -0,0 +1,69 @@
+/*
+ * exitlat.h: HVM exit latency histograms
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ASM_X86_HVM_EXITLAT_H__
+#define __ASM_X86_HVM_EXITLAT_H__
+
+#include <xen/types.h>
+#include <asm/msr.h>
+
+struct xen_sysctl_exitlat_op;
+
+extern bool_t hvm_exitlat_enabled;
+
+void hvm_exitlat_exit(uint64_t tsc, unsigned long reason);
+void hvm_exitlat_entry(uint64_t tsc);
+void hvm_exitlat_cancel(void);
+int hvm_exitlat_control(struct xen_sysctl_exitlat_op *op);
+
+/*
+ * Called by the exit handlers once the exit reason is known, and just
+ * before VM entry.  Both cost a single test while timing is disabled.
+ */
+static inline void hvm_exitlat_start(unsigned long reason)
+{
+    if ( unlikely(hvm_exitlat_enabled) )
+        hvm_exitlat_exit(rdtsc(), reason);
+}
+
+static inline void hvm_exitlat_end(void)
+{
+    if ( unlikely(hvm_exitlat_enabled) )
+        hvm_exitlat_entry(rdtsc());
+}
+
+/*
+ * Called when the vCPU running on this pCPU is descheduled, e.g. because
+ * it blocked in HLT or waiting for the device model.  The time until it
+ * runs again isn't spent handling its pending exit, if any.
+ */
+static inline void hvm_exitlat_descheduled(void)
+{
+    if ( unlikely(hvm_exitlat_enabled) )
+        hvm_exitlat_cancel();
+}
+
+#endif /* __ASM_X86_HVM_EXITLAT_H__ */
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
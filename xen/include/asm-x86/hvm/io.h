@@ -75,6 +75,33 @@ struct hvm_io_handler {
     uint8_t type;
 };
 
+/*
+ * Index of a domain's handlers for hvm_find_io_handler(), so that it
+ * need not offer every access to every handler in turn.  The ports claimed
+ * by register_portio_handler() are flattened into sorted, disjoint ranges,
+ * each owned by the first handler claiming it, which are double-buffered
+ * so that relocate_portio_handler() can update them while vCPUs run.
+ * Lookups retry if the generation count moved meanwhile.  The handlers
+ * with an accept() hook of their own are listed by type, in registration
+ * order.  So are the MMIO handlers whose range the guest can move, and
+ * which may therefore overlap another's.
+ */
+struct hvm_portio_range {
+    unsigned int start, end;    /* [start, end) */
+    unsigned int handler;
+};
+
+struct hvm_io_index {
+    spinlock_t              lock;           /* Serialises updates. */
+    unsigned int            nr_generic[2];  /* by IOREQ_TYPE_{PIO,COPY} */
+    uint8_t                 generic[2][NR_IO_HANDLERS];
+    unsigned int            nr_relocated;
+    uint8_t                 relocated[NR_IO_HANDLERS];
+    unsigned int            gen;            /* ranges[gen & 1] are current */
+    unsigned int            nr_ranges[2];
+    struct hvm_portio_range ranges[2][2 * NR_IO_HANDLERS];
+};
+
 typedef int (*hvm_io_read_t)(const struct hvm_io_handler *,
                              uint64_t addr,
                              uint32_t size,
@@ -101,13 +128,19 @@ const struct hvm_io_handler *hvm_find_io_handler(ioreq_t *p);
 
 int hvm_io_intercept(ioreq_t *p);
 
-struct hvm_io_handler *hvm_next_io_handler(struct domain *d);
+struct hvm_io_handler *hvm_next_io_handler(struct domain *d, uint8_t type);
 
 bool_t hvm_mmio_internal(paddr_t gpa);
 
 void register_mmio_handler(struct domain *d,
                            const struct hvm_mmio_ops *ops);
 
+/* The range covered by a handler has moved, and may overlap another's. */
+void hvm_relocate_io_handler(struct domain *d,
+                             const struct hvm_io_handler *handler);
+void relocate_mmio_handler(struct domain *d,
+                           const struct hvm_mmio_ops *ops);
+
 void register_portio_handler(
     struct domain *d, unsigned int port, unsigned int size,
     portio_action_t action);
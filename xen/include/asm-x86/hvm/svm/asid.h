@@ -24,6 +24,7 @@
 #include <asm/processor.h>
 
 void svm_asid_init(struct cpuinfo_x86 *c);
+void svm_asid_handle_vmrun(void);
 
 static inline void svm_asid_g_invlpg(struct vcpu *v, unsigned long g_vaddr)
 {
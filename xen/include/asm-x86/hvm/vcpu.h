@@ -53,6 +53,21 @@ struct hvm_mmio_cache {
     uint8_t buffer[32];
 };
 
+/*
+ * Decode of an instruction recently emulated, reused while the bytes at
+ * @rip in the same address space and execution mode stay the same.
+ */
+struct hvm_insn_cache {
+    unsigned long cr3;
+    unsigned long rip;
+    unsigned int mode;
+    unsigned int len; /* 0 if unused */
+    uint8_t insn[16];
+    struct x86_emulate_state *state;
+};
+
+#define HVM_INSN_CACHE_ENTRIES 4
+
 struct hvm_vcpu_io {
     /* I/O request in flight to device model. */
     enum hvm_io_completion io_completion;
@@ -78,6 +93,10 @@ struct hvm_vcpu_io {
     /* For retries we shouldn't re-fetch the instruction. */
     unsigned int mmio_insn_bytes;
     unsigned char mmio_insn[16];
+
+    /* Nor re-decode the ones we keep emulating. */
+    struct hvm_insn_cache insn_cache[HVM_INSN_CACHE_ENTRIES];
+    unsigned int insn_cache_next;
     /*
      * For string instruction emulation we need to be able to signal a
      * necessary retry through other than function return codes.
@@ -89,6 +108,9 @@ struct hvm_vcpu_io {
     unsigned long msix_snoop_gpa;
 
     const struct g2m_ioport *g2m_ioport;
+
+    /* Internal MMIO handler which accepted the last access. */
+    unsigned int mmio_handler;
 };
 
 static inline bool_t hvm_vcpu_io_need_completion(const struct hvm_vcpu_io *vio)
@@ -163,6 +185,7 @@ struct hvm_vcpu {
     /* Lock and list for virtual platform timers. */
     spinlock_t          tm_lock;
     struct list_head    tm_list;
+    bool_t              tm_pending; /* A timer on tm_list may have ticks */
 
     u8                  flag_dr_dirty;
     bool_t              debug_state_latch;
@@ -87,6 +87,12 @@ struct vlapic {
         uint32_t             icr, dest;
         struct tasklet       tasklet;
     } init_sipi;
+    bool_t                   x2apic_default; /* x2APIC ID and LDR unchanged */
+    /* IPIs sent through the ICR, for the 'q' debug key. */
+    struct {
+        unsigned long        sent, direct;
+        uint64_t             ns, max_ns;
+    } ipi_stats;
 };
 
 /* vlapic's frequence is 100 MHz */
@@ -129,6 +135,7 @@ void vlapic_EOI_set(struct vlapic *vlapic);
 void vlapic_handle_EOI(struct vlapic *vlapic, u8 vector);
 
 void vlapic_ipi(struct vlapic *vlapic, uint32_t icr_low, uint32_t icr_high);
+void vlapic_dump_ipi_stats(const struct domain *d);
 
 int vlapic_apicv_write(struct vcpu *v, unsigned int offset);
 
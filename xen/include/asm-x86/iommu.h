@@ -37,6 +37,7 @@ struct arch_iommu
     struct list_head g2m_ioport_list;   /* guest to machine ioport mapping */
     u64 iommu_bitmap;              /* bitmap of iommu(s) that the domain uses */
     struct list_head mapped_rmrrs;
+    unsigned long pgtable_pages;   /* io page table pages allocated */
 
     /* amd iommu support */
     int paging_mode;
@@ -34,6 +34,8 @@ typedef struct rmap_hashtab {
     /* Overlaps with prev pointer of list_head in union below.
      * Unlike the prev pointer, this can be NULL. */
     void *flag;
+    /* Allocation order of the bucket array; grows with the sharing degree. */
+    unsigned int order;
 } rmap_hashtab_t;
 
 struct page_sharing_info
@@ -89,6 +91,11 @@ static inline int mem_sharing_unshare_page(struct domain *d,
  */
 int mem_sharing_notify_enomem(struct domain *d, unsigned long gfn,
                                 bool_t allow_sleep);
+/* Populate a hole in a fork's host p2m from its parent: shared for reads,
+ * copied when unsharing. The gfn must be locked by the caller. */
+int mem_sharing_fork_page(struct domain *d, unsigned long gfn,
+                          bool_t unsharing);
+
 int mem_sharing_memop(XEN_GUEST_HANDLE_PARAM(xen_mem_sharing_op_t) arg);
 int mem_sharing_domctl(struct domain *d, 
                        xen_domctl_mem_sharing_op_t *mec);
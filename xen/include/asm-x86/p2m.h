@@ -29,6 +29,7 @@
 #include <xen/config.h>
 #include <xen/paging.h>
 #include <xen/p2m-common.h>
+#include <xen/radix-tree.h>
 #include <asm/mem_sharing.h>
 #include <asm/page.h>    /* for pagetable_t */
 
@@ -297,6 +298,13 @@ struct p2m_domain {
     unsigned long min_remapped_gfn;
     unsigned long max_remapped_gfn;
 
+    /*
+     * Alternate p2m's only: the remappings behind the range above, indexed
+     * by the gfn whose mfn is borrowed, so that dropping that gfn only
+     * invalidates the entries aliasing it rather than the whole view.
+     */
+    struct radix_tree_root remapped_gfns;
+
     /* When releasing shared gfn's in a preemptible manner, recall where
      * to resume the search */
     unsigned long next_shared_gfn_to_relinquish;
@@ -6,12 +6,12 @@ PERFCOUNTER_ARRAY(exceptions,           "exceptions", 32)
 
 #define VMX_PERF_EXIT_REASON_SIZE 56
 #define VMX_PERF_VECTOR_SIZE 0x20
-PERFCOUNTER_ARRAY(vmexits,              "vmexits", VMX_PERF_EXIT_REASON_SIZE)
+PERFCOUNTER_ARRAY_LIGHT(vmexits,        "vmexits", VMX_PERF_EXIT_REASON_SIZE)
 PERFCOUNTER_ARRAY(cause_vector,         "cause vector", VMX_PERF_VECTOR_SIZE)
 
 #define VMEXIT_NPF_PERFC 141
 #define SVM_PERF_EXIT_REASON_SIZE (1+141)
-PERFCOUNTER_ARRAY(svmexits,             "SVMexits", SVM_PERF_EXIT_REASON_SIZE)
+PERFCOUNTER_ARRAY_LIGHT(svmexits,       "SVMexits", SVM_PERF_EXIT_REASON_SIZE)
 
 PERFCOUNTER(seg_fixups,             "segmentation fixups")
 
@@ -29,7 +29,7 @@ PERFCOUNTER(page_faults,            "page faults")
 PERFCOUNTER(copy_user_faults,       "copy_user faults")
 
 PERFCOUNTER(map_domain_page_count,  "map_domain_page count")
-PERFCOUNTER(ptwr_emulations,        "writable pt emulations")
+PERFCOUNTER_LIGHT(ptwr_emulations,  "writable pt emulations")
 
 PERFCOUNTER(exception_fixed,        "pre-exception fixed")
 
@@ -137,9 +137,26 @@ PERFCOUNTER(mshv_wrmsr_apic_assist,     "MS Hv wrmsr APIC assist")
 PERFCOUNTER(mshv_wrmsr_apic_msr,        "MS Hv wrmsr APIC msr")
 PERFCOUNTER(mshv_wrmsr_tsc_msr,         "MS Hv wrmsr TSC msr")
 
-PERFCOUNTER(realmode_emulations, "realmode instructions emulated")
+PERFCOUNTER_LIGHT(hvm_emulations,        "HVM instructions emulated")
+PERFCOUNTER_LIGHT(hvm_emulations_failed, "HVM emulations unhandleable")
+PERFCOUNTER(hvm_insn_cache_hit,         "HVM emulations of cached decodes")
+PERFCOUNTER(hvm_insn_cache_miss,        "HVM emulations decoded afresh")
+PERFCOUNTER(bufioreq_notified,          "buffered ioreq notifications")
+PERFCOUNTER(bufioreq_suppressed,        "buffered ioreq notifications suppressed")
+PERFCOUNTER_LIGHT(realmode_emulations, "realmode instructions emulated")
 PERFCOUNTER(realmode_exits,      "vmexits from realmode")
 
 PERFCOUNTER(pauseloop_exits, "vmexits from Pause-Loop Detection")
 
+PERFCOUNTER(invept_single,          "INVEPT single context")
+PERFCOUNTER(invept_all,             "INVEPT all contexts")
+
+PERFCOUNTER(altp2m_propagate,       "altp2m host p2m changes propagated")
+PERFCOUNTER(altp2m_propagate_ns,    "altp2m propagation time (ns)")
+PERFCOUNTER(altp2m_propagate_lazy,  "altp2m view entries invalidated")
+PERFCOUNTER(altp2m_propagate_eager, "altp2m view entries updated")
+PERFCOUNTER(altp2m_propagate_flush, "altp2m propagation TLB flushes")
+PERFCOUNTER(altp2m_reset_range,     "altp2m views reset by range")
+PERFCOUNTER(altp2m_reset_full,      "altp2m views reset fully")
+
 /*#endif*/ /* __XEN_PERFC_DEFN_H__ */
@@ -37,7 +37,7 @@
 #include "hvm/save.h"
 #include "memory.h"
 
-#define XEN_DOMCTL_INTERFACE_VERSION 0x0000000c
+#define XEN_DOMCTL_INTERFACE_VERSION 0x0000000d
 
 /*
  * NB. xen_domctl.domain is an IN/OUT parameter for this operation.
@@ -878,6 +878,18 @@ struct xen_domctl_gdbsx_domstatus {
  */
 #define XEN_DOMCTL_VM_EVENT_OP_SHARING           3
 
+/*
+ * Rings larger than a page.
+ *
+ * By default XEN_VM_EVENT_ENABLE sets up a single page ring at the gfn held
+ * in the mode's HVM param, which only has room for a handful of requests:
+ * on guests with more vCPUs than ring slots, vCPUs end up blocked waiting
+ * for the helper.  Setting nr_frames > 1 instead makes the ring span the
+ * nr_frames contiguous gfns starting at ring_gfn (the HVM param is ignored),
+ * sized so that each vCPU can have an event in flight.
+ */
+#define XEN_VM_EVENT_MAX_RING_FRAMES             32
+
 /* Use for teardown/setup of helper<->hypervisor interface for paging, 
  * access and sharing.*/
 struct xen_domctl_vm_event_op {
@@ -885,6 +897,8 @@ struct xen_domctl_vm_event_op {
     uint32_t       mode;         /* XEN_DOMCTL_VM_EVENT_OP_* */
 
     uint32_t port;              /* OUT: event channel for ring */
+    uint32_t nr_frames;         /* IN: ring size in pages (ENABLE, 0 == 1) */
+    uint64_aligned_t ring_gfn;  /* IN: first ring gfn, if nr_frames > 1 */
 };
 typedef struct xen_domctl_vm_event_op xen_domctl_vm_event_op_t;
 DEFINE_XEN_GUEST_HANDLE(xen_domctl_vm_event_op_t);
@@ -893,14 +907,31 @@ DEFINE_XEN_GUEST_HANDLE(xen_domctl_vm_event_op_t);
  * Memory sharing operations
  */
 /* XEN_DOMCTL_mem_sharing_op.
- * The CONTROL sub-domctl is used for bringup/teardown. */
+ * The CONTROL sub-domctl is used for bringup/teardown.
+ *
+ * FORK turns the target domain, which must be a freshly created HAP domain
+ * with no memory and the same number of vCPUs, into a copy-on-write clone
+ * of parent_domain. The parent must be paused, and is kept paused for as
+ * long as the fork exists. vCPU and HVM context are copied from the parent;
+ * memory is populated lazily on first access, by sharing the parent's page
+ * for reads and by copying it for writes.
+ *
+ * FORK_RESET returns a fork to the state of its parent by dropping all
+ * pages it has privately populated, and reloading the vCPU and HVM context.
+ * Pages still shared with the parent are left untouched. */
 #define XEN_DOMCTL_MEM_SHARING_CONTROL          0
+#define XEN_DOMCTL_MEM_SHARING_FORK             1
+#define XEN_DOMCTL_MEM_SHARING_FORK_RESET       2
 
 struct xen_domctl_mem_sharing_op {
     uint8_t op; /* XEN_DOMCTL_MEM_SHARING_* */
 
     union {
         uint8_t enable;                   /* CONTROL */
+        struct {                          /* FORK */
+            domid_t parent_domain;        /* IN: domain to fork */
+            uint16_t _pad[3];             /* Must be set to 0 */
+        } fork;
     } u;
 };
 typedef struct xen_domctl_mem_sharing_op xen_domctl_mem_sharing_op_t;
@@ -281,6 +281,18 @@ struct xen_hvm_create_ioreq_server {
  * the pointer pair gets read atomically:
  */
 #define HVM_IOREQSRV_BUFIOREQ_ATOMIC 2
+/*
+ * Or this in with HVM_IOREQSRV_BUFIOREQ_ATOMIC to have the buffered ioreq
+ * ring laid out as a struct buffered_iopage_ext, through which the emulator
+ * can batch or suppress notifications, spanning the 1 << order consecutive
+ * gmfns from <bufioreq_pfn> (order up to HVM_IOREQSRV_BUFIOREQ_MAX_ORDER):
+ */
+#define HVM_IOREQSRV_BUFIOREQ_EVTIDX      0x04
+#define HVM_IOREQSRV_BUFIOREQ_ORDER_SHIFT 4
+#define HVM_IOREQSRV_BUFIOREQ_ORDER_MASK  0x30
+#define HVM_IOREQSRV_BUFIOREQ_ORDER(h) \
+    (((h) >> HVM_IOREQSRV_BUFIOREQ_ORDER_SHIFT) & 3)
+#define HVM_IOREQSRV_BUFIOREQ_MAX_ORDER   2
     uint8_t handle_bufioreq; /* IN - should server handle buffered ioreqs */
     ioservid_t id;           /* OUT - server id */
 };
@@ -98,6 +98,38 @@ struct buffered_iopage {
 }; /* NB. Size of this structure must be no greater than one page. */
 typedef struct buffered_iopage buffered_iopage_t;
 
+/*
+ * Buffered ioreq ring of the IOREQ Servers created with
+ * HVM_IOREQSRV_BUFIOREQ_EVTIDX, spanning 1 << order pages.  The pointers
+ * are handled as with HVM_IOREQSRV_BUFIOREQ_ATOMIC.
+ *
+ * Xen raises the buffered ioreq event channel when a request brings the
+ * number of unconsumed slots (write_pointer - read_pointer) from below
+ * notify_threshold to at least notify_threshold, in the manner of the event
+ * indexes of the netif rings.  The emulator sets it:
+ *  - to 0, the initial value, to be notified of every request, as with
+ *    struct buffered_iopage;
+ *  - to IOREQ_BUFFER_NOTIFY_NEVER while it is busy polling the ring;
+ *  - to 1 once it found the ring empty, before waiting on the event
+ *    channel, or higher to be woken for batches of requests only (picking
+ *    up stragglers on a timer of its own).  It must then check the ring
+ *    again, as requests may have been queued meanwhile.
+ */
+#define IOREQ_BUFFER_NOTIFY_NEVER 0xffffffffU
+#define IOREQ_BUFFER_EXT_SLOT_NUM(order) ((((4096U) << (order)) - 16) / 8)
+struct buffered_iopage_ext {
+#ifdef __XEN__
+    union bufioreq_pointers ptrs;
+#else
+    uint32_t read_pointer;
+    uint32_t write_pointer;
+#endif
+    uint32_t notify_threshold;
+    uint32_t pad;
+    buf_ioreq_t buf_ioreq[1]; /* IOREQ_BUFFER_EXT_SLOT_NUM(order) slots */
+};
+typedef struct buffered_iopage_ext buffered_iopage_ext_t;
+
 /*
  * ACPI Control/Event register locations. Location is controlled by a 
  * version number in HVM_PARAM_ACPI_IOPORTS_LOCATION.
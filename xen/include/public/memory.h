@@ -478,6 +478,7 @@ DEFINE_XEN_GUEST_HANDLE(xen_mem_access_op_t);
 #define XENMEM_sharing_op_add_physmap       6
 #define XENMEM_sharing_op_audit             7
 #define XENMEM_sharing_op_range_share       8
+#define XENMEM_sharing_op_bulk_share        9
 
 #define XENMEM_SHARING_OP_S_HANDLE_INVALID  (-10)
 #define XENMEM_SHARING_OP_C_HANDLE_INVALID  (-9)
@@ -521,6 +522,19 @@ struct xen_mem_sharing_op {
             domid_t client_domain;           /* IN: the client domain id */
             uint16_t _pad[3];                /* Must be set to 0 */
         } range;
+        struct mem_sharing_op_bulk {          /* OP_BULK_SHARE */
+            /*
+             * Nominate and share source_gfns[i] with client_gfns[i] for each
+             * i < nr. Pairs that are not sharable are skipped.
+             */
+            XEN_GUEST_HANDLE_64(uint64) source_gfns; /* IN: source gfns */
+            XEN_GUEST_HANDLE_64(uint64) client_gfns; /* IN: client gfns */
+            uint32_t nr;                     /* IN: number of gfn pairs */
+            uint32_t opaque;                 /* Must be set to 0 */
+            uint32_t nr_shared;              /* OUT: pairs deduplicated */
+            domid_t client_domain;           /* IN: the client domain id */
+            uint16_t _pad;                   /* Must be set to 0 */
+        } bulk;
         struct mem_sharing_op_debug {     /* OP_DEBUG_xxx */
             union {
                 uint64_aligned_t gfn;      /* IN: gfn to debug          */
@@ -36,7 +36,7 @@
 #include "physdev.h"
 #include "tmem.h"
 
-#define XEN_SYSCTL_INTERFACE_VERSION 0x0000000E
+#define XEN_SYSCTL_INTERFACE_VERSION 0x0000000F
 
 /*
  * Read console content from Xen buffer ring.
@@ -82,6 +82,107 @@ struct xen_sysctl_tbuf_op {
 typedef struct xen_sysctl_tbuf_op xen_sysctl_tbuf_op_t;
 DEFINE_XEN_GUEST_HANDLE(xen_sysctl_tbuf_op_t);
 
+/*
+ * Shared statistics region.
+ *
+ * A physically contiguous set of Xen pages, which the control domain maps
+ * read-only (as foreign pages of DOMID_XEN), and which Xen refreshes every
+ * @period_ms with host, per-domain and per-vcpu statistics.  Monitoring
+ * tools can then sample all domains without issuing any hypercalls.
+ *
+ * The region starts with a struct xen_stats_header.  The domain and vcpu
+ * arrays follow at @domain_offset and @vcpu_offset; their entries are
+ * cache line sized and aligned.  Each domain's vcpus are stored in order of
+ * vcpu_id, from @first_vcpu, for vcpu ids 0 to @max_vcpu_id.
+ *
+ * Readers must sample @seq before and after copying the data, and retry if
+ * it was odd (an update was in progress) or has changed.
+ *
+ * The region is allocated by the first enable, and never freed: later
+ * enables only change the period.  Disabling stops the updates.
+ */
+/* XEN_SYSCTL_stats_op */
+#define XEN_SYSCTL_STATS_OP_get_info   0
+#define XEN_SYSCTL_STATS_OP_enable     1
+#define XEN_SYSCTL_STATS_OP_disable    2
+struct xen_sysctl_stats_op {
+    uint32_t cmd;             /* IN: XEN_SYSCTL_STATS_OP_* */
+    uint32_t period_ms;       /* IN (enable)/OUT: 0 when disabled */
+    uint32_t max_domains;     /* IN (first enable, 0 = default)/OUT */
+    uint32_t max_vcpus;       /* IN (first enable, 0 = default)/OUT */
+    uint32_t nr_frames;       /* OUT: 0 if not allocated */
+    uint32_t pad;
+    uint64_aligned_t mfn;     /* OUT: first frame of the region */
+};
+typedef struct xen_sysctl_stats_op xen_sysctl_stats_op_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_stats_op_t);
+
+#define XEN_STATS_VERSION            1
+#define XEN_STATS_MIN_PERIOD_MS      100
+
+/* Not all domains or vcpus fitted: the arrays are incomplete. */
+#define _XEN_STATS_F_overflow        0
+#define XEN_STATS_F_overflow         (1u<<_XEN_STATS_F_overflow)
+/* Transcendent memory is in use; its statistics aren't in the region. */
+#define _XEN_STATS_F_tmem            1
+#define XEN_STATS_F_tmem             (1u<<_XEN_STATS_F_tmem)
+
+struct xen_stats_header {
+    uint32_t version;         /* XEN_STATS_VERSION */
+    uint32_t seq;
+    uint64_aligned_t timestamp; /* Xen system time of the last update */
+    uint32_t period_ms;
+    uint32_t flags;           /* XEN_STATS_F_* */
+    uint32_t nr_domains, max_domains;
+    uint32_t nr_vcpus, max_vcpus;
+    uint32_t domain_offset, vcpu_offset;
+    /* As in struct xen_sysctl_physinfo */
+    uint32_t nr_cpus;
+    uint32_t cpu_khz;
+    uint64_aligned_t total_pages;
+    uint64_aligned_t free_pages;
+};
+
+struct xen_stats_domain {
+    domid_t domain;
+    uint16_t pad0;
+    uint32_t flags;           /* XEN_DOMINF_* */
+    uint32_t nr_online_vcpus;
+    uint32_t max_vcpu_id;     /* XEN_INVALID_MAX_VCPU_ID if no vcpus */
+    uint32_t first_vcpu;      /* Index of vcpu 0 in the vcpu array */
+    uint32_t ssidref;
+    uint64_aligned_t tot_pages;
+    uint64_aligned_t max_pages;
+    uint64_aligned_t shr_pages;
+    uint64_aligned_t paged_pages;
+    uint64_aligned_t cpu_time;  /* ns, of all vcpus */
+    uint64_aligned_t evtchn_notifications;
+    xen_domain_handle_t handle;
+    uint8_t pad1[128 - 88];
+};
+
+/* The vcpu is up. */
+#define _XEN_STATS_VCPU_online       0
+#define XEN_STATS_VCPU_online        (1u<<_XEN_STATS_VCPU_online)
+/* The vcpu is blocked. */
+#define _XEN_STATS_VCPU_blocked      1
+#define XEN_STATS_VCPU_blocked       (1u<<_XEN_STATS_VCPU_blocked)
+/* The vcpu is running. */
+#define _XEN_STATS_VCPU_running      2
+#define XEN_STATS_VCPU_running       (1u<<_XEN_STATS_VCPU_running)
+
+struct xen_stats_vcpu {
+    domid_t domain;
+    uint16_t vcpu_id;
+    uint32_t flags;           /* XEN_STATS_VCPU_*; 0 if there's no vcpu */
+    uint32_t cpu;             /* Processor last run on */
+    uint32_t pad0;
+    uint64_aligned_t runstate_time[4]; /* ns, indexed by RUNSTATE_* */
+    /* Event channel notifications sent to the vcpu (approximate). */
+    uint64_aligned_t evtchn_notifications;
+    uint64_aligned_t pad1;
+};
+
 /*
  * Get physical information about the host machine
  */
@@ -131,6 +232,8 @@ DEFINE_XEN_GUEST_HANDLE(xen_sysctl_sched_id_t);
 struct xen_sysctl_perfc_desc {
     char         name[80];             /* name of perf counter */
     uint32_t     nr_vals;              /* number of values for this counter */
+    uint32_t     nr_elems;             /* number of array elements (1 if not
+                                          an array) */
 };
 typedef struct xen_sysctl_perfc_desc xen_sysctl_perfc_desc_t;
 DEFINE_XEN_GUEST_HANDLE(xen_sysctl_perfc_desc_t);
@@ -143,6 +246,13 @@ struct xen_sysctl_perfc_op {
     /* OUT variables. */
     uint32_t       nr_counters;       /*  number of counters description  */
     uint32_t       nr_vals;           /*  number of values  */
+    /* IN variables. */
+    uint32_t       flags;             /*  XEN_SYSCTL_PERFC_F_???  */
+/*
+ * Report arrays per CPU (nr_elems values for each online CPU, CPU-major)
+ * rather than summed over all CPUs.
+ */
+#define XEN_SYSCTL_PERFC_F_percpu (1u << 0)
     /* counter information (or NULL) */
     XEN_GUEST_HANDLE_64(xen_sysctl_perfc_desc_t) desc;
     /* counter values (or NULL) */
@@ -436,10 +546,17 @@ struct xen_sysctl_page_offline_op {
 /* Sub-operations: */
 #define XEN_SYSCTL_LOCKPROF_reset 1   /* Reset all profile data to zero. */
 #define XEN_SYSCTL_LOCKPROF_query 2   /* Get lock profile information. */
+#define XEN_SYSCTL_LOCKPROF_query_waits 3 /* Get the longest waits. */
 /* Record-type: */
 #define LOCKPROF_TYPE_GLOBAL      0   /* global lock, idx meaningless */
 #define LOCKPROF_TYPE_PERDOM      1   /* per-domain lock, idx is domid */
 #define LOCKPROF_TYPE_N           2   /* number of types */
+/*
+ * Histogram bucket i counts the waits (holds) which took [2^i, 2^(i+1))
+ * nsecs, with bucket 0 also counting those under a nsec and the last
+ * bucket everything longer.
+ */
+#define LOCKPROF_HIST_BUCKETS     32
 struct xen_sysctl_lockprof_data {
     char     name[40];     /* lock name (may include up to 2 %d specifiers) */
     int32_t  type;         /* LOCKPROF_TYPE_??? */
@@ -448,9 +565,23 @@ struct xen_sysctl_lockprof_data {
     uint64_aligned_t block_cnt;    /* # of wait for lock */
     uint64_aligned_t lock_time;    /* nsecs lock held */
     uint64_aligned_t block_time;   /* nsecs waited for lock */
+    uint32_t block_hist[LOCKPROF_HIST_BUCKETS]; /* wait time histogram */
+    uint32_t hold_hist[LOCKPROF_HIST_BUCKETS];  /* hold time histogram */
 };
 typedef struct xen_sysctl_lockprof_data xen_sysctl_lockprof_data_t;
 DEFINE_XEN_GUEST_HANDLE(xen_sysctl_lockprof_data_t);
+/* One of the longest waits seen since the last reset. */
+struct xen_sysctl_lockprof_wait {
+    char     name[40];     /* lock name */
+    uint64_aligned_t lock;         /* address of the lock */
+    uint64_aligned_t caller;       /* address the lock was taken from */
+    uint64_aligned_t wait_time;    /* nsecs waited */
+    uint64_aligned_t when;         /* system time the lock was got */
+    uint32_t cpu;                  /* cpu which waited */
+    uint32_t pad;
+};
+typedef struct xen_sysctl_lockprof_wait xen_sysctl_lockprof_wait_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_lockprof_wait_t);
 struct xen_sysctl_lockprof_op {
     /* IN variables. */
     uint32_t       cmd;               /* XEN_SYSCTL_LOCKPROF_??? */
@@ -460,6 +591,8 @@ struct xen_sysctl_lockprof_op {
     uint64_aligned_t time;            /* nsecs of profile measurement */
     /* profile information (or NULL) */
     XEN_GUEST_HANDLE_64(xen_sysctl_lockprof_data_t) data;
+    /* longest waits, longest first (query_waits only, or NULL) */
+    XEN_GUEST_HANDLE_64(xen_sysctl_lockprof_wait_t) waits;
 };
 typedef struct xen_sysctl_lockprof_op xen_sysctl_lockprof_op_t;
 DEFINE_XEN_GUEST_HANDLE(xen_sysctl_lockprof_op_t);
@@ -1098,6 +1231,106 @@ struct xen_sysctl_livepatch_op {
 typedef struct xen_sysctl_livepatch_op xen_sysctl_livepatch_op_t;
 DEFINE_XEN_GUEST_HANDLE(xen_sysctl_livepatch_op_t);
 
+/*
+ * XEN_SYSCTL_exitlat_op
+ *
+ * Per-pCPU HVM exit latency histograms (x86 only).  Each exit is timed
+ * from the exit handler to the next VM entry on the same pCPU, in TSC
+ * cycles, and accounted to its exit reason.  Exits after which another
+ * vCPU is entered are not accounted.
+ *
+ * enable allocates the histograms of the online pCPUs which have none yet
+ * and starts timing, disable stops it, and reset clears all histograms.
+ * query returns the exit reasons seen on one pCPU.
+ */
+#define XEN_SYSCTL_EXITLAT_enable       0
+#define XEN_SYSCTL_EXITLAT_disable      1
+#define XEN_SYSCTL_EXITLAT_reset        2
+#define XEN_SYSCTL_EXITLAT_query        3
+
+#define XEN_SYSCTL_EXITLAT_BUCKETS      32
+
+struct xen_sysctl_exitlat {
+    uint32_t         reason;    /* VMX exit reason or SVM exit code */
+    uint32_t         pad;
+    uint64_aligned_t count;     /* number of exits timed */
+    uint64_aligned_t cycles;    /* total cycles */
+    uint64_aligned_t max;       /* longest, in cycles */
+    /*
+     * hist[i] counts the exits which took [2^i, 2^(i+1)) cycles.  The first
+     * bucket also counts shorter exits, and the last one longer exits.
+     */
+    uint32_t         hist[XEN_SYSCTL_EXITLAT_BUCKETS];
+};
+typedef struct xen_sysctl_exitlat xen_sysctl_exitlat_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_exitlat_t);
+
+#define XEN_SYSCTL_EXITLAT_vmx          1
+#define XEN_SYSCTL_EXITLAT_svm          2
+
+struct xen_sysctl_exitlat_op {
+    uint32_t cmd;               /* IN: XEN_SYSCTL_EXITLAT_* */
+    uint32_t cpu;               /* IN: pCPU to query */
+    /*
+     * IN: number of entries in the buffer (query).
+     * OUT: number of exit reasons seen, which may be more than was copied.
+     */
+    uint32_t nr_entries;
+    uint32_t vendor;            /* OUT: XEN_SYSCTL_EXITLAT_{vmx,svm} */
+    uint32_t enabled;           /* OUT: whether exits are being timed */
+    uint32_t cpu_khz;           /* OUT: TSC frequency */
+    XEN_GUEST_HANDLE_64(xen_sysctl_exitlat_t) entries; /* OUT (or NULL) */
+};
+typedef struct xen_sysctl_exitlat_op xen_sysctl_exitlat_op_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_exitlat_op_t);
+
+/*
+ * XEN_SYSCTL_hcall_prof_op
+ *
+ * Per-domain hypercall cost accounting.  While enabled, every hypercall
+ * made by a guest, and every call made from within a multicall, is timed in
+ * nanoseconds and accounted to the calling domain and hypercall number.  The
+ * time of a multicall includes that of the calls it batches, which are
+ * also accounted under their own numbers with the subcalls count bumped.
+ *
+ * enable starts accounting, disable stops it and reset clears the counts
+ * of all domains.  query returns an entry for each hypercall number each
+ * domain (or just the one asked for) has made.
+ */
+#define XEN_SYSCTL_HCALL_PROF_enable    0
+#define XEN_SYSCTL_HCALL_PROF_disable   1
+#define XEN_SYSCTL_HCALL_PROF_reset     2
+#define XEN_SYSCTL_HCALL_PROF_query     3
+
+struct xen_sysctl_hcall_prof {
+    domid_t          domid;
+    uint16_t         pad;
+    uint32_t         op;        /* __HYPERVISOR_* */
+    uint64_aligned_t count;     /* number of calls */
+    uint64_aligned_t time;      /* total time, in ns */
+    uint64_aligned_t max;       /* longest, in ns */
+    uint64_aligned_t preempted; /* calls which created a continuation */
+    uint64_aligned_t subcalls;  /* calls made from within a multicall */
+    uint64_aligned_t subcall_time; /* time of those, in ns */
+};
+typedef struct xen_sysctl_hcall_prof xen_sysctl_hcall_prof_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_hcall_prof_t);
+
+struct xen_sysctl_hcall_prof_op {
+    uint32_t cmd;               /* IN: XEN_SYSCTL_HCALL_PROF_* */
+    domid_t  domid;             /* IN: domain to query, or DOMID_INVALID */
+    uint16_t pad;
+    /*
+     * IN: number of entries in the buffer (query).
+     * OUT: number of entries available, which may be more than was copied.
+     */
+    uint32_t nr_entries;
+    uint32_t enabled;           /* OUT: whether hypercalls are accounted */
+    XEN_GUEST_HANDLE_64(xen_sysctl_hcall_prof_t) entries; /* OUT (or NULL) */
+};
+typedef struct xen_sysctl_hcall_prof_op xen_sysctl_hcall_prof_op_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_hcall_prof_op_t);
+
 struct xen_sysctl {
     uint32_t cmd;
 #define XEN_SYSCTL_readconsole                    1
@@ -1126,6 +1359,9 @@ struct xen_sysctl {
 #define XEN_SYSCTL_get_cpu_levelling_caps        25
 #define XEN_SYSCTL_get_cpu_featureset            26
 #define XEN_SYSCTL_livepatch_op                  27
+#define XEN_SYSCTL_stats_op                      28
+#define XEN_SYSCTL_exitlat_op                    29
+#define XEN_SYSCTL_hcall_prof_op                 30
     uint32_t interface_version; /* XEN_SYSCTL_INTERFACE_VERSION */
     union {
         struct xen_sysctl_readconsole       readconsole;
@@ -1154,6 +1390,9 @@ struct xen_sysctl {
         struct xen_sysctl_cpu_levelling_caps cpu_levelling_caps;
         struct xen_sysctl_cpu_featureset    cpu_featureset;
         struct xen_sysctl_livepatch_op      livepatch;
+        struct xen_sysctl_stats_op          stats_op;
+        struct xen_sysctl_exitlat_op        exitlat_op;
+        struct xen_sysctl_hcall_prof_op     hcall_prof_op;
         uint8_t                             pad[128];
     } u;
 };
@@ -159,6 +159,7 @@ static inline void evtchn_port_set_pending(struct domain *d,
                                            unsigned int vcpu_id,
                                            struct evtchn *evtchn)
 {
+    d->vcpu[vcpu_id]->evtchn_notifications++;
     d->evtchn_port_ops->set_pending(d->vcpu[vcpu_id], evtchn);
 }
 
@@ -0,0 +1,39 @@
+#ifndef __XEN_HCALL_PROF_H__
+#define __XEN_HCALL_PROF_H__
+
+#include <xen/types.h>
+#include <xen/time.h>
+
+struct xen_sysctl_hcall_prof_op;
+
+extern bool_t hcall_prof_enabled;
+
+s_time_t hcall_prof_begin(void);
+void hcall_prof_account(unsigned long op, s_time_t start, bool_t subcall);
+void hcall_prof_set_preempted(bool_t preempted);
+int hcall_prof_control(struct xen_sysctl_hcall_prof_op *op);
+
+/*
+ * Called around the dispatch of every hypercall, and of every call made
+ * from a multicall.  They cost a single test while accounting is disabled.
+ */
+static inline s_time_t hcall_prof_start(void)
+{
+    return unlikely(hcall_prof_enabled) ? hcall_prof_begin() : 0;
+}
+
+static inline void hcall_prof_end(unsigned long op, s_time_t start,
+                                  bool_t subcall)
+{
+    if ( unlikely(start) )
+        hcall_prof_account(op, start, subcall);
+}
+
+/* Called when the current hypercall creates or cancels a continuation. */
+static inline void hcall_prof_preempted(bool_t preempted)
+{
+    if ( unlikely(hcall_prof_enabled) )
+        hcall_prof_set_preempted(preempted);
+}
+
+#endif /* __XEN_HCALL_PROF_H__ */
@@ -94,7 +94,9 @@ struct hvm_pirq_dpci {
     uint32_t flags;
     unsigned int state;
     bool_t masked;
+    bool_t posted;              /* IRTE set up for VT-d posting */
     uint16_t pending;
+    unsigned long slow_path;    /* interrupts delivered through Xen */
     struct list_head digl_list;
     struct domain *dom;
     struct hvm_gmsi_info gmsi;
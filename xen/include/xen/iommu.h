@@ -79,6 +79,16 @@ void iommu_teardown(struct domain *d);
 int __must_check iommu_map_page(struct domain *d, unsigned long gfn,
                                 unsigned long mfn, unsigned int flags);
 int __must_check iommu_unmap_page(struct domain *d, unsigned long gfn);
+/*
+ * Map or unmap 2^order contiguous pages, with a single IOTLB flush for the
+ * whole range unless the caller has set iommu_dont_flush_iotlb (in which
+ * case flushing is up to it, as for the single page variants).
+ */
+int __must_check iommu_map_pages(struct domain *d, unsigned long gfn,
+                                 unsigned long mfn, unsigned int order,
+                                 unsigned int flags);
+int __must_check iommu_unmap_pages(struct domain *d, unsigned long gfn,
+                                   unsigned int order);
 
 enum iommu_feature
 {
@@ -171,6 +181,16 @@ struct iommu_ops {
     int __must_check (*map_page)(struct domain *d, unsigned long gfn,
                                  unsigned long mfn, unsigned int flags);
     int __must_check (*unmap_page)(struct domain *d, unsigned long gfn);
+    /*
+     * Optional: (un)map a naturally aligned 2^order range with a single
+     * (super)page entry, flushing as needed.  -EOPNOTSUPP makes the caller
+     * fall back to the page by page operations.
+     */
+    int __must_check (*map_pages)(struct domain *d, unsigned long gfn,
+                                  unsigned long mfn, unsigned int order,
+                                  unsigned int flags);
+    int __must_check (*unmap_pages)(struct domain *d, unsigned long gfn,
+                                    unsigned int order);
     void (*free_page_table)(struct page_info *);
 #ifdef CONFIG_X86
     void (*update_ire_from_apic)(unsigned int apic, unsigned int reg, unsigned int value);
@@ -569,6 +569,11 @@ int page_is_ram_type(unsigned long mfn, unsigned long mem_type);
 int prepare_ring_for_helper(struct domain *d, unsigned long gmfn,
                             struct page_info **_page, void **_va);
 void destroy_ring_for_helper(void **_va, struct page_info *page);
+int prepare_ring_frames_for_helper(struct domain *d, unsigned long gmfn,
+                                   unsigned int nr, struct page_info **pages,
+                                   void **_va);
+void destroy_ring_frames_for_helper(void **_va, struct page_info **pages,
+                                    unsigned int nr);
 
 #include <asm/flushtlb.h>
 
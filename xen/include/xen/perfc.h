@@ -1,7 +1,7 @@
 #ifndef __XEN_PERFC_H__
 #define __XEN_PERFC_H__
 
-#ifdef CONFIG_PERF_COUNTERS
+#ifdef CONFIG_PERF_COUNTERS_LIGHT
 
 #include <xen/lib.h>
 #include <xen/smp.h>
@@ -17,6 +17,11 @@
  * Unlike counters, status variables do not reset:
  * PERFSTATUS (counter, string)               define a new performance stauts
  * PERFSTATUS_ARRAY (counter, string, size)   define an array of status vars
+ *
+ * Counters which are cheap enough to be kept in production builds
+ * (CONFIG_PERF_COUNTERS_LIGHT without CONFIG_PERF_COUNTERS):
+ * PERFCOUNTER_LIGHT (counter, string)
+ * PERFCOUNTER_ARRAY_LIGHT (counter, string, size)
  * 
  * unsigned long perfc_value  (counter)        get value of a counter  
  * unsigned long perfc_valuea (counter, index) get value of an array counter
@@ -30,47 +35,85 @@
  * void perfc_print (counter)                  print out the counter
  */
 
-#define PERFCOUNTER( name, descr ) \
+#define PERFC_ENTRY( name ) \
   PERFC_##name,
-#define PERFCOUNTER_ARRAY( name, descr, size ) \
+#define PERFC_ARRAY_ENTRY( name, size )        \
   PERFC_##name,                                \
   PERFC_LAST_##name = PERFC_ ## name + (size) - sizeof(char[2 * !!(size) - 1]),
 
 #define PERFSTATUS       PERFCOUNTER
 #define PERFSTATUS_ARRAY PERFCOUNTER_ARRAY
 
+/*
+ * The light counters are numbered first, so that when only they are
+ * built every other counter has an index of at least NUM_PERFCOUNTERS,
+ * and updating it folds away (see perfc_present()).
+ */
 enum perfcounter {
+#define PERFCOUNTER_LIGHT( name, descr )             PERFC_ENTRY(name)
+#define PERFCOUNTER_ARRAY_LIGHT( name, descr, size ) PERFC_ARRAY_ENTRY(name, size)
+#define PERFCOUNTER( name, descr )
+#define PERFCOUNTER_ARRAY( name, descr, size )
+#include <xen/perfc_defn.h>
+	NUM_PERFCOUNTERS_LIGHT,
+	PERFC_LIGHT_END = NUM_PERFCOUNTERS_LIGHT - 1,
+#undef PERFCOUNTER_LIGHT
+#undef PERFCOUNTER_ARRAY_LIGHT
+#undef PERFCOUNTER
+#undef PERFCOUNTER_ARRAY
+#define PERFCOUNTER_LIGHT( name, descr )
+#define PERFCOUNTER_ARRAY_LIGHT( name, descr, size )
+#define PERFCOUNTER( name, descr )                   PERFC_ENTRY(name)
+#define PERFCOUNTER_ARRAY( name, descr, size )       PERFC_ARRAY_ENTRY(name, size)
 #include <xen/perfc_defn.h>
-	NUM_PERFCOUNTERS
+	NUM_PERFCOUNTERS_ALL
 };
 
+#undef PERFCOUNTER_LIGHT
+#undef PERFCOUNTER_ARRAY_LIGHT
 #undef PERFCOUNTER
 #undef PERFCOUNTER_ARRAY
 #undef PERFSTATUS
 #undef PERFSTATUS_ARRAY
+#undef PERFC_ENTRY
+#undef PERFC_ARRAY_ENTRY
+
+#ifdef CONFIG_PERF_COUNTERS
+#define NUM_PERFCOUNTERS NUM_PERFCOUNTERS_ALL
+#else
+#define NUM_PERFCOUNTERS NUM_PERFCOUNTERS_LIGHT
+#endif
 
 typedef unsigned perfc_t;
 #define PRIperfc ""
 
 DECLARE_PER_CPU(perfc_t[NUM_PERFCOUNTERS], perfcounters);
 
-#define perfc_value(x)    this_cpu(perfcounters)[PERFC_ ## x]
+/* Whether a counter is built; constant, so that the checks fold away. */
+#define perfc_present(x)  (PERFC_ ## x < NUM_PERFCOUNTERS)
+#define perfc_slot(x,y)                                                 \
+    this_cpu(perfcounters)[perfc_present(x) ? PERFC_ ## x + (y) : 0]
+#define perfc_inrange(x,y)                                              \
+    (perfc_present(x) && (y) <= PERFC_LAST_ ## x - PERFC_ ## x)
+
+#define perfc_value(x)    (perfc_present(x) ? perfc_slot(x, 0) : 0)
 #define perfc_valuea(x,y)                                               \
-    ( (y) <= PERFC_LAST_ ## x - PERFC_ ## x ?                           \
-	 this_cpu(perfcounters)[PERFC_ ## x + (y)] : 0 )
-#define perfc_set(x,v)    (this_cpu(perfcounters)[PERFC_ ## x] = (v))
+    ( perfc_inrange(x, y) ? perfc_slot(x, y) : 0 )
+/* Updates are void, as when counters aren't built at all. */
+#define perfc_set(x,v)                                                  \
+    ((void)(perfc_present(x) ? (perfc_slot(x, 0) = (v)) : 0))
 #define perfc_seta(x,y,v)                                               \
-    ( (y) <= PERFC_LAST_ ## x - PERFC_ ## x ?                           \
-	 this_cpu(perfcounters)[PERFC_ ## x + (y)] = (v) : (v) )
-#define perfc_incr(x)     (++this_cpu(perfcounters)[PERFC_ ## x])
-#define perfc_decr(x)     (--this_cpu(perfcounters)[PERFC_ ## x])
+    ((void)(perfc_inrange(x, y) ? (perfc_slot(x, y) = (v)) : 0))
+#define perfc_incr(x)                                                   \
+    ((void)(perfc_present(x) ? ++perfc_slot(x, 0) : 0))
+#define perfc_decr(x)                                                   \
+    ((void)(perfc_present(x) ? --perfc_slot(x, 0) : 0))
 #define perfc_incra(x,y)                                                \
-    ( (y) <= PERFC_LAST_ ## x - PERFC_ ## x ?                           \
-	 ++this_cpu(perfcounters)[PERFC_ ## x + (y)] : 0 )
-#define perfc_add(x,v)    (this_cpu(perfcounters)[PERFC_ ## x] += (v))
+    ((void)(perfc_inrange(x, y) ? ++perfc_slot(x, y) : 0))
+#define perfc_add(x,v)                                                  \
+    ((void)(perfc_present(x) ? (perfc_slot(x, 0) += (v)) : 0))
 #define perfc_adda(x,y,v)                                               \
-    ( (y) <= PERFC_LAST_ ## x - PERFC_ ## x ?                           \
-	 this_cpu(perfcounters)[PERFC_ ## x + (y)] = (v) : (v) )
+    ((void)(perfc_inrange(x, y) ? (perfc_slot(x, y) = (v)) : 0))
 
 /*
  * Histogram: special treatment for 0 and 1 count. After that equally spaced 
@@ -100,7 +143,7 @@ extern void perfc_printall(unsigned char key);
 extern void perfc_reset(unsigned char key);
 
     
-#else /* CONFIG_PERF_COUNTERS */
+#else /* CONFIG_PERF_COUNTERS_LIGHT */
 
 #define perfc_value(x)    (0)
 #define perfc_valuea(x,y) (0)
@@ -114,6 +157,6 @@ extern void perfc_reset(unsigned char key);
 #define perfc_adda(x,y,z) ((void)0)
 #define perfc_incr_histo(x,y,z) ((void)0)
 
-#endif /* CONFIG_PERF_COUNTERS */
+#endif /* CONFIG_PERF_COUNTERS_LIGHT */
 
 #endif /* __XEN_PERFC_H__ */
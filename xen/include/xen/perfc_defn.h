@@ -4,7 +4,7 @@
 
 #include <asm/perfc_defn.h>
 
-PERFCOUNTER_ARRAY(hypercalls,           "hypercalls", NR_hypercalls)
+PERFCOUNTER_ARRAY_LIGHT(hypercalls,     "hypercalls", NR_hypercalls)
 
 PERFCOUNTER(calls_to_multicall,         "calls to multicall")
 PERFCOUNTER(calls_from_multicall,       "calls from multicall")
@@ -161,6 +161,8 @@ struct vcpu
     void            *sched_priv;    /* scheduler-specific data */
 
     struct vcpu_runstate_info runstate;
+    /* Event channel notifications sent to this vcpu (not atomic). */
+    unsigned long    evtchn_notifications;
 #ifndef CONFIG_COMPAT
 # define runstate_guest(v) ((v)->runstate_guest)
     XEN_GUEST_HANDLE(vcpu_runstate_info_t) runstate_guest; /* guest address */
@@ -256,6 +258,9 @@ struct vcpu
 
     struct evtchn_fifo_vcpu *evtchn_fifo;
 
+    /* Hypercall cost accounting, allocated on first use. */
+    struct hcall_prof *hcall_prof;
+
     struct arch_vcpu arch;
 };
 
@@ -268,12 +273,13 @@ struct vm_event_domain
 {
     /* ring lock */
     spinlock_t ring_lock;
-    /* The ring has 64 entries */
-    unsigned char foreign_producers;
-    unsigned char target_producers;
-    /* shared ring page */
+    /* slots reserved by producers */
+    unsigned int foreign_producers;
+    unsigned int target_producers;
+    /* shared ring pages, mapped contiguously */
     void *ring_page;
-    struct page_info *ring_pg_struct;
+    struct page_info *ring_pg_struct[XEN_VM_EVENT_MAX_RING_FRAMES];
+    unsigned int nr_frames;
     /* front-end ring */
     vm_event_front_ring_t front_ring;
     /* event channel port (vcpu0 only) */
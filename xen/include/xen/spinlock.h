@@ -56,6 +56,11 @@ struct lock_debug { };
     - removing of a structure is done via
 
       lock_profile_deregister_struct(type, ptr);
+
+    Besides the cumulated counts and times, every profiled lock keeps log2
+    histograms of its wait and hold times, and the longest waits on any
+    profiled lock are recorded together with the address they were taken
+    from (XEN_SYSCTL_LOCKPROF_query_waits).
 */
 
 struct spinlock;
@@ -69,6 +74,8 @@ struct lock_profile {
     s64                 time_hold;   /* cumulated lock time */
     s64                 time_block;  /* cumulated wait time */
     s64                 time_locked; /* system time of last locking */
+    u32                 block_hist[LOCKPROF_HIST_BUCKETS]; /* log2 ns waits */
+    u32                 hold_hist[LOCKPROF_HIST_BUCKETS];  /* log2 ns holds */
 };
 
 struct lock_profile_qhead {
@@ -0,0 +1,8 @@
+#ifndef __XEN_STATS_H__
+#define __XEN_STATS_H__
+
+struct xen_sysctl_stats_op;
+
+int stats_control(struct xen_sysctl_stats_op *op);
+
+#endif /* __XEN_STATS_H__ */
@@ -67,6 +67,11 @@ void vm_event_put_request(struct domain *d, struct vm_event_domain *ved,
 int vm_event_get_response(struct domain *d, struct vm_event_domain *ved,
                           vm_event_response_t *rsp);
 
+unsigned int vm_event_get_responses(struct domain *d,
+                                    struct vm_event_domain *ved,
+                                    vm_event_response_t *rsp,
+                                    unsigned int nr);
+
 void vm_event_resume(struct domain *d, struct vm_event_domain *ved);
 
 int vm_event_domctl(struct domain *d, xen_domctl_vm_event_op_t *vec,
@@ -823,6 +823,18 @@ static int flask_sysctl(int cmd)
         return avc_current_has_perm(SECINITSID_XEN, SECCLASS_XEN2,
                                     XEN2__LIVEPATCH_OP, NULL);
 
+    case XEN_SYSCTL_stats_op:
+        return avc_current_has_perm(SECINITSID_XEN, SECCLASS_XEN2,
+                                    XEN2__STATS_OP, NULL);
+
+    case XEN_SYSCTL_exitlat_op:
+        return avc_current_has_perm(SECINITSID_XEN, SECCLASS_XEN2,
+                                    XEN2__EXITLAT_OP, NULL);
+
+    case XEN_SYSCTL_hcall_prof_op:
+        return avc_current_has_perm(SECINITSID_XEN, SECCLASS_XEN2,
+                                    XEN2__HCALL_PROF_OP, NULL);
+
     default:
         return avc_unknown_permission("sysctl", cmd);
     }